@@ -0,0 +1,266 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+
+// Names one asset in an AssetCache<T>. A slot's generation changes when its
+// asset is evicted, so a handle kept past that finds nothing rather than
+// whatever was loaded into the slot next
+template <typename T>
+struct AssetHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool isValid() const { return index != UINT32_MAX; }
+    bool operator==(const AssetHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const AssetHandle& other) const {
+        return !(*this == other);
+    }
+};
+
+struct AssetCacheStats {
+    // Loads served from memory and loads that went to the source
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint32_t assets = 0;
+    // Every cached asset, referenced or not
+    uint64_t residentBytes = 0;
+    // Part of residentBytes nothing references, what eviction can free
+    uint64_t unreferencedBytes = 0;
+    // Evicted, waiting for the frames that may still use them
+    uint64_t retiringBytes = 0;
+};
+
+// What an asset loaded from path with the given importer settings is cached
+// under. The same file loaded with other settings is another asset
+inline std::string makeAssetKey(const std::string& path,
+                                const std::string& settings) {
+    return settings.empty() ? path : path + "?" + settings;
+}
+
+// Loads each asset once and shares it. Assets are cached by key, so loading
+// the same path with the same settings again hands back the asset already in
+// memory with one more reference. An asset nothing references stays cached
+// for the next load, and the ones released longest ago are evicted once the
+// cache is over its memory cap. Evicted assets may still be used by frames
+// the GPU has not finished, so they are destroyed retireFrames frames later.
+// Not thread safe, use it from the thread that records frames
+template <typename T>
+class AssetCache {
+   public:
+    // Fill asset and the memory it holds, returns false if it failed to load
+    using LoadFunction = std::function<bool(T& asset, uint64_t& bytes)>;
+    using DestroyFunction = std::function<void(T& asset)>;
+
+    void init(DestroyFunction destroyFunction, uint64_t cap,
+              uint32_t frames) {
+        destroy = std::move(destroyFunction);
+        memoryCap = cap;
+        retireFrames = frames;
+    }
+
+    // Unreferenced assets over the new cap are evicted straight away
+    void setMemoryCap(uint64_t bytes) {
+        memoryCap = bytes;
+        trim();
+    }
+    // Frames that may be using an asset after it is evicted
+    void setRetireFrames(uint32_t frames) { retireFrames = frames; }
+
+    // The cached asset with one more reference, or load it. Returns an
+    // invalid handle if loading failed
+    AssetHandle<T> acquire(const std::string& key, const LoadFunction& load) {
+        auto found = keys.find(key);
+        if (found != keys.end()) {
+            stats.hits++;
+            Slot& slot = slots[found->second];
+            if (slot.references++ == 0) {
+                unreferenced.erase(slot.unreferencedEntry);
+                stats.unreferencedBytes -= slot.bytes;
+            }
+            return {found->second, slot.generation};
+        }
+
+        stats.misses++;
+        T asset{};
+        uint64_t bytes = 0;
+        if (!load(asset, bytes)) return {};
+
+        uint32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.emplace_back();
+        }
+        Slot& slot = slots[index];
+        slot.asset = std::move(asset);
+        slot.key = key;
+        slot.bytes = bytes;
+        slot.references = 1;
+        slot.live = true;
+        keys[key] = index;
+        stats.assets++;
+        stats.residentBytes += bytes;
+        trim();
+        return {index, slot.generation};
+    }
+
+    void addRef(AssetHandle<T> handle) {
+        Slot* slot = find(handle);
+        if (!slot) {
+            debugger.consoleMessage("Referenced a stale asset handle!", true);
+        }
+        if (slot->references++ == 0) {
+            unreferenced.erase(slot->unreferencedEntry);
+            stats.unreferencedBytes -= slot->bytes;
+        }
+    }
+
+    // The asset stays cached until the memory cap needs the room
+    void release(AssetHandle<T> handle) {
+        Slot* slot = find(handle);
+        if (!slot || slot->references == 0) {
+            debugger.consoleMessage("Released a stale asset handle!", true);
+        }
+        if (--slot->references == 0) {
+            slot->unreferencedEntry =
+                unreferenced.insert(unreferenced.end(), handle.index);
+            stats.unreferencedBytes += slot->bytes;
+            trim();
+        }
+    }
+
+    // Null if the handle is invalid or its asset was evicted
+    T* get(AssetHandle<T> handle) {
+        Slot* slot = find(handle);
+        return slot ? &slot->asset : nullptr;
+    }
+    const T* get(AssetHandle<T> handle) const {
+        return const_cast<AssetCache*>(this)->get(handle);
+    }
+
+    // Call once a frame once its fence has signalled, destroys what the
+    // frames in flight are done with
+    void beginFrame() {
+        frameNumber++;
+        while (!retired.empty() &&
+               retired.front().frame + retireFrames <= frameNumber) {
+            destroy(retired.front().asset);
+            stats.retiringBytes -= retired.front().bytes;
+            retired.pop_front();
+        }
+    }
+
+    // Destroy every asset now, referenced or not, and make every handle
+    // stale. Only with the device idle
+    void clear() {
+        for (Retired& entry : retired) {
+            destroy(entry.asset);
+        }
+        retired.clear();
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            if (!slots[i].live) continue;
+            destroy(slots[i].asset);
+            free(i);
+        }
+        unreferenced.clear();
+        keys.clear();
+        uint64_t hits = stats.hits;
+        uint64_t misses = stats.misses;
+        uint64_t evictions = stats.evictions;
+        stats = AssetCacheStats();
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.evictions = evictions;
+    }
+
+    const AssetCacheStats& getStats() const { return stats; }
+
+   private:
+    struct Slot {
+        T asset{};
+        std::string key;
+        uint32_t generation = 0;
+        uint32_t references = 0;
+        uint64_t bytes = 0;
+        bool live = false;
+        // Where it sits in unreferenced while references is 0
+        std::list<uint32_t>::iterator unreferencedEntry;
+    };
+
+    // Evicted, destroyed once frame + retireFrames frames have begun
+    struct Retired {
+        T asset;
+        uint64_t bytes = 0;
+        uint64_t frame = 0;
+    };
+
+    Slot* find(AssetHandle<T> handle) {
+        if (handle.index >= slots.size()) return nullptr;
+        Slot& slot = slots[handle.index];
+        if (!slot.live || slot.generation != handle.generation) {
+            return nullptr;
+        }
+        return &slot;
+    }
+
+    // Empty the slot for reuse, bumping its generation so old handles miss
+    void free(uint32_t index) {
+        Slot& slot = slots[index];
+        slot.asset = T{};
+        slot.key.clear();
+        slot.references = 0;
+        slot.bytes = 0;
+        slot.live = false;
+        slot.generation++;
+        freeSlots.push_back(index);
+    }
+
+    // Evict unreferenced assets, least recently released first, until the
+    // cache fits under its cap
+    void trim() {
+        while (stats.residentBytes > memoryCap && !unreferenced.empty()) {
+            uint32_t index = unreferenced.front();
+            unreferenced.pop_front();
+            Slot& slot = slots[index];
+            keys.erase(slot.key);
+            retired.push_back({std::move(slot.asset), slot.bytes,
+                               frameNumber});
+            stats.evictions++;
+            stats.assets--;
+            stats.residentBytes -= slot.bytes;
+            stats.unreferencedBytes -= slot.bytes;
+            stats.retiringBytes += slot.bytes;
+            free(index);
+        }
+    }
+
+    Debugger debugger;
+    DestroyFunction destroy;
+    uint64_t memoryCap = UINT64_MAX;
+    uint32_t retireFrames = 0;
+    uint64_t frameNumber = 0;
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<std::string, uint32_t> keys;
+    // Slots nothing references, released longest ago first
+    std::list<uint32_t> unreferenced;
+    std::deque<Retired> retired;
+    AssetCacheStats stats;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef COOKED_FORMAT_H
+#define COOKED_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "core/vfs/pack_archive.h"
+
+// On disk layout of assets the asset cooker writes, little endian. A cooked
+// texture is
+//   CookedTextureHeader
+//   width * height tightly packed 8-bit sRGB RGBA pixels, compressed the
+//   way packs compress files
+// so loading one is a read and a decompress, with no image decoding
+
+const uint32_t COOKED_TEXTURE_MAGIC = 0x58455441;  // "ATEX"
+const uint32_t COOKED_TEXTURE_VERSION = 2;
+// What the cooker names a texture artifact, "textures/dennis.jpg" becomes
+// "textures/dennis.tex"
+const char* const COOKED_TEXTURE_EXTENSION = ".tex";
+
+struct CookedTextureHeader {
+    uint32_t magic = COOKED_TEXTURE_MAGIC;
+    uint32_t version = COOKED_TEXTURE_VERSION;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // Coarsest mip level worth building, from the texture's import settings
+    uint32_t lastLevel = 0;
+    // How the pixels after the header are stored
+    PackCompression compression = PackCompression::None;
+};
+
+static_assert(sizeof(CookedTextureHeader) == 24,
+              "CookedTextureHeader layout changed");
+
+// Decompresses the pixels, returns false if file is not a whole cooked
+// texture
+inline bool readCookedTexture(const std::vector<uint8_t>& file,
+                              CookedTextureHeader& header,
+                              std::vector<uint8_t>& pixels) {
+    if (file.size() < sizeof(CookedTextureHeader)) return false;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != COOKED_TEXTURE_MAGIC ||
+        header.version != COOKED_TEXTURE_VERSION || header.width == 0 ||
+        header.height == 0) {
+        return false;
+    }
+
+    // The pixels are stored like a pack entry, so they decode like one
+    PackEntry entry;
+    entry.storedSize = file.size() - sizeof(header);
+    entry.size = uint64_t(header.width) * header.height * 4;
+    entry.compression = header.compression;
+    pixels.resize(entry.size);
+    return PackArchive::decode(entry, file.data() + sizeof(header),
+                               pixels.data());
+}
+
+#endif
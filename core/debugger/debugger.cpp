@@ -1,10 +1,12 @@
 #include "debugger.h"
 
-// Print a message to the console. Throw an exception if it's an error
+// Queue a message for the console. Throw an exception if it's an error, after
+// the messages leading up to it have been written
 void Debugger::consoleMessage(const char* message, bool error) {
     if (error) {
+        Logger::get().flush();
         throw std::runtime_error(message);
     } else {
-        std::cout << message << std::endl;
+        Logger::get().log(LogLevel::Info, "{}", message);
     }
 }
\ No newline at end of file
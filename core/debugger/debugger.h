@@ -2,9 +2,11 @@
 #define DEBUGGER_H
 #include <iostream>
 
+#include "logger.h"
+
 class Debugger {
    public:
-    // Print a message to the console. Throw an exception if it's an error
+    // Queue a message for the console. Throw an exception if it's an error
     void consoleMessage(const char* message, bool error);
 };
 #endif
\ No newline at end of file
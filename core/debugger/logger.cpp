@@ -0,0 +1,181 @@
+#include "logger.h"
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+namespace {
+// Serializes direct writes once the writer thread is gone
+std::mutex directWriteMutex;
+}  // namespace
+
+Logger& Logger::get() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() {
+    ring = new Record[QUEUE_CAPACITY];
+    for (size_t i = 0; i < QUEUE_CAPACITY; i++) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    running.store(true, std::memory_order_release);
+    writer = std::thread(&Logger::writerLoop, this);
+}
+
+Logger::~Logger() {
+    shutdown();
+    delete[] ring;
+}
+
+// Claim a free slot, waiting if the writer has fallen a whole ring behind
+Logger::Record* Logger::acquire() {
+    uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+    bool stalled = false;
+    while (true) {
+        Record* record = &ring[position & (QUEUE_CAPACITY - 1)];
+        uint64_t sequence = record->sequence.load(std::memory_order_acquire);
+        int64_t difference =
+            static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+
+        if (difference == 0) {
+            // Slot is free for this position, try to claim it
+            if (enqueuePosition.compare_exchange_weak(
+                    position, position + 1, std::memory_order_relaxed)) {
+                record->position = position;
+                return record;
+            }
+        } else if (difference < 0) {
+            // Ring is full, give the writer a chance to catch up
+            if (!stalled) {
+                stalled = true;
+                stallCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::this_thread::yield();
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        } else {
+            // Another producer took this position first
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::publish(Record* record) {
+    record->sequence.store(record->position + 1, std::memory_order_release);
+}
+
+// Write and release every published record, returns how many
+size_t Logger::drain(std::ostream& out) {
+    size_t count = 0;
+    uint64_t position = dequeuePosition.load(std::memory_order_relaxed);
+    while (true) {
+        Record* record = &ring[position & (QUEUE_CAPACITY - 1)];
+        uint64_t sequence = record->sequence.load(std::memory_order_acquire);
+        if (sequence != position + 1) break;
+
+        writePrefix(out, record->level);
+        record->write(out, record->format, record->arguments);
+        out << '\n';
+
+        // Hand the slot back to producers one lap ahead
+        record->sequence.store(position + QUEUE_CAPACITY,
+                               std::memory_order_release);
+        position++;
+        count++;
+    }
+    dequeuePosition.store(position, std::memory_order_release);
+    return count;
+}
+
+void Logger::writerLoop() {
+    std::ostringstream batch;
+    uint32_t idleSpins = 0;
+    while (running.load(std::memory_order_acquire)) {
+        if (drain(batch) > 0) {
+            // One write and one flush per batch instead of per message
+            const std::string text = batch.str();
+            std::cout.write(text.data(), text.size());
+            std::cout.flush();
+            batch.str(std::string());
+            idleSpins = 0;
+        } else if (idleSpins < 64) {
+            idleSpins++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+// Block until everything queued so far has been written
+void Logger::flush() {
+    uint64_t target = enqueuePosition.load(std::memory_order_acquire);
+    while (running.load(std::memory_order_acquire) &&
+           dequeuePosition.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+// Stop the writer thread after draining the queue
+void Logger::shutdown() {
+    if (!running.exchange(false, std::memory_order_acq_rel)) return;
+    writer.join();
+
+    // Producers that saw the writer running may still be publishing
+    std::ostringstream rest;
+    while (dequeuePosition.load(std::memory_order_relaxed) <
+           enqueuePosition.load(std::memory_order_acquire)) {
+        if (drain(rest) == 0) std::this_thread::yield();
+    }
+    writeDirect(rest.str());
+
+    uint64_t stalls = stallCount.load(std::memory_order_relaxed);
+    if (stalls > 0) {
+        writeDirect("Logger queue was full " + std::to_string(stalls) +
+                    " times\n");
+    }
+}
+
+void Logger::writeDirect(const std::string& text) {
+    if (text.empty()) return;
+    std::lock_guard<std::mutex> lock(directWriteMutex);
+    std::cout.write(text.data(), text.size());
+    std::cout.flush();
+}
+
+// Info messages are written as is so existing console output is unchanged
+void Logger::writePrefix(std::ostream& out, LogLevel level) {
+    switch (level) {
+        case LogLevel::Verbose:
+            out << "[verbose] ";
+            break;
+        case LogLevel::Debug:
+            out << "[debug] ";
+            break;
+        case LogLevel::Info:
+            break;
+        case LogLevel::Warning:
+            out << "[warning] ";
+            break;
+        case LogLevel::Error:
+            out << "[error] ";
+            break;
+    }
+}
+
+// Write format up to the next {} and return what follows it
+const char* Logger::writeUntilPlaceholder(std::ostream& out,
+                                          const char* format) {
+    const char* cursor = format;
+    while (*cursor) {
+        if (cursor[0] == '{' && cursor[1] == '}') {
+            out.write(format, cursor - format);
+            return cursor + 2;
+        }
+        cursor++;
+    }
+    // No placeholder left, the argument goes after a space
+    out.write(format, cursor - format);
+    out << ' ';
+    return cursor;
+}
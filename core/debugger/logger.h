@@ -0,0 +1,194 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+enum class LogLevel : uint8_t { Verbose, Debug, Info, Warning, Error };
+
+// How a log argument is kept until the writer formats it. C strings are
+// copied since the caller's buffer may be gone by then
+template <typename T>
+using LogStored = std::conditional_t<
+    std::is_same<std::decay_t<T>, const char*>::value ||
+        std::is_same<std::decay_t<T>, char*>::value,
+    std::string, std::decay_t<T>>;
+
+// Messages below this level are compiled out of the LOG_ macros entirely.
+// Override with -DLOG_MIN_LEVEL=0..4
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL 2
+#else
+#define LOG_MIN_LEVEL 0
+#endif
+#endif
+
+// Asynchronous logger. Producers copy the format string pointer and the raw
+// arguments into a slot of a bounded lock-free MPSC ring and return. A
+// background thread turns them into text and writes them out in batches, so
+// neither formatting nor console IO happens on the calling thread
+class Logger {
+   public:
+    static Logger& get();
+
+    // Messages below this level are dropped at runtime
+    void setLevel(LogLevel level) {
+        minLevel.store(level, std::memory_order_relaxed);
+    }
+    bool isEnabled(LogLevel level) const {
+        return level >= minLevel.load(std::memory_order_relaxed);
+    }
+
+    // Queue a message. The format must outlive the writer (a string literal)
+    // and uses {} as the placeholder for each argument. Arguments are copied,
+    // so temporaries and std::string are fine
+    template <typename... Args>
+    void log(LogLevel level, const char* format, Args&&... args);
+
+    // Block until everything queued so far has been written
+    void flush();
+
+    // Stop the writer thread after draining the queue. Later messages are
+    // written synchronously
+    void shutdown();
+
+    ~Logger();
+
+   private:
+    // Inline storage for the packed arguments of one message
+    static const size_t ARGUMENT_STORAGE = 192;
+    static const size_t QUEUE_CAPACITY = 4096;
+
+    struct Record {
+        // Ring sequence number, see enqueue and dequeue
+        std::atomic<uint64_t> sequence;
+        // Ring position claimed by the producer
+        uint64_t position;
+        LogLevel level;
+        const char* format;
+        // Formats the packed arguments into out, then destroys them
+        void (*write)(std::ostream& out, const char* format, void* arguments);
+        alignas(std::max_align_t) unsigned char arguments[ARGUMENT_STORAGE];
+    };
+
+    // Packs arguments and replays them into a stream on the writer thread
+    template <typename Tuple>
+    static void writeRecord(std::ostream& out, const char* format,
+                            void* arguments);
+    template <typename Tuple, size_t... I>
+    static void writeArguments(std::ostream& out, const char* format,
+                               const Tuple& tuple, std::index_sequence<I...>);
+    static const char* writeUntilPlaceholder(std::ostream& out,
+                                             const char* format);
+
+    Logger();
+
+    // Claim a free slot, waiting if the writer has fallen a whole ring behind
+    Record* acquire();
+    void publish(Record* record);
+    void writerLoop();
+    // Write and release every published record, returns how many
+    size_t drain(std::ostream& out);
+    static void writePrefix(std::ostream& out, LogLevel level);
+    // Used once the writer thread has stopped
+    void writeDirect(const std::string& text);
+
+    std::atomic<LogLevel> minLevel{LogLevel::Verbose};
+
+    Record* ring;
+    // Next slot a producer will claim
+    alignas(64) std::atomic<uint64_t> enqueuePosition{0};
+    // Next slot the writer will read, only written by the writer
+    alignas(64) std::atomic<uint64_t> dequeuePosition{0};
+
+    std::thread writer;
+    std::atomic<bool> running{false};
+    // Times a producer found the ring full and had to wait
+    std::atomic<uint64_t> stallCount{0};
+};
+
+template <typename... Args>
+void Logger::log(LogLevel level, const char* format, Args&&... args) {
+    if (!isEnabled(level)) return;
+
+    using Tuple = std::tuple<LogStored<Args>...>;
+    static_assert(sizeof(Tuple) <= ARGUMENT_STORAGE,
+                  "Log arguments do not fit in a log record");
+    static_assert(alignof(Tuple) <= alignof(std::max_align_t),
+                  "Log arguments are over aligned");
+
+    if (!running.load(std::memory_order_acquire)) {
+        Tuple tuple(std::forward<Args>(args)...);
+        std::ostringstream out;
+        writePrefix(out, level);
+        writeArguments(out, format, tuple,
+                       std::make_index_sequence<sizeof...(Args)>{});
+        out << '\n';
+        writeDirect(out.str());
+        return;
+    }
+
+    Record* record = acquire();
+    record->level = level;
+    record->format = format;
+    record->write = &writeRecord<Tuple>;
+    new (record->arguments) Tuple(std::forward<Args>(args)...);
+    publish(record);
+}
+
+template <typename Tuple>
+void Logger::writeRecord(std::ostream& out, const char* format,
+                         void* arguments) {
+    Tuple* tuple = static_cast<Tuple*>(arguments);
+    writeArguments(out, format, *tuple,
+                   std::make_index_sequence<std::tuple_size<Tuple>::value>{});
+    tuple->~Tuple();
+}
+
+template <typename Tuple, size_t... I>
+void Logger::writeArguments(std::ostream& out, const char* format,
+                            const Tuple& tuple, std::index_sequence<I...>) {
+    // Each argument replaces the next {}, extra arguments are appended
+    ((format = writeUntilPlaceholder(out, format), out << std::get<I>(tuple)),
+     ...);
+    out << format;
+}
+
+// Only reached when LOG_MIN_LEVEL lets the level through
+#define LOG_AT(level, ...)                     \
+    do {                                       \
+        Logger::get().log(level, __VA_ARGS__); \
+    } while (0)
+
+#if LOG_MIN_LEVEL <= 0
+#define LOG_VERBOSE(...) LOG_AT(LogLevel::Verbose, __VA_ARGS__)
+#else
+#define LOG_VERBOSE(...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= 1
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= 2
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= 3
+#define LOG_WARNING(...) LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) ((void)0)
+#endif
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,155 @@
+#include "profiler.h"
+
+#include <fstream>
+#include <iomanip>
+
+Profiler& Profiler::get() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler() : epoch(std::chrono::steady_clock::now()) {}
+
+// Static destruction at exit, threads still recording would be too late
+Profiler::~Profiler() {
+    for (auto& thread : threads) {
+        Block* block = thread->head;
+        while (block) {
+            Block* next = block->next.load(std::memory_order_relaxed);
+            delete block;
+            block = next;
+        }
+    }
+}
+
+// Nanoseconds since the profiler started
+uint64_t Profiler::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch)
+        .count();
+}
+
+Profiler::ThreadBuffer* Profiler::getThreadBuffer() {
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (buffer) return buffer;
+
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    threads.push_back(std::make_unique<ThreadBuffer>());
+    buffer = threads.back().get();
+    buffer->threadId = static_cast<uint32_t>(threads.size());
+    buffer->head = new Block();
+    buffer->tail = buffer->head;
+    return buffer;
+}
+
+void Profiler::push(const Event& event) {
+    ThreadBuffer* buffer = getThreadBuffer();
+    if (buffer->eventCount >= maxEventsPerThread) {
+        buffer->droppedCount++;
+        return;
+    }
+
+    Block* block = buffer->tail;
+    uint32_t index = block->count.load(std::memory_order_relaxed);
+    if (index == Block::CAPACITY) {
+        Block* next = new Block();
+        block->next.store(next, std::memory_order_release);
+        buffer->tail = next;
+        block = next;
+        index = 0;
+    }
+
+    block->events[index] = event;
+    // Publish the event to readers only once it is fully written
+    block->count.store(index + 1, std::memory_order_release);
+    buffer->eventCount++;
+}
+
+// Record a finished zone on the calling thread
+void Profiler::recordZone(const char* name, uint64_t startNs, uint64_t endNs) {
+    push({name, startNs, endNs, 0.0, EventType::Zone});
+}
+
+// Record a counter value on the calling thread
+void Profiler::recordCounter(const char* name, double value) {
+    push({name, now(), 0, value, EventType::Counter});
+}
+
+// Name the calling thread in the trace
+void Profiler::setThreadName(const char* name) {
+    getThreadBuffer()->name.store(name, std::memory_order_release);
+}
+
+// The same pointer for the same name, for as long as the profiler lives
+const char* Profiler::internName(const std::string& name) {
+    std::lock_guard<std::mutex> lock(namesMutex);
+    return names.insert(name).first->c_str();
+}
+
+// Write every event recorded so far as Chrome trace JSON
+bool Profiler::writeChromeTrace(const std::string& path) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        debugger.consoleMessage(("Failed to open " + path).c_str(), false);
+        return false;
+    }
+
+    std::vector<ThreadBuffer*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (auto& thread : threads) {
+            snapshot.push_back(thread.get());
+        }
+    }
+
+    // Chrome traces use microseconds
+    auto toUs = [](uint64_t ns) { return ns / 1000.0; };
+
+    // Fixed notation, long sessions would otherwise print in exponent form
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) file << ",\n";
+        first = false;
+    };
+
+    uint64_t eventCount = 0;
+    for (ThreadBuffer* thread : snapshot) {
+        const char* name = thread->name.load(std::memory_order_acquire);
+        separator();
+        file << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+             << "\"tid\": " << thread->threadId << ", \"args\": {\"name\": \""
+             << (name ? name : "thread " + std::to_string(thread->threadId))
+             << "\"}}";
+
+        for (Block* block = thread->head; block;
+             block = block->next.load(std::memory_order_acquire)) {
+            uint32_t count = block->count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; i++) {
+                const Event& event = block->events[i];
+                separator();
+                if (event.type == EventType::Zone) {
+                    file << "{\"ph\": \"X\", \"name\": \"" << event.name
+                         << "\", \"pid\": 1, \"tid\": " << thread->threadId
+                         << ", \"ts\": " << toUs(event.startNs)
+                         << ", \"dur\": " << toUs(event.endNs - event.startNs)
+                         << "}";
+                } else {
+                    file << "{\"ph\": \"C\", \"name\": \"" << event.name
+                         << "\", \"pid\": 1, \"tid\": " << thread->threadId
+                         << ", \"ts\": " << toUs(event.startNs)
+                         << ", \"args\": {\"value\": " << event.value << "}}";
+                }
+                eventCount++;
+            }
+        }
+    }
+    file << "\n]}\n";
+
+    debugger.consoleMessage(("Wrote " + std::to_string(eventCount) +
+                             " profiler events to " + path)
+                                .c_str(),
+                            false);
+    return true;
+}
@@ -0,0 +1,137 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "debugger.h"
+
+// The profiler is compiled in for debug builds, and for release builds when
+// ENABLE_PROFILER is defined (cmake -DENABLE_PROFILER=ON). Otherwise every
+// PROFILE_ macro expands to nothing
+#if !defined(NDEBUG) || defined(ENABLE_PROFILER)
+#define PROFILER_ENABLED 1
+#else
+#define PROFILER_ENABLED 0
+#endif
+
+// Records CPU zones and counters into per-thread buffers and writes them out
+// as a Chrome trace (chrome://tracing or ui.perfetto.dev). Each thread only
+// ever appends to its own buffer, so recording takes no locks. Names must be
+// string literals or come from internName, only the pointer is stored
+class Profiler {
+   public:
+    static Profiler& get();
+    ~Profiler();
+
+    // Record a finished zone on the calling thread
+    void recordZone(const char* name, uint64_t startNs, uint64_t endNs);
+    // Record a counter value on the calling thread
+    void recordCounter(const char* name, double value);
+    // Name the calling thread in the trace
+    void setThreadName(const char* name);
+
+    // A copy of a name built at runtime that lives as long as the profiler,
+    // the same pointer for the same name. Takes a lock
+    const char* internName(const std::string& name);
+
+    // Nanoseconds since the profiler started
+    uint64_t now() const;
+
+    // Write every event recorded so far as Chrome trace JSON. Safe to call
+    // while other threads are still recording, their newest events may just
+    // be missed
+    bool writeChromeTrace(const std::string& path);
+
+   private:
+    enum class EventType : uint8_t { Zone, Counter };
+
+    struct Event {
+        const char* name;
+        uint64_t startNs;
+        // Zone end time, unused for counters
+        uint64_t endNs;
+        double value;
+        EventType type;
+    };
+
+    // Fixed block of events. Blocks are chained and only freed with the
+    // profiler at exit, which is what lets readers walk them without a lock
+    struct Block {
+        static const uint32_t CAPACITY = 4096;
+        Event events[CAPACITY];
+        std::atomic<uint32_t> count{0};
+        std::atomic<Block*> next{nullptr};
+    };
+
+    struct ThreadBuffer {
+        uint32_t threadId;
+        std::atomic<const char*> name{nullptr};
+        Block* head = nullptr;
+        // Only touched by the owning thread
+        Block* tail = nullptr;
+        uint64_t eventCount = 0;
+        uint64_t droppedCount = 0;
+    };
+
+    Profiler();
+
+    ThreadBuffer* getThreadBuffer();
+    void push(const Event& event);
+
+    Debugger debugger;
+    std::chrono::steady_clock::time_point epoch;
+
+    // Guards registration of new threads only
+    std::mutex threadsMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+    std::mutex namesMutex;
+    // Nodes never move, so the strings' pointers stay valid
+    std::unordered_set<std::string> names;
+
+    // Past this many events a thread stops recording, roughly 40 MB
+    uint64_t maxEventsPerThread = 1 << 20;
+};
+
+// Times the enclosing scope
+class ProfileZone {
+   public:
+    explicit ProfileZone(const char* name)
+        : name(name), startNs(Profiler::get().now()) {}
+    ~ProfileZone() {
+        Profiler::get().recordZone(name, startNs, Profiler::get().now());
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+   private:
+    const char* name;
+    uint64_t startNs;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if PROFILER_ENABLED
+#define PROFILE_ZONE(name) \
+    ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#define PROFILE_COUNTER(name, value) \
+    Profiler::get().recordCounter(name, static_cast<double>(value))
+#define PROFILE_THREAD(name) Profiler::get().setThreadName(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
+
+#endif
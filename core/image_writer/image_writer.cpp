@@ -0,0 +1,107 @@
+#include "image_writer.h"
+
+#include <algorithm>
+#include <fstream>
+
+// Largest payload a stored deflate block can hold
+const size_t MAX_STORED_BLOCK = 65535;
+
+// Write tightly packed 8-bit RGBA pixels to a PNG file
+bool ImageWriter::writePNG(const std::string& path, uint32_t width,
+                           uint32_t height, const uint8_t* pixels) {
+    // Every row starts with a filter byte, 0 means no filtering
+    size_t rowSize = static_cast<size_t>(width) * 4;
+    std::vector<uint8_t> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (uint32_t y = 0; y < height; y++) {
+        raw.push_back(0);
+        const uint8_t* row = pixels + rowSize * y;
+        raw.insert(raw.end(), row, row + rowSize);
+    }
+
+    // zlib stream made of stored (uncompressed) deflate blocks
+    std::vector<uint8_t> idat = {0x78, 0x01};
+    size_t offset = 0;
+    do {
+        size_t blockSize = std::min(MAX_STORED_BLOCK, raw.size() - offset);
+        bool last = offset + blockSize == raw.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back(blockSize & 0xFF);
+        idat.push_back((blockSize >> 8) & 0xFF);
+        idat.push_back(~blockSize & 0xFF);
+        idat.push_back((~blockSize >> 8) & 0xFF);
+        idat.insert(idat.end(), raw.begin() + offset,
+                    raw.begin() + offset + blockSize);
+        offset += blockSize;
+    } while (offset < raw.size());
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    writeUint32(idat, (b << 16) | a);
+
+    std::vector<uint8_t> ihdr;
+    writeUint32(ihdr, width);
+    writeUint32(ihdr, height);
+    ihdr.push_back(8);  // Bit depth
+    ihdr.push_back(6);  // Color type RGBA
+    ihdr.push_back(0);  // Compression
+    ihdr.push_back(0);  // Filter
+    ihdr.push_back(0);  // Interlace
+
+    std::vector<uint8_t> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    writeChunk(out, "IHDR", ihdr);
+    writeChunk(out, "IDAT", idat);
+    writeChunk(out, "IEND", {});
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        debugger.consoleMessage(("Failed to open " + path).c_str(), false);
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+    debugger.consoleMessage(("Wrote " + path).c_str(), false);
+    return true;
+}
+
+// Append a PNG chunk (length, type, data, CRC) to the file buffer
+void ImageWriter::writeChunk(std::vector<uint8_t>& out, const char* type,
+                             const std::vector<uint8_t>& data) {
+    writeUint32(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    uint32_t crc =
+        crc32(out.data() + start, out.size() - start, 0xFFFFFFFF) ^ 0xFFFFFFFF;
+    writeUint32(out, crc);
+}
+
+// PNG stores integers big endian
+void ImageWriter::writeUint32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back((value >> 24) & 0xFF);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+uint32_t ImageWriter::crc32(const uint8_t* data, size_t length, uint32_t crc) {
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        tableReady = true;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
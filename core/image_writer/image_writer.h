@@ -0,0 +1,28 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+
+// Writes raw pixels out to image files. Only what we need for frame captures,
+// so the PNGs are stored uncompressed
+class ImageWriter {
+   public:
+    // Write tightly packed 8-bit RGBA pixels to a PNG file
+    bool writePNG(const std::string& path, uint32_t width, uint32_t height,
+                  const uint8_t* pixels);
+
+   private:
+    Debugger debugger;
+
+    // Append a PNG chunk (length, type, data, CRC) to the file buffer
+    void writeChunk(std::vector<uint8_t>& out, const char* type,
+                    const std::vector<uint8_t>& data);
+    void writeUint32(std::vector<uint8_t>& out, uint32_t value);
+    uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc);
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "job_system.h"
+
+#include <algorithm>
+#include <string>
+
+// The job system this thread is running batches or tasks for. A parallelFor
+// from inside one runs inline, waiting for the pool would wait on itself
+static thread_local const JobSystem* runningFor = nullptr;
+
+// 0 workers picks one less than the number of hardware threads
+void JobSystem::init(uint32_t workerCount) {
+    if (workerCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    stopping = false;
+    for (uint32_t i = 0; i < workerCount; i++) {
+        workers.emplace_back(&JobSystem::workerLoop, this);
+    }
+    debugger.consoleMessage(
+        ("Started " + std::to_string(workerCount) + " job system workers")
+            .c_str(),
+        false);
+}
+
+void JobSystem::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeWorkers.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+JobSystem::~JobSystem() {
+    if (!workers.empty()) shutdown();
+}
+
+// Claim and run batches of the current job until none are left
+void JobSystem::runBatches() {
+    while (true) {
+        uint32_t begin = nextIndex.fetch_add(jobGrain, std::memory_order_relaxed);
+        if (begin >= jobCount) break;
+        (*job)(begin, std::min(begin + jobGrain, jobCount));
+    }
+}
+
+void JobSystem::workerLoop() {
+    runningFor = this;
+    uint64_t seenGeneration = 0;
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeWorkers.wait(lock, [&] {
+                return stopping || jobGeneration != seenGeneration ||
+                       !tasks.empty();
+            });
+            // Loops come first, their caller is waiting on every worker
+            if (jobGeneration != seenGeneration) {
+                seenGeneration = jobGeneration;
+            } else if (!tasks.empty()) {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            } else {
+                return;
+            }
+        }
+
+        if (task) {
+            task();
+            continue;
+        }
+
+        runBatches();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0) {
+            jobDone.notify_one();
+        }
+    }
+}
+
+// Run a task on a worker some time later
+void JobSystem::post(Task task) {
+    if (workers.empty()) {
+        task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    wakeWorkers.notify_one();
+}
+
+// Split [0, count) into batches and run them across the pool
+void JobSystem::parallelFor(uint32_t count, uint32_t grain,
+                            const RangeFunction& function) {
+    if (count == 0) return;
+    grain = std::max(grain, 1u);
+
+    // Not worth waking anyone for a single batch
+    if (workers.empty() || count <= grain || runningFor == this) {
+        function(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &function;
+        jobCount = count;
+        jobGrain = grain;
+        nextIndex.store(0, std::memory_order_relaxed);
+        busyWorkers = static_cast<uint32_t>(workers.size());
+        jobGeneration++;
+    }
+    wakeWorkers.notify_all();
+
+    const JobSystem* outer = runningFor;
+    runningFor = this;
+    runBatches();
+    runningFor = outer;
+
+    // Every worker has to check in before the function can go out of scope
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [&] { return busyWorkers == 0; });
+    job = nullptr;
+}
@@ -0,0 +1,74 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+
+// A fixed pool of worker threads for data parallel loops. The calling thread
+// works alongside the pool, so a parallelFor never just sits and waits.
+// Workers also run posted tasks when there is no loop to help with
+class JobSystem {
+   public:
+    // Range of indices handed to one batch
+    using RangeFunction = std::function<void(uint32_t begin, uint32_t end)>;
+    using Task = std::function<void()>;
+
+    // 0 workers picks one less than the number of hardware threads
+    void init(uint32_t workerCount = 0);
+    void shutdown();
+    ~JobSystem();
+
+    uint32_t getWorkerCount() const {
+        return static_cast<uint32_t>(workers.size());
+    }
+
+    // Split [0, count) into batches of grain indices and run them across the
+    // pool and the calling thread. Returns once every batch has finished.
+    // Batches run in any order, so they must not depend on each other.
+    // Called from a batch or a posted task, it runs the whole range inline
+    void parallelFor(uint32_t count, uint32_t grain,
+                     const RangeFunction& function);
+
+    // Run a task on a worker some time later, for work nobody waits on like
+    // I/O completions. A parallelFor waits for workers to finish the task
+    // they are on, so keep tasks short. Runs inline without workers, and
+    // tasks still queued at shutdown run before it returns
+    void post(Task task);
+
+   private:
+    void workerLoop();
+    // Claim and run batches of the current job until none are left
+    void runBatches();
+
+    Debugger debugger;
+    std::vector<std::thread> workers;
+
+    // Only one parallelFor runs at a time
+    std::mutex dispatchMutex;
+
+    std::mutex mutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable jobDone;
+    bool stopping = false;
+    // Bumped for every job so sleeping workers can tell a new one arrived
+    uint64_t jobGeneration = 0;
+
+    const RangeFunction* job = nullptr;
+    uint32_t jobCount = 0;
+    uint32_t jobGrain = 1;
+    std::atomic<uint32_t> nextIndex{0};
+    // Workers still inside the current job
+    uint32_t busyWorkers = 0;
+
+    std::deque<Task> tasks;
+};
+
+#endif
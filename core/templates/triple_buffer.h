@@ -0,0 +1,49 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the newest value from one writer thread to one reader thread without
+// locks. The writer fills its own slot and swaps it with the shared middle
+// slot, the reader swaps the middle slot with its own when something new is
+// there. Neither side ever waits, the reader may just skip values
+template <typename T>
+class TripleBuffer {
+   public:
+    // Slot the writer fills next. Only the writer thread may touch it
+    T& getWriteBuffer() { return slots[backIndex]; }
+
+    // Publish the write buffer. The writer gets a stale slot back to fill
+    void publish() {
+        backIndex = middle.exchange(backIndex | FRESH_BIT,
+                                    std::memory_order_acq_rel) &
+                    INDEX_MASK;
+    }
+
+    // Newest published value. Only the reader thread may call this, and the
+    // reference stays valid until its next call
+    const T& read() {
+        if (middle.load(std::memory_order_relaxed) & FRESH_BIT) {
+            frontIndex =
+                middle.exchange(frontIndex, std::memory_order_acq_rel) &
+                INDEX_MASK;
+        }
+        return slots[frontIndex];
+    }
+
+   private:
+    static const uint8_t INDEX_MASK = 0x3;
+    static const uint8_t FRESH_BIT = 0x4;
+
+    T slots[3];
+    // Writer side
+    uint8_t backIndex = 0;
+    // Index of the shared slot, with FRESH_BIT set if the reader has not
+    // taken it yet
+    alignas(64) std::atomic<uint8_t> middle{1};
+    // Reader side
+    alignas(64) uint8_t frontIndex = 2;
+};
+
+#endif
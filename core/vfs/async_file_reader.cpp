@@ -0,0 +1,351 @@
+#include "async_file_reader.h"
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+#ifdef HAVE_IO_URING
+#include <liburing.h>
+#endif
+
+#include "core/debugger/logger.h"
+#include "core/debugger/profiler.h"
+
+// Largest single read, bigger reads are split so a huge file does not
+// hold one syscall for seconds
+const uint64_t MAX_READ_CHUNK = 8ull * 1024 * 1024;
+// Reads in flight on the ring at once, the rest wait in the queue
+const uint32_t RING_DEPTH = 64;
+
+const char* fileReadBackendName(FileReadBackend backend) {
+    return backend == FileReadBackend::IoUring ? "io_uring" : "thread pool";
+}
+
+#ifdef HAVE_IO_URING
+// A read on the ring, put back on it if the kernel returns less
+struct RingRead {
+    FileRead read;
+    uint64_t completed = 0;
+    // Registered buffer holding the destination, -1 for none
+    int bufferIndex = -1;
+};
+
+struct AsyncFileReader::IoRing {
+    io_uring ring;
+    std::thread reaper;
+    std::vector<ReadBuffer> registered;
+    uint32_t inFlight = 0;
+    // Every read on the ring, handed to the thread pool if the ring fails
+    std::unordered_set<RingRead*> reading;
+};
+
+// Put the rest of a read on the ring, there is always room for it
+static void prepareRead(io_uring& ring, RingRead* ringRead) {
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    FileRead& read = ringRead->read;
+    uint64_t chunk = std::min(read.size - ringRead->completed, MAX_READ_CHUNK);
+    uint8_t* destination = read.destination + ringRead->completed;
+    uint64_t offset = read.offset + ringRead->completed;
+    if (ringRead->bufferIndex >= 0) {
+        io_uring_prep_read_fixed(sqe, read.fd, destination,
+                                 static_cast<unsigned>(chunk), offset,
+                                 ringRead->bufferIndex);
+    } else {
+        io_uring_prep_read(sqe, read.fd, destination,
+                           static_cast<unsigned>(chunk), offset);
+    }
+    io_uring_sqe_set_data(sqe, ringRead);
+}
+#else
+struct AsyncFileReader::IoRing {};
+#endif
+
+AsyncFileReader::AsyncFileReader() = default;
+
+// threadCount is only used by the thread pool
+void AsyncFileReader::init(uint32_t threadCount, FileReadBackend preferred) {
+    stopping = false;
+    workerCount = std::max(threadCount, 1u);
+    backend = FileReadBackend::ThreadPool;
+    if (preferred == FileReadBackend::IoUring && initRing()) {
+        backend = FileReadBackend::IoUring;
+        debugger.consoleMessage("Reading files with io_uring", false);
+        return;
+    }
+    startWorkers();
+}
+
+// Mutex held, or before any read is submitted
+void AsyncFileReader::startWorkers() {
+    for (uint32_t i = 0; i < workerCount; i++) {
+        workers.emplace_back(&AsyncFileReader::workerLoop, this);
+    }
+    debugger.consoleMessage(
+        ("Started " + std::to_string(workers.size()) + " file I/O threads")
+            .c_str(),
+        false);
+}
+
+// Falls back to the thread pool when this returns false
+bool AsyncFileReader::initRing() {
+#ifdef HAVE_IO_URING
+    auto newRing = std::make_unique<IoRing>();
+    int result = io_uring_queue_init(RING_DEPTH, &newRing->ring, 0);
+    if (result < 0) {
+        LOG_WARNING("io_uring unavailable ({}), using the thread pool",
+                    strerror(-result));
+        return false;
+    }
+    ring = std::move(newRing);
+    ring->reaper = std::thread(&AsyncFileReader::reapLoop, this);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AsyncFileReader::shutdown() {
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+#ifdef HAVE_IO_URING
+        // A read of nothing with no data wakes the reaper to exit
+        if (ring) {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring->ring);
+            io_uring_prep_nop(sqe);
+            io_uring_sqe_set_data(sqe, nullptr);
+            io_uring_submit(&ring->ring);
+        }
+#endif
+    }
+    wakeWorkers.notify_all();
+#ifdef HAVE_IO_URING
+    // First, a reaper falling back to the thread pool starts workers
+    if (ring) {
+        ring->reaper.join();
+        io_uring_queue_exit(&ring->ring);
+        ring.reset();
+    }
+#endif
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+AsyncFileReader::~AsyncFileReader() {
+    if (!workers.empty() || ring) shutdown();
+}
+
+// Replaces the buffers registered before, call with no reads in flight
+bool AsyncFileReader::registerBuffers(const std::vector<ReadBuffer>& buffers) {
+#ifdef HAVE_IO_URING
+    if (!ring) return false;
+    waitIdle();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (backend != FileReadBackend::IoUring) return false;
+    if (!ring->registered.empty()) {
+        io_uring_unregister_buffers(&ring->ring);
+        ring->registered.clear();
+    }
+    if (buffers.empty()) return true;
+
+    std::vector<iovec> vectors;
+    for (const ReadBuffer& buffer : buffers) {
+        vectors.push_back({buffer.memory, buffer.size});
+    }
+    int result = io_uring_register_buffers(
+        &ring->ring, vectors.data(), static_cast<unsigned>(vectors.size()));
+    if (result < 0) {
+        // Usually the locked memory limit
+        LOG_WARNING("Failed to register {} read buffers ({})", buffers.size(),
+                    strerror(-result));
+        return false;
+    }
+    ring->registered = buffers;
+    return true;
+#else
+    (void)buffers;
+    return false;
+#endif
+}
+
+void AsyncFileReader::submit(std::vector<FileRead> reads) {
+    if (reads.empty()) return;
+    bool usingRing;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending += static_cast<uint32_t>(reads.size());
+        for (FileRead& read : reads) {
+            queue.push_back(std::move(read));
+        }
+        usingRing = backend == FileReadBackend::IoUring;
+        if (usingRing) fillRing();
+    }
+    if (!usingRing) wakeWorkers.notify_all();
+}
+
+// Block until every read submitted so far is done, callbacks included
+void AsyncFileReader::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return pending == 0; });
+}
+
+// Hand the result to the callback and count the read as done
+void AsyncFileReader::complete(FileRead& read, uint64_t bytesRead) {
+    if (!completionJobs) {
+        if (read.done) read.done(bytesRead);
+        finishRead();
+        return;
+    }
+    completionJobs->post([this, done = std::move(read.done), bytesRead]() {
+        if (done) done(bytesRead);
+        finishRead();
+    });
+}
+
+void AsyncFileReader::finishRead() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pending == 0) {
+        idle.notify_all();
+    }
+}
+
+void AsyncFileReader::workerLoop() {
+    PROFILE_THREAD("File I/O");
+    while (true) {
+        FileRead read;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeWorkers.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (stopping && queue.empty()) return;
+            read = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        uint64_t bytesRead = 0;
+        {
+            PROFILE_ZONE("pread");
+            while (bytesRead < read.size) {
+                uint64_t chunk =
+                    std::min(read.size - bytesRead, MAX_READ_CHUNK);
+                ssize_t count =
+                    pread(read.fd, read.destination + bytesRead, chunk,
+                          static_cast<off_t>(read.offset + bytesRead));
+                if (count < 0 && errno == EINTR) continue;
+                if (count <= 0) break;
+                bytesRead += count;
+            }
+        }
+        complete(read, bytesRead);
+    }
+}
+
+// Move waiting reads onto the ring while it has room, mutex held
+void AsyncFileReader::fillRing() {
+#ifdef HAVE_IO_URING
+    bool queued = false;
+    while (!queue.empty() && ring->inFlight < RING_DEPTH) {
+        auto* ringRead = new RingRead{std::move(queue.front())};
+        queue.pop_front();
+        const uint8_t* begin = ringRead->read.destination;
+        const uint8_t* end = begin + ringRead->read.size;
+        for (size_t i = 0; i < ring->registered.size(); i++) {
+            auto* memory = static_cast<uint8_t*>(ring->registered[i].memory);
+            if (begin >= memory && end <= memory + ring->registered[i].size) {
+                ringRead->bufferIndex = static_cast<int>(i);
+                break;
+            }
+        }
+        prepareRead(ring->ring, ringRead);
+        ring->inFlight++;
+        ring->reading.insert(ringRead);
+        queued = true;
+    }
+    if (queued) io_uring_submit(&ring->ring);
+#endif
+}
+
+// The only thread taking from the completion queue
+void AsyncFileReader::reapLoop() {
+#ifdef HAVE_IO_URING
+    PROFILE_THREAD("File I/O");
+    while (true) {
+        io_uring_cqe* cqe = nullptr;
+        int result = io_uring_wait_cqe(&ring->ring, &cqe);
+        if (result == -EINTR) continue;
+        if (result < 0) {
+            LOG_ERROR("io_uring wait failed ({}), using the thread pool",
+                      strerror(-result));
+            fallBackToThreadPool();
+            return;
+        }
+        auto* ringRead = static_cast<RingRead*>(io_uring_cqe_get_data(cqe));
+        int bytes = cqe->res;
+        io_uring_cqe_seen(&ring->ring, cqe);
+        // The wake up from shutdown
+        if (!ringRead) return;
+
+        bool finished = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ring->inFlight--;
+            if (bytes > 0) {
+                ringRead->completed += bytes;
+            }
+            // Short reads and interruptions go back on for the rest
+            if ((bytes > 0 && ringRead->completed < ringRead->read.size) ||
+                bytes == -EINTR || bytes == -EAGAIN) {
+                prepareRead(ring->ring, ringRead);
+                ring->inFlight++;
+                io_uring_submit(&ring->ring);
+                finished = false;
+            } else {
+                ring->reading.erase(ringRead);
+                fillRing();
+            }
+        }
+        if (finished) {
+            complete(ringRead->read, ringRead->completed);
+            delete ringRead;
+        }
+    }
+#endif
+}
+
+// The ring is unusable, so the reads on it and those still queued are read
+// with pread instead. A read keeps what the ring got and the thread pool
+// reads the rest, so its callback still sees every byte
+void AsyncFileReader::fallBackToThreadPool() {
+#ifdef HAVE_IO_URING
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (RingRead* ringRead : ring->reading) {
+            uint64_t completed = ringRead->completed;
+            FileRead rest = std::move(ringRead->read);
+            rest.offset += completed;
+            rest.destination += completed;
+            rest.size -= completed;
+            rest.done = [completed, done = std::move(rest.done)](
+                            uint64_t bytesRead) {
+                if (done) done(completed + bytesRead);
+            };
+            queue.push_front(std::move(rest));
+            delete ringRead;
+        }
+        ring->reading.clear();
+        ring->inFlight = 0;
+        backend = FileReadBackend::ThreadPool;
+        // Shutdown joins the reaper before the workers, so none can start
+        // after it stops waiting for them
+        if (!stopping) startWorkers();
+    }
+    wakeWorkers.notify_all();
+#endif
+}
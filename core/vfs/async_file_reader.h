@@ -0,0 +1,104 @@
+#ifndef ASYNC_FILE_READER_H
+#define ASYNC_FILE_READER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "core/jobs/job_system.h"
+
+enum class FileReadBackend { IoUring, ThreadPool };
+
+const char* fileReadBackendName(FileReadBackend backend);
+
+// One positioned read into memory the caller keeps alive until done runs
+struct FileRead {
+    int fd = -1;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint8_t* destination = nullptr;
+    // Runs once the read is over, with fewer bytes than asked for if the
+    // file was short or the read failed
+    std::function<void(uint64_t bytesRead)> done;
+};
+
+// Memory reads land in often, see registerBuffers
+struct ReadBuffer {
+    void* memory = nullptr;
+    size_t size = 0;
+};
+
+// Reads files without blocking the caller. On Linux with io_uring, reads
+// go on the kernel's submission queue and one thread reaps the completion
+// queue, so a whole batch is in flight at once without a thread per read.
+// Without io_uring, or if the kernel refuses a ring or it fails later, a
+// few threads pread instead. Reads start in the order they were submitted,
+// submit a batch sorted by offset to keep the disk reading sequentially
+class AsyncFileReader {
+   public:
+    AsyncFileReader();
+    ~AsyncFileReader();
+
+    // threadCount is only used by the thread pool
+    void init(uint32_t threadCount = 2,
+              FileReadBackend preferred = FileReadBackend::IoUring);
+    void shutdown();
+
+    FileReadBackend getBackend() const { return backend; }
+
+    // Run done callbacks on the job system rather than the I/O thread, so
+    // decoding one read never holds up the next. Call before submitting
+    void setCompletionJobs(JobSystem* jobs) { completionJobs = jobs; }
+
+    // Memory io_uring maps once up front, like persistently mapped staging
+    // buffers, so reads into it skip pinning its pages every time. Replaces
+    // the buffers registered before, call with no reads in flight. Returns
+    // false if they were not registered, reads into them still work
+    bool registerBuffers(const std::vector<ReadBuffer>& buffers);
+
+    void submit(std::vector<FileRead> reads);
+
+    // Block until every read submitted so far is done, callbacks included
+    void waitIdle();
+
+   private:
+    struct IoRing;
+
+    void startWorkers();
+    void workerLoop();
+    // Hand the result to the callback and count the read as done
+    void complete(FileRead& read, uint64_t bytesRead);
+    void finishRead();
+
+    bool initRing();
+    void reapLoop();
+    // Move waiting reads onto the ring while it has room, mutex held
+    void fillRing();
+    // Hand every read on the ring and in the queue to new pread threads
+    void fallBackToThreadPool();
+
+    Debugger debugger;
+    FileReadBackend backend = FileReadBackend::ThreadPool;
+    JobSystem* completionJobs = nullptr;
+    uint32_t workerCount = 1;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable idle;
+    bool stopping = false;
+    std::deque<FileRead> queue;
+    // Queued, being read or in a callback
+    uint32_t pending = 0;
+
+    // Only set while the io_uring backend is in use
+    std::unique_ptr<IoRing> ring;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "io_benchmark.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "async_file_reader.h"
+#include "core/debugger/logger.h"
+#include "pack_writer.h"
+#include "virtual_file_system.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The pack is mounted under this, so it cannot shadow real assets
+const char* MOUNT_PREFIX = "io_benchmark";
+
+double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+uint64_t nextRandom(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Mostly small files, a quarter medium and one in twenty a large texture
+uint64_t pickFileSize(uint64_t& state) {
+    uint64_t roll = nextRandom(state) % 100;
+    if (roll < 70) return 4096 + nextRandom(state) % (28 * 1024);
+    if (roll < 95) return 64 * 1024 + nextRandom(state) % (192 * 1024);
+    return 1024 * 1024 + nextRandom(state) % (1024 * 1024);
+}
+
+// Only clean pages can be dropped, the files are synced after writing
+void evict(const std::vector<std::string>& paths) {
+    for (const std::string& path : paths) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Adds up every byte, so each method can be checked against the files
+uint64_t checksum(const uint8_t* data, uint64_t size) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// Open every file and read it whole through the reader, into arena when
+// given or a buffer per file otherwise
+uint64_t readAll(AsyncFileReader& reader, const std::vector<std::string>& paths,
+                 uint8_t* arena) {
+    std::vector<int> descriptors;
+    std::vector<std::vector<uint8_t>> buffers(arena ? 0 : paths.size());
+    std::vector<FileRead> reads;
+    uint64_t arenaOffset = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        int fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat fileStat {};
+        if (fd < 0 || fstat(fd, &fileStat) != 0) {
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        descriptors.push_back(fd);
+
+        FileRead read;
+        read.fd = fd;
+        read.size = static_cast<uint64_t>(fileStat.st_size);
+        if (arena) {
+            read.destination = arena + arenaOffset;
+            arenaOffset += read.size;
+        } else {
+            buffers[i].resize(read.size);
+            read.destination = buffers[i].data();
+        }
+        reads.push_back(std::move(read));
+    }
+
+    // Kept to sum once everything has landed
+    std::vector<std::pair<const uint8_t*, uint64_t>> results;
+    for (const FileRead& read : reads) {
+        results.push_back({read.destination, read.size});
+    }
+    reader.submit(std::move(reads));
+    reader.waitIdle();
+
+    for (int fd : descriptors) {
+        close(fd);
+    }
+    uint64_t sum = 0;
+    for (const auto& [data, size] : results) {
+        sum += checksum(data, size);
+    }
+    return sum;
+}
+
+}  // namespace
+
+void IoBenchmark::run(uint32_t fileCount, uint32_t passes) {
+    debugger.consoleMessage("\nBegin I/O benchmark...", false);
+    std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / "ape_io_benchmark";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    // Random bytes, so the pack stores them as they are and every method
+    // reads the same amount
+    std::vector<std::string> paths;
+    std::vector<std::string> virtualPaths;
+    PackWriter packWriter;
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    uint64_t totalBytes = 0;
+    uint64_t expected = 0;
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < fileCount; i++) {
+        std::vector<uint8_t> data(pickFileSize(state));
+        for (uint8_t& byte : data) {
+            byte = static_cast<uint8_t>(nextRandom(state));
+        }
+        totalBytes += data.size();
+        expected += checksum(data.data(), data.size());
+
+        std::string name = "file" + std::to_string(i) + ".bin";
+        std::ofstream out(directory / name, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        paths.push_back((directory / name).string());
+        virtualPaths.push_back(std::string(MOUNT_PREFIX) + "/" + name);
+        packWriter.addFile(name, std::move(data), PackCompression::None);
+    }
+    std::string packPath = (directory / "level.pack").string();
+    if (!packWriter.write(packPath)) {
+        debugger.consoleMessage("Failed to write the benchmark pack!", true);
+    }
+    sync();
+    LOG_INFO("Wrote {} files, {} MB, in {} ms", fileCount,
+             totalBytes / (1024 * 1024), millisecondsSince(start));
+
+    std::vector<std::string> evictPaths = paths;
+    evictPaths.push_back(packPath);
+    auto report = [&](const char* name, double milliseconds, uint64_t sum) {
+        double perPass = milliseconds / passes;
+        double megabytes = double(totalBytes) / (1024.0 * 1024.0);
+        LOG_INFO("{}: {} ms per pass, {} MB/s", name, perPass,
+                 megabytes * 1000.0 / perPass);
+        if (sum != expected * passes) {
+            LOG_WARNING("{} read different bytes than were written", name);
+        }
+    };
+
+    // The blocking way every asset used to be read
+    double elapsed = 0.0;
+    uint64_t sum = 0;
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        evict(evictPaths);
+        start = Clock::now();
+        for (const std::string& path : paths) {
+            std::ifstream in(path, std::ios::binary | std::ios::ate);
+            std::vector<uint8_t> data(static_cast<size_t>(in.tellg()));
+            in.seekg(0);
+            in.read(reinterpret_cast<char*>(data.data()), data.size());
+            sum += checksum(data.data(), data.size());
+        }
+        elapsed += millisecondsSince(start);
+    }
+    report("ifstream", elapsed, sum);
+
+    // Completions go through a job system, as they do in the file system
+    JobSystem jobs;
+    jobs.init(2);
+    auto runReader = [&](const char* name, FileReadBackend backend,
+                         bool registered) {
+        AsyncFileReader reader;
+        reader.setCompletionJobs(&jobs);
+        reader.init(4, backend);
+        if (reader.getBackend() != backend) {
+            LOG_WARNING("Skipping {}, {} is unavailable", name,
+                        fileReadBackendName(backend));
+            reader.shutdown();
+            return;
+        }
+
+        std::vector<uint8_t> arena(registered ? totalBytes : 0);
+        if (registered &&
+            !reader.registerBuffers({{arena.data(), arena.size()}})) {
+            LOG_WARNING("Skipping {}, registering {} MB failed, see ulimit -l",
+                        name, arena.size() / (1024 * 1024));
+            reader.shutdown();
+            return;
+        }
+
+        double readerElapsed = 0.0;
+        uint64_t readerSum = 0;
+        for (uint32_t pass = 0; pass < passes; pass++) {
+            evict(evictPaths);
+            Clock::time_point passStart = Clock::now();
+            readerSum += readAll(reader, paths,
+                                 registered ? arena.data() : nullptr);
+            readerElapsed += millisecondsSince(passStart);
+        }
+        report(name, readerElapsed, readerSum);
+        reader.shutdown();
+    };
+    runReader("Thread pool", FileReadBackend::ThreadPool, false);
+    runReader("io_uring", FileReadBackend::IoUring, false);
+    runReader("io_uring, registered buffers", FileReadBackend::IoUring, true);
+    jobs.shutdown();
+
+    // Neighbouring files in the pack are fetched with a few large reads
+    VirtualFileSystem& fileSystem = VirtualFileSystem::get();
+    if (fileSystem.mountPack(packPath, MOUNT_PREFIX)) {
+        FileSystemStats before = fileSystem.getStats();
+        elapsed = 0.0;
+        sum = 0;
+        for (uint32_t pass = 0; pass < passes; pass++) {
+            evict(evictPaths);
+            start = Clock::now();
+            std::shared_ptr<FileBatch> batch =
+                fileSystem.readAsync(virtualPaths);
+            batch->wait();
+            for (size_t i = 0; i < batch->size(); i++) {
+                sum += checksum(batch->getData(i).data(),
+                                batch->getData(i).size());
+            }
+            elapsed += millisecondsSince(start);
+        }
+        FileSystemStats after = fileSystem.getStats();
+        report(("Pack batch on " +
+                std::string(fileReadBackendName(fileSystem.getBackend())))
+                   .c_str(),
+               elapsed, sum);
+        LOG_INFO("Pack batch issued {} reads per pass for {} files",
+                 (after.readsIssued - before.readsIssued) / passes, fileCount);
+        fileSystem.unmount(MOUNT_PREFIX);
+    }
+
+    std::filesystem::remove_all(directory);
+    debugger.consoleMessage("Successfully ran I/O benchmark", false);
+}
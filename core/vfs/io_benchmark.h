@@ -0,0 +1,21 @@
+#ifndef IO_BENCHMARK_H
+#define IO_BENCHMARK_H
+
+#include <cstdint>
+
+#include "core/debugger/debugger.h"
+
+// Times loading a level's worth of files: a mix of small meshes and
+// scripts with a few large textures. Compares a blocking ifstream per file
+// against the async reader on its thread pool, on io_uring, on io_uring
+// reading into registered buffers, and one virtual file system batch from
+// a pack. The files are dropped from the page cache before every pass
+class IoBenchmark {
+   public:
+    void run(uint32_t fileCount = 1000, uint32_t passes = 5);
+
+   private:
+    Debugger debugger;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "pack_archive.h"
+
+#include <fcntl.h>
+#include <lz4.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "core/debugger/logger.h"
+
+// Read exactly size bytes at offset, false on error or a short file
+static bool readFully(int fd, uint64_t offset, void* destination,
+                      uint64_t size) {
+    auto* bytes = static_cast<uint8_t*>(destination);
+    while (size > 0) {
+        ssize_t count = pread(fd, bytes, size, static_cast<off_t>(offset));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        bytes += count;
+        offset += count;
+        size -= count;
+    }
+    return true;
+}
+
+PackArchive::~PackArchive() { close(); }
+
+// Returns false if the file is missing or not a pack of this version
+bool PackArchive::open(const std::string& path) {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat fileStat {};
+    PackHeader header;
+    bool valid = fstat(fd, &fileStat) == 0 &&
+                 readFully(fd, 0, &header, sizeof(header)) &&
+                 header.magic == PACK_MAGIC && header.version == PACK_VERSION;
+
+    // The table and strings come straight after the header, one read
+    uint64_t tableSize = sizeof(PackEntry) * uint64_t(header.entryCount);
+    valid = valid &&
+            sizeof(header) + tableSize + header.stringsSize <=
+                header.dataOffset &&
+            header.dataOffset <= static_cast<uint64_t>(fileStat.st_size);
+    if (valid) {
+        std::vector<uint8_t> table(tableSize + header.stringsSize);
+        valid = readFully(fd, sizeof(header), table.data(), table.size());
+        if (valid) {
+            entries.resize(header.entryCount);
+            memcpy(entries.data(), table.data(), tableSize);
+            strings.assign(reinterpret_cast<char*>(table.data()) + tableSize,
+                           header.stringsSize);
+        }
+    }
+    for (const PackEntry& entry : entries) {
+        valid = valid &&
+                uint64_t(entry.pathOffset) + entry.pathLength <=
+                    strings.size() &&
+                entry.offset + entry.storedSize <=
+                    static_cast<uint64_t>(fileStat.st_size);
+    }
+
+    if (!valid) {
+        LOG_WARNING("{} is not a version {} pack", path, PACK_VERSION);
+        close();
+        return false;
+    }
+    archivePath = path;
+    LOG_INFO("Opened pack {} with {} entries", path, entries.size());
+    return true;
+}
+
+void PackArchive::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    entries.clear();
+    strings.clear();
+    archivePath.clear();
+}
+
+// Null if the pack has no such path
+const PackEntry* PackArchive::find(const std::string& path) const {
+    uint64_t hash = hashPackPath(path);
+    auto it = std::lower_bound(
+        entries.begin(), entries.end(), hash,
+        [](const PackEntry& entry, uint64_t value) {
+            return entry.pathHash < value;
+        });
+    // Hashes can collide, the path decides
+    for (; it != entries.end() && it->pathHash == hash; ++it) {
+        if (it->pathLength == path.size() &&
+            strings.compare(it->pathOffset, it->pathLength, path) == 0) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+std::string PackArchive::getPath(const PackEntry& entry) const {
+    return strings.substr(entry.pathOffset, entry.pathLength);
+}
+
+// Turn an entry's stored bytes into its contents
+bool PackArchive::decode(const PackEntry& entry, const uint8_t* stored,
+                         uint8_t* output) {
+    switch (entry.compression) {
+        case PackCompression::None:
+            if (entry.storedSize != entry.size) return false;
+            // An empty file has no buffer to copy into
+            if (entry.size > 0) memcpy(output, stored, entry.size);
+            return true;
+        case PackCompression::Lz4:
+            return LZ4_decompress_safe(
+                       reinterpret_cast<const char*>(stored),
+                       reinterpret_cast<char*>(output),
+                       static_cast<int>(entry.storedSize),
+                       static_cast<int>(entry.size)) ==
+                   static_cast<int>(entry.size);
+        case PackCompression::Zstd: {
+            size_t result =
+                ZSTD_decompress(output, entry.size, stored, entry.storedSize);
+            return !ZSTD_isError(result) && result == entry.size;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,46 @@
+#ifndef PACK_ARCHIVE_H
+#define PACK_ARCHIVE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "pack_format.h"
+
+// A pack opened for reading. Only the entry table is kept in memory, entry
+// data is read by whoever holds the file descriptor, at the entry's offset
+class PackArchive {
+   public:
+    PackArchive() = default;
+    PackArchive(const PackArchive&) = delete;
+    PackArchive& operator=(const PackArchive&) = delete;
+    ~PackArchive();
+
+    // Returns false if the file is missing or not a pack of this version
+    bool open(const std::string& path);
+    void close();
+
+    // Null if the pack has no such path
+    const PackEntry* find(const std::string& path) const;
+    std::string getPath(const PackEntry& entry) const;
+    const std::vector<PackEntry>& getEntries() const { return entries; }
+
+    int getFileDescriptor() const { return fd; }
+    const std::string& getArchivePath() const { return archivePath; }
+
+    // Turn an entry's stored bytes into its contents, output must hold
+    // entry.size bytes. Returns false if the data is corrupt
+    static bool decode(const PackEntry& entry, const uint8_t* stored,
+                       uint8_t* output);
+
+   private:
+    Debugger debugger;
+    int fd = -1;
+    std::string archivePath;
+    // Sorted by path hash
+    std::vector<PackEntry> entries;
+    std::string strings;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef PACK_FORMAT_H
+#define PACK_FORMAT_H
+
+#include <cstdint>
+#include <string>
+
+// On disk layout of a pack archive, little endian:
+//   PackHeader
+//   PackEntry[entryCount], sorted by pathHash
+//   path strings, not null terminated
+//   padding to PACK_ALIGNMENT, then every entry's stored bytes, each
+//   starting on a PACK_ALIGNMENT boundary
+// The header, table and strings are small and read in one go when the pack
+// is mounted. Entries are laid out in the order they were added, so files
+// added together are read together
+
+const uint32_t PACK_MAGIC = 0x4B415041;  // "APAK"
+const uint32_t PACK_VERSION = 1;
+// Entry data alignment, so reads of an entry never share a block with
+// another and large reads stay aligned
+const uint64_t PACK_ALIGNMENT = 64 * 1024;
+
+enum class PackCompression : uint32_t { None = 0, Lz4 = 1, Zstd = 2 };
+
+struct PackHeader {
+    uint32_t magic = PACK_MAGIC;
+    uint32_t version = PACK_VERSION;
+    uint32_t entryCount = 0;
+    uint32_t stringsSize = 0;
+    // Where the first entry's data starts, the table ends well before it
+    uint64_t dataOffset = 0;
+};
+
+struct PackEntry {
+    uint64_t pathHash = 0;
+    // From the start of the pack, a multiple of PACK_ALIGNMENT
+    uint64_t offset = 0;
+    // Bytes on disk, compressed or not
+    uint64_t storedSize = 0;
+    // Bytes once decoded
+    uint64_t size = 0;
+    // Into the string block
+    uint32_t pathOffset = 0;
+    uint32_t pathLength = 0;
+    PackCompression compression = PackCompression::None;
+    uint32_t reserved = 0;
+};
+
+static_assert(sizeof(PackHeader) == 24, "PackHeader layout changed");
+static_assert(sizeof(PackEntry) == 48, "PackEntry layout changed");
+
+// FNV-1a over the virtual path, what the entry table is sorted by
+inline uint64_t hashPackPath(const std::string& path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : path) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t alignPackOffset(uint64_t offset) {
+    return (offset + PACK_ALIGNMENT - 1) & ~(PACK_ALIGNMENT - 1);
+}
+
+#endif
@@ -0,0 +1,127 @@
+#include "pack_writer.h"
+
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "core/debugger/logger.h"
+
+// Compression has to save at least this fraction to be kept
+const double MIN_COMPRESSION_SAVING = 0.05;
+// Packs are built offline, so spend the time on the ratio
+const int LZ4_PACK_LEVEL = LZ4HC_CLEVEL_DEFAULT;
+const int ZSTD_PACK_LEVEL = 15;
+
+// Empty if it failed. A level of 0 is the one packs use
+std::vector<uint8_t> PackWriter::compress(const std::vector<uint8_t>& data,
+                                          PackCompression compression,
+                                          int level) {
+    std::vector<uint8_t> stored;
+    if (compression == PackCompression::Lz4) {
+        stored.resize(LZ4_compressBound(static_cast<int>(data.size())));
+        int size = LZ4_compress_HC(
+            reinterpret_cast<const char*>(data.data()),
+            reinterpret_cast<char*>(stored.data()),
+            static_cast<int>(data.size()), static_cast<int>(stored.size()),
+            level != 0 ? level : LZ4_PACK_LEVEL);
+        stored.resize(std::max(size, 0));
+    } else if (compression == PackCompression::Zstd) {
+        stored.resize(ZSTD_compressBound(data.size()));
+        size_t size = ZSTD_compress(stored.data(), stored.size(), data.data(),
+                                    data.size(),
+                                    level != 0 ? level : ZSTD_PACK_LEVEL);
+        stored.resize(ZSTD_isError(size) ? 0 : size);
+    }
+    return stored;
+}
+
+// Compression is only kept where it saves space
+void PackWriter::addFile(const std::string& path, std::vector<uint8_t> data,
+                         PackCompression compression) {
+    PendingFile file{path, PackCompression::None, data.size(), {}};
+    if (compression != PackCompression::None && !data.empty()) {
+        std::vector<uint8_t> stored = compress(data, compression);
+        if (!stored.empty() &&
+            stored.size() <= data.size() * (1.0 - MIN_COMPRESSION_SAVING)) {
+            file.compression = compression;
+            file.stored = std::move(stored);
+        }
+    }
+    if (file.compression == PackCompression::None) {
+        file.stored = std::move(data);
+    }
+    files.push_back(std::move(file));
+}
+
+// Returns false if the pack could not be written
+bool PackWriter::write(const std::string& outputPath) {
+    PackHeader header;
+    header.entryCount = static_cast<uint32_t>(files.size());
+
+    std::vector<PackEntry> entries;
+    std::string strings;
+    for (const PendingFile& file : files) {
+        PackEntry entry;
+        entry.pathHash = hashPackPath(file.path);
+        entry.storedSize = file.stored.size();
+        entry.size = file.size;
+        entry.pathOffset = static_cast<uint32_t>(strings.size());
+        entry.pathLength = static_cast<uint32_t>(file.path.size());
+        entry.compression = file.compression;
+        strings += file.path;
+        entries.push_back(entry);
+    }
+    header.stringsSize = static_cast<uint32_t>(strings.size());
+    header.dataOffset = alignPackOffset(
+        sizeof(header) + sizeof(PackEntry) * entries.size() + strings.size());
+
+    // Data goes in the order files were added
+    uint64_t offset = header.dataOffset;
+    for (PackEntry& entry : entries) {
+        entry.offset = offset;
+        offset = alignPackOffset(offset + entry.storedSize);
+    }
+    uint64_t packSize = entries.empty()
+                            ? header.dataOffset
+                            : entries.back().offset + entries.back().storedSize;
+
+    // Only the table is sorted, by hash for lookups
+    std::vector<PackEntry> table = entries;
+    std::stable_sort(table.begin(), table.end(),
+                     [](const PackEntry& a, const PackEntry& b) {
+                         return a.pathHash < b.pathHash;
+                     });
+
+    std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        LOG_WARNING("Failed to open {} for writing", outputPath);
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()),
+              sizeof(PackEntry) * table.size());
+    out.write(strings.data(), strings.size());
+
+    const std::vector<char> padding(PACK_ALIGNMENT, 0);
+    uint64_t position = sizeof(header) + sizeof(PackEntry) * table.size() +
+                        strings.size();
+    for (size_t i = 0; i < files.size(); i++) {
+        out.write(padding.data(), entries[i].offset - position);
+        out.write(reinterpret_cast<const char*>(files[i].stored.data()),
+                  files[i].stored.size());
+        position = entries[i].offset + entries[i].storedSize;
+    }
+    out.close();
+    if (!out) {
+        LOG_WARNING("Failed to write {}", outputPath);
+        return false;
+    }
+
+    LOG_INFO("Wrote pack {}, {} files in {} bytes", outputPath, files.size(),
+             packSize);
+    files.clear();
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef PACK_WRITER_H
+#define PACK_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "pack_format.h"
+
+// Builds a pack archive. Files are kept in memory until write, and stored
+// in the order they were added
+class PackWriter {
+   public:
+    // Compression is only kept where it saves space, incompressible files
+    // like JPEGs are stored as they are
+    void addFile(const std::string& path, std::vector<uint8_t> data,
+                 PackCompression compression);
+
+    // Returns false if the pack could not be written
+    bool write(const std::string& outputPath);
+
+    // Empty if it failed. A level of 0 is the one packs use
+    static std::vector<uint8_t> compress(const std::vector<uint8_t>& data,
+                                         PackCompression compression,
+                                         int level = 0);
+
+   private:
+    struct PendingFile {
+        std::string path;
+        PackCompression compression;
+        uint64_t size;
+        std::vector<uint8_t> stored;
+    };
+
+    Debugger debugger;
+    std::vector<PendingFile> files;
+};
+
+#endif
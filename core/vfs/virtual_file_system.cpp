@@ -0,0 +1,281 @@
+#include "virtual_file_system.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+
+#include "core/debugger/logger.h"
+#include "core/debugger/profiler.h"
+
+// Largest run of pack entries fetched with one read
+const uint64_t MAX_SPAN_SIZE = 32ull * 1024 * 1024;
+
+bool FileBatch::isDone() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return remaining == 0;
+}
+
+void FileBatch::wait() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return remaining == 0; });
+}
+
+void FileBatch::finish(size_t index, bool succeeded) {
+    results[index] = succeeded ? 1 : 0;
+    if (!succeeded) data[index].clear();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--remaining == 0) {
+        done.notify_all();
+    }
+}
+
+VirtualFileSystem& VirtualFileSystem::get() {
+    static VirtualFileSystem fileSystem;
+    return fileSystem;
+}
+
+// Decoding a pack span runs on the completion jobs, so the I/O thread goes
+// straight back to reading
+VirtualFileSystem::VirtualFileSystem() {
+    jobs.init(2);
+    reader.setCompletionJobs(&jobs);
+    reader.init();
+}
+
+VirtualFileSystem::~VirtualFileSystem() {
+    reader.shutdown();
+    jobs.shutdown();
+}
+
+// Serve prefix/path from directory/path
+void VirtualFileSystem::mountDirectory(const std::string& directory,
+                                       const std::string& prefix) {
+    Mount mount;
+    mount.prefix = prefix;
+    mount.directory = directory;
+    mounts.push_back(std::move(mount));
+    LOG_INFO("Mounted {} at \"{}\"", directory, prefix);
+}
+
+// Returns false if the file is missing or not a pack
+bool VirtualFileSystem::mountPack(const std::string& path,
+                                  const std::string& prefix) {
+    auto pack = std::make_unique<PackArchive>();
+    if (!pack->open(path)) return false;
+
+    Mount mount;
+    mount.prefix = prefix;
+    mount.pack = std::move(pack);
+    mounts.push_back(std::move(mount));
+    LOG_INFO("Mounted {} at \"{}\"", path, prefix);
+    return true;
+}
+
+// Drop every mount made at prefix, waits for reads in flight
+void VirtualFileSystem::unmount(const std::string& prefix) {
+    reader.waitIdle();
+    mounts.erase(std::remove_if(mounts.begin(), mounts.end(),
+                                [&](const Mount& mount) {
+                                    return mount.prefix == prefix;
+                                }),
+                 mounts.end());
+}
+
+void VirtualFileSystem::unmountAll() {
+    reader.waitIdle();
+    mounts.clear();
+}
+
+// Newest mount first. A prefix only matches whole directory names
+bool VirtualFileSystem::resolve(const std::string& path,
+                                Location& location) const {
+    for (auto mount = mounts.rbegin(); mount != mounts.rend(); ++mount) {
+        std::string relative = path;
+        if (!mount->prefix.empty()) {
+            if (path.size() <= mount->prefix.size() ||
+                path.compare(0, mount->prefix.size(), mount->prefix) != 0 ||
+                path[mount->prefix.size()] != '/') {
+                continue;
+            }
+            relative = path.substr(mount->prefix.size() + 1);
+        }
+
+        if (mount->pack) {
+            const PackEntry* entry = mount->pack->find(relative);
+            if (!entry) continue;
+            location.pack = mount->pack.get();
+            location.entry = entry;
+            return true;
+        }
+
+        std::string diskPath = mount->directory + "/" + relative;
+        struct stat fileStat {};
+        if (stat(diskPath.c_str(), &fileStat) == 0 &&
+            S_ISREG(fileStat.st_mode)) {
+            location.diskPath = diskPath;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VirtualFileSystem::exists(const std::string& path) const {
+    Location location;
+    return resolve(path, location);
+}
+
+// The whole file in one read, the descriptor is closed once it is done
+void VirtualFileSystem::readLoose(const std::shared_ptr<FileBatch>& batch,
+                                  size_t index, const std::string& diskPath,
+                                  std::vector<FileRead>& reads) {
+    int fd = open(diskPath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat fileStat {};
+    if (fd < 0 || fstat(fd, &fileStat) != 0) {
+        if (fd >= 0) close(fd);
+        batch->finish(index, false);
+        return;
+    }
+
+    uint64_t size = static_cast<uint64_t>(fileStat.st_size);
+    batch->data[index].resize(size);
+    FileRead read;
+    read.fd = fd;
+    read.offset = 0;
+    read.size = size;
+    read.destination = batch->data[index].data();
+    read.done = [this, batch, index, fd, size](uint64_t count) {
+        close(fd);
+        bytesRead.fetch_add(count, std::memory_order_relaxed);
+        batch->finish(index, count == size);
+    };
+    reads.push_back(std::move(read));
+}
+
+// Start reading every path, missing files fail in the batch
+std::shared_ptr<FileBatch> VirtualFileSystem::readAsync(
+    const std::vector<std::string>& paths) {
+    PROFILE_FUNCTION();
+    auto batch = std::make_shared<FileBatch>();
+    batch->paths = paths;
+    batch->data.resize(paths.size());
+    batch->results.assign(paths.size(), 0);
+    batch->remaining = paths.size();
+    filesRead.fetch_add(paths.size(), std::memory_order_relaxed);
+
+    std::vector<FileRead> reads;
+    // Pack entries per pack, to be sorted by offset
+    std::map<const PackArchive*,
+             std::vector<std::pair<const PackEntry*, size_t>>>
+        packFiles;
+    for (size_t i = 0; i < paths.size(); i++) {
+        Location location;
+        if (!resolve(paths[i], location)) {
+            LOG_WARNING("No such file {}", paths[i]);
+            batch->finish(i, false);
+        } else if (location.pack) {
+            packFiles[location.pack].push_back({location.entry, i});
+        } else {
+            readLoose(batch, i, location.diskPath, reads);
+        }
+    }
+
+    for (auto& [pack, files] : packFiles) {
+        std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+            return a.first->offset < b.first->offset;
+        });
+
+        // Entries with only alignment padding between them join one span
+        size_t first = 0;
+        while (first < files.size()) {
+            uint64_t start = files[first].first->offset;
+            uint64_t end = start + files[first].first->storedSize;
+            size_t last = first + 1;
+            while (last < files.size()) {
+                const PackEntry* entry = files[last].first;
+                uint64_t entryEnd =
+                    std::max(end, entry->offset + entry->storedSize);
+                if (entry->offset > end + PACK_ALIGNMENT ||
+                    entryEnd - start > MAX_SPAN_SIZE) {
+                    break;
+                }
+                end = entryEnd;
+                last++;
+            }
+
+            FileRead read;
+            read.fd = pack->getFileDescriptor();
+            read.offset = start;
+            read.size = end - start;
+            const PackEntry* single = files[first].first;
+            if (last == first + 1 &&
+                single->compression == PackCompression::None) {
+                // Straight into the file's buffer, nothing to decode
+                size_t index = files[first].second;
+                batch->data[index].resize(single->size);
+                read.destination = batch->data[index].data();
+                read.done = [this, batch, index, single](uint64_t count) {
+                    bytesRead.fetch_add(count, std::memory_order_relaxed);
+                    batch->finish(index, count == single->storedSize);
+                };
+            } else {
+                auto span = std::make_shared<std::vector<uint8_t>>(end - start);
+                std::vector<std::pair<const PackEntry*, size_t>> spanFiles(
+                    files.begin() + first, files.begin() + last);
+                read.destination = span->data();
+                read.done = [this, batch, span, spanFiles,
+                             start](uint64_t count) {
+                    PROFILE_ZONE("decode pack entries");
+                    bytesRead.fetch_add(count, std::memory_order_relaxed);
+                    for (const auto& [entry, index] : spanFiles) {
+                        uint64_t offset = entry->offset - start;
+                        bool ok = offset + entry->storedSize <= count;
+                        if (ok) {
+                            batch->data[index].resize(entry->size);
+                            ok = PackArchive::decode(
+                                *entry, span->data() + offset,
+                                batch->data[index].data());
+                        }
+                        if (!ok) {
+                            LOG_WARNING("Failed to read {} from its pack",
+                                        batch->paths[index]);
+                        }
+                        batch->finish(index, ok);
+                    }
+                };
+            }
+            reads.push_back(std::move(read));
+            first = last;
+        }
+    }
+
+    readsIssued.fetch_add(reads.size(), std::memory_order_relaxed);
+    reader.submit(std::move(reads));
+    return batch;
+}
+
+// Read one file and wait for it, returns false if it failed
+bool VirtualFileSystem::readFile(const std::string& path,
+                                 std::vector<uint8_t>& data) {
+    std::shared_ptr<FileBatch> batch = readAsync({path});
+    batch->wait();
+    if (!batch->succeeded(0)) return false;
+    data = std::move(batch->getData(0));
+    return true;
+}
+
+FileSystemStats VirtualFileSystem::getStats() const {
+    FileSystemStats stats;
+    stats.filesRead = filesRead.load(std::memory_order_relaxed);
+    stats.readsIssued = readsIssued.load(std::memory_order_relaxed);
+    stats.bytesRead = bytesRead.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool VirtualFileSystem::registerBuffers(
+    const std::vector<ReadBuffer>& buffers) {
+    return reader.registerBuffers(buffers);
+}
@@ -0,0 +1,119 @@
+#ifndef VIRTUAL_FILE_SYSTEM_H
+#define VIRTUAL_FILE_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "async_file_reader.h"
+#include "core/debugger/debugger.h"
+#include "core/jobs/job_system.h"
+#include "pack_archive.h"
+
+// Files read together, see VirtualFileSystem::readAsync. Results fill in on
+// I/O and job threads, nothing in here may be looked at before isDone
+class FileBatch {
+   public:
+    bool isDone() const;
+    void wait() const;
+
+    size_t size() const { return paths.size(); }
+    const std::string& getPath(size_t index) const { return paths[index]; }
+    // False if the file is missing, or failed to read or decode
+    bool succeeded(size_t index) const { return results[index] != 0; }
+    // Move it out to keep it past the batch
+    std::vector<uint8_t>& getData(size_t index) { return data[index]; }
+
+   private:
+    friend class VirtualFileSystem;
+
+    void finish(size_t index, bool succeeded);
+
+    std::vector<std::string> paths;
+    std::vector<std::vector<uint8_t>> data;
+    std::vector<uint8_t> results;
+
+    mutable std::mutex mutex;
+    mutable std::condition_variable done;
+    size_t remaining = 0;
+};
+
+// Totals since startup, to see how many reads a load turned into
+struct FileSystemStats {
+    uint64_t filesRead = 0;
+    // Reads issued, a run of files in a pack is one
+    uint64_t readsIssued = 0;
+    uint64_t bytesRead = 0;
+};
+
+// Every asset is read through here by its virtual path, like
+// "textures/dennis.jpg", whether it sits loose in a directory or in a pack.
+// Mounts made later are searched first, so a pack mounted over the asset
+// directory replaces the files it has and leaves the rest loose. A batch of
+// reads is sorted by where the files live, and files next to each other in
+// a pack are fetched with one large read, so loading a level's files costs
+// a few sequential reads rather than an open per file
+class VirtualFileSystem {
+   public:
+    static VirtualFileSystem& get();
+
+    // Serve prefix/path from directory/path. Mount before the first read,
+    // mounts must not change while reads are in flight
+    void mountDirectory(const std::string& directory,
+                        const std::string& prefix = "");
+    // Returns false if the file is missing or not a pack
+    bool mountPack(const std::string& path, const std::string& prefix = "");
+    // Drop every mount made at prefix, waits for reads in flight
+    void unmount(const std::string& prefix);
+    void unmountAll();
+
+    bool exists(const std::string& path) const;
+
+    // Start reading every path, missing files fail in the batch
+    std::shared_ptr<FileBatch> readAsync(const std::vector<std::string>& paths);
+
+    // Read one file and wait for it, returns false if it failed
+    bool readFile(const std::string& path, std::vector<uint8_t>& data);
+
+    FileSystemStats getStats() const;
+    FileReadBackend getBackend() const { return reader.getBackend(); }
+
+    // Memory reads land in often, see AsyncFileReader::registerBuffers
+    bool registerBuffers(const std::vector<ReadBuffer>& buffers);
+
+    ~VirtualFileSystem();
+
+   private:
+    struct Mount {
+        std::string prefix;
+        std::string directory;
+        std::unique_ptr<PackArchive> pack;
+    };
+
+    // Where a virtual path lives, a pack entry or a loose file
+    struct Location {
+        const PackArchive* pack = nullptr;
+        const PackEntry* entry = nullptr;
+        std::string diskPath;
+    };
+
+    VirtualFileSystem();
+    bool resolve(const std::string& path, Location& location) const;
+    void readLoose(const std::shared_ptr<FileBatch>& batch, size_t index,
+                   const std::string& diskPath, std::vector<FileRead>& reads);
+
+    Debugger debugger;
+    JobSystem jobs;
+    AsyncFileReader reader;
+    std::vector<Mount> mounts;
+
+    std::atomic<uint64_t> filesRead{0};
+    std::atomic<uint64_t> readsIssued{0};
+    std::atomic<uint64_t> bytesRead{0};
+};
+
+#endif
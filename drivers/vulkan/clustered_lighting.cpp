@@ -0,0 +1,269 @@
+#include "clustered_lighting.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "core/debugger/profiler.h"
+
+// Threads per group, must match local_size in light_cluster.comp
+const uint32_t BINNING_GROUP_SIZE = 64;
+
+// Deterministic lights scattered around the scene. The generator's raw
+// output is scaled by hand, standard distributions differ between standard
+// libraries
+std::vector<PointLight> scatterPointLights(uint32_t count, uint32_t seed) {
+    std::mt19937 random(seed);
+    auto uniform = [&random](float minimum, float maximum) {
+        return minimum + (maximum - minimum) *
+                             (random() / static_cast<float>(random.max()));
+    };
+
+    std::vector<PointLight> lights(count);
+    for (PointLight& light : lights) {
+        light.position = {uniform(-2.0f, 2.0f), uniform(-1.0f, 2.0f),
+                          uniform(-2.0f, 2.0f)};
+        light.radius = uniform(0.3f, 1.0f);
+        // Saturated colors, so overlapping lights are easy to tell apart
+        light.color = {uniform(0.2f, 1.0f), uniform(0.2f, 1.0f),
+                       uniform(0.2f, 1.0f)};
+        light.intensity = uniform(0.5f, 2.0f);
+    }
+    return lights;
+}
+
+void ClusteredLighting::init(VkDevice device, VulkanRecovery* recovery,
+                             VkShaderModule binShader) {
+    debugger.consoleMessage("\nBegin creating clustered lighting...", false);
+    this->device = device;
+    this->recovery = recovery;
+
+    // Bindings follow the order in light_cluster.comp
+    std::array<VkDescriptorType, 4> types = {
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER};
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = types[i];
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    setLayoutInfo.pBindings = bindings.data();
+    checkVulkanResult(vkCreateDescriptorSetLayout(device, &setLayoutInfo,
+                                                  nullptr, &setLayout),
+                      "create light binning descriptor set layout");
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    checkVulkanResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo,
+                                             nullptr, &pipelineLayout),
+                      "create light binning pipeline layout");
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = binShader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout;
+    checkVulkanResult(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+                                               &pipelineInfo, nullptr,
+                                               &pipeline),
+                      "create light binning pipeline");
+
+    std::vector<DescriptorPoolSizeRatio> poolRatios = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3.0f}};
+    descriptors.init(device, 8, poolRatios);
+    debugger.consoleMessage("Successfully created clustered lighting", false);
+}
+
+void ClusteredLighting::cleanup() {
+    cleanupFrameResources();
+    descriptors.cleanup();
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    debugger.consoleMessage("Destroyed clustered lighting", false);
+}
+
+ClusteredLighting::Buffer ClusteredLighting::createBuffer(
+    VkDeviceSize size, VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags properties) {
+    Buffer result;
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    checkVulkanResult(
+        vkCreateBuffer(device, &bufferInfo, nullptr, &result.buffer),
+        "create lighting buffer");
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, result.buffer, &memRequirements);
+    checkVulkanResult(
+        recovery->allocateMemory(memRequirements.size,
+                                 memRequirements.memoryTypeBits, properties,
+                                 result.memory),
+        "allocate lighting buffer memory");
+    vkBindBufferMemory(device, result.buffer, result.memory, 0);
+
+    if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(device, result.memory, 0, size, 0, &result.mapped);
+        memset(result.mapped, 0, static_cast<size_t>(size));
+    }
+    return result;
+}
+
+void ClusteredLighting::destroyBuffer(Buffer& buffer) {
+    vkDestroyBuffer(device, buffer.buffer, nullptr);
+    vkFreeMemory(device, buffer.memory, nullptr);
+    buffer = Buffer();
+}
+
+// Parameters, lights and cluster lists, one set per frame in flight
+void ClusteredLighting::createFrameResources(uint32_t framesInFlight,
+                                             uint32_t maxLights) {
+    this->framesInFlight = framesInFlight;
+    this->maxLights = maxLights;
+
+    const VkMemoryPropertyFlags hostVisible =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        paramBuffers.push_back(createBuffer(sizeof(LightingParams),
+                                            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                            hostVisible));
+        lightBuffers.push_back(createBuffer(getLightBufferSize(),
+                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                            hostVisible));
+        // Read by every fragment, so they stay in device memory
+        clusterCountBuffers.push_back(
+            createBuffer(getClusterCountBufferSize(),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+        clusterLightBuffers.push_back(
+            createBuffer(getClusterLightBufferSize(),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+    }
+    staleLightFrames = (1u << framesInFlight) - 1;
+}
+
+void ClusteredLighting::cleanupFrameResources() {
+    // The binning sets point at these buffers
+    descriptors.resetPools();
+    for (uint32_t i = 0; i < paramBuffers.size(); i++) {
+        destroyBuffer(paramBuffers[i]);
+        destroyBuffer(lightBuffers[i]);
+        destroyBuffer(clusterCountBuffers[i]);
+        destroyBuffer(clusterLightBuffers[i]);
+    }
+    paramBuffers.clear();
+    lightBuffers.clear();
+    clusterCountBuffers.clear();
+    clusterLightBuffers.clear();
+    framesInFlight = 0;
+}
+
+// Each frame in flight gets its own copy as it comes around
+void ClusteredLighting::setLights(const std::vector<PointLight>& lights) {
+    this->lights = lights;
+    staleLightFrames = (1u << std::max(framesInFlight, 1u)) - 1;
+}
+
+uint32_t ClusteredLighting::getLightCount() const {
+    return std::min(static_cast<uint32_t>(lights.size()), maxLights);
+}
+
+// Write the frame's parameters and any lights it has not seen yet
+void ClusteredLighting::beginFrame(uint32_t frame,
+                                   const ClusteredLightingFrame& params) {
+    PROFILE_FUNCTION();
+    currentFrame = frame;
+    uint32_t lightCount = getLightCount();
+    uint32_t frameBit = 1u << frame;
+    if (staleLightFrames & frameBit) {
+        memcpy(lightBuffers[frame].mapped, lights.data(),
+               sizeof(PointLight) * lightCount);
+        staleLightFrames &= ~frameBit;
+    }
+
+    // slice = log(depth / near) / log(far / near) * slices, split into a
+    // scale and bias on log(depth)
+    float logDepthRange = std::log(params.farPlane / params.nearPlane);
+    float sliceScale = LIGHT_CLUSTERS_Z / logDepthRange;
+    float sliceBias = -sliceScale * std::log(params.nearPlane);
+
+    LightingParams lightingParams{};
+    lightingParams.view = params.view;
+    lightingParams.inverseProj = glm::inverse(params.proj);
+    lightingParams.gridX = LIGHT_CLUSTERS_X;
+    lightingParams.gridY = LIGHT_CLUSTERS_Y;
+    lightingParams.gridZ = LIGHT_CLUSTERS_Z;
+    lightingParams.lightCount = lightCount;
+    lightingParams.viewport = glm::vec4(params.viewport.width,
+                                        params.viewport.height, 0.0f, 0.0f);
+    lightingParams.depthSlicing = glm::vec4(params.nearPlane, params.farPlane,
+                                            sliceScale, sliceBias);
+    lightingParams.ambient = glm::vec4(ambient, 0.0f);
+    memcpy(paramBuffers[frame].mapped, &lightingParams,
+           sizeof(lightingParams));
+
+    DescriptorBindings bindings;
+    bindings
+        .bindBuffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                    paramBuffers[frame].buffer, 0, getParamBufferSize())
+        .bindBuffer(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    lightBuffers[frame].buffer, 0, getLightBufferSize())
+        .bindBuffer(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    clusterCountBuffers[frame].buffer, 0,
+                    getClusterCountBufferSize())
+        .bindBuffer(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    clusterLightBuffers[frame].buffer, 0,
+                    getClusterLightBufferSize());
+    binningSet = descriptors.getSet(setLayout, bindings);
+}
+
+// Fill the cluster lists, one thread per cluster. Every cluster is written,
+// empty ones with a count of zero, so nothing has to be cleared first
+void ClusteredLighting::recordBinning(VkCommandBuffer commandBuffer) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipelineLayout, 0, 1, &binningSet, 0, nullptr);
+    vkCmdDispatch(commandBuffer,
+                  (LIGHT_CLUSTER_COUNT + BINNING_GROUP_SIZE - 1) /
+                      BINNING_GROUP_SIZE,
+                  1, 1);
+
+    // The main pass's fragment shader reads the lists
+    std::array<VkBufferMemoryBarrier, 2> barriers{};
+    VkBuffer buffers[] = {clusterCountBuffers[currentFrame].buffer,
+                          clusterLightBuffers[currentFrame].buffer};
+    for (size_t i = 0; i < barriers.size(); i++) {
+        barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].buffer = buffers[i];
+        barriers[i].offset = 0;
+        barriers[i].size = VK_WHOLE_SIZE;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                         static_cast<uint32_t>(barriers.size()),
+                         barriers.data(), 0, nullptr);
+}
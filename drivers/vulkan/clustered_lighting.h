@@ -0,0 +1,162 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "descriptor_allocator.h"
+#include "vulkan_result.h"
+
+// Froxel grid the lights are binned into: screen tiles split into depth
+// slices that grow exponentially with distance, so every cluster covers a
+// similar share of the view. Must match the lighting shaders
+const uint32_t LIGHT_CLUSTERS_X = 16;
+const uint32_t LIGHT_CLUSTERS_Y = 9;
+const uint32_t LIGHT_CLUSTERS_Z = 24;
+const uint32_t LIGHT_CLUSTER_COUNT =
+    LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z;
+// Lights past this in one cluster are dropped from it
+const uint32_t MAX_LIGHTS_PER_CLUSTER = 256;
+
+// A point light in world space, matches PointLight in the lighting shaders
+// with std430 layout
+struct PointLight {
+    glm::vec3 position;
+    // Distance at which the light has faded out completely
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// Deterministic lights scattered around the scene, for stress tests
+std::vector<PointLight> scatterPointLights(uint32_t count, uint32_t seed = 1);
+
+// Per frame inputs
+struct ClusteredLightingFrame {
+    glm::mat4 view;
+    glm::mat4 proj;
+    float nearPlane = 0.0f;
+    float farPlane = 0.0f;
+    // Part of the color attachment the frame renders to, from the top left
+    // corner. Fragments find their cluster from gl_FragCoord within it
+    VkExtent2D viewport{};
+};
+
+// Clustered forward lighting. A compute pass bins every light into the
+// clusters its sphere touches, then the main pass only shades each fragment
+// with the lights of its own cluster. The shading cost follows the lights
+// near a pixel instead of the total, so thousands of lights cost about as
+// much as a handful
+class ClusteredLighting {
+   public:
+    void init(VkDevice device, VulkanRecovery* recovery,
+              VkShaderModule binShader);
+    void cleanup();
+
+    // Parameters, lights and cluster lists, one set per frame in flight
+    void createFrameResources(uint32_t framesInFlight, uint32_t maxLights);
+    void cleanupFrameResources();
+
+    // Lights past maxLights are ignored. Each frame in flight gets its own
+    // copy as it comes around
+    void setLights(const std::vector<PointLight>& lights);
+    uint32_t getLightCount() const;
+    // Added to every light, white by default so an unlit scene shows its
+    // textures as they are
+    void setAmbient(const glm::vec3& ambient) { this->ambient = ambient; }
+
+    // Write the frame's parameters and any lights it has not seen yet. The
+    // frame's fence must have signalled
+    void beginFrame(uint32_t frame, const ClusteredLightingFrame& params);
+
+    // Fill the cluster lists. Record before the main pass
+    void recordBinning(VkCommandBuffer commandBuffer);
+
+    // What the fragment shader binds, indexed by frame in flight
+    VkBuffer getParamBuffer(uint32_t frame) const {
+        return paramBuffers[frame].buffer;
+    }
+    VkDeviceSize getParamBufferSize() const { return sizeof(LightingParams); }
+    VkBuffer getLightBuffer(uint32_t frame) const {
+        return lightBuffers[frame].buffer;
+    }
+    VkDeviceSize getLightBufferSize() const {
+        return sizeof(PointLight) * maxLights;
+    }
+    VkBuffer getClusterCountBuffer(uint32_t frame) const {
+        return clusterCountBuffers[frame].buffer;
+    }
+    VkDeviceSize getClusterCountBufferSize() const {
+        return sizeof(uint32_t) * LIGHT_CLUSTER_COUNT;
+    }
+    VkBuffer getClusterLightBuffer(uint32_t frame) const {
+        return clusterLightBuffers[frame].buffer;
+    }
+    VkDeviceSize getClusterLightBufferSize() const {
+        return sizeof(uint32_t) * LIGHT_CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER;
+    }
+
+   private:
+    // Matches LightingParams in light_cluster.comp and shader.frag with
+    // std140 layout
+    struct LightingParams {
+        glm::mat4 view;
+        glm::mat4 inverseProj;
+        uint32_t gridX;
+        uint32_t gridY;
+        uint32_t gridZ;
+        uint32_t lightCount;
+        // Width and height of the viewport in pixels, then unused
+        glm::vec4 viewport;
+        // Near, far, then the scale and bias that turn log(depth) into a
+        // slice
+        glm::vec4 depthSlicing;
+        glm::vec4 ambient;
+    };
+
+    // Buffer with memory of its own, mapped for its whole life when host
+    // visible
+    struct Buffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+    };
+
+    Buffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags properties);
+    void destroyBuffer(Buffer& buffer);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    VulkanRecovery* recovery = nullptr;
+
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    // Sets are looked up every frame and cached, a reset drops them all
+    DescriptorAllocator descriptors;
+
+    uint32_t framesInFlight = 0;
+    uint32_t maxLights = 0;
+    // Host visible, written before recording
+    std::vector<Buffer> paramBuffers;
+    std::vector<Buffer> lightBuffers;
+    // Device local, only the binning pass writes them
+    std::vector<Buffer> clusterCountBuffers;
+    std::vector<Buffer> clusterLightBuffers;
+    uint32_t currentFrame = 0;
+    // Looked up in beginFrame for the frame being recorded
+    VkDescriptorSet binningSet = VK_NULL_HANDLE;
+
+    std::vector<PointLight> lights;
+    // Bit f is set while frame f's light buffer is out of date
+    uint32_t staleLightFrames = 0;
+    glm::vec3 ambient = glm::vec3(1.0f);
+};
+
+#endif
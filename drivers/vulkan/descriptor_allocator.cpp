@@ -0,0 +1,289 @@
+#include "descriptor_allocator.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "vulkan_result.h"
+
+// Pools stop growing once they reach this many sets
+const uint32_t MAX_SETS_PER_POOL = 4096;
+
+static void hashCombine(size_t& seed, size_t value) {
+    seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+// Bind a buffer (uniform or storage) to a binding slot
+DescriptorBindings& DescriptorBindings::bindBuffer(uint32_t binding,
+                                                   VkDescriptorType type,
+                                                   VkBuffer buffer,
+                                                   VkDeviceSize offset,
+                                                   VkDeviceSize range) {
+    Binding entry{};
+    entry.binding = binding;
+    entry.type = type;
+    entry.bufferInfo.buffer = buffer;
+    entry.bufferInfo.offset = offset;
+    entry.bufferInfo.range = range;
+    entry.isImage = false;
+    bindings.push_back(entry);
+    return *this;
+}
+
+// Bind an image and sampler to a binding slot
+DescriptorBindings& DescriptorBindings::bindImage(uint32_t binding,
+                                                  VkDescriptorType type,
+                                                  VkImageView imageView,
+                                                  VkSampler sampler,
+                                                  VkImageLayout imageLayout) {
+    Binding entry{};
+    entry.binding = binding;
+    entry.type = type;
+    entry.imageInfo.imageView = imageView;
+    entry.imageInfo.sampler = sampler;
+    entry.imageInfo.imageLayout = imageLayout;
+    entry.isImage = true;
+    bindings.push_back(entry);
+    return *this;
+}
+
+// Write every binding into the given descriptor set
+void DescriptorBindings::write(VkDevice device, VkDescriptorSet set) const {
+    std::vector<VkWriteDescriptorSet> descriptorWrites(bindings.size());
+
+    for (size_t i = 0; i < bindings.size(); i++) {
+        descriptorWrites[i] = {};
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = set;
+        descriptorWrites[i].dstBinding = bindings[i].binding;
+        descriptorWrites[i].dstArrayElement = 0;
+        descriptorWrites[i].descriptorType = bindings[i].type;
+        descriptorWrites[i].descriptorCount = 1;
+        if (bindings[i].isImage) {
+            descriptorWrites[i].pImageInfo = &bindings[i].imageInfo;
+        } else {
+            descriptorWrites[i].pBufferInfo = &bindings[i].bufferInfo;
+        }
+    }
+
+    vkUpdateDescriptorSets(device,
+                           static_cast<uint32_t>(descriptorWrites.size()),
+                           descriptorWrites.data(), 0, nullptr);
+}
+
+// Whether any binding samples the given image view
+bool DescriptorBindings::usesImageView(VkImageView imageView) const {
+    for (const auto& entry : bindings) {
+        if (entry.isImage && entry.imageInfo.imageView == imageView) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t DescriptorBindings::hash() const {
+    size_t seed = bindings.size();
+    for (const auto& entry : bindings) {
+        hashCombine(seed, std::hash<uint32_t>()(entry.binding));
+        hashCombine(seed, std::hash<int64_t>()(entry.type));
+        if (entry.isImage) {
+            hashCombine(seed, std::hash<const void*>()(entry.imageInfo.imageView));
+            hashCombine(seed, std::hash<const void*>()(entry.imageInfo.sampler));
+            hashCombine(seed, std::hash<int64_t>()(entry.imageInfo.imageLayout));
+        } else {
+            hashCombine(seed, std::hash<const void*>()(entry.bufferInfo.buffer));
+            hashCombine(seed, std::hash<uint64_t>()(entry.bufferInfo.offset));
+            hashCombine(seed, std::hash<uint64_t>()(entry.bufferInfo.range));
+        }
+    }
+    return seed;
+}
+
+bool DescriptorBindings::operator==(const DescriptorBindings& other) const {
+    if (bindings.size() != other.bindings.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < bindings.size(); i++) {
+        const Binding& a = bindings[i];
+        const Binding& b = other.bindings[i];
+        if (a.binding != b.binding || a.type != b.type ||
+            a.isImage != b.isImage) {
+            return false;
+        }
+        if (a.isImage) {
+            if (a.imageInfo.imageView != b.imageInfo.imageView ||
+                a.imageInfo.sampler != b.imageInfo.sampler ||
+                a.imageInfo.imageLayout != b.imageInfo.imageLayout) {
+                return false;
+            }
+        } else if (a.bufferInfo.buffer != b.bufferInfo.buffer ||
+                   a.bufferInfo.offset != b.bufferInfo.offset ||
+                   a.bufferInfo.range != b.bufferInfo.range) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t DescriptorAllocator::CacheKeyHash::operator()(
+    const CacheKey& key) const {
+    size_t seed = key.bindings.hash();
+    hashCombine(seed, std::hash<const void*>()(key.layout));
+    return seed;
+}
+
+// Create the first pool. setsPerPool grows as more pools are needed
+void DescriptorAllocator::init(
+    VkDevice device, uint32_t setsPerPool,
+    const std::vector<DescriptorPoolSizeRatio>& poolRatios) {
+    this->device = device;
+    this->setsPerPool = setsPerPool;
+    ratios = poolRatios;
+
+    readyPools.push_back(createPool(setsPerPool));
+    this->setsPerPool = std::min(
+        static_cast<uint32_t>(setsPerPool * 1.5f), MAX_SETS_PER_POOL);
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(uint32_t setCount) {
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (const auto& ratio : ratios) {
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = ratio.type;
+        poolSize.descriptorCount =
+            std::max(1u, static_cast<uint32_t>(ratio.ratio * setCount));
+        poolSizes.push_back(poolSize);
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = setCount;
+
+    VkDescriptorPool pool;
+    checkVulkanResult(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool),
+                      "create descriptor pool");
+    debugger.consoleMessage("Successfully created descriptor pool", false);
+    stats.poolsCreated++;
+    return pool;
+}
+
+// Grab a pool with free space, creating one if they are all full
+VkDescriptorPool DescriptorAllocator::getPool() {
+    if (!readyPools.empty()) {
+        VkDescriptorPool pool = readyPools.back();
+        readyPools.pop_back();
+        return pool;
+    }
+
+    VkDescriptorPool pool = createPool(setsPerPool);
+    setsPerPool = std::min(static_cast<uint32_t>(setsPerPool * 1.5f),
+                           MAX_SETS_PER_POOL);
+    return pool;
+}
+
+// Allocate an empty descriptor set, growing the pool chain if needed
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+    VkDescriptorPool pool = getPool();
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set;
+    VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+
+    // The pool is used up, retire it and try again with a fresh one
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY ||
+        result == VK_ERROR_FRAGMENTED_POOL) {
+        fullPools.push_back(pool);
+        pool = getPool();
+        allocInfo.descriptorPool = pool;
+        result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+    }
+
+    // Hand the pool back before reporting a failure, so cleanup still
+    // destroys it
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY ||
+        result == VK_ERROR_FRAGMENTED_POOL) {
+        fullPools.push_back(pool);
+    } else {
+        readyPools.push_back(pool);
+    }
+    checkVulkanResult(result, "allocate descriptor set");
+
+    stats.allocations++;
+    return set;
+}
+
+// Get a descriptor set holding the given bindings, reusing a cached one if an
+// identical set was already written
+VkDescriptorSet DescriptorAllocator::getSet(
+    VkDescriptorSetLayout layout, const DescriptorBindings& bindings) {
+    CacheKey key{layout, bindings};
+
+    auto cached = setCache.find(key);
+    if (cached != setCache.end()) {
+        stats.cacheHits++;
+        return cached->second;
+    }
+
+    stats.cacheMisses++;
+    VkDescriptorSet set;
+    std::vector<VkDescriptorSet>& stale = staleSets[layout];
+    if (!stale.empty()) {
+        set = stale.back();
+        stale.pop_back();
+    } else {
+        set = allocate(layout);
+    }
+    bindings.write(device, set);
+    setCache.emplace(std::move(key), set);
+    return set;
+}
+
+// Drop the cached sets that bind imageView, once it is replaced. Their sets
+// are rewritten by later cache misses, so the GPU must be done with them
+void DescriptorAllocator::invalidateImageView(VkImageView imageView) {
+    for (auto it = setCache.begin(); it != setCache.end();) {
+        if (it->first.bindings.usesImageView(imageView)) {
+            staleSets[it->first.layout].push_back(it->second);
+            it = setCache.erase(it);
+            stats.invalidations++;
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Reset every pool at once. All sets handed out so far become invalid
+void DescriptorAllocator::resetPools() {
+    for (auto pool : readyPools) {
+        vkResetDescriptorPool(device, pool, 0);
+    }
+    for (auto pool : fullPools) {
+        vkResetDescriptorPool(device, pool, 0);
+        readyPools.push_back(pool);
+    }
+    fullPools.clear();
+    setCache.clear();
+    staleSets.clear();
+    stats.poolResets++;
+}
+
+// Destroy every pool
+void DescriptorAllocator::cleanup() {
+    for (auto pool : readyPools) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    for (auto pool : fullPools) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    readyPools.clear();
+    fullPools.clear();
+    setCache.clear();
+    staleSets.clear();
+    debugger.consoleMessage("Destroyed Vulkan descriptor pools", false);
+}
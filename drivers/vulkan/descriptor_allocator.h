@@ -0,0 +1,128 @@
+#ifndef DESCRIPTOR_ALLOCATOR_H
+#define DESCRIPTOR_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+
+// How many descriptors of a type each pool holds per descriptor set
+struct DescriptorPoolSizeRatio {
+    VkDescriptorType type;
+    float ratio;
+};
+
+// Counters exposed so we can see how the allocator is behaving
+struct DescriptorAllocatorStats {
+    uint64_t allocations = 0;
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
+    uint64_t poolsCreated = 0;
+    uint64_t poolResets = 0;
+    uint64_t invalidations = 0;
+};
+
+// The resources written into a descriptor set. Two sets with the same layout
+// and the same bindings are interchangeable, so this doubles as the cache key
+class DescriptorBindings {
+   public:
+    // Bind a buffer (uniform or storage) to a binding slot
+    DescriptorBindings& bindBuffer(uint32_t binding, VkDescriptorType type,
+                                   VkBuffer buffer, VkDeviceSize offset,
+                                   VkDeviceSize range);
+
+    // Bind an image and sampler to a binding slot
+    DescriptorBindings& bindImage(uint32_t binding, VkDescriptorType type,
+                                  VkImageView imageView, VkSampler sampler,
+                                  VkImageLayout imageLayout);
+
+    // Write every binding into the given descriptor set
+    void write(VkDevice device, VkDescriptorSet set) const;
+
+    // Whether any binding samples the given image view
+    bool usesImageView(VkImageView imageView) const;
+
+    size_t hash() const;
+    bool operator==(const DescriptorBindings& other) const;
+
+   private:
+    struct Binding {
+        uint32_t binding;
+        VkDescriptorType type;
+        VkDescriptorBufferInfo bufferInfo;
+        VkDescriptorImageInfo imageInfo;
+        bool isImage;
+    };
+
+    std::vector<Binding> bindings;
+};
+
+// Allocates descriptor sets from a chain of pools. When a pool fills up a
+// larger one is created, so callers never need to know the set count ahead of
+// time. Sets requested with bindings are cached and handed out again when the
+// same layout and bindings are asked for, until invalidated or reset
+class DescriptorAllocator {
+   public:
+    // Create the first pool. setsPerPool grows as more pools are needed
+    void init(VkDevice device, uint32_t setsPerPool,
+              const std::vector<DescriptorPoolSizeRatio>& poolRatios);
+
+    // Allocate an empty descriptor set, growing the pool chain if needed
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+    // Get a descriptor set holding the given bindings, reusing a cached one
+    // if an identical set was already written
+    VkDescriptorSet getSet(VkDescriptorSetLayout layout,
+                           const DescriptorBindings& bindings);
+
+    // Drop the cached sets that bind imageView, once it is replaced. Their
+    // sets are rewritten by later cache misses, so the GPU must be done with
+    // them
+    void invalidateImageView(VkImageView imageView);
+
+    // Reset every pool at once. All sets handed out so far become invalid
+    void resetPools();
+
+    // Destroy every pool
+    void cleanup();
+
+    const DescriptorAllocatorStats& getStats() const { return stats; }
+
+   private:
+    struct CacheKey {
+        VkDescriptorSetLayout layout;
+        DescriptorBindings bindings;
+
+        bool operator==(const CacheKey& other) const {
+            return layout == other.layout && bindings == other.bindings;
+        }
+    };
+
+    struct CacheKeyHash {
+        size_t operator()(const CacheKey& key) const;
+    };
+
+    // Grab a pool with free space, creating one if they are all full
+    VkDescriptorPool getPool();
+    VkDescriptorPool createPool(uint32_t setCount);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+
+    std::vector<DescriptorPoolSizeRatio> ratios;
+    std::vector<VkDescriptorPool> readyPools;
+    std::vector<VkDescriptorPool> fullPools;
+    uint32_t setsPerPool = 0;
+
+    std::unordered_map<CacheKey, VkDescriptorSet, CacheKeyHash> setCache;
+    // Invalidated sets by layout, reused before allocating new ones
+    std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>>
+        staleSets;
+
+    DescriptorAllocatorStats stats;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Weight of the newest frame in the smoothed time
+const double SMOOTHING = 0.1;
+// Frames under this fraction of the budget have room to grow
+const double HEADROOM = 0.85;
+// Largest change of the scale in one step, down and up. Growing is slow so a
+// frame that is only just under budget does not bounce back over it
+const double MAX_DECREASE = 0.25;
+const double MAX_INCREASE = 0.05;
+// Changes smaller than this are not worth resizing for
+const double MIN_STEP = 0.01;
+
+void DynamicResolution::setTarget(double targetMs) {
+    if (targetMs <= 0.0) {
+        debugger.consoleMessage("Dynamic resolution target must be positive!",
+                                true);
+    }
+    this->targetMs = targetMs;
+}
+
+void DynamicResolution::setRange(double minimum, double maximum) {
+    if (minimum <= 0.0 || minimum > maximum) {
+        debugger.consoleMessage("Invalid dynamic resolution range!", true);
+    }
+    minimumScale = minimum;
+    maximumScale = maximum;
+    scale = std::clamp(scale, minimumScale, maximumScale);
+}
+
+void DynamicResolution::setLatency(uint32_t frames) { latency = frames; }
+
+// Feed one frame's GPU time
+bool DynamicResolution::update(double gpuTimeMs) {
+    if (gpuTimeMs <= 0.0) return false;
+
+    smoothedMs = smoothedMs > 0.0
+                     ? smoothedMs + (gpuTimeMs - smoothedMs) * SMOOTHING
+                     : gpuTimeMs;
+    if (cooldown > 0) {
+        cooldown--;
+        return false;
+    }
+
+    // GPU time goes roughly with the pixel count, the square of the scale
+    double wanted = scale;
+    if (smoothedMs > targetMs) {
+        wanted = scale * std::max(std::sqrt(targetMs / smoothedMs),
+                                  1.0 - MAX_DECREASE);
+    } else if (smoothedMs < targetMs * HEADROOM) {
+        wanted = scale * std::min(std::sqrt(targetMs * HEADROOM / smoothedMs),
+                                  1.0 + MAX_INCREASE);
+    }
+    wanted = std::clamp(wanted, minimumScale, maximumScale);
+    if (std::abs(wanted - scale) < MIN_STEP &&
+        wanted != minimumScale && wanted != maximumScale) {
+        return false;
+    }
+    if (wanted == scale) return false;
+
+    // The smoothed time still holds the old scale's frames, restart it from
+    // what the new scale should cost
+    smoothedMs *= (wanted * wanted) / (scale * scale);
+    scale = wanted;
+    cooldown = latency;
+    return true;
+}
+
+void DynamicResolution::reset() {
+    scale = maximumScale;
+    smoothedMs = 0.0;
+    cooldown = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <cstdint>
+
+#include "core/debugger/debugger.h"
+
+// Picks the render scale from the measured GPU frame time. The time is
+// smoothed first, then the scale drops quickly when the frame is over budget
+// and climbs back slowly when there is headroom. After every change the
+// controller waits for the new scale to show up in the timings, which trail
+// the CPU by the frames in flight, so it does not keep correcting for frames
+// that were rendered at the old scale
+class DynamicResolution {
+   public:
+    void setTarget(double targetMs);
+    double getTarget() const { return targetMs; }
+    // Smallest and largest scale of either axis, the largest is usually 1
+    void setRange(double minimum, double maximum);
+    // Frames to wait after a change before judging the timings again
+    void setLatency(uint32_t frames);
+
+    // Feed one frame's GPU time. Returns true if the scale changed
+    bool update(double gpuTimeMs);
+    // Go back to the largest scale and forget the history
+    void reset();
+
+    double getScale() const { return scale; }
+    double getSmoothedMs() const { return smoothedMs; }
+
+   private:
+    Debugger debugger;
+
+    double targetMs = 16.0;
+    double minimumScale = 0.5;
+    double maximumScale = 1.0;
+    uint32_t latency = 3;
+
+    double scale = 1.0;
+    // 0 until the first frame comes in
+    double smoothedMs = 0.0;
+    uint32_t cooldown = 0;
+};
+
+#endif
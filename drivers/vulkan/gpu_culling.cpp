@@ -0,0 +1,609 @@
+#include "gpu_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+
+#include "core/debugger/profiler.h"
+
+// Threads per group, must match local_size in the shaders
+const uint32_t CULL_GROUP_SIZE = 64;
+const uint32_t PYRAMID_GROUP_SIZE = 8;
+
+// Push constants of the pyramid shaders
+struct PyramidReduceConstants {
+    int32_t width;
+    int32_t height;
+    int32_t samples;
+};
+
+struct PyramidDownsampleConstants {
+    int32_t sourceWidth;
+    int32_t sourceHeight;
+    int32_t destinationWidth;
+    int32_t destinationHeight;
+};
+
+namespace {
+
+VkDescriptorSetLayout createSetLayout(
+    VkDevice device, const std::vector<VkDescriptorType>& types,
+    Debugger& debugger) {
+    std::vector<VkDescriptorSetLayoutBinding> bindings(types.size());
+    for (uint32_t i = 0; i < types.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = types[i];
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    VkDescriptorSetLayout layout;
+    checkVulkanResult(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                                  &layout),
+                      "create culling descriptor set layout");
+    return layout;
+}
+
+VkPipelineLayout createPipelineLayout(VkDevice device,
+                                      VkDescriptorSetLayout setLayout,
+                                      uint32_t pushConstantSize,
+                                      Debugger& debugger) {
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &setLayout;
+    layoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkPipelineLayout layout;
+    checkVulkanResult(vkCreatePipelineLayout(device, &layoutInfo, nullptr,
+                                             &layout),
+                      "create culling pipeline layout");
+    return layout;
+}
+
+// Make compute writes to the whole pyramid visible to the next compute read
+void pyramidBarrier(VkCommandBuffer commandBuffer, VkImage image,
+                    VkImageLayout oldLayout, VkAccessFlags srcAccess,
+                    VkAccessFlags dstAccess) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+}
+
+uint32_t groupCount(uint32_t size, uint32_t groupSize) {
+    return (size + groupSize - 1) / groupSize;
+}
+
+}  // namespace
+
+void GpuCulling::init(VkDevice device, VulkanRecovery* recovery,
+                      const GpuCullingShaders& shaders) {
+    debugger.consoleMessage("\nBegin creating GPU culling...", false);
+    this->device = device;
+    this->recovery = recovery;
+
+    createLayouts();
+    createPipelines(shaders);
+
+    // The pyramid is read with texelFetch, the sampler only has to exist
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    checkVulkanResult(
+        vkCreateSampler(device, &samplerInfo, nullptr, &pyramidSampler),
+        "create depth pyramid sampler");
+
+    std::vector<DescriptorPoolSizeRatio> poolRatios = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2.0f}};
+    descriptors.init(device, 32, poolRatios);
+    debugger.consoleMessage("Successfully created GPU culling", false);
+}
+
+void GpuCulling::cleanup() {
+    cleanupPyramid();
+    cleanupFrameResources();
+    descriptors.cleanup();
+
+    vkDestroySampler(device, pyramidSampler, nullptr);
+    vkDestroyPipeline(device, cullPipeline, nullptr);
+    vkDestroyPipeline(device, reducePipeline, nullptr);
+    vkDestroyPipeline(device, reduceMultisamplePipeline, nullptr);
+    vkDestroyPipeline(device, downsamplePipeline, nullptr);
+    vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device, reducePipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device, downsamplePipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, cullSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, reduceSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, downsampleSetLayout, nullptr);
+    debugger.consoleMessage("Destroyed GPU culling", false);
+}
+
+void GpuCulling::createLayouts() {
+    // Bindings follow the order in cull.comp
+    cullSetLayout = createSetLayout(
+        device,
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER},
+        debugger);
+    reduceSetLayout = createSetLayout(
+        device,
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+         VK_DESCRIPTOR_TYPE_STORAGE_IMAGE},
+        debugger);
+    downsampleSetLayout = createSetLayout(
+        device,
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE},
+        debugger);
+
+    cullPipelineLayout =
+        createPipelineLayout(device, cullSetLayout, 0, debugger);
+    reducePipelineLayout = createPipelineLayout(
+        device, reduceSetLayout, sizeof(PyramidReduceConstants), debugger);
+    downsamplePipelineLayout =
+        createPipelineLayout(device, downsampleSetLayout,
+                             sizeof(PyramidDownsampleConstants), debugger);
+}
+
+void GpuCulling::createPipelines(const GpuCullingShaders& shaders) {
+    cullPipeline = createComputePipeline(shaders.cull, cullPipelineLayout);
+    reducePipeline =
+        createComputePipeline(shaders.depthReduce, reducePipelineLayout);
+    reduceMultisamplePipeline = createComputePipeline(
+        shaders.depthReduceMultisample, reducePipelineLayout);
+    downsamplePipeline =
+        createComputePipeline(shaders.downsample, downsamplePipelineLayout);
+}
+
+VkPipeline GpuCulling::createComputePipeline(VkShaderModule module,
+                                             VkPipelineLayout layout) {
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = module;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = layout;
+
+    VkPipeline pipeline;
+    checkVulkanResult(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+                                               &pipelineInfo, nullptr,
+                                               &pipeline),
+                      "create culling compute pipeline");
+    return pipeline;
+}
+
+GpuCulling::MappedBuffer GpuCulling::createMappedBuffer(
+    VkDeviceSize size, VkBufferUsageFlags usage) {
+    MappedBuffer result;
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    checkVulkanResult(
+        vkCreateBuffer(device, &bufferInfo, nullptr, &result.buffer),
+        "create culling buffer");
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, result.buffer, &memRequirements);
+    checkVulkanResult(
+        recovery->allocateMemory(memRequirements.size,
+                                 memRequirements.memoryTypeBits,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                 result.memory),
+        "allocate culling buffer memory");
+    vkBindBufferMemory(device, result.buffer, result.memory, 0);
+
+    vkMapMemory(device, result.memory, 0, size, 0, &result.mapped);
+    memset(result.mapped, 0, static_cast<size_t>(size));
+    return result;
+}
+
+void GpuCulling::destroyMappedBuffer(MappedBuffer& buffer) {
+    vkDestroyBuffer(device, buffer.buffer, nullptr);
+    vkFreeMemory(device, buffer.memory, nullptr);
+    buffer = MappedBuffer();
+}
+
+// Indirect draws, visible lists and counters, one set per frame in flight
+void GpuCulling::createFrameResources(uint32_t framesInFlight,
+                                      uint32_t maxInstances,
+                                      uint32_t maxDraws) {
+    this->framesInFlight = framesInFlight;
+    this->maxInstances = maxInstances;
+    this->maxDraws = maxDraws;
+
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        paramBuffers.push_back(createMappedBuffer(
+            sizeof(CullParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT));
+        drawBuffers.push_back(createMappedBuffer(
+            sizeof(VkDrawIndexedIndirectCommand) * maxDraws,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT));
+        visibleBuffers.push_back(createMappedBuffer(
+            sizeof(uint32_t) * maxInstances,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+        counterBuffers.push_back(createMappedBuffer(
+            sizeof(CullCounters), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+    }
+    frameDrawCounts.assign(framesInFlight, 0);
+    frameInstanceCounts.assign(framesInFlight, 0);
+    stats = GpuCullingStats();
+}
+
+void GpuCulling::cleanupFrameResources() {
+    // The cull sets point at these buffers
+    descriptors.resetPools();
+    for (uint32_t i = 0; i < paramBuffers.size(); i++) {
+        destroyMappedBuffer(paramBuffers[i]);
+        destroyMappedBuffer(drawBuffers[i]);
+        destroyMappedBuffer(visibleBuffers[i]);
+        destroyMappedBuffer(counterBuffers[i]);
+    }
+    paramBuffers.clear();
+    drawBuffers.clear();
+    visibleBuffers.clear();
+    counterBuffers.clear();
+    framesInFlight = 0;
+}
+
+// Size the pyramid to the depth attachment
+void GpuCulling::createPyramid(VkExtent2D extent, VkImageView depthView,
+                               VkSampleCountFlagBits samples) {
+    pyramidExtent = extent;
+    pyramidViewport = extent;
+    this->depthView = depthView;
+    depthSamples = samples;
+    pyramidLevels = 1;
+    while ((std::max(extent.width, extent.height) >> pyramidLevels) > 0) {
+        pyramidLevels++;
+    }
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {extent.width, extent.height, 1};
+    imageInfo.mipLevels = pyramidLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage =
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    checkVulkanResult(
+        vkCreateImage(device, &imageInfo, nullptr, &pyramidImage),
+        "create depth pyramid");
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, pyramidImage, &memRequirements);
+    checkVulkanResult(
+        recovery->allocateMemory(memRequirements.size,
+                                 memRequirements.memoryTypeBits,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                 pyramidMemory),
+        "allocate depth pyramid memory");
+    vkBindImageMemory(device, pyramidImage, pyramidMemory, 0);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = pyramidImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = pyramidLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    checkVulkanResult(
+        vkCreateImageView(device, &viewInfo, nullptr, &pyramidView),
+        "create depth pyramid view");
+
+    // Storage images bind a single mip
+    pyramidMipViews.resize(pyramidLevels);
+    viewInfo.subresourceRange.levelCount = 1;
+    for (uint32_t level = 0; level < pyramidLevels; level++) {
+        viewInfo.subresourceRange.baseMipLevel = level;
+        checkVulkanResult(vkCreateImageView(device, &viewInfo, nullptr,
+                                            &pyramidMipViews[level]),
+                          "create depth pyramid mip view");
+    }
+
+    pyramidLayoutReady = false;
+    pyramidBuilt = false;
+    debugger.consoleMessage(
+        ("Created depth pyramid with " + std::to_string(pyramidLevels) +
+         " levels")
+            .c_str(),
+        false);
+}
+
+void GpuCulling::cleanupPyramid() {
+    if (pyramidImage == VK_NULL_HANDLE) return;
+    // The sets point at the pyramid views
+    descriptors.resetPools();
+    for (VkImageView view : pyramidMipViews) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    pyramidMipViews.clear();
+    vkDestroyImageView(device, pyramidView, nullptr);
+    vkDestroyImage(device, pyramidImage, nullptr);
+    vkFreeMemory(device, pyramidMemory, nullptr);
+    pyramidImage = VK_NULL_HANDLE;
+    pyramidView = VK_NULL_HANDLE;
+    pyramidMemory = VK_NULL_HANDLE;
+    pyramidLevels = 0;
+    pyramidBuilt = false;
+}
+
+void GpuCulling::setEnabled(bool frustum, bool occlusion) {
+    frustumEnabled = frustum;
+    occlusionEnabled = occlusion;
+}
+
+// Planes of the frustum from a view projection matrix, for 0 to 1 depth
+void GpuCulling::extractFrustumPlanes(const glm::mat4& viewProj,
+                                      glm::vec4 planes[6]) {
+    glm::mat4 rows = glm::transpose(viewProj);
+    planes[0] = rows[3] + rows[0];  // left
+    planes[1] = rows[3] - rows[0];  // right
+    planes[2] = rows[3] + rows[1];  // bottom
+    planes[3] = rows[3] - rows[1];  // top
+    planes[4] = rows[2];            // near
+    planes[5] = rows[3] - rows[2];  // far
+    for (int i = 0; i < 6; i++) {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+// Collect the counters last written in this frame slot, then set up the
+// frame's draws and parameters
+void GpuCulling::beginFrame(
+    uint32_t frame, const GpuCullingFrame& params,
+    const std::vector<VkDrawIndexedIndirectCommand>& draws) {
+    PROFILE_FUNCTION();
+    if (draws.size() > maxDraws || params.instanceCount > maxInstances) {
+        debugger.consoleMessage("Too many draws for the culling buffers!",
+                                true);
+    }
+    currentFrame = frame;
+
+    // The fence for this slot has signalled, so its results are final
+    auto* lastDraws = static_cast<const VkDrawIndexedIndirectCommand*>(
+        drawBuffers[frame].mapped);
+    auto* lastCounters =
+        static_cast<const CullCounters*>(counterBuffers[frame].mapped);
+    if (frameDrawCounts[frame] > 0) {
+        stats.testedInstances = frameInstanceCounts[frame];
+        stats.visibleInstances = 0;
+        stats.visibleTriangles = 0;
+        for (uint32_t i = 0; i < frameDrawCounts[frame]; i++) {
+            stats.visibleInstances += lastDraws[i].instanceCount;
+            stats.visibleTriangles +=
+                static_cast<uint64_t>(lastDraws[i].indexCount / 3) *
+                lastDraws[i].instanceCount;
+        }
+        stats.frustumCulled = lastCounters->frustumCulled;
+        stats.occlusionCulled = lastCounters->occlusionCulled;
+    }
+
+    // The cull pass counts the instances up from zero
+    auto* frameDraws =
+        static_cast<VkDrawIndexedIndirectCommand*>(drawBuffers[frame].mapped);
+    for (size_t i = 0; i < draws.size(); i++) {
+        frameDraws[i] = draws[i];
+        frameDraws[i].instanceCount = 0;
+    }
+    memset(counterBuffers[frame].mapped, 0, sizeof(CullCounters));
+    frameDrawCounts[frame] = static_cast<uint32_t>(draws.size());
+    frameInstanceCounts[frame] = params.instanceCount;
+
+    CullParams cullParams{};
+    cullParams.previousView = pyramidViewMatrix;
+    cullParams.previousProj = pyramidProjMatrix;
+    extractFrustumPlanes(params.proj * params.view, cullParams.frustumPlanes);
+    cullParams.pyramidSize =
+        glm::vec2(pyramidExtent.width, pyramidExtent.height);
+    cullParams.nearPlane = params.nearPlane;
+    cullParams.instanceCount = params.instanceCount;
+    cullParams.pyramidLevels =
+        occlusionEnabled && pyramidBuilt ? pyramidLevels : 0;
+    cullParams.frustumEnabled = frustumEnabled ? 1 : 0;
+    cullParams.pyramidViewport =
+        glm::vec2(pyramidViewport.width, pyramidViewport.height);
+    memcpy(paramBuffers[frame].mapped, &cullParams, sizeof(cullParams));
+
+    frameView = params.view;
+    frameProj = params.proj;
+    frameViewport = params.viewport.width > 0 ? params.viewport : pyramidExtent;
+
+    DescriptorBindings bindings;
+    bindings
+        .bindBuffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                    paramBuffers[frame].buffer, 0, sizeof(CullParams))
+        .bindBuffer(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    params.transformBuffer, 0, params.transformRange)
+        .bindBuffer(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    params.instanceBuffer, 0, params.instanceRange)
+        .bindBuffer(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    drawBuffers[frame].buffer, 0,
+                    sizeof(VkDrawIndexedIndirectCommand) * maxDraws)
+        .bindBuffer(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    visibleBuffers[frame].buffer, 0, getVisibleBufferSize())
+        .bindBuffer(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    counterBuffers[frame].buffer, 0, sizeof(CullCounters))
+        .bindImage(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, pyramidView,
+                   pyramidSampler, VK_IMAGE_LAYOUT_GENERAL);
+    cullSet = descriptors.getSet(cullSetLayout, bindings);
+}
+
+// Fill the draws and the visible list, before the draws are recorded
+void GpuCulling::recordCull(VkCommandBuffer commandBuffer) {
+    if (!pyramidLayoutReady) {
+        pyramidBarrier(commandBuffer, pyramidImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                       0, VK_ACCESS_SHADER_READ_BIT);
+        pyramidLayoutReady = true;
+    }
+
+    uint32_t instanceCount = frameInstanceCounts[currentFrame];
+    if (instanceCount > 0) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          cullPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                cullPipelineLayout, 0, 1, &cullSet, 0,
+                                nullptr);
+        vkCmdDispatch(commandBuffer,
+                      groupCount(instanceCount, CULL_GROUP_SIZE), 1, 1);
+    }
+
+    // The draws read the counts as indirect arguments and the vertex shader
+    // reads the visible list. The host reads both back once the fence
+    // signals
+    std::array<VkBufferMemoryBarrier, 3> barriers{};
+    VkBuffer buffers[] = {drawBuffers[currentFrame].buffer,
+                          visibleBuffers[currentFrame].buffer,
+                          counterBuffers[currentFrame].buffer};
+    for (size_t i = 0; i < barriers.size(); i++) {
+        barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barriers[i].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                                    VK_ACCESS_SHADER_READ_BIT |
+                                    VK_ACCESS_HOST_READ_BIT;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].buffer = buffers[i];
+        barriers[i].offset = 0;
+        barriers[i].size = VK_WHOLE_SIZE;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                             VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 0, nullptr,
+                         static_cast<uint32_t>(barriers.size()),
+                         barriers.data(), 0, nullptr);
+}
+
+// Rebuild the pyramid from this frame's depth: mip 0 takes the farthest
+// sample of each pixel, every mip above the farthest of the texels it covers
+void GpuCulling::recordPyramid(VkCommandBuffer commandBuffer) {
+    // Everything is overwritten, so the old contents can go. This also waits
+    // for the cull pass that read the previous pyramid
+    pyramidBarrier(commandBuffer, pyramidImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                   VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+    DescriptorBindings reduceBindings;
+    reduceBindings
+        .bindImage(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthView,
+                   pyramidSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        .bindImage(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, pyramidMipViews[0],
+                   VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL);
+    VkDescriptorSet reduceSet =
+        descriptors.getSet(reduceSetLayout, reduceBindings);
+
+    PyramidReduceConstants reduceConstants{
+        static_cast<int32_t>(pyramidExtent.width),
+        static_cast<int32_t>(pyramidExtent.height),
+        static_cast<int32_t>(depthSamples)};
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      depthSamples == VK_SAMPLE_COUNT_1_BIT
+                          ? reducePipeline
+                          : reduceMultisamplePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            reducePipelineLayout, 0, 1, &reduceSet, 0,
+                            nullptr);
+    vkCmdPushConstants(commandBuffer, reducePipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(reduceConstants),
+                       &reduceConstants);
+    vkCmdDispatch(commandBuffer,
+                  groupCount(pyramidExtent.width, PYRAMID_GROUP_SIZE),
+                  groupCount(pyramidExtent.height, PYRAMID_GROUP_SIZE), 1);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      downsamplePipeline);
+    for (uint32_t level = 1; level < pyramidLevels; level++) {
+        pyramidBarrier(commandBuffer, pyramidImage, VK_IMAGE_LAYOUT_GENERAL,
+                       VK_ACCESS_SHADER_WRITE_BIT,
+                       VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        DescriptorBindings downsampleBindings;
+        downsampleBindings
+            .bindImage(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                       pyramidMipViews[level - 1], VK_NULL_HANDLE,
+                       VK_IMAGE_LAYOUT_GENERAL)
+            .bindImage(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                       pyramidMipViews[level], VK_NULL_HANDLE,
+                       VK_IMAGE_LAYOUT_GENERAL);
+        VkDescriptorSet downsampleSet =
+            descriptors.getSet(downsampleSetLayout, downsampleBindings);
+
+        uint32_t sourceWidth =
+            std::max(pyramidExtent.width >> (level - 1), 1u);
+        uint32_t sourceHeight =
+            std::max(pyramidExtent.height >> (level - 1), 1u);
+        uint32_t width = std::max(pyramidExtent.width >> level, 1u);
+        uint32_t height = std::max(pyramidExtent.height >> level, 1u);
+        PyramidDownsampleConstants constants{
+            static_cast<int32_t>(sourceWidth),
+            static_cast<int32_t>(sourceHeight), static_cast<int32_t>(width),
+            static_cast<int32_t>(height)};
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                downsamplePipelineLayout, 0, 1,
+                                &downsampleSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, downsamplePipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                           &constants);
+        vkCmdDispatch(commandBuffer, groupCount(width, PYRAMID_GROUP_SIZE),
+                      groupCount(height, PYRAMID_GROUP_SIZE), 1);
+    }
+
+    // Next frame's cull pass samples it
+    pyramidBarrier(commandBuffer, pyramidImage, VK_IMAGE_LAYOUT_GENERAL,
+                   VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+    pyramidBuilt = true;
+    pyramidViewMatrix = frameView;
+    pyramidProjMatrix = frameProj;
+    pyramidViewport = frameViewport;
+}
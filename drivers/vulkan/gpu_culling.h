@@ -0,0 +1,208 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "descriptor_allocator.h"
+#include "vulkan_result.h"
+
+// Results of the last frame whose culling pass has finished. Like GPU
+// timings they trail the CPU by the number of frames in flight
+struct GpuCullingStats {
+    uint32_t testedInstances = 0;
+    uint32_t visibleInstances = 0;
+    uint32_t frustumCulled = 0;
+    uint32_t occlusionCulled = 0;
+    uint64_t visibleTriangles = 0;
+};
+
+// Compiled compute shaders, only needed while the pipelines are created
+struct GpuCullingShaders {
+    VkShaderModule cull = VK_NULL_HANDLE;
+    VkShaderModule depthReduce = VK_NULL_HANDLE;
+    VkShaderModule depthReduceMultisample = VK_NULL_HANDLE;
+    VkShaderModule downsample = VK_NULL_HANDLE;
+};
+
+// Per frame inputs, the buffers belong to the caller and must hold the
+// frame's model matrices and instances by the time the work is submitted
+struct GpuCullingFrame {
+    glm::mat4 view;
+    glm::mat4 proj;
+    float nearPlane = 0.0f;
+    VkBuffer transformBuffer = VK_NULL_HANDLE;
+    VkDeviceSize transformRange = 0;
+    VkBuffer instanceBuffer = VK_NULL_HANDLE;
+    VkDeviceSize instanceRange = 0;
+    uint32_t instanceCount = 0;
+    // Part of the depth attachment the frame renders to, from the top left
+    // corner. Zero for all of it
+    VkExtent2D viewport{};
+};
+
+// Culls instances on the GPU before the main pass. A compute pass tests every
+// instance's bounding sphere against the view frustum and against a
+// hierarchical depth pyramid built from the previous frame's depth buffer,
+// then appends the survivors to a compacted visible list and bumps the
+// instance count of their indirect draw. The pyramid trails by one frame, so
+// an object that just came out from behind something can be missing for a
+// frame
+class GpuCulling {
+   public:
+    void init(VkDevice device, VulkanRecovery* recovery,
+              const GpuCullingShaders& shaders);
+    void cleanup();
+
+    // Indirect draws, visible lists and counters, one set per frame in flight
+    void createFrameResources(uint32_t framesInFlight, uint32_t maxInstances,
+                              uint32_t maxDraws);
+    void cleanupFrameResources();
+
+    // Size the pyramid to the depth attachment. The depth image needs
+    // VK_IMAGE_USAGE_SAMPLED_BIT, call again whenever it is recreated
+    void createPyramid(VkExtent2D extent, VkImageView depthView,
+                       VkSampleCountFlagBits samples);
+    void cleanupPyramid();
+
+    // Frustum culling on its own still skips off screen objects. Turning
+    // both off draws everything, which is handy for comparing
+    void setEnabled(bool frustum, bool occlusion);
+
+    // Collect the counters last written in this frame slot, then write the
+    // frame's draws with zero instances and the culling parameters. The
+    // frame's fence must have signalled
+    void beginFrame(uint32_t frame, const GpuCullingFrame& params,
+                    const std::vector<VkDrawIndexedIndirectCommand>& draws);
+
+    // Fill the draws and the visible list. Record before the draws
+    void recordCull(VkCommandBuffer commandBuffer);
+    // Rebuild the pyramid from this frame's depth, which must already be in
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Record after the last pass
+    // that writes depth
+    void recordPyramid(VkCommandBuffer commandBuffer);
+
+    // Indexed like the draws handed to beginFrame
+    VkBuffer getDrawBuffer(uint32_t frame) const {
+        return drawBuffers[frame].buffer;
+    }
+    // Instance indices in draw order, the vertex shader looks these up
+    // through gl_InstanceIndex
+    VkBuffer getVisibleBuffer(uint32_t frame) const {
+        return visibleBuffers[frame].buffer;
+    }
+    VkDeviceSize getVisibleBufferSize() const {
+        return sizeof(uint32_t) * maxInstances;
+    }
+
+    const GpuCullingStats& getStats() const { return stats; }
+
+   private:
+    // Matches CullParams in cull.comp with std140 layout
+    struct CullParams {
+        glm::mat4 previousView;
+        glm::mat4 previousProj;
+        glm::vec4 frustumPlanes[6];
+        glm::vec2 pyramidSize;
+        float nearPlane;
+        uint32_t instanceCount;
+        // 0 when there is no pyramid from the last frame to test against
+        uint32_t pyramidLevels;
+        uint32_t frustumEnabled;
+        glm::vec2 pyramidViewport;
+    };
+
+    // Matches CullCounters in cull.comp
+    struct CullCounters {
+        uint32_t frustumCulled;
+        uint32_t occlusionCulled;
+    };
+
+    // Host visible buffer, mapped for its whole life
+    struct MappedBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+    };
+
+    void createLayouts();
+    void createPipelines(const GpuCullingShaders& shaders);
+    VkPipeline createComputePipeline(VkShaderModule module,
+                                     VkPipelineLayout layout);
+    MappedBuffer createMappedBuffer(VkDeviceSize size,
+                                    VkBufferUsageFlags usage);
+    void destroyMappedBuffer(MappedBuffer& buffer);
+    // Planes of the frustum from a view projection matrix, normalized so
+    // distances come out in world units
+    static void extractFrustumPlanes(const glm::mat4& viewProj,
+                                     glm::vec4 planes[6]);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    VulkanRecovery* recovery = nullptr;
+
+    VkDescriptorSetLayout cullSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout reduceSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout downsampleSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+    VkPipelineLayout reducePipelineLayout = VK_NULL_HANDLE;
+    VkPipelineLayout downsamplePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline cullPipeline = VK_NULL_HANDLE;
+    VkPipeline reducePipeline = VK_NULL_HANDLE;
+    VkPipeline reduceMultisamplePipeline = VK_NULL_HANDLE;
+    VkPipeline downsamplePipeline = VK_NULL_HANDLE;
+
+    // Sets are looked up every frame and cached, a reset drops them all
+    DescriptorAllocator descriptors;
+
+    uint32_t framesInFlight = 0;
+    uint32_t maxInstances = 0;
+    uint32_t maxDraws = 0;
+    std::vector<MappedBuffer> paramBuffers;
+    std::vector<MappedBuffer> drawBuffers;
+    std::vector<MappedBuffer> visibleBuffers;
+    std::vector<MappedBuffer> counterBuffers;
+    // Draws written in each slot, so their results can be read back
+    std::vector<uint32_t> frameDrawCounts;
+    std::vector<uint32_t> frameInstanceCounts;
+    uint32_t currentFrame = 0;
+    // Looked up in beginFrame for the frame being recorded
+    VkDescriptorSet cullSet = VK_NULL_HANDLE;
+
+    // Max depth pyramid, R32 with a full chain of mips. Mip 0 matches the
+    // depth attachment, every texel above covers the texels below it
+    VkImage pyramidImage = VK_NULL_HANDLE;
+    VkDeviceMemory pyramidMemory = VK_NULL_HANDLE;
+    VkImageView pyramidView = VK_NULL_HANDLE;
+    std::vector<VkImageView> pyramidMipViews;
+    VkSampler pyramidSampler = VK_NULL_HANDLE;
+    VkExtent2D pyramidExtent{};
+    uint32_t pyramidLevels = 0;
+    VkImageView depthView = VK_NULL_HANDLE;
+    VkSampleCountFlagBits depthSamples = VK_SAMPLE_COUNT_1_BIT;
+    // The pyramid starts out undefined and must be moved to GENERAL before
+    // the cull pass may bind it
+    bool pyramidLayoutReady = false;
+    // Set once a pyramid has been built, along with the matrices it was
+    // rendered with
+    bool pyramidBuilt = false;
+    glm::mat4 pyramidViewMatrix = glm::mat4(1.0f);
+    glm::mat4 pyramidProjMatrix = glm::mat4(1.0f);
+    // Part of mip 0 holding that frame's depth, the rest is stale
+    VkExtent2D pyramidViewport{};
+    // Camera of the frame being recorded, the next pyramid is built with it
+    glm::mat4 frameView = glm::mat4(1.0f);
+    glm::mat4 frameProj = glm::mat4(1.0f);
+    VkExtent2D frameViewport{};
+
+    bool frustumEnabled = true;
+    bool occlusionEnabled = true;
+
+    GpuCullingStats stats;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include "gpu_profiler.h"
+
+#include <cstdio>
+
+#include "vulkan_result.h"
+
+// Queries available to each frame in flight
+const uint32_t MAX_TIMESTAMPS_PER_FRAME = 256;
+const uint32_t MAX_STATISTICS_PER_FRAME = 64;
+
+// Number of frames kept for the rolling history
+const size_t HISTORY_SIZE = 120;
+
+const VkQueryPipelineStatisticFlags PIPELINE_STATISTICS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+// Values per statistics query, in the bit order of PIPELINE_STATISTICS
+const uint32_t PIPELINE_STATISTIC_COUNT = 6;
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice,
+                       uint32_t queueFamilyIndex, uint32_t framesInFlight,
+                       bool pipelineStatistics) {
+    debugger.consoleMessage("\nBegin creating GPU profiler...", false);
+    this->device = device;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                             queueFamilies.data());
+    uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+
+    if (!properties.limits.timestampComputeAndGraphics || validBits == 0) {
+        debugger.consoleMessage(
+            "Timestamps not supported, GPU profiler disabled", false);
+        return;
+    }
+
+    enabled = true;
+    statisticsEnabled = pipelineStatistics;
+    timestampPeriod = properties.limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    frames.resize(framesInFlight);
+    for (auto& frame : frames) {
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = MAX_TIMESTAMPS_PER_FRAME;
+
+        checkVulkanResult(vkCreateQueryPool(device, &poolInfo, nullptr,
+                                            &frame.timestampPool),
+                          "create timestamp query pool");
+
+        if (statisticsEnabled) {
+            poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            poolInfo.queryCount = MAX_STATISTICS_PER_FRAME;
+            poolInfo.pipelineStatistics = PIPELINE_STATISTICS;
+
+            checkVulkanResult(vkCreateQueryPool(device, &poolInfo, nullptr,
+                                                &frame.statisticsPool),
+                              "create pipeline statistics query pool");
+        }
+    }
+    debugger.consoleMessage("Successfully created GPU profiler", false);
+}
+
+void GpuProfiler::cleanup() {
+    for (auto& frame : frames) {
+        vkDestroyQueryPool(device, frame.timestampPool, nullptr);
+        if (frame.statisticsPool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(device, frame.statisticsPool, nullptr);
+        }
+    }
+    frames.clear();
+    debugger.consoleMessage("Destroyed GPU profiler query pools", false);
+}
+
+// Collect the results last recorded in this frame slot, then reset its
+// queries. Call right after the command buffer begins
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer,
+                             uint32_t frameIndex) {
+    if (!enabled) return;
+    currentFrame = frameIndex;
+    FrameQueries& frame = frames[currentFrame];
+
+    if (frame.recorded) {
+        collect(frame);
+    }
+
+    vkCmdResetQueryPool(commandBuffer, frame.timestampPool, 0,
+                        MAX_TIMESTAMPS_PER_FRAME);
+    if (frame.statisticsPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, frame.statisticsPool, 0,
+                            MAX_STATISTICS_PER_FRAME);
+    }
+
+    frame.timestampCount = 0;
+    frame.statisticsCount = 0;
+    frame.regions.clear();
+    frame.open.clear();
+    frame.recorded = false;
+
+    frame.frameBeginQuery = nextTimestamp(frame);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        frame.timestampPool, frame.frameBeginQuery);
+}
+
+// Close the whole frame region. Call before the command buffer ends
+void GpuProfiler::endFrame(VkCommandBuffer commandBuffer) {
+    if (!enabled) return;
+    FrameQueries& frame = frames[currentFrame];
+
+    while (!frame.open.empty()) {
+        debugger.consoleMessage(
+            ("GPU profiler region " + frame.regions[frame.open.back()].name +
+             " was never ended")
+                .c_str(),
+            false);
+        endRegion(commandBuffer);
+    }
+
+    frame.frameEndQuery = nextTimestamp(frame);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        frame.timestampPool, frame.frameEndQuery);
+    frame.recorded = true;
+}
+
+// Regions can nest. Pipeline statistics are only gathered for top level
+// regions, since those queries cannot overlap
+void GpuProfiler::beginRegion(VkCommandBuffer commandBuffer,
+                              const std::string& name) {
+    if (!enabled) return;
+    FrameQueries& frame = frames[currentFrame];
+
+    RecordedRegion region;
+    region.name = name;
+    region.depth = static_cast<uint32_t>(frame.open.size());
+    region.beginQuery = nextTimestamp(frame);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        frame.timestampPool, region.beginQuery);
+
+    if (frame.statisticsPool != VK_NULL_HANDLE && region.depth == 0 &&
+        frame.statisticsCount < MAX_STATISTICS_PER_FRAME) {
+        region.statisticsQuery = frame.statisticsCount++;
+        vkCmdBeginQuery(commandBuffer, frame.statisticsPool,
+                        region.statisticsQuery, 0);
+    }
+
+    frame.open.push_back(frame.regions.size());
+    frame.regions.push_back(region);
+}
+
+void GpuProfiler::endRegion(VkCommandBuffer commandBuffer) {
+    if (!enabled) return;
+    FrameQueries& frame = frames[currentFrame];
+    if (frame.open.empty()) {
+        debugger.consoleMessage("GPU profiler region ended twice!", true);
+    }
+
+    RecordedRegion& region = frame.regions[frame.open.back()];
+    frame.open.pop_back();
+
+    if (region.statisticsQuery >= 0) {
+        vkCmdEndQuery(commandBuffer, frame.statisticsPool,
+                      region.statisticsQuery);
+    }
+    region.endQuery = nextTimestamp(frame);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        frame.timestampPool, region.endQuery);
+}
+
+uint32_t GpuProfiler::nextTimestamp(FrameQueries& frame) {
+    if (frame.timestampCount >= MAX_TIMESTAMPS_PER_FRAME) {
+        debugger.consoleMessage("GPU profiler ran out of timestamp queries!",
+                                true);
+    }
+    return frame.timestampCount++;
+}
+
+// Read the results of a frame slot that has finished on the GPU
+void GpuProfiler::collect(FrameQueries& frame) {
+    std::vector<uint64_t> timestamps(frame.timestampCount);
+    if (vkGetQueryPoolResults(device, frame.timestampPool, 0,
+                              frame.timestampCount,
+                              timestamps.size() * sizeof(uint64_t),
+                              timestamps.data(), sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    std::vector<uint64_t> statistics(frame.statisticsCount *
+                                     PIPELINE_STATISTIC_COUNT);
+    bool haveStatistics =
+        frame.statisticsCount > 0 &&
+        vkGetQueryPoolResults(
+            device, frame.statisticsPool, 0, frame.statisticsCount,
+            statistics.size() * sizeof(uint64_t), statistics.data(),
+            PIPELINE_STATISTIC_COUNT * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT) == VK_SUCCESS;
+
+    auto toMs = [&](uint32_t begin, uint32_t end) {
+        uint64_t ticks =
+            (timestamps[end] - timestamps[begin]) & timestampMask;
+        return ticks * timestampPeriod / 1000000.0;
+    };
+
+    auto pushHistory = [](std::deque<double>& samples, double value) {
+        samples.push_back(value);
+        if (samples.size() > HISTORY_SIZE) {
+            samples.pop_front();
+        }
+        double sum = 0.0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        return sum / samples.size();
+    };
+
+    frameTimeMs = toMs(frame.frameBeginQuery, frame.frameEndQuery);
+    pushHistory(history, frameTimeMs);
+
+    regions.clear();
+    for (const auto& recorded : frame.regions) {
+        GpuRegionTiming timing;
+        timing.name = recorded.name;
+        timing.depth = recorded.depth;
+        timing.timeMs = toMs(recorded.beginQuery, recorded.endQuery);
+        timing.averageMs =
+            pushHistory(regionHistory[recorded.name], timing.timeMs);
+
+        if (haveStatistics && recorded.statisticsQuery >= 0) {
+            const uint64_t* values =
+                &statistics[recorded.statisticsQuery * PIPELINE_STATISTIC_COUNT];
+            timing.hasStatistics = true;
+            timing.statistics.inputAssemblyVertices = values[0];
+            timing.statistics.inputAssemblyPrimitives = values[1];
+            timing.statistics.vertexShaderInvocations = values[2];
+            timing.statistics.clippingPrimitives = values[3];
+            timing.statistics.fragmentShaderInvocations = values[4];
+            timing.statistics.computeShaderInvocations = values[5];
+        }
+        regions.push_back(timing);
+    }
+}
+
+double GpuProfiler::getAverageFrameTime() const {
+    if (history.empty()) return 0.0;
+    double sum = 0.0;
+    for (double sample : history) {
+        sum += sample;
+    }
+    return sum / history.size();
+}
+
+// Human readable breakdown of the last frame
+std::string GpuProfiler::getReport() const {
+    if (!enabled) return "GPU profiler disabled";
+
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "GPU frame %.3f ms (avg %.3f ms over %zu frames)",
+                  frameTimeMs, getAverageFrameTime(), history.size());
+    std::string report = line;
+
+    for (const auto& region : regions) {
+        std::snprintf(line, sizeof(line), "\n%*s%-24s %8.3f ms (avg %.3f ms)",
+                      region.depth * 2 + 2, "", region.name.c_str(),
+                      region.timeMs, region.averageMs);
+        report += line;
+        if (region.hasStatistics) {
+            std::snprintf(
+                line, sizeof(line),
+                "\n%*s  verts %llu, prims %llu, clipped %llu, vs %llu, "
+                "fs %llu, cs %llu",
+                region.depth * 2 + 2, "",
+                (unsigned long long)region.statistics.inputAssemblyVertices,
+                (unsigned long long)region.statistics.inputAssemblyPrimitives,
+                (unsigned long long)region.statistics.clippingPrimitives,
+                (unsigned long long)region.statistics.vertexShaderInvocations,
+                (unsigned long long)region.statistics.fragmentShaderInvocations,
+                (unsigned long long)region.statistics.computeShaderInvocations);
+            report += line;
+        }
+    }
+    return report;
+}
@@ -0,0 +1,117 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+
+// Pipeline statistics gathered per region when enabled
+struct GpuPipelineStatistics {
+    uint64_t inputAssemblyVertices = 0;
+    uint64_t inputAssemblyPrimitives = 0;
+    uint64_t vertexShaderInvocations = 0;
+    uint64_t clippingPrimitives = 0;
+    uint64_t fragmentShaderInvocations = 0;
+    uint64_t computeShaderInvocations = 0;
+};
+
+// Timing of one profiled region from the last frame that has results
+struct GpuRegionTiming {
+    std::string name;
+    // Nesting depth, 0 for top level regions
+    uint32_t depth = 0;
+    double timeMs = 0.0;
+    // Average over the rolling history window
+    double averageMs = 0.0;
+    bool hasStatistics = false;
+    GpuPipelineStatistics statistics;
+};
+
+// Times regions of a command buffer with timestamp query pairs. Every frame
+// in flight has its own query pools, and a frame's results are read when its
+// slot comes around again, after its fence has signalled, so reading never
+// stalls the GPU
+class GpuProfiler {
+   public:
+    // pipelineStatistics needs the pipelineStatisticsQuery device feature
+    void init(VkDevice device, VkPhysicalDevice physicalDevice,
+              uint32_t queueFamilyIndex, uint32_t framesInFlight,
+              bool pipelineStatistics);
+    void cleanup();
+
+    // Collect the results last recorded in this frame slot, then reset its
+    // queries. Call right after the command buffer begins
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    // Close the whole frame region. Call before the command buffer ends
+    void endFrame(VkCommandBuffer commandBuffer);
+
+    // Regions can nest. Pipeline statistics are only gathered for top level
+    // regions, since those queries cannot overlap
+    void beginRegion(VkCommandBuffer commandBuffer, const std::string& name);
+    void endRegion(VkCommandBuffer commandBuffer);
+
+    bool isEnabled() const { return enabled; }
+
+    // Whole frame GPU time of the last frame with results
+    double getFrameTime() const { return frameTimeMs; }
+    // Per region breakdown of the last frame with results
+    const std::vector<GpuRegionTiming>& getRegions() const { return regions; }
+    // Whole frame GPU times, oldest first
+    const std::deque<double>& getHistory() const { return history; }
+    double getAverageFrameTime() const;
+
+    // Human readable breakdown of the last frame
+    std::string getReport() const;
+
+   private:
+    struct RecordedRegion {
+        std::string name;
+        uint32_t depth;
+        uint32_t beginQuery;
+        uint32_t endQuery = 0;
+        // Index into the statistics pool, or -1 if none
+        int32_t statisticsQuery = -1;
+    };
+
+    struct FrameQueries {
+        VkQueryPool timestampPool = VK_NULL_HANDLE;
+        VkQueryPool statisticsPool = VK_NULL_HANDLE;
+        uint32_t timestampCount = 0;
+        uint32_t statisticsCount = 0;
+        std::vector<RecordedRegion> regions;
+        // Stack of open regions, indices into regions
+        std::vector<size_t> open;
+        // Timestamps bracketing the whole frame
+        uint32_t frameBeginQuery = 0;
+        uint32_t frameEndQuery = 0;
+        bool recorded = false;
+    };
+
+    // Read the results of a frame slot that has finished on the GPU
+    void collect(FrameQueries& frame);
+    uint32_t nextTimestamp(FrameQueries& frame);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    bool enabled = false;
+    bool statisticsEnabled = false;
+    float timestampPeriod = 1.0f;
+    // Bits of the timestamp that are valid, the rest must be masked off
+    uint64_t timestampMask = ~0ull;
+
+    std::vector<FrameQueries> frames;
+    uint32_t currentFrame = 0;
+
+    double frameTimeMs = 0.0;
+    std::vector<GpuRegionTiming> regions;
+    std::deque<double> history;
+    std::unordered_map<std::string, std::deque<double>> regionHistory;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef POST_PROCESS_PASS_H
+#define POST_PROCESS_PASS_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "descriptor_allocator.h"
+
+// A full screen triangle filtering one sampled input image into a color
+// attachment, such as FXAA or upscaling. The fragment shader reads the input
+// at binding 0 and gets its parameters as push constants
+class PostProcessPass {
+   public:
+    // Pipeline for writing images of outputFormat. The shader modules are
+    // only needed during the call
+    void init(VkDevice device, const std::string& name, VkFormat outputFormat,
+              VkShaderModule vertexShader, VkShaderModule fragmentShader,
+              uint32_t pushConstantSize);
+    void cleanup();
+
+    // Framebuffers for every output image and the set sampling the input.
+    // Call again whenever either is recreated
+    void createTargets(VkExtent2D extent, VkImageView input,
+                       const std::vector<VkImageView>& outputs);
+    void cleanupTargets();
+
+    // Cover the top left viewport of the output. The input must be in
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and the output in
+    // VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    void record(VkCommandBuffer commandBuffer, uint32_t outputIndex,
+                VkExtent2D viewport, const void* pushConstants);
+
+   private:
+    void createRenderPass(VkFormat outputFormat);
+    void createPipeline(VkShaderModule vertexShader,
+                        VkShaderModule fragmentShader);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    std::string name;
+    uint32_t pushConstantSize = 0;
+
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkSampler sampler = VK_NULL_HANDLE;
+
+    // Reset along with the targets
+    DescriptorAllocator descriptors;
+    VkDescriptorSet inputSet = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> framebuffers;
+    VkExtent2D extent{};
+};
+
+#endif
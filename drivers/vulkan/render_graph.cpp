@@ -0,0 +1,614 @@
+#include "render_graph.h"
+
+#include <algorithm>
+
+#include "core/debugger/profiler.h"
+
+RenderGraph::PassBuilder::PassBuilder(RenderGraph* graph, uint32_t passIndex)
+    : graph(graph), passIndex(passIndex) {}
+
+// Declare that the pass reads an image
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(
+    RenderGraphHandle handle, RenderGraphAccess access) {
+    graph->passes[passIndex].uses.push_back({handle, access});
+    return *this;
+}
+
+// Declare that the pass writes an image
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(
+    RenderGraphHandle handle, RenderGraphAccess access) {
+    graph->passes[passIndex].uses.push_back({handle, access});
+    return *this;
+}
+
+// Never cull this pass, even if nothing reads its output
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffect() {
+    graph->passes[passIndex].sideEffect = true;
+    return *this;
+}
+
+// The commands recorded for this pass
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::execute(
+    std::function<void(VkCommandBuffer)> callback) {
+    graph->passes[passIndex].callback = std::move(callback);
+    return *this;
+}
+
+void RenderGraph::init(VkDevice device, VkPhysicalDevice physicalDevice) {
+    this->device = device;
+    this->physicalDevice = physicalDevice;
+}
+
+RenderGraph::AccessInfo RenderGraph::getAccessInfo(RenderGraphAccess access) {
+    switch (access) {
+        case RenderGraphAccess::ColorAttachmentWrite:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true};
+        case RenderGraphAccess::DepthAttachmentWrite:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true};
+        case RenderGraphAccess::DepthAttachmentRead:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false};
+        case RenderGraphAccess::FragmentSampledRead:
+            return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false};
+        case RenderGraphAccess::ComputeSampledRead:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false};
+        case RenderGraphAccess::ComputeStorageRead:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false};
+        case RenderGraphAccess::ComputeStorageWrite:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL, true};
+        case RenderGraphAccess::TransferRead:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false};
+        case RenderGraphAccess::TransferWrite:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true};
+    }
+    return {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, VK_IMAGE_LAYOUT_GENERAL,
+            true};
+}
+
+// Create an image owned by the graph. Memory is allocated on compile
+RenderGraphHandle RenderGraph::createImage(const std::string& name,
+                                           const RenderGraphImageDesc& desc) {
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resources.push_back(resource);
+    return static_cast<RenderGraphHandle>(resources.size() - 1);
+}
+
+// Bring in an image the graph does not own, such as a swapchain image
+RenderGraphHandle RenderGraph::importImage(const std::string& name,
+                                           VkImage image,
+                                           VkImageView imageView,
+                                           VkImageAspectFlags aspect,
+                                           VkImageLayout initialLayout,
+                                           VkImageLayout finalLayout) {
+    Resource resource;
+    resource.name = name;
+    resource.desc.aspect = aspect;
+    resource.imported = true;
+    resource.image = image;
+    resource.imageView = imageView;
+    resource.initialLayout = initialLayout;
+    resource.finalLayout = finalLayout;
+    resources.push_back(resource);
+    return static_cast<RenderGraphHandle>(resources.size() - 1);
+}
+
+// Swap the image behind an imported handle
+void RenderGraph::setImportedImage(RenderGraphHandle handle, VkImage image,
+                                   VkImageView imageView) {
+    resources[handle].image = image;
+    resources[handle].imageView = imageView;
+}
+
+// Add a pass. Passes run in the order they are added
+RenderGraph::PassBuilder RenderGraph::addPass(const std::string& name) {
+    Pass pass;
+    pass.name = name;
+    passes.push_back(pass);
+    return PassBuilder(this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+// Cull unused passes, compute barriers and allocate owned images
+void RenderGraph::compile() {
+    PROFILE_FUNCTION();
+    debugger.consoleMessage("\nBegin compiling render graph...", false);
+    stats = {};
+    stats.passCount = static_cast<uint32_t>(passes.size());
+
+    cullPasses();
+    computeLifetimes();
+    allocateImages();
+    computeBarriers();
+
+    std::string summary =
+        "Render graph: " +
+        std::to_string(stats.passCount - stats.culledPassCount) + "/" +
+        std::to_string(stats.passCount) + " passes, " +
+        std::to_string(stats.barrierCount) + " barriers, " +
+        std::to_string(stats.allocatedMemory / 1024) + " KiB allocated for " +
+        std::to_string(stats.requestedMemory / 1024) + " KiB of images";
+    debugger.consoleMessage(summary.c_str(), false);
+    debugger.consoleMessage("Successfully compiled render graph", false);
+}
+
+// Walk the passes backwards, keeping only those whose writes are read by a
+// later surviving pass or reach an imported or persistent image
+void RenderGraph::cullPasses() {
+    std::vector<bool> needed(resources.size(), false);
+    for (size_t i = 0; i < resources.size(); i++) {
+        needed[i] = resources[i].imported || !resources[i].desc.transient;
+    }
+
+    for (size_t p = passes.size(); p-- > 0;) {
+        Pass& pass = passes[p];
+        bool keep = pass.sideEffect;
+        for (const auto& use : pass.uses) {
+            if (getAccessInfo(use.access).isWrite && needed[use.handle]) {
+                keep = true;
+            }
+        }
+
+        pass.culled = !keep;
+        if (pass.culled) {
+            stats.culledPassCount++;
+            debugger.consoleMessage(("Culled render pass " + pass.name).c_str(),
+                                    false);
+            continue;
+        }
+
+        // Anything written here without being read does not need an earlier
+        // producer, but anything read here does
+        for (const auto& use : pass.uses) {
+            if (getAccessInfo(use.access).isWrite) {
+                needed[use.handle] = false;
+            }
+        }
+        for (const auto& use : pass.uses) {
+            if (!getAccessInfo(use.access).isWrite) {
+                needed[use.handle] = true;
+            }
+        }
+    }
+}
+
+void RenderGraph::computeLifetimes() {
+    for (auto& resource : resources) {
+        resource.firstPass = -1;
+        resource.lastPass = -1;
+    }
+    for (size_t p = 0; p < passes.size(); p++) {
+        if (passes[p].culled) continue;
+        for (const auto& use : passes[p].uses) {
+            Resource& resource = resources[use.handle];
+            if (resource.firstPass < 0) {
+                resource.firstPass = static_cast<int32_t>(p);
+            }
+            resource.lastPass = static_cast<int32_t>(p);
+        }
+    }
+}
+
+// Create the owned images and place them in memory blocks. Transient images
+// whose lifetimes do not overlap share a block
+void RenderGraph::allocateImages() {
+    std::vector<RenderGraphHandle> owned;
+    std::vector<VkMemoryRequirements> requirements(resources.size());
+
+    for (size_t i = 0; i < resources.size(); i++) {
+        Resource& resource = resources[i];
+        if (resource.imported || resource.firstPass < 0) continue;
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = resource.desc.width;
+        imageInfo.extent.height = resource.desc.height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = resource.desc.format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = resource.desc.usage;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.samples = resource.desc.samples;
+
+        checkVulkanResult(vkCreateImage(device, &imageInfo, nullptr,
+                                        &resource.image),
+                          "create render graph image");
+
+        vkGetImageMemoryRequirements(device, resource.image, &requirements[i]);
+        stats.requestedMemory += requirements[i].size;
+        owned.push_back(static_cast<RenderGraphHandle>(i));
+    }
+
+    // Place the biggest images first so smaller ones fit into their blocks
+    std::sort(owned.begin(), owned.end(),
+              [&](RenderGraphHandle a, RenderGraphHandle b) {
+                  return requirements[a].size > requirements[b].size;
+              });
+
+    for (RenderGraphHandle handle : owned) {
+        Resource& resource = resources[handle];
+        const VkMemoryRequirements& req = requirements[handle];
+
+        int32_t chosen = -1;
+        if (resource.desc.transient) {
+            for (size_t b = 0; b < memoryBlocks.size() && chosen < 0; b++) {
+                MemoryBlock& block = memoryBlocks[b];
+                if ((block.memoryTypeBits & req.memoryTypeBits) == 0) continue;
+
+                bool overlaps = false;
+                for (RenderGraphHandle resident : block.residents) {
+                    const Resource& other = resources[resident];
+                    if (!other.desc.transient ||
+                        (resource.firstPass <= other.lastPass &&
+                         other.firstPass <= resource.lastPass)) {
+                        overlaps = true;
+                        break;
+                    }
+                }
+                if (!overlaps) {
+                    chosen = static_cast<int32_t>(b);
+                }
+            }
+        }
+
+        if (chosen < 0) {
+            MemoryBlock block;
+            block.memoryTypeBits = req.memoryTypeBits;
+            memoryBlocks.push_back(block);
+            chosen = static_cast<int32_t>(memoryBlocks.size() - 1);
+        }
+
+        MemoryBlock& block = memoryBlocks[chosen];
+        block.size = std::max(block.size, req.size);
+        block.memoryTypeBits &= req.memoryTypeBits;
+        block.residents.push_back(handle);
+        resource.memoryBlock = chosen;
+    }
+
+    for (auto& block : memoryBlocks) {
+        if (recovery) {
+            checkVulkanResult(
+                recovery->allocateMemory(block.size, block.memoryTypeBits,
+                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                         block.memory),
+                "allocate render graph image memory");
+        } else {
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = block.size;
+            allocInfo.memoryTypeIndex = findMemoryType(
+                block.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+            checkVulkanResult(vkAllocateMemory(device, &allocInfo, nullptr,
+                                               &block.memory),
+                              "allocate render graph image memory");
+        }
+        stats.allocatedMemory += block.size;
+
+        for (RenderGraphHandle handle : block.residents) {
+            Resource& resource = resources[handle];
+            vkBindImageMemory(device, resource.image, block.memory, 0);
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = resource.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = resource.desc.format;
+            viewInfo.subresourceRange.aspectMask = resource.desc.aspect;
+            viewInfo.subresourceRange.baseMipLevel = 0;
+            viewInfo.subresourceRange.levelCount = 1;
+            viewInfo.subresourceRange.baseArrayLayer = 0;
+            viewInfo.subresourceRange.layerCount = 1;
+
+            checkVulkanResult(vkCreateImageView(device, &viewInfo, nullptr,
+                                                &resource.imageView),
+                              "create render graph image view");
+        }
+    }
+}
+
+std::map<RenderGraphHandle, RenderGraph::AccessInfo> RenderGraph::mergeUses(
+    const Pass& pass) {
+    std::map<RenderGraphHandle, AccessInfo> merged;
+    for (const auto& use : pass.uses) {
+        AccessInfo info = getAccessInfo(use.access);
+        auto found = merged.find(use.handle);
+        if (found == merged.end()) {
+            merged.emplace(use.handle, info);
+            continue;
+        }
+        if (found->second.layout != info.layout) {
+            debugger.consoleMessage(("Render pass " + pass.name +
+                                     " uses an image in two different layouts!")
+                                        .c_str(),
+                                    true);
+        }
+        found->second.stage |= info.stage;
+        found->second.access |= info.access;
+        found->second.isWrite |= info.isWrite;
+    }
+    return merged;
+}
+
+// Track the layout and last access of every image through the surviving
+// passes and emit a barrier only where a hazard or layout change occurs
+void RenderGraph::computeBarriers() {
+    struct State {
+        bool touched = false;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags writeStage = 0;
+        VkAccessFlags writeAccess = 0;
+        VkPipelineStageFlags readStages = 0;
+        VkAccessFlags readAccess = 0;
+    };
+    std::vector<State> states(resources.size());
+
+    // How every image is left at the end of the frame. An owned image is
+    // reused next frame, so its first barrier waits on the last user of its
+    // memory, which may be last frame's
+    std::vector<State> endStates(resources.size());
+    for (const auto& pass : passes) {
+        if (pass.culled) continue;
+        for (const auto& [handle, info] : mergeUses(pass)) {
+            State& state = endStates[handle];
+            state.layout = info.layout;
+            if (info.isWrite) {
+                state.writeStage = info.stage;
+                state.writeAccess = info.access;
+                state.readStages = 0;
+            } else {
+                state.readStages |= info.stage;
+            }
+        }
+    }
+
+    for (size_t p = 0; p < passes.size(); p++) {
+        Pass& pass = passes[p];
+        pass.barriers = {};
+        if (pass.culled) continue;
+
+        std::map<RenderGraphHandle, AccessInfo> merged = mergeUses(pass);
+        for (const auto& [handle, info] : merged) {
+            State& state = states[handle];
+            const Resource& resource = resources[handle];
+
+            bool firstUse = !state.touched;
+            if (firstUse) {
+                state.touched = true;
+                if (resource.imported) {
+                    // Whatever used the image before the graph (acquire,
+                    // last frame) must be waited on
+                    state.layout = resource.initialLayout;
+                    state.writeStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                } else {
+                    // Wait for the previous image living in the same memory,
+                    // or the last one to use it if this image comes first
+                    const MemoryBlock& block =
+                        memoryBlocks[resource.memoryBlock];
+                    RenderGraphHandle previous = handle;
+                    int32_t previousLast = -1;
+                    for (RenderGraphHandle resident : block.residents) {
+                        if (resources[resident].lastPass > previousLast) {
+                            previousLast = resources[resident].lastPass;
+                            previous = resident;
+                        }
+                    }
+                    previousLast = -1;
+                    for (RenderGraphHandle resident : block.residents) {
+                        const Resource& other = resources[resident];
+                        if (other.lastPass < resource.firstPass &&
+                            other.lastPass > previousLast) {
+                            previousLast = other.lastPass;
+                            previous = resident;
+                        }
+                    }
+                    state.writeStage = endStates[previous].writeStage |
+                                       endStates[previous].readStages;
+                    state.writeAccess = endStates[previous].writeAccess;
+
+                    // Persistent images keep their contents between frames
+                    if (!resource.desc.transient) {
+                        state.layout = endStates[handle].layout;
+                    }
+                }
+            }
+
+            bool needBarrier = false;
+            VkPipelineStageFlags srcStage = 0;
+            VkAccessFlags srcAccess = 0;
+            VkImageLayout oldLayout = state.layout;
+
+            if (info.isWrite) {
+                needBarrier = state.layout != info.layout ||
+                              state.writeStage != 0 || state.readStages != 0;
+                srcStage = state.writeStage | state.readStages;
+                srcAccess = state.writeAccess;
+                state.writeStage = info.stage;
+                state.writeAccess = info.access;
+                state.readStages = 0;
+                state.readAccess = 0;
+            } else if (state.layout != info.layout) {
+                needBarrier = true;
+                srcStage = state.writeStage | state.readStages;
+                srcAccess = state.writeAccess;
+                state.readStages = info.stage;
+                state.readAccess = info.access;
+            } else if ((info.stage & ~state.readStages) ||
+                       (info.access & ~state.readAccess)) {
+                // Same layout, but this stage has not yet waited on the write
+                needBarrier = state.writeStage != 0;
+                srcStage = state.writeStage;
+                srcAccess = state.writeAccess;
+                state.readStages |= info.stage;
+                state.readAccess |= info.access;
+            }
+            state.layout = info.layout;
+
+            if (needBarrier) {
+                pass.barriers.srcStage |=
+                    srcStage ? srcStage : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                pass.barriers.dstStage |= info.stage;
+                pass.barriers.barriers.push_back(
+                    {handle, oldLayout, info.layout, srcAccess, info.access,
+                     firstUse && !resource.imported &&
+                         !resource.desc.transient});
+                stats.barrierCount++;
+            }
+        }
+    }
+
+    finalBarriers = {};
+    for (size_t i = 0; i < resources.size(); i++) {
+        const Resource& resource = resources[i];
+        const State& state = states[i];
+        if (!resource.imported || !state.touched ||
+            resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED ||
+            resource.finalLayout == state.layout) {
+            continue;
+        }
+        VkPipelineStageFlags srcStage = state.writeStage | state.readStages;
+        finalBarriers.srcStage |=
+            srcStage ? srcStage : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        finalBarriers.dstStage |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        finalBarriers.barriers.push_back(
+            {static_cast<RenderGraphHandle>(i), state.layout,
+             resource.finalLayout, state.writeAccess, 0, false});
+        stats.barrierCount++;
+    }
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer,
+                                 const BarrierBatch& batch) {
+    if (batch.barriers.empty()) return;
+
+    std::vector<VkImageMemoryBarrier> imageBarriers(batch.barriers.size());
+    for (size_t i = 0; i < batch.barriers.size(); i++) {
+        const Barrier& barrier = batch.barriers[i];
+        const Resource& resource = resources[barrier.handle];
+
+        VkImageAspectFlags aspect = resource.desc.aspect;
+        if ((aspect & VK_IMAGE_ASPECT_DEPTH_BIT) &&
+            (resource.desc.format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+             resource.desc.format == VK_FORMAT_D24_UNORM_S8_UINT)) {
+            aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+
+        imageBarriers[i] = {};
+        imageBarriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        // Nothing has been written to a persistent image on its first frame
+        imageBarriers[i].oldLayout =
+            barrier.carriedLayout && !resource.initialized
+                ? VK_IMAGE_LAYOUT_UNDEFINED
+                : barrier.oldLayout;
+        imageBarriers[i].newLayout = barrier.newLayout;
+        imageBarriers[i].srcAccessMask = barrier.srcAccess;
+        imageBarriers[i].dstAccessMask = barrier.dstAccess;
+        imageBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarriers[i].image = resource.image;
+        imageBarriers[i].subresourceRange.aspectMask = aspect;
+        imageBarriers[i].subresourceRange.baseMipLevel = 0;
+        imageBarriers[i].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        imageBarriers[i].subresourceRange.baseArrayLayer = 0;
+        imageBarriers[i].subresourceRange.layerCount =
+            VK_REMAINING_ARRAY_LAYERS;
+    }
+
+    vkCmdPipelineBarrier(commandBuffer, batch.srcStage, batch.dstStage, 0, 0,
+                         nullptr, 0, nullptr,
+                         static_cast<uint32_t>(imageBarriers.size()),
+                         imageBarriers.data());
+}
+
+// Record every surviving pass along with its barriers
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+    for (const auto& pass : passes) {
+        if (pass.culled) continue;
+        PROFILE_ZONE(Profiler::get().internName(pass.name));
+        if (profiler) {
+            profiler->beginRegion(commandBuffer, pass.name);
+        }
+        recordBarriers(commandBuffer, pass.barriers);
+        if (pass.callback) {
+            pass.callback(commandBuffer);
+        }
+        if (profiler) {
+            profiler->endRegion(commandBuffer);
+        }
+    }
+    recordBarriers(commandBuffer, finalBarriers);
+
+    for (auto& resource : resources) {
+        resource.initialized = true;
+    }
+}
+
+VkImage RenderGraph::getImage(RenderGraphHandle handle) const {
+    return resources[handle].image;
+}
+
+VkImageView RenderGraph::getImageView(RenderGraphHandle handle) const {
+    return resources[handle].imageView;
+}
+
+uint32_t RenderGraph::findMemoryType(uint32_t typeFilter,
+                                     VkMemoryPropertyFlags properties) {
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) &&
+            (memProperties.memoryTypes[i].propertyFlags & properties) ==
+                properties) {
+            return i;
+        }
+    }
+
+    debugger.consoleMessage("Failed to find suitable memory type!", true);
+    return 0;
+}
+
+// Destroy owned images and forget every pass and resource
+void RenderGraph::reset() {
+    for (auto& resource : resources) {
+        if (resource.imported) continue;
+        if (resource.imageView != VK_NULL_HANDLE) {
+            vkDestroyImageView(device, resource.imageView, nullptr);
+        }
+        if (resource.image != VK_NULL_HANDLE) {
+            vkDestroyImage(device, resource.image, nullptr);
+        }
+    }
+    for (auto& block : memoryBlocks) {
+        vkFreeMemory(device, block.memory, nullptr);
+    }
+    resources.clear();
+    passes.clear();
+    memoryBlocks.clear();
+    finalBarriers = {};
+    stats = {};
+    debugger.consoleMessage("Destroyed render graph resources", false);
+}
@@ -0,0 +1,216 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "gpu_profiler.h"
+#include "vulkan_result.h"
+
+// Index of an image resource inside the render graph
+typedef uint32_t RenderGraphHandle;
+const RenderGraphHandle INVALID_RENDER_GRAPH_HANDLE = UINT32_MAX;
+
+// How a pass touches a resource. Each access maps to a pipeline stage, an
+// access mask and the image layout the pass expects
+enum class RenderGraphAccess {
+    ColorAttachmentWrite,
+    DepthAttachmentWrite,
+    DepthAttachmentRead,
+    FragmentSampledRead,
+    ComputeSampledRead,
+    ComputeStorageRead,
+    ComputeStorageWrite,
+    TransferRead,
+    TransferWrite,
+};
+
+// Description of an image the graph creates and owns
+struct RenderGraphImageDesc {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    VkImageUsageFlags usage = 0;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    // Transient images only live for the frame and may share memory with
+    // other transient images whose lifetimes do not overlap
+    bool transient = true;
+};
+
+// Numbers from the last compile, handy for seeing what the graph saved
+struct RenderGraphStats {
+    uint32_t passCount = 0;
+    uint32_t culledPassCount = 0;
+    uint32_t barrierCount = 0;
+    // Memory the owned images would need without aliasing
+    VkDeviceSize requestedMemory = 0;
+    // Memory actually allocated after aliasing
+    VkDeviceSize allocatedMemory = 0;
+};
+
+// A frame graph: passes declare the images they read and write, and the graph
+// works out which passes are needed, the barriers between them, and which
+// transient images can share memory
+class RenderGraph {
+   public:
+    class PassBuilder {
+       public:
+        PassBuilder(RenderGraph* graph, uint32_t passIndex);
+
+        // Declare that the pass reads an image
+        PassBuilder& read(RenderGraphHandle handle, RenderGraphAccess access);
+        // Declare that the pass writes an image
+        PassBuilder& write(RenderGraphHandle handle, RenderGraphAccess access);
+        // Never cull this pass, even if nothing reads its output
+        PassBuilder& sideEffect();
+        // The commands recorded for this pass
+        PassBuilder& execute(std::function<void(VkCommandBuffer)> callback);
+
+       private:
+        RenderGraph* graph;
+        uint32_t passIndex;
+    };
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice);
+
+    // Create an image owned by the graph. Memory is allocated on compile
+    RenderGraphHandle createImage(const std::string& name,
+                                  const RenderGraphImageDesc& desc);
+
+    // Bring in an image the graph does not own, such as a swapchain image.
+    // The graph transitions it to finalLayout at the end of the frame
+    RenderGraphHandle importImage(const std::string& name, VkImage image,
+                                  VkImageView imageView,
+                                  VkImageAspectFlags aspect,
+                                  VkImageLayout initialLayout,
+                                  VkImageLayout finalLayout);
+
+    // Swap the image behind an imported handle (the swapchain image changes
+    // every frame)
+    void setImportedImage(RenderGraphHandle handle, VkImage image,
+                          VkImageView imageView);
+
+    // Add a pass. Passes run in the order they are added
+    PassBuilder addPass(const std::string& name);
+
+    // Cull unused passes, compute barriers and allocate owned images
+    void compile();
+
+    // Record every surviving pass along with its barriers
+    void execute(VkCommandBuffer commandBuffer);
+
+    // Time every pass as a profiler region. Pass nullptr to stop
+    void setProfiler(GpuProfiler* profiler) { this->profiler = profiler; }
+
+    // Allocate image memory through the recovery policies
+    void setRecovery(VulkanRecovery* recovery) { this->recovery = recovery; }
+
+    VkImage getImage(RenderGraphHandle handle) const;
+    VkImageView getImageView(RenderGraphHandle handle) const;
+    const RenderGraphStats& getStats() const { return stats; }
+
+    // Destroy owned images and forget every pass and resource
+    void reset();
+
+   private:
+    struct AccessInfo {
+        VkPipelineStageFlags stage;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        bool isWrite;
+    };
+
+    struct Resource {
+        std::string name;
+        RenderGraphImageDesc desc;
+        bool imported = false;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView imageView = VK_NULL_HANDLE;
+        VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        // Index into memoryBlocks, or -1 if the image is not owned
+        int32_t memoryBlock = -1;
+        // First and last surviving pass that touches the image
+        int32_t firstPass = -1;
+        int32_t lastPass = -1;
+        // Set once the image has been through a frame, so persistent images
+        // know their layout is real
+        bool initialized = false;
+    };
+
+    struct ResourceUse {
+        RenderGraphHandle handle;
+        RenderGraphAccess access;
+    };
+
+    struct Barrier {
+        RenderGraphHandle handle;
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+        // oldLayout was carried over from last frame and is only valid once
+        // the image has been through a frame
+        bool carriedLayout;
+    };
+
+    struct BarrierBatch {
+        VkPipelineStageFlags srcStage = 0;
+        VkPipelineStageFlags dstStage = 0;
+        std::vector<Barrier> barriers;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<ResourceUse> uses;
+        std::function<void(VkCommandBuffer)> callback;
+        bool sideEffect = false;
+        bool culled = false;
+        BarrierBatch barriers;
+    };
+
+    struct MemoryBlock {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memoryTypeBits = 0;
+        std::vector<RenderGraphHandle> residents;
+    };
+
+    static AccessInfo getAccessInfo(RenderGraphAccess access);
+    // A pass may list the same image more than once (read and write), so
+    // fold those into one access per image
+    std::map<RenderGraphHandle, AccessInfo> mergeUses(const Pass& pass);
+
+    void cullPasses();
+    void computeLifetimes();
+    void allocateImages();
+    void computeBarriers();
+    void recordBarriers(VkCommandBuffer commandBuffer,
+                        const BarrierBatch& batch);
+
+    uint32_t findMemoryType(uint32_t typeFilter,
+                            VkMemoryPropertyFlags properties);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<MemoryBlock> memoryBlocks;
+    // Moves imported images into their final layout after the last pass
+    BarrierBatch finalBarriers;
+
+    RenderGraphStats stats;
+    GpuProfiler* profiler = nullptr;
+    VulkanRecovery* recovery = nullptr;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#version 450
+
+// Depth only version of shader.vert for the depth pre-pass. The position must
+// come out bit for bit the same as in shader.vert, or the main pass's EQUAL
+// depth test drops fragments, so the math is identical and invariant
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(std430, binding = 2) readonly buffer ObjectTransforms {
+    mat4 models[];
+} objects;
+
+struct InstanceData {
+    uint objectIndex;
+    uint drawIndex;
+    vec4 tint;
+    vec4 boundingSphere;
+};
+
+layout(std430, binding = 3) readonly buffer Instances {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 4) readonly buffer VisibleInstances {
+    uint visible[];
+};
+
+layout(location = 0) in vec3 inPosition;
+
+invariant gl_Position;
+
+void main() {
+    InstanceData instance = instances[visible[gl_InstanceIndex]];
+    vec4 worldPosition =
+        objects.models[instance.objectIndex] * vec4(inPosition, 1.0);
+    gl_Position = ubo.proj * (ubo.view * worldPosition);
+}
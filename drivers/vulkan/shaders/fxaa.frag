@@ -0,0 +1,80 @@
+#version 450
+
+// FXAA in the spirit of Timothy Lottes' FXAA 3 console version: estimate the
+// edge direction from the luma of the four diagonal neighbours, then blend
+// two or four taps along it. Pixels without enough contrast are left alone
+
+layout(binding = 0) uniform sampler2D sceneColor;
+
+layout(push_constant) uniform FxaaConstants {
+    vec2 inverseSize;
+    // Part of the input holding the scene, 1 unless it was rendered at a
+    // lower resolution into its top left corner
+    vec2 uvScale;
+} constants;
+
+layout(location = 0) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+// Contrast needed to count as an edge, relative to the brightest neighbour
+const float EDGE_THRESHOLD = 1.0 / 8.0;
+// Dark areas need at least this much, or noise gets smeared
+const float EDGE_THRESHOLD_MIN = 1.0 / 24.0;
+// Longest blend along an edge, in pixels
+const float SPAN_MAX = 8.0;
+const float REDUCE_MUL = 1.0 / 8.0;
+const float REDUCE_MIN = 1.0 / 128.0;
+
+// The scene color is sampled as linear, the square root brings luma close to
+// perceptual so edges are judged like the eye sees them
+float luma(vec3 color) {
+    return sqrt(dot(color, vec3(0.299, 0.587, 0.114)));
+}
+
+// Taps never reach past the rendered part, whatever is outside it is stale
+vec3 scene(vec2 uv) {
+    vec2 halfTexel = 0.5 * constants.inverseSize;
+    return texture(sceneColor,
+                   clamp(uv, halfTexel, constants.uvScale - halfTexel)).rgb;
+}
+
+void main() {
+    vec2 texel = constants.inverseSize;
+    vec2 uv = fragUV * constants.uvScale;
+    vec3 colorM = scene(uv);
+    float lumaM = luma(colorM);
+    float lumaNW = luma(scene(uv + vec2(-1.0, -1.0) * texel));
+    float lumaNE = luma(scene(uv + vec2(1.0, -1.0) * texel));
+    float lumaSW = luma(scene(uv + vec2(-1.0, 1.0) * texel));
+    float lumaSE = luma(scene(uv + vec2(1.0, 1.0) * texel));
+
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+    if (lumaMax - lumaMin < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD)) {
+        outColor = vec4(colorM, 1.0);
+        return;
+    }
+
+    // Perpendicular to the luma gradient, so along the edge
+    vec2 direction;
+    direction.x = -((lumaNW + lumaNE) - (lumaSW + lumaSE));
+    direction.y = (lumaNW + lumaSW) - (lumaNE + lumaSE);
+
+    float directionReduce =
+        max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * REDUCE_MUL, REDUCE_MIN);
+    float inverseDirectionMin =
+        1.0 / (min(abs(direction.x), abs(direction.y)) + directionReduce);
+    direction = clamp(direction * inverseDirectionMin, vec2(-SPAN_MAX),
+                      vec2(SPAN_MAX)) * texel;
+
+    vec3 colorA = 0.5 * (scene(uv + direction * (1.0 / 3.0 - 0.5)) +
+                         scene(uv + direction * (2.0 / 3.0 - 0.5)));
+    vec3 colorB = colorA * 0.5 +
+                  0.25 * (scene(uv - direction * 0.5) +
+                          scene(uv + direction * 0.5));
+
+    // The wide blend crossed into another edge, fall back to the narrow one
+    float lumaB = luma(colorB);
+    outColor = vec4(lumaB < lumaMin || lumaB > lumaMax ? colorA : colorB, 1.0);
+}
@@ -2,10 +2,171 @@
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec4 fragTint;
+layout(location = 3) in vec3 fragWorldPosition;
+layout(location = 4) in vec3 fragNormal;
+layout(location = 5) in float fragViewDepth;
 layout(location = 0) out vec4 outColor;
 
 layout(binding = 1) uniform sampler2D texSampler;
 
+// Streaming slot of the texture bound at binding 1
+layout(push_constant) uniform TextureSlot {
+    uint textureSlot;
+};
+
+// Must match FEEDBACK_LEVEL_OFFSET in texture_streamer.cpp. Levels are
+// stored relative to the view's first level plus this, so finer levels than
+// the resident ones still fit in a uint
+const int FEEDBACK_LEVEL_OFFSET = 16;
+
+// Finest level sampled per texture slot, read back by TextureStreamer
+layout(std430, binding = 11) buffer TextureFeedback {
+    uint finestLevels[];
+};
+
+// Must match MAX_LIGHTS_PER_CLUSTER in clustered_lighting.h
+const uint MAX_LIGHTS_PER_CLUSTER = 256;
+
+// Shared with light_cluster.comp
+layout(binding = 5) uniform LightingParams {
+    mat4 view;
+    mat4 inverseProj;
+    uint gridX;
+    uint gridY;
+    uint gridZ;
+    uint lightCount;
+    vec4 viewport;
+    // Near, far, slice scale and slice bias
+    vec4 depthSlicing;
+    vec4 ambient;
+} lighting;
+
+struct PointLight {
+    vec3 position;
+    float radius;
+    vec3 color;
+    float intensity;
+};
+
+layout(std430, binding = 6) readonly buffer Lights {
+    PointLight lights[];
+};
+
+layout(std430, binding = 7) readonly buffer ClusterCounts {
+    uint clusterCounts[];
+};
+
+layout(std430, binding = 8) readonly buffer ClusterLights {
+    uint clusterLights[];
+};
+
+// Must match SHADOW_CASCADE_COUNT in shadow_cascades.h
+const uint SHADOW_CASCADE_COUNT = 4;
+
+// One layer per cascade, compared against the fragment's light space depth
+layout(binding = 9) uniform sampler2DArrayShadow shadowMap;
+
+layout(binding = 10) uniform ShadowParams {
+    mat4 cascadeViewProj[SHADOW_CASCADE_COUNT];
+    // View depth every cascade ends at
+    vec4 cascadeSplits;
+    // World size of a texel in every cascade
+    vec4 texelSizes;
+    // Direction the light travels, w is 1 while the sun is on
+    vec4 sunDirection;
+    vec4 sunColor;
+} shadows;
+
+// The froxel this fragment falls in, the same way light_cluster.comp laid
+// them out
+uint findCluster() {
+    uvec2 tile = uvec2(gl_FragCoord.xy * vec2(lighting.gridX, lighting.gridY) /
+                       lighting.viewport.xy);
+    tile = min(tile, uvec2(lighting.gridX - 1, lighting.gridY - 1));
+    float slice = log(fragViewDepth) * lighting.depthSlicing.z +
+                  lighting.depthSlicing.w;
+    uint z = min(uint(max(slice, 0.0)), lighting.gridZ - 1);
+    return tile.x + lighting.gridX * (tile.y + lighting.gridY * z);
+}
+
+// 1 where the sun reaches the fragment, 0 in full shadow. Past the last
+// cascade everything is lit
+float sunVisibility(vec3 normal) {
+    uint cascade = 0;
+    while (cascade < SHADOW_CASCADE_COUNT &&
+           fragViewDepth > shadows.cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade == SHADOW_CASCADE_COUNT) return 1.0;
+
+    // Pushing the lookup out along the normal keeps surfaces from
+    // shadowing themselves at grazing angles
+    float texelSize = shadows.texelSizes[cascade];
+    vec3 position = fragWorldPosition + normal * texelSize * 1.5;
+    vec4 lightPosition =
+        shadows.cascadeViewProj[cascade] * vec4(position, 1.0);
+    vec2 uv = lightPosition.xy * 0.5 + 0.5;
+
+    // Four bilinear comparisons, each already a 2x2 filter
+    vec2 texel = vec2(1.0) / vec2(textureSize(shadowMap, 0).xy);
+    float visibility = 0.0;
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            vec2 offset = (vec2(x, y) - 0.5) * texel;
+            visibility += texture(shadowMap, vec4(uv + offset, cascade,
+                                                  lightPosition.z));
+        }
+    }
+    return visibility * 0.25;
+}
+
+// Report the level this fragment wants, unclamped by what is resident. Only
+// one pixel in every 4x4 block writes, which is plenty and keeps the atomics
+// cheap. The derivatives are taken here, before any branch
+void writeTextureFeedback() {
+    float lod = textureQueryLod(texSampler, fragTexCoord).x;
+    uvec2 pixel = uvec2(gl_FragCoord.xy);
+    if (((pixel.x | pixel.y) & 3u) != 0u) return;
+    uint level =
+        uint(clamp(int(floor(lod)) + FEEDBACK_LEVEL_OFFSET, 0, 31));
+    if (level < finestLevels[textureSlot]) {
+        atomicMin(finestLevels[textureSlot], level);
+    }
+}
+
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
-}
\ No newline at end of file
+    writeTextureFeedback();
+    vec4 albedo = texture(texSampler, fragTexCoord) * fragTint;
+
+    vec3 light = lighting.ambient.rgb;
+    uint cluster = findCluster();
+    uint count = clusterCounts[cluster];
+    vec3 normal = normalize(fragNormal);
+    for (uint i = 0; i < count; i++) {
+        PointLight point =
+            lights[clusterLights[cluster * MAX_LIGHTS_PER_CLUSTER + i]];
+        vec3 toLight = point.position - fragWorldPosition;
+        float distanceSquared = dot(toLight, toLight);
+        float radiusSquared = point.radius * point.radius;
+        if (distanceSquared >= radiusSquared) continue;
+
+        // Inverse square falloff, windowed so it reaches zero at the radius
+        // and the cluster bounds stay exact
+        float ratio = distanceSquared / radiusSquared;
+        float window = (1.0 - ratio * ratio);
+        float attenuation = window * window / (1.0 + distanceSquared);
+        vec3 direction = toLight * inversesqrt(max(distanceSquared, 1e-8));
+        float diffuse = max(dot(normal, direction), 0.0);
+        light += point.color * point.intensity * diffuse * attenuation;
+    }
+
+    if (shadows.sunDirection.w > 0.0) {
+        float diffuse = max(dot(normal, -shadows.sunDirection.xyz), 0.0);
+        if (diffuse > 0.0) {
+            light += shadows.sunColor.rgb * diffuse * sunVisibility(normal);
+        }
+    }
+
+    outColor = vec4(albedo.rgb * light, albedo.a);
+}
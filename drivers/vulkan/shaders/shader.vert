@@ -1,20 +1,59 @@
 #version 450
 
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
+layout(std430, binding = 2) readonly buffer ObjectTransforms {
+    mat4 models[];
+} objects;
+
+struct InstanceData {
+    uint objectIndex;
+    uint drawIndex;
+    vec4 tint;
+    vec4 boundingSphere;
+};
+
+layout(std430, binding = 3) readonly buffer Instances {
+    InstanceData instances[];
+};
+
+// Instances that survived culling, compacted by cull.comp. Every indirect
+// draw reads its own run, gl_InstanceIndex starts at the draw's firstInstance
+layout(std430, binding = 4) readonly buffer VisibleInstances {
+    uint visible[];
+};
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec3 inNormal;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec4 fragTint;
+layout(location = 3) out vec3 fragWorldPosition;
+layout(location = 4) out vec3 fragNormal;
+// Distance in front of the camera, picks the cluster's depth slice
+layout(location = 5) out float fragViewDepth;
+
+// Must match depth_prepass.vert exactly for the EQUAL depth test
+invariant gl_Position;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    InstanceData instance = instances[visible[gl_InstanceIndex]];
+    mat4 model = objects.models[instance.objectIndex];
+    // Same operations in the same order as depth_prepass.vert
+    vec4 worldPosition = model * vec4(inPosition, 1.0);
+    vec4 viewPosition = ubo.view * worldPosition;
+    gl_Position = ubo.proj * viewPosition;
+    fragWorldPosition = worldPosition.xyz;
+    // Good enough for the uniform scales the scene uses
+    fragNormal = mat3(model) * inNormal;
+    fragViewDepth = -viewPosition.z;
     fragColor = inColor;
     fragTexCoord = inTexCoord;
+    fragTint = instance.tint;
 }
\ No newline at end of file
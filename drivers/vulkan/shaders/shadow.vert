@@ -0,0 +1,23 @@
+#version 450
+
+// Light view projection of the cascade being drawn
+layout(push_constant) uniform Cascade {
+    mat4 viewProj;
+} cascade;
+
+layout(std430, binding = 0) readonly buffer ObjectTransforms {
+    mat4 models[];
+} objects;
+
+// Object of every caster, each draw reads its own run through
+// gl_InstanceIndex, which starts at the draw's firstInstance
+layout(std430, binding = 1) readonly buffer Casters {
+    uint casterObjects[];
+};
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+    mat4 model = objects.models[casterObjects[gl_InstanceIndex]];
+    gl_Position = cascade.viewProj * (model * vec4(inPosition, 1.0));
+}
@@ -0,0 +1,55 @@
+#version 450
+
+// Upscale the scene from the part of the input it was rendered to onto the
+// whole output. Bilinear filtering does the resampling, then a contrast
+// adaptive sharpening step in the spirit of AMD's CAS gets back some of the
+// detail it softened. Sharpening follows the scale, so at full resolution the
+// input is copied as is
+
+layout(binding = 0) uniform sampler2D sceneColor;
+
+layout(push_constant) uniform UpscaleConstants {
+    vec2 inverseSize;
+    // Part of the input holding the scene
+    vec2 uvScale;
+    // 0 leaves the bilinear result alone, 1 sharpens the most
+    float sharpness;
+} constants;
+
+layout(location = 0) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+vec3 scene(vec2 uv) {
+    vec2 halfTexel = 0.5 * constants.inverseSize;
+    return texture(sceneColor,
+                   clamp(uv, halfTexel, constants.uvScale - halfTexel)).rgb;
+}
+
+void main() {
+    vec2 texel = constants.inverseSize;
+    vec2 uv = fragUV * constants.uvScale;
+    vec3 center = scene(uv);
+    if (constants.sharpness <= 0.0) {
+        outColor = vec4(center, 1.0);
+        return;
+    }
+
+    vec3 north = scene(uv + vec2(0.0, -texel.y));
+    vec3 south = scene(uv + vec2(0.0, texel.y));
+    vec3 west = scene(uv + vec2(-texel.x, 0.0));
+    vec3 east = scene(uv + vec2(texel.x, 0.0));
+
+    // Sharpen less where the neighbourhood already spans most of the range,
+    // so edges do not ring
+    vec3 colorMin = min(center, min(min(north, south), min(west, east)));
+    vec3 colorMax = max(center, max(max(north, south), max(west, east)));
+    vec3 amount = sqrt(clamp(min(colorMin, 1.0 - colorMax) /
+                                 max(colorMax, vec3(1.0 / 1024.0)),
+                             0.0, 1.0));
+    vec3 weight = -amount / mix(8.0, 5.0, constants.sharpness);
+
+    vec3 color = (center + weight * (north + south + west + east)) /
+                 (1.0 + 4.0 * weight);
+    outColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,812 @@
+#include "shadow_cascades.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "core/debugger/profiler.h"
+
+// Blend between logarithmic and even splits, 1 is fully logarithmic
+const float CASCADE_SPLIT_LAMBDA = 0.75f;
+// Casters this far past a cascade towards the sun still shadow it
+const float CASTER_DISTANCE = 20.0f;
+// Cached cascades cover this much more than they need, so the eye can move
+// a while before the cache has to follow
+const float CACHE_MARGIN = 1.5f;
+// Near cascade radii are rounded up to this step, so the texel size does
+// not change as the camera turns
+const float RADIUS_STEP = 1.0f / 16.0f;
+// Slope scaled depth bias while drawing casters, against shadow acne
+const float DEPTH_BIAS_CONSTANT = 1.25f;
+const float DEPTH_BIAS_SLOPE = 1.75f;
+
+void ShadowCascades::init(VkDevice device, VulkanRecovery* recovery,
+                          VkFormat depthFormat, VkShaderModule vertexShader,
+                          uint32_t vertexStride) {
+    debugger.consoleMessage("\nBegin creating shadow cascades...", false);
+    this->device = device;
+    this->recovery = recovery;
+    this->depthFormat = depthFormat;
+
+    createRenderPasses();
+    createPipeline(vertexShader, vertexStride);
+    createImages();
+
+    std::vector<DescriptorPoolSizeRatio> poolRatios = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f}};
+    descriptors.init(device, 8, poolRatios);
+    debugger.consoleMessage("Successfully created shadow cascades", false);
+}
+
+void ShadowCascades::cleanup() {
+    cleanupFrameResources();
+    descriptors.cleanup();
+    cleanupImages();
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    vkDestroyRenderPass(device, clearRenderPass, nullptr);
+    vkDestroyRenderPass(device, loadRenderPass, nullptr);
+    debugger.consoleMessage("Destroyed shadow cascades", false);
+}
+
+// Depth only, one clearing the layer and one drawing over what is there.
+// Layouts are moved outside the render pass
+void ShadowCascades::createRenderPasses() {
+    for (bool clear : {true, false}) {
+        VkAttachmentDescription depthAttachment{};
+        depthAttachment.format = depthFormat;
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp =
+            clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthAttachment.finalLayout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentRef{};
+        depthAttachmentRef.attachment = 0;
+        depthAttachmentRef.layout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 0;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &depthAttachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+
+        checkVulkanResult(
+            vkCreateRenderPass(device, &renderPassInfo, nullptr,
+                               clear ? &clearRenderPass : &loadRenderPass),
+            "create shadow render pass");
+    }
+}
+
+// Positions only, the model matrix comes from the caster list
+void ShadowCascades::createPipeline(VkShaderModule vertexShader,
+                                    uint32_t vertexStride) {
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    setLayoutInfo.pBindings = bindings.data();
+    checkVulkanResult(vkCreateDescriptorSetLayout(device, &setLayoutInfo,
+                                                  nullptr, &setLayout),
+                      "create shadow descriptor set layout");
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(glm::mat4);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    checkVulkanResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo,
+                                             nullptr, &pipelineLayout),
+                      "create shadow pipeline layout");
+
+    VkPipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stageInfo.module = vertexShader;
+    stageInfo.pName = "main";
+
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = vertexStride;
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription positionAttribute{};
+    positionAttribute.binding = 0;
+    positionAttribute.location = 0;
+    positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+    positionAttribute.offset = 0;
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = 1;
+    vertexInputInfo.pVertexAttributeDescriptions = &positionAttribute;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    // Every cascade is the same size, so the viewport never changes
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(SHADOW_MAP_SIZE);
+    viewport.height = static_cast<float>(SHADOW_MAP_SIZE);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE};
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+
+    // Both faces cast, the meshes are not guaranteed to be closed
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_TRUE;
+    rasterizer.depthBiasConstantFactor = DEPTH_BIAS_CONSTANT;
+    rasterizer.depthBiasSlopeFactor = DEPTH_BIAS_SLOPE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.attachmentCount = 0;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 1;
+    pipelineInfo.pStages = &stageInfo;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = pipelineLayout;
+    // Works with the load variant too, they are compatible
+    pipelineInfo.renderPass = clearRenderPass;
+    pipelineInfo.subpass = 0;
+    checkVulkanResult(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                                &pipelineInfo, nullptr,
+                                                &pipeline),
+                      "create shadow pipeline");
+}
+
+// The shadow map with a layer per cascade and the cache with a layer per
+// cached cascade, a view and framebuffer for every layer and the comparison
+// sampler
+void ShadowCascades::createImages() {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.format = depthFormat;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.format = depthFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+
+    VkFramebufferCreateInfo framebufferInfo{};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = clearRenderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.width = SHADOW_MAP_SIZE;
+    framebufferInfo.height = SHADOW_MAP_SIZE;
+    framebufferInfo.layers = 1;
+
+    struct Target {
+        VkImage* image;
+        VkDeviceMemory* memory;
+        uint32_t layers;
+        VkImageUsageFlags usage;
+        VkImageView* layerViews;
+        VkFramebuffer* framebuffers;
+    };
+    Target targets[] = {
+        {&shadowImage, &shadowMemory, SHADOW_CASCADE_COUNT,
+         VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+         layerViews.data(), framebuffers.data()},
+        {&cacheImage, &cacheMemory, CACHED_CASCADE_COUNT,
+         VK_IMAGE_USAGE_TRANSFER_SRC_BIT, cacheLayerViews.data(),
+         cacheFramebuffers.data()}};
+
+    for (const Target& target : targets) {
+        imageInfo.arrayLayers = target.layers;
+        imageInfo.usage =
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | target.usage;
+        checkVulkanResult(
+            vkCreateImage(device, &imageInfo, nullptr, target.image),
+            "create shadow map");
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, *target.image, &memRequirements);
+        checkVulkanResult(
+            recovery->allocateMemory(memRequirements.size,
+                                     memRequirements.memoryTypeBits,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                     *target.memory),
+            "allocate shadow map memory");
+        vkBindImageMemory(device, *target.image, *target.memory, 0);
+
+        viewInfo.image = *target.image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.subresourceRange.layerCount = 1;
+        for (uint32_t layer = 0; layer < target.layers; layer++) {
+            viewInfo.subresourceRange.baseArrayLayer = layer;
+            checkVulkanResult(vkCreateImageView(device, &viewInfo, nullptr,
+                                                &target.layerViews[layer]),
+                              "create shadow map layer view");
+
+            framebufferInfo.pAttachments = &target.layerViews[layer];
+            checkVulkanResult(
+                vkCreateFramebuffer(device, &framebufferInfo, nullptr,
+                                    &target.framebuffers[layer]),
+                "create shadow framebuffer");
+        }
+    }
+
+    viewInfo.image = shadowImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = SHADOW_CASCADE_COUNT;
+    checkVulkanResult(
+        vkCreateImageView(device, &viewInfo, nullptr, &shadowView),
+        "create shadow map view");
+
+    // Hardware comparison with bilinear filtering gives 2x2 PCF per tap.
+    // Outside the map counts as lit
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    samplerInfo.compareEnable = VK_TRUE;
+    samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 0.0f;
+    checkVulkanResult(
+        vkCreateSampler(device, &samplerInfo, nullptr, &shadowSampler),
+        "create shadow sampler");
+
+    layoutReady = false;
+    cacheValid.fill(false);
+    layerMatchesCache.fill(false);
+    debugger.consoleMessage(
+        ("Created " + std::to_string(SHADOW_CASCADE_COUNT) + " shadow " +
+         "cascades of " + std::to_string(SHADOW_MAP_SIZE) + " texels")
+            .c_str(),
+        false);
+}
+
+void ShadowCascades::cleanupImages() {
+    if (shadowImage == VK_NULL_HANDLE) return;
+    vkDestroySampler(device, shadowSampler, nullptr);
+    vkDestroyImageView(device, shadowView, nullptr);
+    for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        vkDestroyFramebuffer(device, framebuffers[i], nullptr);
+        vkDestroyImageView(device, layerViews[i], nullptr);
+    }
+    for (uint32_t i = 0; i < CACHED_CASCADE_COUNT; i++) {
+        vkDestroyFramebuffer(device, cacheFramebuffers[i], nullptr);
+        vkDestroyImageView(device, cacheLayerViews[i], nullptr);
+    }
+    vkDestroyImage(device, shadowImage, nullptr);
+    vkFreeMemory(device, shadowMemory, nullptr);
+    vkDestroyImage(device, cacheImage, nullptr);
+    vkFreeMemory(device, cacheMemory, nullptr);
+    shadowImage = VK_NULL_HANDLE;
+    cacheImage = VK_NULL_HANDLE;
+}
+
+ShadowCascades::MappedBuffer ShadowCascades::createMappedBuffer(
+    VkDeviceSize size, VkBufferUsageFlags usage) {
+    MappedBuffer result;
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    checkVulkanResult(
+        vkCreateBuffer(device, &bufferInfo, nullptr, &result.buffer),
+        "create shadow buffer");
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, result.buffer, &memRequirements);
+    checkVulkanResult(recovery->allocateMemory(
+                          memRequirements.size, memRequirements.memoryTypeBits,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          result.memory),
+                      "allocate shadow buffer memory");
+    vkBindBufferMemory(device, result.buffer, result.memory, 0);
+    vkMapMemory(device, result.memory, 0, size, 0, &result.mapped);
+    memset(result.mapped, 0, static_cast<size_t>(size));
+    return result;
+}
+
+void ShadowCascades::destroyMappedBuffer(MappedBuffer& buffer) {
+    vkDestroyBuffer(device, buffer.buffer, nullptr);
+    vkFreeMemory(device, buffer.memory, nullptr);
+    buffer = MappedBuffer();
+}
+
+// A caster can land in every cascade once, plus once more in the cache of
+// each cached cascade
+void ShadowCascades::createFrameResources(uint32_t framesInFlight,
+                                          uint32_t maxCasters) {
+    this->framesInFlight = framesInFlight;
+    this->maxCasters =
+        maxCasters * (SHADOW_CASCADE_COUNT + CACHED_CASCADE_COUNT);
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        paramBuffers.push_back(createMappedBuffer(
+            sizeof(ShadowParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT));
+        casterBuffers.push_back(
+            createMappedBuffer(sizeof(uint32_t) * this->maxCasters,
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+    }
+}
+
+void ShadowCascades::cleanupFrameResources() {
+    // The caster sets point at these buffers
+    descriptors.resetPools();
+    for (uint32_t i = 0; i < paramBuffers.size(); i++) {
+        destroyMappedBuffer(paramBuffers[i]);
+        destroyMappedBuffer(casterBuffers[i]);
+    }
+    paramBuffers.clear();
+    casterBuffers.clear();
+    framesInFlight = 0;
+}
+
+void ShadowCascades::setMeshes(const std::vector<ShadowMesh>& meshes) {
+    this->meshes = meshes;
+    invalidateCache();
+}
+
+// A black sun is off. Cached shadows were cast from the old direction
+void ShadowCascades::setSun(const glm::vec3& direction,
+                            const glm::vec3& color) {
+    glm::vec3 normalized = glm::normalize(direction);
+    if (normalized != sunDirection) {
+        sunDirection = normalized;
+        invalidateCache();
+    }
+    sunColor = color;
+}
+
+bool ShadowCascades::isSunEnabled() const {
+    return sunColor.x > 0.0f || sunColor.y > 0.0f || sunColor.z > 0.0f;
+}
+
+// Redraw the cache of every cached cascade that overlaps the sphere
+void ShadowCascades::invalidateStatic(const glm::vec4& boundingSphere) {
+    for (uint32_t i = 0; i < CACHED_CASCADE_COUNT; i++) {
+        if (cacheValid[i] &&
+            overlaps(cascades[FIRST_CACHED_CASCADE + i], boundingSphere)) {
+            cacheValid[i] = false;
+        }
+    }
+}
+
+void ShadowCascades::invalidateCache() { cacheValid.fill(false); }
+
+// Box around a sphere, looking down the sun. The center moves in whole
+// texels of light space, so the same world point always lands on the same
+// texel and edges do not crawl as the camera moves
+ShadowCascades::CascadeBounds ShadowCascades::fitCascade(
+    const glm::vec3& center, float radius) const {
+    glm::vec3 up = std::abs(sunDirection.y) > 0.99f
+                       ? glm::vec3(0.0f, 0.0f, 1.0f)
+                       : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 rotation = glm::lookAt(glm::vec3(0.0f), sunDirection, up);
+    glm::vec3 lightCenter = glm::vec3(rotation * glm::vec4(center, 1.0f));
+    float texelSize = 2.0f * radius / SHADOW_MAP_SIZE;
+    lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+    lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+    CascadeBounds bounds;
+    bounds.view = glm::translate(glm::mat4(1.0f), -lightCenter) * rotation;
+    // Light space z runs towards the sun, so near is the far side of the
+    // sphere plus the caster distance
+    glm::mat4 proj = glm::orthoRH_ZO(-radius, radius, -radius, radius,
+                                     -(radius + CASTER_DISTANCE), radius);
+    bounds.viewProj = proj * bounds.view;
+    bounds.center = center;
+    bounds.radius = radius;
+    return bounds;
+}
+
+bool ShadowCascades::overlaps(const CascadeBounds& bounds,
+                              const glm::vec4& boundingSphere) {
+    glm::vec4 center =
+        bounds.view * glm::vec4(glm::vec3(boundingSphere), 1.0f);
+    float reach = bounds.radius + boundingSphere.w;
+    return std::abs(center.x) <= reach && std::abs(center.y) <= reach &&
+           center.z - boundingSphere.w <= bounds.radius + CASTER_DISTANCE &&
+           center.z + boundingSphere.w >= -bounds.radius;
+}
+
+// Append the casters overlapping the cascade, one draw per mesh. Casters
+// past the buffer's end are dropped
+void ShadowCascades::cullCasters(const CascadeBounds& bounds,
+                                 const std::vector<ShadowCaster>& casters,
+                                 bool wantStatic, bool wantDynamic,
+                                 std::vector<CasterDraw>& draws) {
+    for (uint32_t mesh = 0; mesh < meshes.size(); mesh++) {
+        CasterDraw draw{mesh, static_cast<uint32_t>(casterObjects.size()), 0};
+        for (const ShadowCaster& caster : casters) {
+            if (casterObjects.size() >= maxCasters) break;
+            if (caster.mesh != mesh) continue;
+            if (caster.isStatic ? !wantStatic : !wantDynamic) continue;
+            if (!overlaps(bounds, caster.boundingSphere)) continue;
+            casterObjects.push_back(caster.object);
+            draw.casterCount++;
+        }
+        if (draw.casterCount > 0) {
+            draws.push_back(draw);
+            stats.casterDraws += draw.casterCount;
+        }
+    }
+}
+
+// Fit the cascades, cull the casters and write the frame's parameters
+void ShadowCascades::beginFrame(uint32_t frame, const ShadowFrame& params,
+                                const std::vector<ShadowCaster>& casters) {
+    PROFILE_FUNCTION();
+    stats = ShadowStats();
+    casterObjects.clear();
+    for (auto& draws : cascadeDraws) draws.clear();
+    for (auto& draws : cacheDraws) draws.clear();
+    redrawCache.fill(false);
+
+    // Corners of the view at a depth of one, from the camera
+    glm::mat4 inverseProj = glm::inverse(params.proj);
+    glm::mat4 inverseView = glm::inverse(params.view);
+    glm::vec3 eye = glm::vec3(inverseView[3]);
+    std::array<glm::vec3, 4> rays;
+    float longestRay = 0.0f;
+    for (uint32_t i = 0; i < rays.size(); i++) {
+        glm::vec4 corner = inverseProj * glm::vec4(i & 1 ? 1.0f : -1.0f,
+                                                   i & 2 ? 1.0f : -1.0f,
+                                                   1.0f, 1.0f);
+        rays[i] = glm::vec3(corner) / -corner.z;
+        longestRay = std::max(longestRay, glm::length(rays[i]));
+    }
+
+    // Practical split scheme, logarithmic near the camera where texels
+    // matter most
+    std::array<float, SHADOW_CASCADE_COUNT + 1> splits;
+    splits[0] = params.nearPlane;
+    for (uint32_t i = 1; i <= SHADOW_CASCADE_COUNT; i++) {
+        float fraction = static_cast<float>(i) / SHADOW_CASCADE_COUNT;
+        float logarithmic = params.nearPlane *
+                            std::pow(params.farPlane / params.nearPlane,
+                                     fraction);
+        float even =
+            params.nearPlane + (params.farPlane - params.nearPlane) * fraction;
+        splits[i] = CASCADE_SPLIT_LAMBDA * logarithmic +
+                    (1.0f - CASCADE_SPLIT_LAMBDA) * even;
+    }
+
+    // Nothing reports static changes to a cache that is not drawn
+    bool enabled = isSunEnabled() && !meshes.empty();
+    if (!enabled) invalidateCache();
+    for (uint32_t c = 0; enabled && c < SHADOW_CASCADE_COUNT; c++) {
+        if (c < FIRST_CACHED_CASCADE) {
+            // Sphere around the slice. Its radius only depends on the
+            // projection, so turning the camera keeps the texel size
+            std::array<glm::vec3, 8> corners;
+            glm::vec3 center = glm::vec3(0.0f);
+            for (uint32_t i = 0; i < corners.size(); i++) {
+                float depth = splits[c + (i >> 2)];
+                corners[i] = glm::vec3(inverseView *
+                                       glm::vec4(rays[i & 3] * depth, 1.0f));
+                center += corners[i] / static_cast<float>(corners.size());
+            }
+            float radius = 0.0f;
+            for (const glm::vec3& corner : corners) {
+                radius = std::max(radius, glm::length(corner - center));
+            }
+            radius = std::ceil(radius / RADIUS_STEP) * RADIUS_STEP;
+            cascades[c] = fitCascade(center, radius);
+            cullCasters(cascades[c], casters, true, true, cascadeDraws[c]);
+            stats.cascadesRendered++;
+            continue;
+        }
+
+        // Sphere around the eye that holds the slice whichever way the
+        // camera faces. It only moves once the eye gets near its edge
+        uint32_t cached = c - FIRST_CACHED_CASCADE;
+        float needed = splits[c + 1] * longestRay;
+        if (glm::length(eye - cascades[c].center) + needed >
+            cascades[c].radius) {
+            cascades[c] = fitCascade(eye, needed * CACHE_MARGIN);
+            cacheValid[cached] = false;
+        }
+        if (!cacheValid[cached]) {
+            cullCasters(cascades[c], casters, true, false, cacheDraws[cached]);
+            redrawCache[cached] = true;
+            cacheValid[cached] = true;
+            stats.cascadesRendered++;
+            stats.cacheRebuilds++;
+        }
+        cullCasters(cascades[c], casters, false, true, cascadeDraws[c]);
+    }
+
+    ShadowParams shadowParams{};
+    for (uint32_t c = 0; c < SHADOW_CASCADE_COUNT; c++) {
+        shadowParams.cascadeViewProj[c] = cascades[c].viewProj;
+        shadowParams.cascadeSplits[c] = splits[c + 1];
+        shadowParams.texelSizes[c] =
+            2.0f * cascades[c].radius / SHADOW_MAP_SIZE;
+    }
+    shadowParams.sunDirection = glm::vec4(sunDirection, enabled ? 1.0f : 0.0f);
+    shadowParams.sunColor = glm::vec4(sunColor, 0.0f);
+    memcpy(paramBuffers[frame].mapped, &shadowParams, sizeof(shadowParams));
+    memcpy(casterBuffers[frame].mapped, casterObjects.data(),
+           sizeof(uint32_t) * casterObjects.size());
+
+    DescriptorBindings bindings;
+    bindings
+        .bindBuffer(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    params.transformBuffer, 0, params.transformRange)
+        .bindBuffer(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    casterBuffers[frame].buffer, 0,
+                    sizeof(uint32_t) * maxCasters);
+    casterSet = descriptors.getSet(setLayout, bindings);
+}
+
+void ShadowCascades::transitionLayers(
+    VkCommandBuffer commandBuffer, VkImage image, uint32_t firstLayer,
+    uint32_t layerCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+        depthFormat == VK_FORMAT_D24_UNORM_S8_UINT) {
+        barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = firstLayer;
+    barrier.subresourceRange.layerCount = layerCount;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+}
+
+// One render pass into a layer with the given casters
+void ShadowCascades::drawCasters(VkCommandBuffer commandBuffer,
+                                 VkFramebuffer framebuffer, bool clear,
+                                 const glm::mat4& viewProj,
+                                 const std::vector<CasterDraw>& draws) {
+    VkClearValue clearValue{};
+    clearValue.depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = clear ? clearRenderPass : loadRenderPass;
+    renderPassInfo.framebuffer = framebuffer;
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE};
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearValue;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
+
+    vkCmdPushConstants(commandBuffer, pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4),
+                       &viewProj);
+    for (const CasterDraw& draw : draws) {
+        const ShadowMesh& mesh = meshes[draw.mesh];
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mesh.vertexBuffer,
+                               &offset);
+        vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer, 0,
+                             VK_INDEX_TYPE_UINT32);
+        // gl_InstanceIndex starts at firstInstance, so it indexes the caster
+        // list directly
+        vkCmdDrawIndexed(commandBuffer, mesh.indexCount, draw.casterCount, 0,
+                         0, draw.firstCaster);
+    }
+    vkCmdEndRenderPass(commandBuffer);
+}
+
+void ShadowCascades::copyCacheLayer(VkCommandBuffer commandBuffer,
+                                    uint32_t cachedIndex) {
+    VkImageCopy region{};
+    region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    region.srcSubresource.mipLevel = 0;
+    region.srcSubresource.baseArrayLayer = cachedIndex;
+    region.srcSubresource.layerCount = 1;
+    region.dstSubresource = region.srcSubresource;
+    region.dstSubresource.baseArrayLayer = FIRST_CACHED_CASCADE + cachedIndex;
+    region.extent = {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1};
+    vkCmdCopyImage(commandBuffer, cacheImage,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadowImage,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+// Between frames the shadow map rests in the read only depth layout for the
+// main pass and the cache in the transfer source layout for its copies.
+// Every layer goes back there once drawn
+void ShadowCascades::recordShadows(VkCommandBuffer commandBuffer) {
+    const VkImageLayout readLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    const VkImageLayout attachmentLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    const VkPipelineStageFlags depthStages =
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    const VkAccessFlags depthAccess =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    if (!layoutReady) {
+        transitionLayers(commandBuffer, shadowImage, 0, SHADOW_CASCADE_COUNT,
+                         VK_IMAGE_LAYOUT_UNDEFINED, readLayout,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_SHADER_READ_BIT);
+        transitionLayers(commandBuffer, cacheImage, 0, CACHED_CASCADE_COUNT,
+                         VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_READ_BIT);
+        layoutReady = true;
+    }
+    if (!isSunEnabled() || meshes.empty()) return;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipelineLayout, 0, 1, &casterSet, 0, nullptr);
+
+    // Near cascades, every caster drawn from scratch
+    for (uint32_t c = 0; c < FIRST_CACHED_CASCADE; c++) {
+        transitionLayers(commandBuffer, shadowImage, c, 1, readLayout,
+                         attachmentLayout,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         depthStages, depthAccess);
+        drawCasters(commandBuffer, framebuffers[c], true,
+                    cascades[c].viewProj, cascadeDraws[c]);
+        transitionLayers(commandBuffer, shadowImage, c, 1, attachmentLayout,
+                         readLayout, depthStages,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_SHADER_READ_BIT);
+    }
+
+    // Cached cascades, the cache when it is stale, then the dynamic casters
+    // over a copy of it
+    for (uint32_t cached = 0; cached < CACHED_CASCADE_COUNT; cached++) {
+        uint32_t c = FIRST_CACHED_CASCADE + cached;
+        if (redrawCache[cached]) {
+            transitionLayers(commandBuffer, cacheImage, cached, 1,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             attachmentLayout, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, depthStages, depthAccess);
+            drawCasters(commandBuffer, cacheFramebuffers[cached], true,
+                        cascades[c].viewProj, cacheDraws[cached]);
+            transitionLayers(commandBuffer, cacheImage, cached, 1,
+                             attachmentLayout,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             depthStages,
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_READ_BIT);
+            layerMatchesCache[cached] = false;
+        }
+
+        bool dynamic = !cascadeDraws[c].empty();
+        if (!dynamic && layerMatchesCache[cached]) continue;
+
+        transitionLayers(commandBuffer, shadowImage, c, 1, readLayout,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_WRITE_BIT);
+        copyCacheLayer(commandBuffer, cached);
+        if (dynamic) {
+            transitionLayers(commandBuffer, shadowImage, c, 1,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             attachmentLayout, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_WRITE_BIT, depthStages,
+                             depthAccess);
+            drawCasters(commandBuffer, framebuffers[c], false,
+                        cascades[c].viewProj, cascadeDraws[c]);
+            transitionLayers(commandBuffer, shadowImage, c, 1,
+                             attachmentLayout, readLayout, depthStages,
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             VK_ACCESS_SHADER_READ_BIT);
+        } else {
+            transitionLayers(commandBuffer, shadowImage, c, 1,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, readLayout,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             VK_ACCESS_SHADER_READ_BIT);
+        }
+        // Dynamic casters drawn now have to be copied over next frame
+        layerMatchesCache[cached] = !dynamic;
+    }
+}
@@ -0,0 +1,250 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "descriptor_allocator.h"
+#include "vulkan_result.h"
+
+// Cascades the view is split into, must match the lighting shader
+const uint32_t SHADOW_CASCADE_COUNT = 4;
+// Cascades from this one on are cached, the ones before it are redrawn
+// every frame
+const uint32_t FIRST_CACHED_CASCADE = 2;
+const uint32_t CACHED_CASCADE_COUNT =
+    SHADOW_CASCADE_COUNT - FIRST_CACHED_CASCADE;
+// Width and height of every cascade in texels
+const uint32_t SHADOW_MAP_SIZE = 2048;
+
+// Mesh the shadow passes can draw, indexed like the context's meshes
+struct ShadowMesh {
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    uint32_t indexCount = 0;
+    // Model space center and radius
+    glm::vec4 boundingSphere;
+};
+
+// An object that may cast a shadow
+struct ShadowCaster {
+    uint32_t object;
+    uint32_t mesh;
+    // World space center and radius
+    glm::vec4 boundingSphere;
+    // Static casters go into the cached cascades' cache, dynamic ones are
+    // drawn over it every frame
+    bool isStatic;
+};
+
+// Per frame inputs. The transform buffer belongs to the caller and must hold
+// the frame's model matrices by the time the work is submitted
+struct ShadowFrame {
+    glm::mat4 view;
+    glm::mat4 proj;
+    float nearPlane = 0.0f;
+    // Shadows end here, past it the sun lights everything
+    float farPlane = 0.0f;
+    VkBuffer transformBuffer = VK_NULL_HANDLE;
+    VkDeviceSize transformRange = 0;
+};
+
+// What the last beginFrame decided to draw
+struct ShadowStats {
+    // Cascade renders, cached cascades count when their cache is redrawn
+    uint32_t cascadesRendered = 0;
+    // Cached cascades whose cache was redrawn
+    uint32_t cacheRebuilds = 0;
+    // Caster draws summed over every cascade
+    uint32_t casterDraws = 0;
+};
+
+// Directional sun shadows with cascaded shadow maps. The view is split into
+// slices that grow with distance, each with its own orthographic shadow map
+// in a layer of one depth array. Near cascades follow the camera and are
+// redrawn every frame. Far cascades cover a wider sphere around the eye and
+// keep their static casters in a cache, only redrawn when the sun turns,
+// the eye leaves the sphere or a static caster inside it changes. Every
+// frame the cache is copied into the shadow map and only the dynamic
+// casters are drawn over it. Casters are culled against each cascade on the
+// CPU before anything is recorded. Cascades snap to whole texels, so
+// shadows stay still while the camera moves
+class ShadowCascades {
+   public:
+    // vertexStride is the size of the context's vertex, the position must
+    // be three floats at its start
+    void init(VkDevice device, VulkanRecovery* recovery, VkFormat depthFormat,
+              VkShaderModule vertexShader, uint32_t vertexStride);
+    void cleanup();
+
+    // Parameters and caster lists, one set per frame in flight
+    void createFrameResources(uint32_t framesInFlight, uint32_t maxCasters);
+    void cleanupFrameResources();
+
+    void setMeshes(const std::vector<ShadowMesh>& meshes);
+
+    // Direction the light travels in world space and its color. A black sun
+    // is off, which skips every shadow pass. Turning it drops the cache
+    void setSun(const glm::vec3& direction, const glm::vec3& color);
+    bool isSunEnabled() const;
+
+    // Redraw the cache of every cached cascade that overlaps the sphere,
+    // for a static caster that moved or changed mesh. Call with both its
+    // old and its new bounds
+    void invalidateStatic(const glm::vec4& boundingSphere);
+    // Redraw every cached cascade
+    void invalidateCache();
+
+    // Fit the cascades to the camera, cull the casters into each of them
+    // and write the frame's parameters and caster lists. The frame's fence
+    // must have signalled
+    void beginFrame(uint32_t frame, const ShadowFrame& params,
+                    const std::vector<ShadowCaster>& casters);
+
+    // Draw the cascades that need it. Leaves the shadow map ready for
+    // sampling in fragment shaders. Record before the main pass
+    void recordShadows(VkCommandBuffer commandBuffer);
+
+    // What the lighting shader binds. The view covers every cascade, the
+    // sampler compares depth
+    VkImageView getShadowView() const { return shadowView; }
+    VkSampler getShadowSampler() const { return shadowSampler; }
+    VkImageLayout getShadowLayout() const {
+        return VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    }
+    VkBuffer getParamBuffer(uint32_t frame) const {
+        return paramBuffers[frame].buffer;
+    }
+    VkDeviceSize getParamBufferSize() const { return sizeof(ShadowParams); }
+
+    const ShadowStats& getStats() const { return stats; }
+
+   private:
+    // Matches ShadowParams in shader.frag with std140 layout
+    struct ShadowParams {
+        glm::mat4 cascadeViewProj[SHADOW_CASCADE_COUNT];
+        // View depth every cascade ends at
+        glm::vec4 cascadeSplits;
+        // World size of a texel in every cascade, for the normal offset
+        glm::vec4 texelSizes;
+        // Direction the light travels, w is 1 while the sun is on
+        glm::vec4 sunDirection;
+        glm::vec4 sunColor;
+    };
+
+    // Host visible buffer, mapped for its whole life
+    struct MappedBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+    };
+
+    // Casters sharing a mesh, a run of the caster buffer
+    struct CasterDraw {
+        uint32_t mesh;
+        uint32_t firstCaster;
+        uint32_t casterCount;
+    };
+
+    // Light space box of a cascade. The light looks down -z, casters up to
+    // CASTER_DISTANCE towards the sun are kept
+    struct CascadeBounds {
+        glm::mat4 view = glm::mat4(1.0f);
+        glm::mat4 viewProj = glm::mat4(1.0f);
+        glm::vec3 center = glm::vec3(0.0f);
+        float radius = 0.0f;
+    };
+
+    void createRenderPasses();
+    void createPipeline(VkShaderModule vertexShader, uint32_t vertexStride);
+    void createImages();
+    void cleanupImages();
+    MappedBuffer createMappedBuffer(VkDeviceSize size,
+                                    VkBufferUsageFlags usage);
+    void destroyMappedBuffer(MappedBuffer& buffer);
+
+    // Box around a sphere, with its center snapped to whole texels
+    CascadeBounds fitCascade(const glm::vec3& center, float radius) const;
+    static bool overlaps(const CascadeBounds& bounds,
+                         const glm::vec4& boundingSphere);
+    // Append the casters overlapping the cascade, grouped by mesh
+    void cullCasters(const CascadeBounds& bounds,
+                     const std::vector<ShadowCaster>& casters, bool wantStatic,
+                     bool wantDynamic, std::vector<CasterDraw>& draws);
+
+    void transitionLayers(VkCommandBuffer commandBuffer, VkImage image,
+                          uint32_t firstLayer, uint32_t layerCount,
+                          VkImageLayout oldLayout, VkImageLayout newLayout,
+                          VkPipelineStageFlags srcStage,
+                          VkAccessFlags srcAccess,
+                          VkPipelineStageFlags dstStage,
+                          VkAccessFlags dstAccess);
+    // One render pass into a layer, clearing it or keeping what is there
+    void drawCasters(VkCommandBuffer commandBuffer, VkFramebuffer framebuffer,
+                     bool clear, const glm::mat4& viewProj,
+                     const std::vector<CasterDraw>& draws);
+    void copyCacheLayer(VkCommandBuffer commandBuffer, uint32_t cachedIndex);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    VulkanRecovery* recovery = nullptr;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+
+    VkRenderPass clearRenderPass = VK_NULL_HANDLE;
+    VkRenderPass loadRenderPass = VK_NULL_HANDLE;
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    // Sets are looked up every frame and cached, a reset drops them all
+    DescriptorAllocator descriptors;
+
+    // One layer per cascade, sampled by the main pass
+    VkImage shadowImage = VK_NULL_HANDLE;
+    VkDeviceMemory shadowMemory = VK_NULL_HANDLE;
+    VkImageView shadowView = VK_NULL_HANDLE;
+    std::array<VkImageView, SHADOW_CASCADE_COUNT> layerViews{};
+    std::array<VkFramebuffer, SHADOW_CASCADE_COUNT> framebuffers{};
+    // Static casters of the cached cascades, one layer each
+    VkImage cacheImage = VK_NULL_HANDLE;
+    VkDeviceMemory cacheMemory = VK_NULL_HANDLE;
+    std::array<VkImageView, CACHED_CASCADE_COUNT> cacheLayerViews{};
+    std::array<VkFramebuffer, CACHED_CASCADE_COUNT> cacheFramebuffers{};
+    VkSampler shadowSampler = VK_NULL_HANDLE;
+    // Both images start out undefined and are moved to their resting
+    // layouts before the first frame
+    bool layoutReady = false;
+
+    std::vector<ShadowMesh> meshes;
+
+    uint32_t framesInFlight = 0;
+    uint32_t maxCasters = 0;
+    std::vector<MappedBuffer> paramBuffers;
+    // Object index of every caster drawn, in draw order
+    std::vector<MappedBuffer> casterBuffers;
+    std::vector<uint32_t> casterObjects;
+    // Looked up in beginFrame for the frame being recorded
+    VkDescriptorSet casterSet = VK_NULL_HANDLE;
+
+    glm::vec3 sunDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+    glm::vec3 sunColor = glm::vec3(0.0f);
+
+    // Decided in beginFrame, drawn in recordShadows
+    std::array<CascadeBounds, SHADOW_CASCADE_COUNT> cascades{};
+    std::array<std::vector<CasterDraw>, SHADOW_CASCADE_COUNT> cascadeDraws;
+    std::array<std::vector<CasterDraw>, CACHED_CASCADE_COUNT> cacheDraws;
+    std::array<bool, CACHED_CASCADE_COUNT> cacheValid{};
+    std::array<bool, CACHED_CASCADE_COUNT> redrawCache{};
+    // The shadow map layer still matches its cache, with nothing drawn over
+    // it, so the copy can be skipped
+    std::array<bool, CACHED_CASCADE_COUNT> layerMatchesCache{};
+
+    ShadowStats stats;
+};
+
+#endif
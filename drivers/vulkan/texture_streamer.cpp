@@ -0,0 +1,798 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "core/debugger/profiler.h"
+
+// Feedback slots hold the finest level sampled plus this offset, so a
+// magnified texture can still ask for levels finer than its resident one.
+// Must match the lighting shader
+const int32_t FEEDBACK_LEVEL_OFFSET = 16;
+// A slot no fragment wrote to this frame
+const uint32_t FEEDBACK_UNUSED = 0xFFFFFFFF;
+// Frames between VK_EXT_memory_budget queries
+const uint64_t BUDGET_QUERY_INTERVAL = 30;
+// Share of the heap budget left after everything else that textures may
+// take, the rest is headroom for allocations that come and go
+const double HEAP_BUDGET_SHARE = 0.9;
+// The staging buffer always fits a row of the widest image Vulkan allows
+const VkDeviceSize MIN_STAGING_SIZE = 16384 * 4;
+
+static uint32_t levelSize(uint32_t size, uint32_t level) {
+    return std::max(size >> level, 1u);
+}
+
+// Mips are averaged in linear light, like a linear blit of an sRGB image
+static const std::array<float, 256>& srgbToLinear() {
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> values{};
+        for (uint32_t i = 0; i < 256; i++) {
+            float c = i / 255.0f;
+            values[i] = c <= 0.04045f ? c / 12.92f
+                                      : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return values;
+    }();
+    return table;
+}
+
+static uint8_t linearToSrgb(float value) {
+    // Fine enough steps that the result is off by at most one
+    static const std::array<uint8_t, 4096> table = [] {
+        std::array<uint8_t, 4096> values{};
+        for (uint32_t i = 0; i < 4096; i++) {
+            float c = (i + 0.5f) / 4096.0f;
+            float srgb = c <= 0.0031308f
+                             ? c * 12.92f
+                             : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+            values[i] = static_cast<uint8_t>(
+                std::clamp(srgb * 255.0f + 0.5f, 0.0f, 255.0f));
+        }
+        return values;
+    }();
+    uint32_t index = static_cast<uint32_t>(
+        std::clamp(value, 0.0f, 1.0f) * 4095.0f + 0.5f);
+    return table[index];
+}
+
+// Box filter every 2x2 block into one texel. Odd edges reuse their last
+// row or column
+static std::vector<uint8_t> downsample(const std::vector<uint8_t>& source,
+                                       uint32_t width, uint32_t height) {
+    const std::array<float, 256>& toLinear = srgbToLinear();
+    uint32_t outWidth = levelSize(width, 1);
+    uint32_t outHeight = levelSize(height, 1);
+    std::vector<uint8_t> result(static_cast<size_t>(outWidth) * outHeight * 4);
+    for (uint32_t y = 0; y < outHeight; y++) {
+        uint32_t y0 = std::min(y * 2, height - 1);
+        uint32_t y1 = std::min(y * 2 + 1, height - 1);
+        for (uint32_t x = 0; x < outWidth; x++) {
+            uint32_t x0 = std::min(x * 2, width - 1);
+            uint32_t x1 = std::min(x * 2 + 1, width - 1);
+            const uint8_t* texels[4] = {
+                &source[(static_cast<size_t>(y0) * width + x0) * 4],
+                &source[(static_cast<size_t>(y0) * width + x1) * 4],
+                &source[(static_cast<size_t>(y1) * width + x0) * 4],
+                &source[(static_cast<size_t>(y1) * width + x1) * 4]};
+            uint8_t* out =
+                &result[(static_cast<size_t>(y) * outWidth + x) * 4];
+            for (uint32_t c = 0; c < 3; c++) {
+                float sum = toLinear[texels[0][c]] + toLinear[texels[1][c]] +
+                            toLinear[texels[2][c]] + toLinear[texels[3][c]];
+                out[c] = linearToSrgb(sum * 0.25f);
+            }
+            // Alpha is stored linear
+            uint32_t alpha =
+                texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3];
+            out[3] = static_cast<uint8_t>((alpha + 2) / 4);
+        }
+    }
+    return result;
+}
+
+void TextureStreamer::init(VkDevice device, VkPhysicalDevice physicalDevice,
+                           VulkanRecovery* recovery,
+                           bool memoryBudgetSupported) {
+    this->device = device;
+    this->physicalDevice = physicalDevice;
+    this->recovery = recovery;
+    this->memoryBudgetSupported = memoryBudgetSupported;
+    heapAvailable = ~VkDeviceSize(0);
+    stats = TextureStreamingStats();
+    recovery->addEvictionCallback(
+        "texture streaming", [this](VkDeviceSize bytesNeeded) {
+            return evictForRecovery(bytesNeeded);
+        });
+}
+
+void TextureStreamer::cleanup() {
+    recovery->removeEvictionCallback("texture streaming");
+    cleanupFrameResources();
+    releaseRetired(true);
+    if (job.active) {
+        destroyLevelImage(job.image);
+    }
+    for (Texture& texture : textures) {
+        destroyLevelImage(texture.tail);
+        destroyLevelImage(texture.detail);
+        if (texture.tailStaging.buffer != VK_NULL_HANDLE) {
+            destroyMappedBuffer(texture.tailStaging);
+        }
+    }
+    textures.clear();
+    freeTextures.clear();
+    job = StreamJob();
+    uploads = FrameUploads();
+    frameNumber = 0;
+    scheduleIdle = true;
+    debugger.consoleMessage("Destroyed streamed textures", false);
+}
+
+TextureStreamer::MappedBuffer TextureStreamer::createMappedBuffer(
+    VkDeviceSize size, VkBufferUsageFlags usage) {
+    MappedBuffer result;
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    checkVulkanResult(
+        vkCreateBuffer(device, &bufferInfo, nullptr, &result.buffer),
+        "create texture streaming buffer");
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, result.buffer, &memRequirements);
+    checkVulkanResult(recovery->allocateMemory(
+                          memRequirements.size, memRequirements.memoryTypeBits,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          result.memory),
+                      "allocate texture streaming buffer memory");
+    vkBindBufferMemory(device, result.buffer, result.memory, 0);
+    vkMapMemory(device, result.memory, 0, size, 0, &result.mapped);
+    return result;
+}
+
+void TextureStreamer::destroyMappedBuffer(MappedBuffer& buffer) {
+    vkDestroyBuffer(device, buffer.buffer, nullptr);
+    vkFreeMemory(device, buffer.memory, nullptr);
+    buffer = MappedBuffer();
+}
+
+// The staging buffer is only written after the frame's fence, so one per
+// frame in flight is enough
+void TextureStreamer::createFrameResources(uint32_t framesInFlight) {
+    this->framesInFlight = framesInFlight;
+    VkDeviceSize stagingSize = std::max(uploadBudget, MIN_STAGING_SIZE);
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        stagingBuffers.push_back(createMappedBuffer(
+            stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT));
+        feedbackBuffers.push_back(createMappedBuffer(
+            getFeedbackBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+        memset(feedbackBuffers[i].mapped, 0xFF,
+               static_cast<size_t>(getFeedbackBufferSize()));
+    }
+    feedbackBaseLevels.assign(
+        framesInFlight, std::vector<uint32_t>(MAX_STREAMED_TEXTURES, 0));
+}
+
+void TextureStreamer::cleanupFrameResources() {
+    for (uint32_t i = 0; i < stagingBuffers.size(); i++) {
+        destroyMappedBuffer(stagingBuffers[i]);
+        destroyMappedBuffer(feedbackBuffers[i]);
+    }
+    stagingBuffers.clear();
+    feedbackBuffers.clear();
+    feedbackBaseLevels.clear();
+    framesInFlight = 0;
+}
+
+uint32_t TextureStreamer::residentLevel(const Texture& texture) const {
+    return texture.detail.image != VK_NULL_HANDLE ? texture.detail.firstLevel
+                                                  : texture.tailLevel;
+}
+
+VkDeviceSize TextureStreamer::levelBytes(const Texture& texture,
+                                         uint32_t level) const {
+    return static_cast<VkDeviceSize>(levelSize(texture.width, level)) *
+           levelSize(texture.height, level) * 4;
+}
+
+// Close to what the driver asks for, the real size is known once allocated
+VkDeviceSize TextureStreamer::estimateBytes(const Texture& texture,
+                                            uint32_t firstLevel) const {
+    VkDeviceSize bytes = 0;
+    for (uint32_t level = firstLevel; level < texture.levelCount; level++) {
+        bytes += levelBytes(texture, level);
+    }
+    return bytes;
+}
+
+// Build the mip chain and upload the tail, the finer levels wait for the
+// feedback to ask for them
+uint32_t TextureStreamer::addTexture(const uint8_t* pixels, uint32_t width,
+                                     uint32_t height, uint32_t lastLevel) {
+    if (textures.size() >= MAX_STREAMED_TEXTURES && freeTextures.empty()) {
+        debugger.consoleMessage("Too many streamed textures!", true);
+    }
+    Texture texture;
+    texture.width = width;
+    texture.height = height;
+    uint32_t fullChain = static_cast<uint32_t>(
+                             std::floor(std::log2(std::max(width, height)))) +
+                         1;
+    texture.levelCount = std::min(lastLevel + 1, fullChain);
+    texture.tailLevel = texture.levelCount - 1;
+    for (uint32_t level = 0; level < texture.levelCount; level++) {
+        if (std::max(levelSize(width, level), levelSize(height, level)) <=
+            TEXTURE_TAIL_SIZE) {
+            texture.tailLevel = level;
+            break;
+        }
+    }
+    texture.wantedLevel = texture.tailLevel;
+
+    {
+        PROFILE_ZONE("build mip chain");
+        texture.levels.resize(texture.levelCount);
+        texture.levels[0].assign(
+            pixels, pixels + static_cast<size_t>(width) * height * 4);
+        for (uint32_t level = 1; level < texture.levelCount; level++) {
+            texture.levels[level] =
+                downsample(texture.levels[level - 1],
+                           levelSize(width, level - 1),
+                           levelSize(height, level - 1));
+        }
+    }
+
+    if (!createLevelImage(texture, texture.tailLevel, texture.tail)) {
+        checkVulkanResult(VK_ERROR_OUT_OF_DEVICE_MEMORY,
+                          "allocate texture tail");
+    }
+    stats.residentBytes += texture.tail.size;
+
+    texture.tailStaging = createMappedBuffer(
+        estimateBytes(texture, texture.tailLevel),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    auto* staging = static_cast<uint8_t*>(texture.tailStaging.mapped);
+    for (uint32_t level = texture.tailLevel; level < texture.levelCount;
+         level++) {
+        memcpy(staging, texture.levels[level].data(),
+               texture.levels[level].size());
+        staging += texture.levels[level].size();
+    }
+
+    scheduleIdle = false;
+    if (!freeTextures.empty()) {
+        uint32_t slot = freeTextures.back();
+        freeTextures.pop_back();
+        textures[slot] = std::move(texture);
+        return slot;
+    }
+    textures.push_back(std::move(texture));
+    return static_cast<uint32_t>(textures.size() - 1);
+}
+
+// Frames already recorded may still sample it, so its images are retired
+// rather than destroyed. Call outside beginFrame and recordUploads
+void TextureStreamer::removeTexture(uint32_t texture) {
+    Texture& entry = textures[texture];
+    if (job.active && job.texture == texture) {
+        retire(job.image);
+        job = StreamJob();
+    }
+    if (uploads.image != VK_NULL_HANDLE && uploads.texture == texture) {
+        uploads = FrameUploads();
+    }
+    retire(entry.tail);
+    retire(entry.detail);
+    if (entry.tailStaging.buffer != VK_NULL_HANDLE) {
+        retire(entry.tailStaging);
+    }
+    // An empty entry has nothing to stream, it sits out until reused
+    entry = Texture();
+    freeTextures.push_back(texture);
+    scheduleIdle = false;
+}
+
+// Device local, with the levels from firstLevel to the last one
+bool TextureStreamer::createLevelImage(const Texture& texture,
+                                       uint32_t firstLevel,
+                                       LevelImage& image) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {levelSize(texture.width, firstLevel),
+                        levelSize(texture.height, firstLevel), 1};
+    imageInfo.mipLevels = texture.levelCount - firstLevel;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                      VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    checkVulkanResult(vkCreateImage(device, &imageInfo, nullptr, &image.image),
+                      "create streamed texture");
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, image.image, &memRequirements);
+    VkResult result = recovery->allocateMemory(
+        memRequirements.size, memRequirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image.memory);
+    if (result != VK_SUCCESS) {
+        vkDestroyImage(device, image.image, nullptr);
+        image = LevelImage();
+        LOG_WARNING("No memory to stream a texture from level {} ({})",
+                    firstLevel, vkResultName(result));
+        return false;
+    }
+    vkBindImageMemory(device, image.image, image.memory, 0);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = imageInfo.mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    checkVulkanResult(
+        vkCreateImageView(device, &viewInfo, nullptr, &image.view),
+        "create streamed texture view");
+
+    image.firstLevel = firstLevel;
+    image.size = memRequirements.size;
+    return true;
+}
+
+void TextureStreamer::destroyLevelImage(LevelImage& image) {
+    if (image.image == VK_NULL_HANDLE) return;
+    vkDestroyImageView(device, image.view, nullptr);
+    vkDestroyImage(device, image.image, nullptr);
+    vkFreeMemory(device, image.memory, nullptr);
+    image = LevelImage();
+}
+
+// Frames already recorded may still sample it, so it lives on until they
+// are done. It stops counting against the budget straight away
+void TextureStreamer::retire(LevelImage& image) {
+    if (image.image == VK_NULL_HANDLE) return;
+    stats.residentBytes -= image.size;
+    Retired entry;
+    entry.image = image;
+    entry.frame = frameNumber;
+    retired.push_back(entry);
+    image = LevelImage();
+}
+
+void TextureStreamer::retire(MappedBuffer& staging) {
+    Retired entry;
+    entry.staging = staging;
+    entry.frame = frameNumber;
+    retired.push_back(entry);
+    staging = MappedBuffer();
+}
+
+// Free what no frame in flight can still be using, or everything once the
+// device is idle
+void TextureStreamer::releaseRetired(bool everything) {
+    auto done = [&](Retired& entry) {
+        if (!everything && entry.frame + framesInFlight > frameNumber) {
+            return false;
+        }
+        destroyLevelImage(entry.image);
+        if (entry.staging.buffer != VK_NULL_HANDLE) {
+            destroyMappedBuffer(entry.staging);
+        }
+        return true;
+    };
+    retired.erase(std::remove_if(retired.begin(), retired.end(), done),
+                  retired.end());
+}
+
+VkImageView TextureStreamer::getView(uint32_t texture) const {
+    const Texture& entry = textures[texture];
+    return entry.detail.view != VK_NULL_HANDLE ? entry.detail.view
+                                               : entry.tail.view;
+}
+
+// Nothing uploading and every texture at the level it last asked for
+bool TextureStreamer::isIdle() const {
+    if (job.active || !scheduleIdle) return false;
+    for (const Texture& texture : textures) {
+        if (texture.tailStaging.buffer != VK_NULL_HANDLE) return false;
+    }
+    return true;
+}
+
+void TextureStreamer::beginFrame(uint32_t frame) {
+    PROFILE_FUNCTION();
+    currentFrame = frame;
+    frameNumber++;
+    stats.uploadedBytes = 0;
+    uploads = FrameUploads();
+
+    releaseRetired(false);
+    readFeedback(frame);
+    updateBudget();
+    scheduleJob();
+    advanceJob();
+
+    // Levels in the feedback are relative to what this frame binds
+    stats.pendingTextures = 0;
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        feedbackBaseLevels[frame][i] = residentLevel(textures[i]);
+        if (residentLevel(textures[i]) > textures[i].wantedLevel) {
+            stats.pendingTextures++;
+        }
+    }
+    PROFILE_COUNTER("textureResidentBytes", stats.residentBytes);
+    PROFILE_COUNTER("textureUploadedBytes", stats.uploadedBytes);
+}
+
+// The frame slot's fence has signalled, so the main pass that last ran in
+// it has written every slot it is going to
+void TextureStreamer::readFeedback(uint32_t frame) {
+    auto* feedback = static_cast<uint32_t*>(feedbackBuffers[frame].mapped);
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        if (feedback[i] == FEEDBACK_UNUSED) continue;
+        Texture& texture = textures[i];
+        int32_t level = static_cast<int32_t>(feedbackBaseLevels[frame][i]) +
+                        static_cast<int32_t>(feedback[i]) -
+                        FEEDBACK_LEVEL_OFFSET;
+        texture.wantedLevel = static_cast<uint32_t>(std::clamp(
+            level, 0, static_cast<int32_t>(texture.tailLevel)));
+        texture.lastUsedFrame = frameNumber;
+    }
+    memset(feedback, 0xFF, static_cast<size_t>(getFeedbackBufferSize()));
+}
+
+// Textures get what the heap budget leaves after everything else, and never
+// more than the configured budget
+void TextureStreamer::updateBudget() {
+    if (memoryBudgetSupported && frameNumber % BUDGET_QUERY_INTERVAL == 1) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT heapBudgets{};
+        heapBudgets.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties.pNext = &heapBudgets;
+        vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+
+        VkDeviceSize heapBudget = 0;
+        VkDeviceSize heapUsage = 0;
+        for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount;
+             i++) {
+            if (properties.memoryProperties.memoryHeaps[i].flags &
+                VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                heapBudget += heapBudgets.heapBudget[i];
+                heapUsage += heapBudgets.heapUsage[i];
+            }
+        }
+        VkDeviceSize others = heapUsage > stats.residentBytes
+                                  ? heapUsage - stats.residentBytes
+                                  : 0;
+        auto usable = static_cast<VkDeviceSize>(heapBudget * HEAP_BUDGET_SHARE);
+        heapAvailable = usable > others ? usable - others : 0;
+    }
+    stats.budgetBytes = std::min(budget, heapAvailable);
+}
+
+void TextureStreamer::scheduleJob() {
+    if (job.active) return;
+    scheduleIdle = false;
+
+    if (stats.residentBytes > stats.budgetBytes) {
+        // Least recently used first, then the biggest
+        Texture* victim = nullptr;
+        for (Texture& texture : textures) {
+            if (texture.detail.image == VK_NULL_HANDLE) continue;
+            if (!victim || texture.lastUsedFrame < victim->lastUsedFrame ||
+                (texture.lastUsedFrame == victim->lastUsedFrame &&
+                 texture.detail.size > victim->detail.size)) {
+                victim = &texture;
+            }
+        }
+        if (victim) {
+            stats.evictions++;
+            // Levels finer than it asked for go first, they cost nothing
+            uint32_t level =
+                std::max(residentLevel(*victim) + 1, victim->wantedLevel);
+            if (level >= victim->tailLevel) {
+                // The view falls back to the tail from the next lookup on
+                retire(victim->detail);
+            } else {
+                startJob(static_cast<uint32_t>(victim - textures.data()),
+                         level);
+            }
+            return;
+        }
+    }
+
+    // Textures seen most recently first, then the ones furthest off
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        if (textures[i].lastUsedFrame > 0 &&
+            residentLevel(textures[i]) > textures[i].wantedLevel) {
+            candidates.push_back(i);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [&](uint32_t a, uint32_t b) {
+                  const Texture& first = textures[a];
+                  const Texture& second = textures[b];
+                  if (first.lastUsedFrame != second.lastUsedFrame) {
+                      return first.lastUsedFrame > second.lastUsedFrame;
+                  }
+                  return residentLevel(first) - first.wantedLevel >
+                         residentLevel(second) - second.wantedLevel;
+              });
+
+    for (uint32_t candidate : candidates) {
+        const Texture& texture = textures[candidate];
+        uint32_t resident = residentLevel(texture);
+        VkDeviceSize others = stats.residentBytes - texture.detail.size;
+        uint32_t level = texture.wantedLevel;
+        while (level < resident &&
+               others + estimateBytes(texture, level) > stats.budgetBytes) {
+            level++;
+        }
+        if (level < resident) {
+            startJob(candidate, level);
+            return;
+        }
+    }
+    scheduleIdle = true;
+}
+
+// Start building a detail image from firstLevel. Levels the current image
+// already has are copied on the GPU, the rest are uploaded
+void TextureStreamer::startJob(uint32_t texture, uint32_t firstLevel) {
+    LevelImage image;
+    if (!createLevelImage(textures[texture], firstLevel, image)) {
+        // Hold at what is resident until the next budget query, rather than
+        // failing the same allocation every frame
+        heapAvailable = stats.residentBytes;
+        return;
+    }
+    job = StreamJob();
+    job.active = true;
+    job.texture = texture;
+    job.image = image;
+    job.copiedLevel = std::max(firstLevel, residentLevel(textures[texture]));
+    job.level = firstLevel;
+    stats.residentBytes += image.size;
+}
+
+// Stage as many rows as the upload budget allows, swapping the image in
+// once the last one is staged
+void TextureStreamer::advanceJob() {
+    if (!job.active) return;
+    Texture& texture = textures[job.texture];
+    uploads.texture = job.texture;
+    uploads.image = job.image.image;
+    uploads.firstLevel = job.image.firstLevel;
+    uploads.levelCount = texture.levelCount - job.image.firstLevel;
+    if (!job.copied) {
+        uploads.begin = true;
+        uploads.source = texture.detail.image != VK_NULL_HANDLE
+                             ? texture.detail
+                             : texture.tail;
+        uploads.copiedLevel = job.copiedLevel;
+        job.copied = true;
+    }
+
+    auto* staging = static_cast<uint8_t*>(stagingBuffers[currentFrame].mapped);
+    VkDeviceSize stagingSize = std::max(uploadBudget, MIN_STAGING_SIZE);
+    VkDeviceSize offset = 0;
+    while (job.level < job.copiedLevel) {
+        uint32_t width = levelSize(texture.width, job.level);
+        uint32_t height = levelSize(texture.height, job.level);
+        VkDeviceSize rowBytes = static_cast<VkDeviceSize>(width) * 4;
+        uint32_t rows = static_cast<uint32_t>(std::min<VkDeviceSize>(
+            height - job.row, (stagingSize - offset) / rowBytes));
+        if (rows == 0) break;
+
+        memcpy(staging + offset,
+               texture.levels[job.level].data() + job.row * rowBytes,
+               static_cast<size_t>(rows * rowBytes));
+        VkBufferImageCopy region{};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = job.level - job.image.firstLevel;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, static_cast<int32_t>(job.row), 0};
+        region.imageExtent = {width, rows, 1};
+        uploads.regions.push_back(region);
+
+        offset += rows * rowBytes;
+        job.row += rows;
+        if (job.row == height) {
+            job.level++;
+            job.row = 0;
+        }
+    }
+    stats.uploadedBytes = offset;
+
+    if (job.level == job.copiedLevel) {
+        // Recorded ahead of the main pass, so this frame already samples it
+        uploads.finish = true;
+        retire(texture.detail);
+        texture.detail = job.image;
+        job = StreamJob();
+    }
+}
+
+// Called from inside an allocation, possibly while a frame is recorded.
+// Only memory no recorded work refers to is given back, the budget is
+// lowered so the next frames evict the rest
+VkDeviceSize TextureStreamer::evictForRecovery(VkDeviceSize bytesNeeded) {
+    vkDeviceWaitIdle(device);
+    VkDeviceSize freed = 0;
+    auto unused = [&](Retired& entry) {
+        if (entry.frame >= frameNumber) return false;
+        freed += entry.image.size;
+        destroyLevelImage(entry.image);
+        if (entry.staging.buffer != VK_NULL_HANDLE) {
+            destroyMappedBuffer(entry.staging);
+        }
+        return true;
+    };
+    retired.erase(std::remove_if(retired.begin(), retired.end(), unused),
+                  retired.end());
+
+    // Nothing has been recorded into a job that has not copied yet
+    if (job.active && !job.copied) {
+        freed += job.image.size;
+        stats.residentBytes -= job.image.size;
+        destroyLevelImage(job.image);
+        job = StreamJob();
+    }
+
+    heapAvailable = stats.residentBytes > bytesNeeded
+                        ? stats.residentBytes - bytesNeeded
+                        : 0;
+    return freed;
+}
+
+void TextureStreamer::transitionLevels(
+    VkCommandBuffer commandBuffer, VkImage image, uint32_t firstLevel,
+    uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = firstLevel;
+    barrier.subresourceRange.levelCount = levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+}
+
+// New tails, then the job's copies from the image it replaces and its
+// uploads from staging
+void TextureStreamer::recordUploads(VkCommandBuffer commandBuffer) {
+    for (Texture& texture : textures) {
+        if (texture.tailStaging.buffer == VK_NULL_HANDLE) continue;
+        uint32_t levelCount = texture.levelCount - texture.tailLevel;
+        transitionLevels(commandBuffer, texture.tail.image, 0, levelCount,
+                         VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_WRITE_BIT);
+
+        std::vector<VkBufferImageCopy> regions(levelCount);
+        VkDeviceSize offset = 0;
+        for (uint32_t i = 0; i < levelCount; i++) {
+            uint32_t level = texture.tailLevel + i;
+            regions[i].bufferOffset = offset;
+            regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            regions[i].imageSubresource.mipLevel = i;
+            regions[i].imageSubresource.baseArrayLayer = 0;
+            regions[i].imageSubresource.layerCount = 1;
+            regions[i].imageExtent = {levelSize(texture.width, level),
+                                      levelSize(texture.height, level), 1};
+            offset += levelBytes(texture, level);
+        }
+        vkCmdCopyBufferToImage(commandBuffer, texture.tailStaging.buffer,
+                               texture.tail.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               levelCount, regions.data());
+
+        transitionLevels(commandBuffer, texture.tail.image, 0, levelCount,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_WRITE_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_SHADER_READ_BIT);
+        retire(texture.tailStaging);
+    }
+
+    if (uploads.image == VK_NULL_HANDLE) return;
+
+    if (uploads.begin) {
+        transitionLevels(commandBuffer, uploads.image, 0, uploads.levelCount,
+                         VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_WRITE_BIT);
+
+        // The source stays sampled by earlier frames, so it goes back to
+        // read only right after
+        const LevelImage& source = uploads.source;
+        uint32_t sourceLevel = uploads.copiedLevel - source.firstLevel;
+        uint32_t copyCount = uploads.levelCount -
+                             (uploads.copiedLevel - uploads.firstLevel);
+        transitionLevels(commandBuffer, source.image, sourceLevel, copyCount,
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_SHADER_READ_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_READ_BIT);
+
+        const Texture& texture = textures[uploads.texture];
+        std::vector<VkImageCopy> copies(copyCount);
+        for (uint32_t i = 0; i < copyCount; i++) {
+            uint32_t level = uploads.copiedLevel + i;
+            copies[i].srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,
+                                        sourceLevel + i, 0, 1};
+            copies[i].dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,
+                                        level - uploads.firstLevel, 0, 1};
+            copies[i].extent = {levelSize(texture.width, level),
+                                levelSize(texture.height, level), 1};
+        }
+        vkCmdCopyImage(commandBuffer, source.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, uploads.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copyCount,
+                       copies.data());
+
+        transitionLevels(commandBuffer, source.image, sourceLevel, copyCount,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_READ_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_SHADER_READ_BIT);
+    }
+
+    if (!uploads.regions.empty()) {
+        vkCmdCopyBufferToImage(
+            commandBuffer, stagingBuffers[currentFrame].buffer, uploads.image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(uploads.regions.size()),
+            uploads.regions.data());
+    }
+
+    if (uploads.finish) {
+        transitionLevels(commandBuffer, uploads.image, 0, uploads.levelCount,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_ACCESS_TRANSFER_WRITE_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_SHADER_READ_BIT);
+    }
+    uploads = FrameUploads();
+}
@@ -0,0 +1,240 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "vulkan_result.h"
+
+// Textures the usage feedback has room for, must match the lighting shader
+const uint32_t MAX_STREAMED_TEXTURES = 64;
+// Mips this size and smaller are uploaded with the texture and never evicted
+const uint32_t TEXTURE_TAIL_SIZE = 128;
+// Device local memory textures may use unless the heap budget is tighter
+const VkDeviceSize DEFAULT_TEXTURE_BUDGET = 256ull * 1024 * 1024;
+// Bytes copied from staging into textures per frame
+const VkDeviceSize DEFAULT_TEXTURE_UPLOAD_BUDGET = 8ull * 1024 * 1024;
+
+struct TextureStreamingStats {
+    // Device memory held by every texture, tails included
+    VkDeviceSize residentBytes = 0;
+    // What residentBytes has to stay under this frame
+    VkDeviceSize budgetBytes = 0;
+    // Copied from staging in the last frame
+    VkDeviceSize uploadedBytes = 0;
+    // Textures dropped to a coarser level to stay in budget, since init
+    uint64_t evictions = 0;
+    // Textures resident at a coarser level than they were last sampled at
+    uint32_t pendingTextures = 0;
+};
+
+// Streams texture mips in and out of device memory. Every texture starts
+// with only its tail, the mips up to TEXTURE_TAIL_SIZE, so loading is quick.
+// The main pass reports the finest level it sampled each texture at, and
+// finer levels are uploaded from the CPU copy a slice at a time, so one
+// frame never copies more than the upload budget. A texture's finer levels
+// live in one image that is rebuilt whenever its resident level changes and
+// swapped in once complete. Under the VRAM budget, queried through
+// VK_EXT_memory_budget when the device has it, the textures sampled least
+// recently are dropped back towards their tail
+class TextureStreamer {
+   public:
+    void init(VkDevice device, VkPhysicalDevice physicalDevice,
+              VulkanRecovery* recovery, bool memoryBudgetSupported);
+    void cleanup();
+
+    // Staging and usage feedback, one of each per frame in flight
+    void createFrameResources(uint32_t framesInFlight);
+    void cleanupFrameResources();
+
+    // Device memory textures may hold, the heap budget can lower it further.
+    // Call any time
+    void setBudget(VkDeviceSize bytes) { budget = bytes; }
+    // Call before createFrameResources
+    void setUploadBudget(VkDeviceSize bytes) { uploadBudget = bytes; }
+
+    // Register RGBA8 sRGB pixels and return the texture's slot. The mip
+    // chain is built here and kept on the CPU, levels past lastLevel are
+    // never built or sampled. The tail is uploaded by the next
+    // recordUploads
+    uint32_t addTexture(const uint8_t* pixels, uint32_t width,
+                        uint32_t height, uint32_t lastLevel);
+    // Free a texture once no frame in flight samples it. Its slot goes to
+    // a later addTexture
+    void removeTexture(uint32_t texture);
+
+    // Read back the usage this frame slot reported last time around, retire
+    // finished work and pick what to stream next. The frame's fence must
+    // have signalled
+    void beginFrame(uint32_t frame);
+
+    // Copy this frame's uploads into place. Record before anything samples
+    // the textures
+    void recordUploads(VkCommandBuffer commandBuffer);
+
+    // Levels resident this frame. Changes whenever streaming swaps images,
+    // so look it up every frame after beginFrame
+    VkImageView getView(uint32_t texture) const;
+    VkImageLayout getLayout() const {
+        return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    // Finest level sampled per slot, written by the main pass
+    VkBuffer getFeedbackBuffer(uint32_t frame) const {
+        return feedbackBuffers[frame].buffer;
+    }
+    VkDeviceSize getFeedbackBufferSize() const {
+        return sizeof(uint32_t) * MAX_STREAMED_TEXTURES;
+    }
+
+    // Nothing uploading and every texture at the level it last asked for
+    bool isIdle() const;
+
+    const TextureStreamingStats& getStats() const { return stats; }
+
+   private:
+    // Host visible buffer, mapped for its whole life
+    struct MappedBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+    };
+
+    // Levels firstLevel to the texture's last level
+    struct LevelImage {
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        uint32_t firstLevel = 0;
+        VkDeviceSize size = 0;
+    };
+
+    struct Texture {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // Levels 0 to levelCount - 1 can be sampled
+        uint32_t levelCount = 0;
+        uint32_t tailLevel = 0;
+        // CPU copy of every level, what uploads are made from
+        std::vector<std::vector<uint8_t>> levels;
+        LevelImage tail;
+        // Finer levels on top of the tail, empty while they are evicted
+        LevelImage detail;
+        // Tail pixels waiting for the first recordUploads
+        MappedBuffer tailStaging;
+        // Finest level the feedback saw it sampled at
+        uint32_t wantedLevel = 0;
+        uint64_t lastUsedFrame = 0;
+    };
+
+    // A texture's next detail image, filled over one or more frames
+    struct StreamJob {
+        bool active = false;
+        uint32_t texture = 0;
+        LevelImage image;
+        // Levels from here on are copied from the image being replaced,
+        // the ones before it are uploaded
+        uint32_t copiedLevel = 0;
+        bool copied = false;
+        // Next level and row to upload
+        uint32_t level = 0;
+        uint32_t row = 0;
+    };
+
+    // What beginFrame decided recordUploads should copy into the job's
+    // image. Tails are found by their staging buffers
+    struct FrameUploads {
+        uint32_t texture = 0;
+        VkImage image = VK_NULL_HANDLE;
+        uint32_t firstLevel = 0;
+        uint32_t levelCount = 0;
+        // The image is new this frame, so its layout is set up and the
+        // levels from copiedLevel on come from source
+        bool begin = false;
+        LevelImage source;
+        uint32_t copiedLevel = 0;
+        std::vector<VkBufferImageCopy> regions;
+        // Every level is in, move the image to be sampled
+        bool finish = false;
+    };
+
+    // Freed once the frames that may still use it have finished
+    struct Retired {
+        LevelImage image;
+        MappedBuffer staging;
+        uint64_t frame = 0;
+    };
+
+    MappedBuffer createMappedBuffer(VkDeviceSize size,
+                                    VkBufferUsageFlags usage);
+    void destroyMappedBuffer(MappedBuffer& buffer);
+    // Returns false if there was no memory for it
+    bool createLevelImage(const Texture& texture, uint32_t firstLevel,
+                          LevelImage& image);
+    void destroyLevelImage(LevelImage& image);
+    void transitionLevels(VkCommandBuffer commandBuffer, VkImage image,
+                          uint32_t firstLevel, uint32_t levelCount,
+                          VkImageLayout oldLayout, VkImageLayout newLayout,
+                          VkPipelineStageFlags srcStage,
+                          VkAccessFlags srcAccess,
+                          VkPipelineStageFlags dstStage,
+                          VkAccessFlags dstAccess);
+    void retire(LevelImage& image);
+    void retire(MappedBuffer& staging);
+    void releaseRetired(bool everything);
+
+    uint32_t residentLevel(const Texture& texture) const;
+    VkDeviceSize levelBytes(const Texture& texture, uint32_t level) const;
+    // Device memory a detail image starting at firstLevel would take
+    VkDeviceSize estimateBytes(const Texture& texture,
+                               uint32_t firstLevel) const;
+
+    void readFeedback(uint32_t frame);
+    void updateBudget();
+    // Pick a job if none is running. Over budget the least recently used
+    // texture gives up a level, otherwise the most recently used one short
+    // of its level gets as close to it as the budget allows
+    void scheduleJob();
+    void startJob(uint32_t texture, uint32_t firstLevel);
+    // Fill the staging buffer with the job's next rows
+    void advanceJob();
+    // Out of memory callback, gives back what nothing recorded this frame
+    // uses
+    VkDeviceSize evictForRecovery(VkDeviceSize bytesNeeded);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VulkanRecovery* recovery = nullptr;
+    bool memoryBudgetSupported = false;
+
+    VkDeviceSize budget = DEFAULT_TEXTURE_BUDGET;
+    VkDeviceSize uploadBudget = DEFAULT_TEXTURE_UPLOAD_BUDGET;
+
+    std::vector<Texture> textures;
+    // Slots of removed textures, reused before the list grows
+    std::vector<uint32_t> freeTextures;
+    StreamJob job;
+    FrameUploads uploads;
+    std::vector<Retired> retired;
+    // Nothing left to start the last time a job was looked for
+    bool scheduleIdle = true;
+    // What the heap budget leaves for textures, refreshed now and then
+    VkDeviceSize heapAvailable = ~VkDeviceSize(0);
+
+    uint32_t framesInFlight = 0;
+    uint32_t currentFrame = 0;
+    // Counts beginFrame calls, stamps usage and retired images
+    uint64_t frameNumber = 0;
+    std::vector<MappedBuffer> stagingBuffers;
+    std::vector<MappedBuffer> feedbackBuffers;
+    // Resident level of every texture when the frame slot was recorded, the
+    // shader reports levels relative to it
+    std::vector<std::vector<uint32_t>> feedbackBaseLevels;
+
+    TextureStreamingStats stats;
+};
+
+#endif
@@ -1,6 +1,26 @@
 #include "vulkan_context.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "thirdparty/stb/stb_image.h"
+
+// Virtual directory every compiled shader is read from, the VFS maps it to
+// SHADER_PATH or a pack
+const std::string SHADER_DIR = "shaders/";
+
+// Read together at the start of initVulkan, by their virtual paths. The
+// textures are cooked, see tools/asset_cooker
+const std::vector<std::string> CONTEXT_ASSET_FILES = {
+    "textures/dennis.tex", "textures/viking_room.tex", "models/dennis.obj",
+    "models/viking_room.obj"};
+
+// Model and texture of each mesh id, in the order Scene numbers them
+struct MeshAsset {
+    const char* model;
+    const char* texture;
+};
+const std::array<MeshAsset, LOADED_MESH_COUNT> MESH_ASSETS = {
+    {{"models/dennis.obj", "textures/dennis.tex"},
+     {"models/viking_room.obj", "textures/viking_room.tex"}}};
+// Part of every mesh's cache key, change it with the import flags in
+// Mesh3D::load. Textures are cooked with their settings already applied
+const char* MESH_LOAD_SETTINGS = "triangulate,flip_uvs,smooth_normals";
 
 // Grab the SDL2 window from the display server
 void VulkanContext::setWindow(SDL_Window* window) { this->window = window; }
@@ -9,44 +29,116 @@ void VulkanContext::setWindow(SDL_Window* window) { this->window = window; }
 void VulkanContext::initVulkan() {
     debugger.consoleMessage("Begin initializing Vulkan...", false);
 
-    if (window == NULL) {
+    if (window == NULL && !headless) {
         debugger.consoleMessage(
             "Cannot initialize Vulkan because window is NULL!", true);
     }
+    assetFiles = VirtualFileSystem::get().readAsync(CONTEXT_ASSET_FILES);
     createInstance();
     setupDebugMessenger();
     createSurface();
     pickPhysicalDevice();
     createLogicalDevice();
+    recovery.init(device, physicalDevice);
+    renderGraph.init(device, physicalDevice);
+    renderGraph.setRecovery(&recovery);
     createSwapchain();
     createImageViews();
     createRenderPass();
     createDescriptorSetLayout();
     createGraphicsPipeline();
+    createPostProcessPasses();
+    createGpuCulling();
+    createClusteredLighting();
     createCommandPool();
     createColorResources();
     createDepthResources();
+    buildRenderGraph();
     createFramebuffers();
-    createTextureImage();
-    createTextureImage2();
-    createTextureImageView();
-    createTextureImageView2();
+    textureStreamer.init(device, physicalDevice, &recovery,
+                         memoryBudgetSupported);
     createTextureSampler();
-    createTextureSampler2();
-    loadModel();
-    loadModel2();
-    createVertexBuffer();
-    createVertexBuffer2();
-    createIndexBuffer();
-    createIndexBuffer2();
+    createAssetCaches();
+    loadMeshAssets();
+    assetFiles.reset();
+    createShadowCascades();
+    createFrameResources();
+    renderGraph.setProfiler(&gpuProfiler);
+    initialized = true;
+};
+
+// Everything duplicated per frame in flight
+void VulkanContext::createFrameResources() {
     createUniformBuffers();
-    createUniformBuffers2();
+    createTransformBuffers();
+    createInstanceBuffers();
+    gpuCulling.createFrameResources(framesInFlight, MAX_OBJECT_TRANSFORMS,
+                                    LOADED_MESH_COUNT);
+    clusteredLighting.createFrameResources(framesInFlight, MAX_POINT_LIGHTS);
+    shadowCascades.createFrameResources(framesInFlight, MAX_OBJECT_TRANSFORMS);
+    textureStreamer.createFrameResources(framesInFlight);
     createDescriptorPool();
-    createDescriptorSets();
-    createDescriptorSets2();
     createCommandBuffers();
     createSyncObjects();
-};
+    gpuProfiler.init(device, physicalDevice,
+                     findQueueFamilies(physicalDevice).graphicsFamily.value(),
+                     framesInFlight,
+                     pipelineStatisticsSupported &&
+                         (enableValidationLayers ||
+                          pipelineStatisticsRequested));
+}
+
+// Destroy everything duplicated per frame in flight
+void VulkanContext::cleanupFrameResources() {
+    for (size_t i = 0; i < framesInFlight; i++) {
+        vkDestroyBuffer(device, uniformBuffers[i], nullptr);
+        debugger.consoleMessage("Destroyed Vulkan uniform buffer", false);
+        vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+        debugger.consoleMessage("Freed Vulkan uniform buffer memory", false);
+    }
+    debugger.consoleMessage(
+        "Destroyed and freed all Vulkan uniform buffers and memory", false);
+
+    for (size_t i = 0; i < framesInFlight; i++) {
+        vkDestroyBuffer(device, transformBuffers[i], nullptr);
+        vkFreeMemory(device, transformBuffersMemory[i], nullptr);
+    }
+    debugger.consoleMessage(
+        "Destroyed and freed all Vulkan transform buffers and memory", false);
+
+    for (size_t i = 0; i < framesInFlight; i++) {
+        vkDestroyBuffer(device, instanceBuffers[i], nullptr);
+        vkFreeMemory(device, instanceBuffersMemory[i], nullptr);
+    }
+    debugger.consoleMessage(
+        "Destroyed and freed all Vulkan instance buffers and memory", false);
+    gpuCulling.cleanupFrameResources();
+    clusteredLighting.cleanupFrameResources();
+    shadowCascades.cleanupFrameResources();
+    textureStreamer.cleanupFrameResources();
+
+    for (auto& frameAllocator : frameDescriptorAllocators) {
+        frameAllocator.cleanup();
+    }
+
+    for (size_t i = 0; i < framesInFlight; i++) {
+        vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+        debugger.consoleMessage("Destroyed Vulkan render finished semaphore",
+                                false);
+        vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+        debugger.consoleMessage("Destroyed Vulkan image available semaphore",
+                                false);
+        vkDestroyFence(device, inFlightFences[i], nullptr);
+        debugger.consoleMessage("Destroyed Vulkan in flight fence", false);
+    }
+    debugger.consoleMessage("Destroyed all Vulkan semaphores and fences\n",
+                            false);
+
+    vkFreeCommandBuffers(device, commandPool,
+                         static_cast<uint32_t>(commandBuffers.size()),
+                         commandBuffers.data());
+    gpuProfiler.cleanup();
+}
 
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"};
@@ -80,6 +172,15 @@ bool VulkanContext::checkValidationLayerSupport() {
 
 // Get the required extensions for the Vulkan instance
 std::vector<const char*> VulkanContext::getRequiredExtensions() {
+    // Without a window we need no surface extensions at all
+    if (headless) {
+        std::vector<const char*> extensions;
+        if (enableValidationLayers) {
+            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+        }
+        return extensions;
+    }
+
     uint32_t extensionCount = 0;
 
     SDL_bool extensionResult =
@@ -176,14 +277,17 @@ QueueFamilyIndices VulkanContext::findQueueFamilies(VkPhysicalDevice device) {
             indices.graphicsFamily = i;
         }
 
-        VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-                                             &presentSupport);
+        // Nothing is presented when headless, and there is no surface to ask
+        if (!headless) {
+            VkBool32 presentSupport = false;
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                                 &presentSupport);
 
-        if (presentSupport) {
-            indices.presentFamily = i;
+            if (presentSupport) {
+                indices.presentFamily = i;
+            }
         }
-        if (indices.isComplete()) {
+        if (indices.isComplete(headless)) {
             break;
         }
         i++;
@@ -195,6 +299,15 @@ QueueFamilyIndices VulkanContext::findQueueFamilies(VkPhysicalDevice device) {
 const std::vector<const char*> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
+// Device extensions we need, the swapchain is skipped when headless
+std::vector<const char*> VulkanContext::getDeviceExtensions() {
+    std::vector<const char*> extensions;
+    if (!headless) {
+        extensions = deviceExtensions;
+    }
+    return extensions;
+}
+
 // Check to make sure the physical device has the required extensions
 bool VulkanContext::checkDeviceExtensionSupport(VkPhysicalDevice device) {
     uint32_t extensionCount;
@@ -205,8 +318,9 @@ bool VulkanContext::checkDeviceExtensionSupport(VkPhysicalDevice device) {
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                          availableExtensions.data());
 
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                             deviceExtensions.end());
+    std::vector<const char*> extensions = getDeviceExtensions();
+    std::set<std::string> requiredExtensions(extensions.begin(),
+                                             extensions.end());
 
     for (const auto& extension : availableExtensions) {
         requiredExtensions.erase(extension.extensionName);
@@ -251,8 +365,8 @@ bool VulkanContext::isDeviceSuitable(VkPhysicalDevice device) {
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-    bool swapchainAdequate = false;
-    if (extensionsSupported) {
+    bool swapchainAdequate = headless;
+    if (extensionsSupported && !headless) {
         SwapchainSupportDetails swapchainSupport =
             querySwapchainSupport(device);
         swapchainAdequate = !swapchainSupport.formats.empty() &&
@@ -262,8 +376,10 @@ bool VulkanContext::isDeviceSuitable(VkPhysicalDevice device) {
     VkPhysicalDeviceFeatures supportedFeatures;
     vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-    return indices.isComplete() && extensionsSupported && swapchainAdequate &&
-           supportedFeatures.samplerAnisotropy;
+    // Texture streaming feedback is written from the fragment shader
+    return indices.isComplete(headless) && extensionsSupported &&
+           swapchainAdequate && supportedFeatures.samplerAnisotropy &&
+           supportedFeatures.fragmentStoresAndAtomics;
 }
 
 // Get the desired surface format
@@ -281,12 +397,75 @@ VkSurfaceFormatKHR VulkanContext::chooseSwapSurfaceFormat(
 // Get the desired present mode
 VkPresentModeKHR VulkanContext::chooseSwapPresentMode(
     const std::vector<VkPresentModeKHR>& availablePresentModes) {
-    for (const auto& availablePresentMode : availablePresentModes) {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            return availablePresentMode;
+    auto available = [&](VkPresentModeKHR mode) {
+        return std::find(availablePresentModes.begin(),
+                         availablePresentModes.end(),
+                         mode) != availablePresentModes.end();
+    };
+
+    // Without tearing support, mailbox is the closest to immediate. FIFO is
+    // the only mode every driver has to support
+    VkPresentModeKHR chosen = VK_PRESENT_MODE_FIFO_KHR;
+    if (available(requestedPresentMode)) {
+        chosen = requestedPresentMode;
+    } else if (requestedPresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR &&
+               available(VK_PRESENT_MODE_MAILBOX_KHR)) {
+        chosen = VK_PRESENT_MODE_MAILBOX_KHR;
+    }
+
+    if (chosen != requestedPresentMode) {
+        LOG_WARNING("Present mode {} is not supported, using {}",
+                    presentModeName(requestedPresentMode),
+                    presentModeName(chosen));
+    } else {
+        LOG_INFO("Using present mode {}", presentModeName(chosen));
+    }
+    return chosen;
+}
+
+// Name of a present mode for logs and the command line
+const char* presentModeName(VkPresentModeKHR mode) {
+    switch (mode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:
+            return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR:
+            return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR:
+            return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+            return "fifo-relaxed";
+        default:
+            return "unknown";
+    }
+}
+
+// off, msaa2, msaa4, msaa8 or fxaa
+const char* antiAliasingName(AntiAliasingMode mode) {
+    switch (mode) {
+        case AntiAliasingMode::Off:
+            return "off";
+        case AntiAliasingMode::Msaa2x:
+            return "msaa2";
+        case AntiAliasingMode::Msaa4x:
+            return "msaa4";
+        case AntiAliasingMode::Msaa8x:
+            return "msaa8";
+        case AntiAliasingMode::Fxaa:
+            return "fxaa";
+        default:
+            return "unknown";
+    }
+}
+
+bool parseAntiAliasing(const std::string& name, AntiAliasingMode& mode) {
+    for (uint32_t i = 0; i < ANTI_ALIASING_MODE_COUNT; i++) {
+        AntiAliasingMode candidate = static_cast<AntiAliasingMode>(i);
+        if (name == antiAliasingName(candidate)) {
+            mode = candidate;
+            return true;
         }
     }
-    return VK_PRESENT_MODE_FIFO_KHR;
+    return false;
 }
 
 // Get the desired swap extent
@@ -317,46 +496,65 @@ VkExtent2D VulkanContext::chooseSwapExtent(
 void VulkanContext::cleanupSwapchain() {
     debugger.consoleMessage("\nBegin cleaning up swapchain...", false);
 
-    vkDestroyImageView(device, colorImageView, nullptr);
-    vkDestroyImage(device, colorImage, nullptr);
-    vkFreeMemory(device, colorImageMemory, nullptr);
-
-    vkDestroyImageView(device, depthImageView, nullptr);
-    vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
+    renderGraph.reset();
+    gpuCulling.cleanupPyramid();
+    fxaaPass.cleanupTargets();
+    upscalePass.cleanupTargets();
     for (auto framebuffer : swapchainFramebuffers) {
         vkDestroyFramebuffer(device, framebuffer, nullptr);
-        debugger.consoleMessage("Destroyed Vulkan framebuffer", false);
+        LOG_VERBOSE("Destroyed Vulkan framebuffer");
     }
+    vkDestroyFramebuffer(device, depthPrepassFramebuffer, nullptr);
+    depthPrepassFramebuffer = VK_NULL_HANDLE;
     debugger.consoleMessage("Destroyed all Vulkan framebuffers\n", false);
 
     for (auto imageView : swapchainImageViews) {
         vkDestroyImageView(device, imageView, nullptr);
-        debugger.consoleMessage("Destroyed Vulkan image view", false);
+        LOG_VERBOSE("Destroyed Vulkan image view");
     }
     debugger.consoleMessage("Destroyed all Vulkan image views", false);
 
+    if (headless) {
+        for (size_t i = 0; i < swapchainImages.size(); i++) {
+            vkDestroyImage(device, swapchainImages[i], nullptr);
+            vkFreeMemory(device, offscreenImageMemory[i], nullptr);
+        }
+        vkDestroyBuffer(device, readbackBuffer, nullptr);
+        vkFreeMemory(device, readbackBufferMemory, nullptr);
+        debugger.consoleMessage("Destroyed offscreen images\n", false);
+        return;
+    }
+
     vkDestroySwapchainKHR(device, swapchain, nullptr);
     debugger.consoleMessage("Destroyed Vulkan swap chain\n", false);
 }
 
-// Read in a file and return the buffer
+// Read in a file through the virtual file system and return the buffer
 std::vector<char> VulkanContext::readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()) {
-        debugger.consoleMessage("Failed to open file!", true);
+    std::vector<uint8_t> data;
+    if (!VirtualFileSystem::get().readFile(filename, data)) {
+        debugger.consoleMessage(("Failed to open " + filename + "!").c_str(),
+                                true);
     }
+    return std::vector<char>(data.begin(), data.end());
+}
 
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
-
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-
-    file.close();
-
-    return buffer;
+// Waits for the batch, or reads the file if the batch does not have it.
+// Throws if the file could not be read
+std::vector<uint8_t>& VulkanContext::getAssetFile(const std::string& path) {
+    if (assetFiles) {
+        assetFiles->wait();
+        for (size_t i = 0; i < assetFiles->size(); i++) {
+            if (assetFiles->getPath(i) != path) continue;
+            if (!assetFiles->succeeded(i)) break;
+            return assetFiles->getData(i);
+        }
+    }
+    if (!VirtualFileSystem::get().readFile(path, assetFile)) {
+        debugger.consoleMessage(("Failed to read " + path + "!").c_str(),
+                                true);
+    }
+    return assetFile;
 }
 
 // Create a shader module from a buffer
@@ -368,12 +566,10 @@ VkShaderModule VulkanContext::createShaderModule(
     createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
     VkShaderModule shaderModule;
-    if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create shader module!", true);
-    } else {
-        debugger.consoleMessage("Successfully created shader module", false);
-    }
+    checkVulkanResult(vkCreateShaderModule(device, &createInfo, nullptr,
+                                           &shaderModule),
+                      "create shader module");
+    debugger.consoleMessage("Successfully created shader module", false);
     return shaderModule;
 }
 
@@ -417,11 +613,9 @@ void VulkanContext::createInstance() {
         createInfo.pNext = nullptr;
     }
 
-    if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create Vulkan instance!", true);
-    } else {
-        debugger.consoleMessage("Successfully created Vulkan instance", false);
-    }
+    checkVulkanResult(vkCreateInstance(&createInfo, nullptr, &instance),
+                      "create Vulkan instance");
+    debugger.consoleMessage("Successfully created Vulkan instance", false);
 }
 
 // If debug mode, create the debug messenger
@@ -433,17 +627,15 @@ void VulkanContext::setupDebugMessenger() {
     VkDebugUtilsMessengerCreateInfoEXT createInfo;
     populateDebugMessengerCreateInfo(createInfo);
 
-    if (createDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
-                                     &debugMessenger) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create Vulkan debug messenger!",
-                                true);
-    } else {
-        debugger.consoleMessage("Successfully created Vulkan debug messenger",
-                                false);
-    }
+    checkVulkanResult(createDebugUtilsMessengerEXT(instance, &createInfo,
+                                                   nullptr, &debugMessenger),
+                      "create Vulkan debug messenger");
+    debugger.consoleMessage("Successfully created Vulkan debug messenger",
+                            false);
 }
 
 void VulkanContext::createSurface() {
+    if (headless) return;
     debugger.consoleMessage("\nBegin creating Vulkan surface...", false);
     SDL_bool surfaceResult =
         SDL_Vulkan_CreateSurface(window, instance, &surface);
@@ -476,7 +668,8 @@ void VulkanContext::pickPhysicalDevice() {
     for (const auto& device : devices) {
         if (isDeviceSuitable(device)) {
             physicalDevice = device;
-            msaaSamples = getMaxUsableSampleCount();
+            maxMsaaSamples = getMaxUsableSampleCount();
+            msaaSamples = sampleCountFor(antiAliasing);
             break;
         }
     }
@@ -493,8 +686,10 @@ void VulkanContext::createLogicalDevice() {
     QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
-                                              indices.presentFamily.value()};
+    std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value()};
+    if (!headless) {
+        uniqueQueueFamilies.insert(indices.presentFamily.value());
+    }
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -509,6 +704,14 @@ void VulkanContext::createLogicalDevice() {
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
     deviceFeatures.sampleRateShading = VK_TRUE;
+    deviceFeatures.fragmentStoresAndAtomics = VK_TRUE;
+
+    // Only needed by the GPU profiler, so turn it on when we can
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery;
+    deviceFeatures.pipelineStatisticsQuery =
+        supportedFeatures.pipelineStatisticsQuery;
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -519,9 +722,25 @@ void VulkanContext::createLogicalDevice() {
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.enabledExtensionCount =
-        static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    std::vector<const char*> extensions = getDeviceExtensions();
+
+    // Optional, lets us report how much device memory is in use
+    uint32_t availableCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                         &availableCount, nullptr);
+    std::vector<VkExtensionProperties> available(availableCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                         &availableCount, available.data());
+    for (const auto& extension : available) {
+        if (strcmp(extension.extensionName,
+                   VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            memoryBudgetSupported = true;
+            extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+    }
+
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     if (enableValidationLayers) {
         createInfo.enabledLayerCount =
@@ -531,18 +750,22 @@ void VulkanContext::createLogicalDevice() {
         createInfo.enabledLayerCount = 0;
     }
 
-    if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create logical device!", true);
-    } else {
-        debugger.consoleMessage("Successfully created logical device", false);
-    }
+    checkVulkanResult(vkCreateDevice(physicalDevice, &createInfo, nullptr,
+                                     &device), "create logical device");
+    debugger.consoleMessage("Successfully created logical device", false);
 
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-    vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    if (!headless) {
+        vkGetDeviceQueue(device, indices.presentFamily.value(), 0,
+                         &presentQueue);
+    }
 }
 
 void VulkanContext::createSwapchain() {
+    if (headless) {
+        createOffscreenTargets();
+        return;
+    }
     debugger.consoleMessage("\nBegin creating swapchain...", false);
 
     SwapchainSupportDetails swapchainSupport =
@@ -586,14 +809,12 @@ void VulkanContext::createSwapchain() {
     createInfo.preTransform = swapchainSupport.capabilities.currentTransform;
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
+    activePresentMode = presentMode;
     createInfo.clipped = VK_TRUE;
 
-    if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create swap chain!", true);
-    } else {
-        debugger.consoleMessage("Successfully created swap chain", false);
-    }
+    checkVulkanResult(vkCreateSwapchainKHR(device, &createInfo, nullptr,
+                                           &swapchain), "create swap chain");
+    debugger.consoleMessage("Successfully created swap chain", false);
 
     vkGetSwapchainImagesKHR(device, swapchain, &imageCount, nullptr);
     swapchainImages.resize(imageCount);
@@ -619,13 +840,9 @@ VkImageView VulkanContext::createImageView(VkImage image, VkFormat format,
     viewInfo.subresourceRange.layerCount = 1;
 
     VkImageView imageView;
-    if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create texture image view!", true);
-    } else {
-        debugger.consoleMessage("Successfully created texture image view",
-                                false);
-    }
+    checkVulkanResult(vkCreateImageView(device, &viewInfo, nullptr, &imageView),
+                      "create texture image view");
+    debugger.consoleMessage("Successfully created texture image view", false);
     return imageView;
 }
 
@@ -662,7 +879,17 @@ void VulkanContext::createImageViews() {
     debugger.consoleMessage("Successfully created all image views", false);
 }
 
+// The main render pass, its depth pre-pass variant and the depth only pass.
+// They share attachment formats and sample counts, so the main framebuffers
+// work with either main variant
 void VulkanContext::createRenderPass() {
+    renderPass = createMainRenderPass(false);
+    depthTestedRenderPass = createMainRenderPass(true);
+    createDepthPrepassRenderPass();
+}
+
+// With the pre-pass, depth is loaded and only tested, never written
+VkRenderPass VulkanContext::createMainRenderPass(bool depthPrepass) {
     debugger.consoleMessage("\nBegin creating render pass...", false);
     VkAttachmentDescription colorAttachment{};
     colorAttachment.format = swapchainImageFormat;
@@ -671,7 +898,8 @@ void VulkanContext::createRenderPass() {
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // The render graph moves every attachment into and out of these layouts
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentDescription colorAttachmentResolve{};
@@ -681,8 +909,10 @@ void VulkanContext::createRenderPass() {
     colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachmentResolve.initialLayout =
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachmentResolve.finalLayout =
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentResolveRef{};
     colorAttachmentResolveRef.attachment = 2;
@@ -695,23 +925,31 @@ void VulkanContext::createRenderPass() {
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = findDepthFormat();
     depthAttachment.samples = msaaSamples;
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.loadOp = depthPrepass ? VK_ATTACHMENT_LOAD_OP_LOAD
+                                          : VK_ATTACHMENT_LOAD_OP_CLEAR;
+    // Kept for the depth pyramid that occlusion culling reads next frame
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout =
-        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    // The render graph puts depth in the read only layout when the main pass
+    // only tests against the pre-pass
+    VkImageLayout depthLayout =
+        depthPrepass ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+                     : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.initialLayout = depthLayout;
+    depthAttachment.finalLayout = depthLayout;
 
     VkAttachmentReference depthAttachmentRef{};
     depthAttachmentRef.attachment = 1;
-    depthAttachmentRef.layout =
-        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachmentRef.layout = depthLayout;
 
+    // Without MSAA the color attachment is already the final image
+    bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
-    subpass.pResolveAttachments = &colorAttachmentResolveRef;
+    subpass.pResolveAttachments =
+        resolve ? &colorAttachmentResolveRef : nullptr;
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
@@ -723,26 +961,78 @@ void VulkanContext::createRenderPass() {
     dependency.srcAccessMask = 0;
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
                               VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
-                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        (depthPrepass ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+                      : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
 
     std::array<VkAttachmentDescription, 3> attachments = {
         colorAttachment, depthAttachment, colorAttachmentResolve};
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.attachmentCount = resolve ? 3 : 2;
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
     renderPassInfo.dependencyCount = 1;
     renderPassInfo.pDependencies = &dependency;
 
-    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create render pass!", true);
-    } else {
-        debugger.consoleMessage("Successfully created render pass", false);
-    }
+    VkRenderPass mainRenderPass = VK_NULL_HANDLE;
+    checkVulkanResult(vkCreateRenderPass(device, &renderPassInfo, nullptr,
+                                         &mainRenderPass),
+                      "create render pass");
+    debugger.consoleMessage("Successfully created render pass", false);
+    return mainRenderPass;
+}
+
+// Depth only, cleared and stored for the main pass to test against
+void VulkanContext::createDepthPrepassRenderPass() {
+    debugger.consoleMessage("\nBegin creating depth pre-pass render pass...",
+                            false);
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = findDepthFormat();
+    depthAttachment.samples = msaaSamples;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 0;
+    depthAttachmentRef.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 0;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    VkSubpassDependency dependency{};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &depthAttachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
+
+    checkVulkanResult(vkCreateRenderPass(device, &renderPassInfo, nullptr,
+                                         &depthPrepassRenderPass),
+                      "create depth pre-pass render pass");
+    debugger.consoleMessage(
+        "Successfully created depth pre-pass render pass", false);
 }
 
 void VulkanContext::createDescriptorSetLayout() {
@@ -762,28 +1052,119 @@ void VulkanContext::createDescriptorSetLayout() {
     samplerLayoutBinding.pImmutableSamplers = nullptr;
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
-        uboLayoutBinding, samplerLayoutBinding};
+    VkDescriptorSetLayoutBinding transformLayoutBinding{};
+    transformLayoutBinding.binding = 2;
+    transformLayoutBinding.descriptorCount = 1;
+    transformLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    transformLayoutBinding.pImmutableSamplers = nullptr;
+    transformLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorSetLayoutBinding instanceLayoutBinding{};
+    instanceLayoutBinding.binding = 3;
+    instanceLayoutBinding.descriptorCount = 1;
+    instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instanceLayoutBinding.pImmutableSamplers = nullptr;
+    instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorSetLayoutBinding visibleLayoutBinding{};
+    visibleLayoutBinding.binding = 4;
+    visibleLayoutBinding.descriptorCount = 1;
+    visibleLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    visibleLayoutBinding.pImmutableSamplers = nullptr;
+    visibleLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    // Lighting parameters, the lights and the cluster lists, written by
+    // ClusteredLighting, then the shadow map and the shadow parameters
+    const VkDescriptorType lightingTypes[] = {
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER};
+    VkDescriptorSetLayoutBinding lightingLayoutBindings[6]{};
+    for (uint32_t i = 0; i < 6; i++) {
+        lightingLayoutBindings[i].binding = 5 + i;
+        lightingLayoutBindings[i].descriptorCount = 1;
+        lightingLayoutBindings[i].descriptorType = lightingTypes[i];
+        lightingLayoutBindings[i].pImmutableSamplers = nullptr;
+        lightingLayoutBindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
+
+    // Finest mip sampled per texture, read back by TextureStreamer
+    VkDescriptorSetLayoutBinding feedbackLayoutBinding{};
+    feedbackLayoutBinding.binding = 11;
+    feedbackLayoutBinding.descriptorCount = 1;
+    feedbackLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    feedbackLayoutBinding.pImmutableSamplers = nullptr;
+    feedbackLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    std::array<VkDescriptorSetLayoutBinding, 12> bindings = {
+        uboLayoutBinding,          samplerLayoutBinding,
+        transformLayoutBinding,    instanceLayoutBinding,
+        visibleLayoutBinding,      lightingLayoutBindings[0],
+        lightingLayoutBindings[1], lightingLayoutBindings[2],
+        lightingLayoutBindings[3], lightingLayoutBindings[4],
+        lightingLayoutBindings[5], feedbackLayoutBinding};
 
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
     layoutInfo.pBindings = bindings.data();
 
-    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
-                                    &descriptorSetLayout) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create descriptor set layout!",
-                                true);
-    } else {
-        debugger.consoleMessage("Successfully created descriptor set layout",
-                                false);
+    checkVulkanResult(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                                  &descriptorSetLayout),
+                      "create descriptor set layout");
+    debugger.consoleMessage("Successfully created descriptor set layout",
+                            false);
+}
+
+// Load the culling compute shaders and build its pipelines
+void VulkanContext::createGpuCulling() {
+    GpuCullingShaders shaders;
+    shaders.cull = createShaderModule(readFile(SHADER_DIR + "cull.spv"));
+    shaders.depthReduce =
+        createShaderModule(readFile(SHADER_DIR + "depth_pyramid_reduce.spv"));
+    shaders.depthReduceMultisample = createShaderModule(
+        readFile(SHADER_DIR + "depth_pyramid_reduce_ms.spv"));
+    shaders.downsample = createShaderModule(
+        readFile(SHADER_DIR + "depth_pyramid_downsample.spv"));
+
+    gpuCulling.init(device, &recovery, shaders);
+
+    vkDestroyShaderModule(device, shaders.cull, nullptr);
+    vkDestroyShaderModule(device, shaders.depthReduce, nullptr);
+    vkDestroyShaderModule(device, shaders.depthReduceMultisample, nullptr);
+    vkDestroyShaderModule(device, shaders.downsample, nullptr);
+}
+
+// Load the caster shader, build the shadow pipeline and hand it the meshes
+void VulkanContext::createShadowCascades() {
+    VkShaderModule vertexShader = createShaderModule(
+        readFile(SHADER_DIR + "shadow.spv"));
+    shadowCascades.init(device, &recovery, findDepthFormat(), vertexShader,
+                        sizeof(Vertex));
+    vkDestroyShaderModule(device, vertexShader, nullptr);
+
+    std::vector<ShadowMesh> meshes(LOADED_MESH_COUNT);
+    for (uint32_t mesh = 0; mesh < LOADED_MESH_COUNT; mesh++) {
+        const GpuMesh& gpuMesh = getMesh(mesh);
+        meshes[mesh] = {gpuMesh.vertexBuffer, gpuMesh.indexBuffer,
+                        gpuMesh.indexCount, gpuMesh.bounds};
     }
+    shadowCascades.setMeshes(meshes);
+}
+
+// Load the light binning compute shader and build its pipeline
+void VulkanContext::createClusteredLighting() {
+    VkShaderModule binShader = createShaderModule(
+        readFile(SHADER_DIR + "light_cluster.spv"));
+    clusteredLighting.init(device, &recovery, binShader);
+    vkDestroyShaderModule(device, binShader, nullptr);
 }
 
 void VulkanContext::createGraphicsPipeline() {
     debugger.consoleMessage("\nBegin creating graphics pipeline...", false);
-    auto vertShaderCode = readFile("build/drivers/vulkan/shaders/vert.spv");
-    auto fragShaderCode = readFile("build/drivers/vulkan/shaders/frag.spv");
+    auto vertShaderCode = readFile(SHADER_DIR + "vert.spv");
+    auto fragShaderCode = readFile(SHADER_DIR + "frag.spv");
 
     VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
     VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
@@ -876,14 +1257,18 @@ void VulkanContext::createGraphicsPipeline() {
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-
-    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
-                               &pipelineLayout) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create pipeline layout!", true);
-    } else {
-        debugger.consoleMessage("Successfully created pipeline layout", false);
-    }
+    // Streaming slot of the texture being drawn, for the usage feedback
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(uint32_t);
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    checkVulkanResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo,
+                                             nullptr, &pipelineLayout),
+                      "create pipeline layout");
+    debugger.consoleMessage("Successfully created pipeline layout", false);
 
     VkPipelineDepthStencilStateCreateInfo depthStencil{};
     depthStencil.sType =
@@ -915,18 +1300,93 @@ void VulkanContext::createGraphicsPipeline() {
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                  nullptr, &graphicsPipeline) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create graphics pipeline!", true);
-    } else {
-        debugger.consoleMessage("Successfully created graphics pipeline",
-                                false);
-    }
+    checkVulkanResult(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                                &pipelineInfo, nullptr,
+                                                &graphicsPipeline),
+                      "create graphics pipeline");
+    debugger.consoleMessage("Successfully created graphics pipeline", false);
+
+    // After the depth pre-pass depth is already final, so only fragments on
+    // the nearest surface pass and nothing needs writing
+    depthStencil.depthWriteEnable = VK_FALSE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    pipelineInfo.renderPass = depthTestedRenderPass;
+
+    checkVulkanResult(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                                &pipelineInfo, nullptr,
+                                                &depthEqualPipeline),
+                      "create depth equal pipeline");
+    debugger.consoleMessage("Successfully created depth equal pipeline", false);
+
+    // The pre-pass itself only needs positions, no fragment shader and no
+    // color attachment
+    auto depthShaderCode = readFile(SHADER_DIR + "depth_prepass.spv");
+    VkShaderModule depthShaderModule = createShaderModule(depthShaderCode);
+
+    VkPipelineShaderStageCreateInfo depthShaderStageInfo = vertShaderStageInfo;
+    depthShaderStageInfo.module = depthShaderModule;
+
+    // Position is the first attribute
+    vertexInputInfo.vertexAttributeDescriptionCount = 1;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    colorBlending.attachmentCount = 0;
+    colorBlending.pAttachments = nullptr;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+    pipelineInfo.stageCount = 1;
+    pipelineInfo.pStages = &depthShaderStageInfo;
+    pipelineInfo.renderPass = depthPrepassRenderPass;
+
+    checkVulkanResult(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                                &pipelineInfo, nullptr,
+                                                &depthPrepassPipeline),
+                      "create depth pre-pass pipeline");
+    debugger.consoleMessage("Successfully created depth pre-pass pipeline",
+                            false);
 
+    vkDestroyShaderModule(device, depthShaderModule, nullptr);
     vkDestroyShaderModule(device, fragShaderModule, nullptr);
     vkDestroyShaderModule(device, vertShaderModule, nullptr);
 }
 
+// Pipelines and render passes depend on the sample count
+void VulkanContext::cleanupGraphicsPipelines() {
+    vkDestroyPipeline(device, graphicsPipeline, nullptr);
+    vkDestroyPipeline(device, depthEqualPipeline, nullptr);
+    vkDestroyPipeline(device, depthPrepassPipeline, nullptr);
+    debugger.consoleMessage("Destroyed Vulkan graphics pipeline", false);
+
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    debugger.consoleMessage("Destroyed Vulkan graphics pipeline layout", false);
+
+    vkDestroyRenderPass(device, renderPass, nullptr);
+    vkDestroyRenderPass(device, depthTestedRenderPass, nullptr);
+    vkDestroyRenderPass(device, depthPrepassRenderPass, nullptr);
+    debugger.consoleMessage("Destroyed Vulkan render pass\n", false);
+}
+
+// Load the full screen shaders and build the FXAA and upscale pipelines.
+// Both write the swapchain format, which stays the same across swapchain
+// rebuilds
+void VulkanContext::createPostProcessPasses() {
+    VkShaderModule vertexShader =
+        createShaderModule(readFile(SHADER_DIR + "fullscreen.spv"));
+    VkShaderModule fxaaShader =
+        createShaderModule(readFile(SHADER_DIR + "fxaa.spv"));
+    VkShaderModule upscaleShader =
+        createShaderModule(readFile(SHADER_DIR + "upscale.spv"));
+
+    fxaaPass.init(device, "FXAA", swapchainImageFormat, vertexShader,
+                  fxaaShader, sizeof(FxaaConstants));
+    upscalePass.init(device, "upscale", swapchainImageFormat, vertexShader,
+                     upscaleShader, sizeof(UpscaleConstants));
+
+    vkDestroyShaderModule(device, vertexShader, nullptr);
+    vkDestroyShaderModule(device, fxaaShader, nullptr);
+    vkDestroyShaderModule(device, upscaleShader, nullptr);
+}
+
 void VulkanContext::createFramebuffers() {
     debugger.consoleMessage("\nBegin creating framebuffers...", false);
     swapchainFramebuffers.resize(swapchainImageViews.size());
@@ -934,8 +1394,24 @@ void VulkanContext::createFramebuffers() {
     for (size_t i = 0; i < swapchainImageViews.size(); i++) {
         // VkImageView attachments[] = {swapchainImageViews[i]};
 
-        std::array<VkImageView, 3> attachments = {
-            colorImageView, depthImageView, swapchainImageViews[i]};
+        // MSAA resolves into the scene color if post-processing reads it or
+        // else the swapchain image. Without MSAA the main pass draws into
+        // either of them directly
+        std::vector<VkImageView> attachments;
+        if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+            attachments = {
+                renderGraph.getImageView(colorTarget),
+                renderGraph.getImageView(depthTarget),
+                sceneColorTarget != INVALID_RENDER_GRAPH_HANDLE
+                    ? renderGraph.getImageView(sceneColorTarget)
+                    : swapchainImageViews[i]};
+        } else if (sceneColorTarget != INVALID_RENDER_GRAPH_HANDLE) {
+            attachments = {renderGraph.getImageView(sceneColorTarget),
+                           renderGraph.getImageView(depthTarget)};
+        } else {
+            attachments = {swapchainImageViews[i],
+                           renderGraph.getImageView(depthTarget)};
+        }
 
         VkFramebufferCreateInfo framebufferInfo{};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -947,13 +1423,26 @@ void VulkanContext::createFramebuffers() {
         framebufferInfo.height = swapchainExtent.height;
         framebufferInfo.layers = 1;
 
-        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr,
-                                &swapchainFramebuffers[i]) != VK_SUCCESS) {
-            debugger.consoleMessage("Failed to create framebuffer!", true);
-        } else {
-            debugger.consoleMessage("Successfully created framebuffer", false);
-        }
-    }
+        checkVulkanResult(vkCreateFramebuffer(device, &framebufferInfo, nullptr,
+                                              &swapchainFramebuffers[i]),
+                          "create framebuffer");
+        debugger.consoleMessage("Successfully created framebuffer", false);
+    }
+
+    // Depth is the same image every frame, so the pre-pass needs only one
+    VkImageView depthView = renderGraph.getImageView(depthTarget);
+    VkFramebufferCreateInfo depthFramebufferInfo{};
+    depthFramebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    depthFramebufferInfo.renderPass = depthPrepassRenderPass;
+    depthFramebufferInfo.attachmentCount = 1;
+    depthFramebufferInfo.pAttachments = &depthView;
+    depthFramebufferInfo.width = swapchainExtent.width;
+    depthFramebufferInfo.height = swapchainExtent.height;
+    depthFramebufferInfo.layers = 1;
+
+    checkVulkanResult(vkCreateFramebuffer(device, &depthFramebufferInfo,
+                                          nullptr, &depthPrepassFramebuffer),
+                      "create depth pre-pass framebuffer");
     debugger.consoleMessage("Successfully created all framebuffers", false);
 }
 
@@ -966,27 +1455,23 @@ void VulkanContext::createCommandPool() {
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create command pool!", true);
-    } else {
-        debugger.consoleMessage("Successfully created command pool", false);
-    }
+    checkVulkanResult(vkCreateCommandPool(device, &poolInfo, nullptr,
+                                          &commandPool), "create command pool");
+    debugger.consoleMessage("Successfully created command pool", false);
 }
 
 void VulkanContext::createDepthResources() {
     debugger.consoleMessage("\nBegin creating depth resources...", false);
-    VkFormat depthFormat = findDepthFormat();
-    createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSamples,
-                depthFormat, VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage,
-                depthImageMemory);
-    depthImageView =
-        createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-
-    transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+    RenderGraphImageDesc desc{};
+    desc.width = swapchainExtent.width;
+    desc.height = swapchainExtent.height;
+    desc.format = findDepthFormat();
+    desc.samples = msaaSamples;
+    // The depth pyramid for occlusion culling is built from it
+    desc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                 VK_IMAGE_USAGE_SAMPLED_BIT;
+    desc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    depthTarget = renderGraph.createImage("depth", desc);
 }
 
 VkFormat VulkanContext::findSupportedFormat(
@@ -1022,234 +1507,198 @@ VkFormat VulkanContext::findDepthFormat() {
         {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
          VK_FORMAT_D24_UNORM_S8_UINT},
         VK_IMAGE_TILING_OPTIMAL,
-        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 }
 
+// Only the anti-aliasing mode and upscaling in use get intermediate color
+// images. They are always swapchain sized, dynamic resolution only uses part
+// of them
 void VulkanContext::createColorResources() {
-    VkFormat colorFormat = swapchainImageFormat;
-
-    createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSamples,
-                colorFormat, VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
-                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage,
-                colorImageMemory);
-    colorImageView =
-        createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
-}
-
-void VulkanContext::createTextureImage() {
-    debugger.consoleMessage("\nBegin creating texture image...", false);
-    int texWidth, texHeight, texChannels;
-    // stbi_uc* pixels = stbi_load(
-    //     (std::string(ASSET_PATH) + "/textures/ape-escape-cover.jpg").c_str(),
-    //     &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    stbi_uc* pixels =
-        stbi_load((std::string(ASSET_PATH) + "/textures/dennis.jpg").c_str(),
-                  &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-
-    if (!pixels) {
-        debugger.consoleMessage("Failed to load texture image!", true);
+    colorTarget = INVALID_RENDER_GRAPH_HANDLE;
+    sceneColorTarget = INVALID_RENDER_GRAPH_HANDLE;
+    antiAliasedTarget = INVALID_RENDER_GRAPH_HANDLE;
+
+    RenderGraphImageDesc desc{};
+    desc.width = swapchainExtent.width;
+    desc.height = swapchainExtent.height;
+    desc.format = swapchainImageFormat;
+    desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+        desc.samples = msaaSamples;
+        desc.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
+                     VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        colorTarget = renderGraph.createImage("color", desc);
+    }
+
+    bool fxaa = antiAliasing == AntiAliasingMode::Fxaa;
+    desc.samples = VK_SAMPLE_COUNT_1_BIT;
+    desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                 VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (fxaa || dynamicResolutionEnabled) {
+        sceneColorTarget = renderGraph.createImage("scene color", desc);
+    }
+    // FXAA runs at the render resolution, before the upscale
+    if (fxaa && dynamicResolutionEnabled) {
+        antiAliasedTarget = renderGraph.createImage("anti-aliased color", desc);
+    }
+}
+
+// Import the swapchain, add the passes and compile the graph
+void VulkanContext::buildRenderGraph() {
+    updateRenderExtent();
+    // Offscreen images are never presented, so leave them where the last
+    // pass put them
+    backbuffer = renderGraph.importImage(
+        "backbuffer", swapchainImages[0], swapchainImageViews[0],
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+        headless ? VK_IMAGE_LAYOUT_UNDEFINED
+                 : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+    // Streamed textures live outside the graph, the pass leaves every one
+    // it touches ready for sampling
+    renderGraph.addPass("texture streaming")
+        .sideEffect()
+        .execute([this](VkCommandBuffer commandBuffer) {
+            textureStreamer.recordUploads(commandBuffer);
+        });
+
+    // Only touches buffers and the pyramid, which live outside the graph
+    renderGraph.addPass("cull")
+        .sideEffect()
+        .execute([this](VkCommandBuffer commandBuffer) {
+            gpuCulling.recordCull(commandBuffer);
+        });
+
+    // Fills the cluster lists the main pass shades with
+    renderGraph.addPass("light binning")
+        .sideEffect()
+        .execute([this](VkCommandBuffer commandBuffer) {
+            clusteredLighting.recordBinning(commandBuffer);
+        });
+
+    // The shadow map lives outside the graph, the pass moves its layouts
+    // itself and leaves it ready for the main pass to sample
+    renderGraph.addPass("shadows")
+        .sideEffect()
+        .execute([this](VkCommandBuffer commandBuffer) {
+            shadowCascades.recordShadows(commandBuffer);
+        });
+
+    if (depthPrepassEnabled) {
+        renderGraph.addPass("depth prepass")
+            .write(depthTarget, RenderGraphAccess::DepthAttachmentWrite)
+            .execute([this](VkCommandBuffer commandBuffer) {
+                recordDepthPrepass(commandBuffer);
+            });
+    }
+
+    // With the pre-pass depth is only tested, so it stays read only
+    RenderGraph::PassBuilder mainPass = renderGraph.addPass("main");
+    if (colorTarget != INVALID_RENDER_GRAPH_HANDLE) {
+        mainPass.write(colorTarget, RenderGraphAccess::ColorAttachmentWrite);
+    }
+    if (sceneColorTarget != INVALID_RENDER_GRAPH_HANDLE) {
+        mainPass.write(sceneColorTarget,
+                       RenderGraphAccess::ColorAttachmentWrite);
     } else {
-        debugger.consoleMessage("Successfully loaded texture image", false);
+        mainPass.write(backbuffer, RenderGraphAccess::ColorAttachmentWrite);
     }
-
-    mipLevels = static_cast<uint32_t>(
-                    std::floor(std::log2(std::max(texWidth, texHeight)))) +
-                1;
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
-    stbi_image_free(pixels);
-
-    createImage(
-        texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT,
-        VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-            VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-    copyBufferToImage(stagingBuffer, textureImage,
-                      static_cast<uint32_t>(texWidth),
-                      static_cast<uint32_t>(texHeight));
-    // transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-    //                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    //                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-    //                       mipLevels);
-    generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight,
-                    mipLevels);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
-
-void VulkanContext::createTextureImage2() {
-    debugger.consoleMessage("\nBegin creating texture image 2...", false);
-    int texWidth, texHeight, texChannels;
-    // stbi_uc* pixels = stbi_load(
-    //     (std::string(ASSET_PATH) + "/textures/ape-escape-cover.jpg").c_str(),
-    //     &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    stbi_uc* pixels =
-        stbi_load((std::string(ASSET_PATH) + "/textures/viking_room.png").c_str(),
-                  &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-
-    if (!pixels) {
-        debugger.consoleMessage("Failed to load texture image 2!", true);
+    if (depthPrepassEnabled) {
+        mainPass.read(depthTarget, RenderGraphAccess::DepthAttachmentRead);
     } else {
-        debugger.consoleMessage("Successfully loaded texture image 2", false);
+        mainPass.write(depthTarget, RenderGraphAccess::DepthAttachmentWrite);
+    }
+    mainPass.execute([this](VkCommandBuffer commandBuffer) {
+        recordMainPass(commandBuffer);
+    });
+
+    // FXAA goes straight to the backbuffer unless it still has to be
+    // upscaled
+    RenderGraphHandle upscaleInput = sceneColorTarget;
+    if (antiAliasing == AntiAliasingMode::Fxaa) {
+        RenderGraphHandle fxaaOutput =
+            antiAliasedTarget != INVALID_RENDER_GRAPH_HANDLE
+                ? antiAliasedTarget
+                : backbuffer;
+        renderGraph.addPass("fxaa")
+            .read(sceneColorTarget, RenderGraphAccess::FragmentSampledRead)
+            .write(fxaaOutput, RenderGraphAccess::ColorAttachmentWrite)
+            .execute([this](VkCommandBuffer commandBuffer) {
+                FxaaConstants constants{};
+                constants.inverseSize =
+                    glm::vec2(1.0f / swapchainExtent.width,
+                              1.0f / swapchainExtent.height);
+                constants.uvScale =
+                    glm::vec2(renderExtent.width * constants.inverseSize.x,
+                              renderExtent.height * constants.inverseSize.y);
+                // The anti-aliased color is a single output image
+                bool upscaled =
+                    antiAliasedTarget != INVALID_RENDER_GRAPH_HANDLE;
+                fxaaPass.record(commandBuffer,
+                                upscaled ? 0 : currentImageIndex,
+                                renderExtent, &constants);
+            });
+        upscaleInput = antiAliasedTarget;
+    }
+
+    if (dynamicResolutionEnabled) {
+        renderGraph.addPass("upscale")
+            .read(upscaleInput, RenderGraphAccess::FragmentSampledRead)
+            .write(backbuffer, RenderGraphAccess::ColorAttachmentWrite)
+            .execute([this](VkCommandBuffer commandBuffer) {
+                UpscaleConstants constants{};
+                constants.inverseSize =
+                    glm::vec2(1.0f / swapchainExtent.width,
+                              1.0f / swapchainExtent.height);
+                constants.uvScale =
+                    glm::vec2(renderExtent.width * constants.inverseSize.x,
+                              renderExtent.height * constants.inverseSize.y);
+                // Sharpen harder the more detail the lower scale lost, and
+                // not at all at full resolution
+                constants.sharpness =
+                    std::clamp(2.0f * (1.0f - constants.uvScale.x), 0.0f,
+                               1.0f);
+                upscalePass.record(commandBuffer, currentImageIndex,
+                                   swapchainExtent, &constants);
+            });
+    }
+
+    // Next frame's cull pass tests against this frame's depth
+    renderGraph.addPass("depth pyramid")
+        .read(depthTarget, RenderGraphAccess::ComputeSampledRead)
+        .sideEffect()
+        .execute([this](VkCommandBuffer commandBuffer) {
+            gpuCulling.recordPyramid(commandBuffer);
+        });
+
+    if (headless) {
+        renderGraph.addPass("readback")
+            .read(backbuffer, RenderGraphAccess::TransferRead)
+            .sideEffect()
+            .execute([this](VkCommandBuffer commandBuffer) {
+                recordReadbackPass(commandBuffer);
+            });
+    }
+
+    renderGraph.compile();
+    gpuCulling.createPyramid(swapchainExtent,
+                             renderGraph.getImageView(depthTarget),
+                             msaaSamples);
+    if (antiAliasing == AntiAliasingMode::Fxaa) {
+        std::vector<VkImageView> fxaaOutputs = swapchainImageViews;
+        if (antiAliasedTarget != INVALID_RENDER_GRAPH_HANDLE) {
+            fxaaOutputs = {renderGraph.getImageView(antiAliasedTarget)};
+        }
+        fxaaPass.createTargets(swapchainExtent,
+                               renderGraph.getImageView(sceneColorTarget),
+                               fxaaOutputs);
     }
-
-    mipLevels2 = static_cast<uint32_t>(
-                    std::floor(std::log2(std::max(texWidth, texHeight)))) +
-                1;
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
-    stbi_image_free(pixels);
-
-    createImage(
-        texWidth, texHeight, mipLevels2, VK_SAMPLE_COUNT_1_BIT,
-        VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-            VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage2, textureImageMemory2);
-
-    transitionImageLayout(textureImage2, VK_FORMAT_R8G8B8A8_SRGB,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels2);
-    copyBufferToImage(stagingBuffer, textureImage2,
-                      static_cast<uint32_t>(texWidth),
-                      static_cast<uint32_t>(texHeight));
-    // transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-    //                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    //                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-    //                       mipLevels);
-    generateMipmaps(textureImage2, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight,
-                    mipLevels2);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
-
-void VulkanContext::generateMipmaps(VkImage image, VkFormat imageFormat,
-                                    int32_t texWidth, int32_t texHeight,
-                                    uint32_t mipLevels) {
-    VkFormatProperties formatProperties;
-    vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat,
-                                        &formatProperties);
-
-    if (!(formatProperties.optimalTilingFeatures &
-          VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-        debugger.consoleMessage(
-            "Texture image format does not support linear blitting!", true);
+    if (dynamicResolutionEnabled) {
+        upscalePass.createTargets(swapchainExtent,
+                                  renderGraph.getImageView(upscaleInput),
+                                  swapchainImageViews);
     }
-
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
-    int32_t mipWidth = texWidth;
-    int32_t mipHeight = texHeight;
-
-    for (uint32_t i = 1; i < mipLevels; i++) {
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
-                             nullptr, 1, &barrier);
-
-        VkImageBlit blit{};
-        blit.srcOffsets[0] = {0, 0, 0};
-        blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.srcSubresource.mipLevel = i - 1;
-        blit.srcSubresource.baseArrayLayer = 0;
-        blit.srcSubresource.layerCount = 1;
-        blit.dstOffsets[0] = {0, 0, 0};
-        blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1,
-                              mipHeight > 1 ? mipHeight / 2 : 1, 1};
-        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.dstSubresource.mipLevel = i;
-        blit.dstSubresource.baseArrayLayer = 0;
-        blit.dstSubresource.layerCount = 1;
-
-        vkCmdBlitImage(
-            commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
-                             nullptr, 0, nullptr, 1, &barrier);
-
-        if (mipWidth > 1) mipWidth /= 2;
-        if (mipHeight > 1) mipHeight /= 2;
-    }
-
-    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
-                         0, nullptr, 1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
-}
-
-void VulkanContext::createTextureImageView() {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                                       VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
-}
-
-void VulkanContext::createTextureImageView2() {
-    textureImageView2 = createImageView(textureImage2, VK_FORMAT_R8G8B8A8_SRGB,
-                                       VK_IMAGE_ASPECT_COLOR_BIT, mipLevels2);
 }
 
 VkSampleCountFlagBits VulkanContext::getMaxUsableSampleCount() {
@@ -1303,131 +1752,109 @@ void VulkanContext::createTextureSampler() {
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = static_cast<float>(mipLevels / 2);
+    // Each texture's view only holds the levels it may sample
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    checkVulkanResult(vkCreateSampler(device, &samplerInfo, nullptr,
+                                      &textureSampler),
+                      "create texture sampler");
+    debugger.consoleMessage("Successfully created texture sampler", false);
+}
+
+// Evicted meshes wait out the frames in flight before their buffers go.
+// The streamer retires texture images the same way, so evicted textures
+// are handed back to it at the next frame
+void VulkanContext::createAssetCaches() {
+    meshCache.init(
+        [this](GpuMesh& mesh) {
+            vkDestroyBuffer(device, mesh.vertexBuffer, nullptr);
+            vkFreeMemory(device, mesh.vertexBufferMemory, nullptr);
+            vkDestroyBuffer(device, mesh.indexBuffer, nullptr);
+            vkFreeMemory(device, mesh.indexBufferMemory, nullptr);
+        },
+        MESH_CACHE_BUDGET, framesInFlight);
+    textureCache.init(
+        [this](GpuTexture& texture) {
+            textureStreamer.removeTexture(texture.slot);
+        },
+        TEXTURE_CACHE_BUDGET, 0);
+}
+
+AssetHandle<GpuMesh> VulkanContext::loadMesh(const std::string& path) {
+    AssetHandle<GpuMesh> handle = meshCache.acquire(
+        makeAssetKey(path, MESH_LOAD_SETTINGS),
+        [&](GpuMesh& mesh, uint64_t& bytes) {
+            std::string format = std::filesystem::path(path).extension();
+            if (!format.empty()) format.erase(0, 1);
+            Mesh3D model;
+            if (!model.load(getAssetFile(path), format) ||
+                model.indices.empty()) {
+                return false;
+            }
 
-    if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create texture sampler!", true);
-    } else {
-        debugger.consoleMessage("Successfully created texture sampler", false);
+            VkDeviceSize vertexBytes = sizeof(Vertex) * model.vertices.size();
+            VkDeviceSize indexBytes = sizeof(uint32_t) * model.indices.size();
+            createDeviceBuffer(model.vertices.data(), vertexBytes,
+                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                               mesh.vertexBuffer, mesh.vertexBufferMemory);
+            createDeviceBuffer(model.indices.data(), indexBytes,
+                               VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                               mesh.indexBuffer, mesh.indexBufferMemory);
+            mesh.indexCount = static_cast<uint32_t>(model.indices.size());
+            mesh.bounds = model.bounds;
+            bytes = vertexBytes + indexBytes;
+            return true;
+        });
+    if (!handle.isValid()) {
+        debugger.consoleMessage(("Failed to load mesh " + path + "!").c_str(),
+                                true);
     }
+    return handle;
 }
 
-void VulkanContext::createTextureSampler2() {
-    debugger.consoleMessage("\nBegin creating texture sampler...", false);
-    VkSamplerCreateInfo samplerInfo{};
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-
-    VkPhysicalDeviceProperties properties{};
-    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
-
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerInfo.mipLodBias = 0.0f;
-    samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = static_cast<float>(mipLevels2 / 2);
+AssetHandle<GpuTexture> VulkanContext::loadTexture(const std::string& path) {
+    AssetHandle<GpuTexture> handle = textureCache.acquire(
+        makeAssetKey(path, ""), [&](GpuTexture& texture, uint64_t& bytes) {
+            CookedTextureHeader header;
+            std::vector<uint8_t> pixels;
+            if (!readCookedTexture(getAssetFile(path), header, pixels)) {
+                return false;
+            }
 
-    if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler2) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create texture sampler!", true);
-    } else {
-        debugger.consoleMessage("Successfully created texture sampler", false);
+            // Only the tail is uploaded now, the rest streams in once it is
+            // seen. The cooker picked the coarsest level worth building
+            texture.slot = textureStreamer.addTexture(
+                pixels.data(), header.width, header.height,
+                header.lastLevel);
+            // The streamer keeps the mip chain on the CPU, a third more than
+            // the top level
+            bytes = uint64_t(header.width) * header.height * 4 * 4 / 3;
+            return true;
+        });
+    if (!handle.isValid()) {
+        debugger.consoleMessage(
+            ("Failed to load texture " + path + "!").c_str(), true);
     }
+    return handle;
 }
 
-void VulkanContext::loadModel() {
-    const aiScene* scene = importer.ReadFile(
-        (std::string(ASSET_PATH) + "/models/dennis.obj").c_str(),
-        aiProcess_Triangulate | aiProcess_FlipUVs);
+// Ids sharing a model or texture share the loaded asset
+void VulkanContext::loadMeshAssets() {
+    for (uint32_t mesh = 0; mesh < LOADED_MESH_COUNT; mesh++) {
+        meshAssets[mesh] = loadMesh(MESH_ASSETS[mesh].model);
+        textureAssets[mesh] = loadTexture(MESH_ASSETS[mesh].texture);
+    }
+}
 
-
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
-        !scene->mRootNode) {
-        debugger.consoleMessage("Failed to load model!", true);
-    } else {
-        debugger.consoleMessage("Successfully loaded model", false);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-
-    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
-        const aiMesh* mesh = scene->mMeshes[i];
-
-        for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
-            Vertex vertex{};
-            vertex.pos = {mesh->mVertices[j].x, mesh->mVertices[j].y,
-                          mesh->mVertices[j].z};
-            vertex.texCoord = {mesh->mTextureCoords[0][j].x,
-                               mesh->mTextureCoords[0][j].y};
-            vertex.color = {1.0f, 1.0f, 1.0f};
-
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                vertices.push_back(vertex);
-            }
-
-            indices.push_back(uniqueVertices[vertex]);
-        }
-
-        /*for (unsigned int j = 0; j < mesh->mNumFaces; j++) {
-            const aiFace& face = mesh->mFaces[j];
-            indices.push_back(face.mIndices[0]);
-            indices.push_back(face.mIndices[1]);
-            indices.push_back(face.mIndices[2]);
-        }*/
-    }
-}
-
-void VulkanContext::loadModel2() {
-    const aiScene* scene = importer.ReadFile(
-        (std::string(ASSET_PATH) + "/models/viking_room.obj").c_str(),
-        aiProcess_Triangulate | aiProcess_FlipUVs);
-
-
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
-        !scene->mRootNode) {
-        debugger.consoleMessage("Failed to load model!", true);
-    } else {
-        debugger.consoleMessage("Successfully loaded model", false);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-
-    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
-        const aiMesh* mesh = scene->mMeshes[i];
-
-        for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
-            Vertex vertex{};
-            vertex.pos = {mesh->mVertices[j].x, mesh->mVertices[j].y,
-                          mesh->mVertices[j].z};
-            vertex.texCoord = {mesh->mTextureCoords[0][j].x,
-                               mesh->mTextureCoords[0][j].y};
-            vertex.color = {1.0f, 1.0f, 1.0f};
-
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(vertices2.size());
-                vertices2.push_back(vertex);
-            }
-
-            indices2.push_back(uniqueVertices[vertex]);
+// The assets stay cached until the caches are cleared or need the room
+void VulkanContext::releaseMeshAssets() {
+    for (uint32_t mesh = 0; mesh < LOADED_MESH_COUNT; mesh++) {
+        if (meshAssets[mesh].isValid()) meshCache.release(meshAssets[mesh]);
+        if (textureAssets[mesh].isValid()) {
+            textureCache.release(textureAssets[mesh]);
         }
-
-        /*for (unsigned int j = 0; j < mesh->mNumFaces; j++) {
-            const aiFace& face = mesh->mFaces[j];
-            indices.push_back(face.mIndices[0]);
-            indices.push_back(face.mIndices[1]);
-            indices.push_back(face.mIndices[2]);
-        }*/
+        meshAssets[mesh] = {};
+        textureAssets[mesh] = {};
     }
 }
 
@@ -1454,50 +1881,24 @@ void VulkanContext::createImage(uint32_t width, uint32_t height,
     imageInfo.samples = numSamples;
     imageInfo.flags = 0;
 
-    if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create texture image!", true);
-    } else {
-        debugger.consoleMessage("Successfully created texture image", false);
-    }
+    checkVulkanResult(vkCreateImage(device, &imageInfo, nullptr, &image),
+                      "create texture image");
+    debugger.consoleMessage("Successfully created texture image", false);
 
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to allocate texture image memory!",
-                                true);
-    } else {
-        debugger.consoleMessage("Successfully allocated texture image memory",
-                                false);
-    }
+    checkVulkanResult(
+        recovery.allocateMemory(memRequirements.size,
+                                memRequirements.memoryTypeBits, properties,
+                                imageMemory),
+        "allocate texture image memory");
+    debugger.consoleMessage("Successfully allocated texture image memory",
+                            false);
 
     vkBindImageMemory(device, image, imageMemory, 0);
 }
 
-uint32_t VulkanContext::findMemoryType(uint32_t typeFilter,
-                                       VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & properties) ==
-                properties) {
-            return i;
-        }
-    }
-
-    debugger.consoleMessage("Failed to find suitable memory type!", true);
-    return 0;
-}
-
 void VulkanContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                                  VkMemoryPropertyFlags properties,
                                  VkBuffer& buffer,
@@ -1509,29 +1910,21 @@ void VulkanContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create buffer!", false);
-    } else {
-        debugger.consoleMessage("Successfully created buffer", false);
-    }
+    checkVulkanResult(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer),
+                      "create buffer");
+    debugger.consoleMessage("Successfully created buffer", false);
 
     debugger.consoleMessage("\nBegin allocating vertex buffer memory...",
                             false);
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to allocate buffer memory!", true);
-    } else {
-        debugger.consoleMessage("Successfully allocated buffer memory", false);
-    }
+    checkVulkanResult(
+        recovery.allocateMemory(memRequirements.size,
+                                memRequirements.memoryTypeBits, properties,
+                                bufferMemory),
+        "allocate buffer memory");
+    debugger.consoleMessage("Successfully allocated buffer memory", false);
 
     vkBindBufferMemory(device, buffer, bufferMemory, 0);
 }
@@ -1545,28 +1938,35 @@ VkCommandBuffer VulkanContext::beginSingleTimeCommands() {
     allocInfo.commandBufferCount = 1;
 
     VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+    checkVulkanResult(
+        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer),
+        "allocate single time command buffer");
 
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    checkVulkanResult(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+                      "begin single time commands");
     debugger.consoleMessage("Successfully created single time commands", false);
     return commandBuffer;
 }
 
 void VulkanContext::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
     debugger.consoleMessage("\nBegin ending single time commands...", false);
-    vkEndCommandBuffer(commandBuffer);
+    checkVulkanResult(vkEndCommandBuffer(commandBuffer),
+                      "end single time commands");
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphicsQueue);
+    checkVulkanResult(
+        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE),
+        "submit single time commands");
+    checkVulkanResult(vkQueueWaitIdle(graphicsQueue),
+                      "wait for single time commands");
 
     vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
     debugger.consoleMessage("\nBegin ending single time commands...", false);
@@ -1616,152 +2016,34 @@ void VulkanContext::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
     debugger.consoleMessage("Successfully copied buffer", false);
 }
 
-void VulkanContext::copyBufferToImage(VkBuffer buffer, VkImage image,
-                                      uint32_t width, uint32_t height) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {width, height, 1};
-
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    endSingleTimeCommands(commandBuffer);
-}
-
-void VulkanContext::transitionImageLayout(VkImage image, VkFormat format,
-                                          VkImageLayout oldLayout,
-                                          VkImageLayout newLayout,
-                                          uint32_t mipLevels) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = mipLevels;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = 0;
-
-    VkPipelineStageFlags sourceStage;
-    VkPipelineStageFlags destinationStage;
-
-    if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-
-        if (hasStencilComponent(format)) {
-            barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-        }
-    } else {
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    }
-
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-        newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-               newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-               newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
-                                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    } else {
-        debugger.consoleMessage("Unsupported layout transition!", true);
-    }
-
-    vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
-                         nullptr, 0, nullptr, 1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
-}
-
-void VulkanContext::createVertexBuffer() {
-    debugger.consoleMessage("\nBegin creating vertex buffer...", false);
-
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    createBuffer(
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
-
-    copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-    debugger.consoleMessage("Successfully created vertex buffer", false);
-}
-
-void VulkanContext::createVertexBuffer2() {
-    debugger.consoleMessage("\nBegin creating vertex buffer...", false);
-
-    VkDeviceSize bufferSize = sizeof(vertices2[0]) * vertices2.size();
+// Stage data and copy it into a new buffer the GPU reads fastest
+void VulkanContext::createDeviceBuffer(const void* data, VkDeviceSize size,
+                                       VkBufferUsageFlags usage,
+                                       VkBuffer& buffer,
+                                       VkDeviceMemory& memory) {
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  stagingBuffer, stagingBufferMemory);
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices2.data(), (size_t)bufferSize);
+    void* mapped;
+    vkMapMemory(device, stagingBufferMemory, 0, size, 0, &mapped);
+    memcpy(mapped, data, static_cast<size_t>(size));
     vkUnmapMemory(device, stagingBufferMemory);
 
-    createBuffer(
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer2, vertexBufferMemory2);
-
-    copyBuffer(stagingBuffer, vertexBuffer2, bufferSize);
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+    copyBuffer(stagingBuffer, buffer, size);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
     vkFreeMemory(device, stagingBufferMemory, nullptr);
-    debugger.consoleMessage("Successfully created vertex buffer", false);
 }
 
 void VulkanContext::createCommandBuffers() {
     debugger.consoleMessage("\nBegin creating command buffers...", false);
-    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    commandBuffers.resize(framesInFlight);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1769,80 +2051,20 @@ void VulkanContext::createCommandBuffers() {
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
 
-    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create command buffers!", true);
-    } else {
-        debugger.consoleMessage("Successfully created command buffers", false);
-    }
-}
-
-void VulkanContext::createIndexBuffer() {
-    debugger.consoleMessage("\nBegin creating index buffer...", false);
-
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    createBuffer(
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
-
-    copyBuffer(stagingBuffer, indexBuffer, bufferSize);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
-
-void VulkanContext::createIndexBuffer2() {
-    debugger.consoleMessage("\nBegin creating index buffer...", false);
-
-    VkDeviceSize bufferSize = sizeof(indices2[0]) * indices2.size();
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices2.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    createBuffer(
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer2, indexBufferMemory2);
-
-    copyBuffer(stagingBuffer, indexBuffer2, bufferSize);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    checkVulkanResult(vkAllocateCommandBuffers(device, &allocInfo,
+                                               commandBuffers.data()),
+                      "allocate command buffers");
+    debugger.consoleMessage("Successfully created command buffers", false);
 }
 
 void VulkanContext::createUniformBuffers() {
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformBuffers.resize(framesInFlight);
+    uniformBuffersMemory.resize(framesInFlight);
+    uniformBuffersMapped.resize(framesInFlight);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < framesInFlight; i++) {
         createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
@@ -1853,227 +2075,310 @@ void VulkanContext::createUniformBuffers() {
     }
 }
 
-void VulkanContext::createUniformBuffers2() {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+void VulkanContext::createTransformBuffers() {
+    VkDeviceSize bufferSize = sizeof(glm::mat4) * MAX_OBJECT_TRANSFORMS;
 
-    uniformBuffers2.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory2.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped2.resize(MAX_FRAMES_IN_FLIGHT);
+    transformBuffers.resize(framesInFlight);
+    transformBuffersMemory.resize(framesInFlight);
+    transformBuffersMapped.resize(framesInFlight);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+    for (size_t i = 0; i < framesInFlight; i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     uniformBuffers2[i], uniformBuffersMemory2[i]);
+                     transformBuffers[i], transformBuffersMemory[i]);
 
-        vkMapMemory(device, uniformBuffersMemory2[i], 0, bufferSize, 0,
-                    &uniformBuffersMapped2[i]);
+        vkMapMemory(device, transformBuffersMemory[i], 0, bufferSize, 0,
+                    &transformBuffersMapped[i]);
+        // New buffers start with every matrix, nothing is stale
+        memcpy(transformBuffersMapped[i], objectTransforms.data(),
+               static_cast<size_t>(bufferSize));
+    }
+    std::fill(transformStaleFrames.begin(), transformStaleFrames.end(), 0);
+    staleTransforms.clear();
+}
+
+void VulkanContext::createInstanceBuffers() {
+    VkDeviceSize bufferSize = sizeof(InstanceData) * MAX_OBJECT_TRANSFORMS;
+
+    instanceBuffers.resize(framesInFlight);
+    instanceBuffersMemory.resize(framesInFlight);
+    instanceBuffersMapped.resize(framesInFlight);
+
+    for (size_t i = 0; i < framesInFlight; i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     instanceBuffers[i], instanceBuffersMemory[i]);
+
+        vkMapMemory(device, instanceBuffersMemory[i], 0, bufferSize, 0,
+                    &instanceBuffersMapped[i]);
     }
 }
 
 void VulkanContext::createDescriptorPool() {
     debugger.consoleMessage("\nBegin creating descriptor pool...", false);
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    // TIMES 2, OR ALL THE OBJECTS IN THE SCENE WE WANT TO DRAW
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(2*MAX_FRAMES_IN_FLIGHT);
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(2*MAX_FRAMES_IN_FLIGHT);
-
-    VkDescriptorPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(2*MAX_FRAMES_IN_FLIGHT);
-
-    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to create descriptor pool!", true);
-    } else {
-        debugger.consoleMessage("Successfully created descriptor pool", false);
-    }
+    // Pools are sized per set and chained as they fill, so the scene can hold
+    // any number of objects
+    std::vector<DescriptorPoolSizeRatio> poolRatios = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3.0f},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7.0f}};
+
+    frameDescriptorAllocators.resize(framesInFlight);
+    for (auto& frameAllocator : frameDescriptorAllocators) {
+        frameAllocator.init(device, 16, poolRatios);
+    }
+    boundTextureViews.assign(framesInFlight, {});
+    meshDescriptorSets.assign(LOADED_MESH_COUNT, {});
+    debugger.consoleMessage("Successfully created descriptor pools", false);
+}
+
+// Bindings 5 to 10 of the main pass set, the same for every mesh
+void VulkanContext::bindLighting(DescriptorBindings& bindings,
+                                 uint32_t frame) const {
+    bindings
+        .bindBuffer(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                    clusteredLighting.getParamBuffer(frame), 0,
+                    clusteredLighting.getParamBufferSize())
+        .bindBuffer(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    clusteredLighting.getLightBuffer(frame), 0,
+                    clusteredLighting.getLightBufferSize())
+        .bindBuffer(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    clusteredLighting.getClusterCountBuffer(frame), 0,
+                    clusteredLighting.getClusterCountBufferSize())
+        .bindBuffer(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    clusteredLighting.getClusterLightBuffer(frame), 0,
+                    clusteredLighting.getClusterLightBufferSize())
+        .bindImage(9, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                   shadowCascades.getShadowView(),
+                   shadowCascades.getShadowSampler(),
+                   shadowCascades.getShadowLayout())
+        .bindBuffer(10, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                    shadowCascades.getParamBuffer(frame), 0,
+                    shadowCascades.getParamBufferSize());
+}
+
+// Sets of every mesh for the frame being recorded. Looked up every frame,
+// streaming may have swapped the texture views since the last time. The
+// frame's fence has signaled, so sets of a swapped out view can be rewritten
+void VulkanContext::updateDescriptorSets(uint32_t frame) {
+    for (uint32_t mesh = 0; mesh < LOADED_MESH_COUNT; mesh++) {
+        VkImageView textureView = textureStreamer.getView(getMeshTexture(mesh));
+        VkImageView& boundView = boundTextureViews[frame][mesh];
+        if (boundView != textureView) {
+            if (boundView != VK_NULL_HANDLE) {
+                frameDescriptorAllocators[frame].invalidateImageView(boundView);
+            }
+            boundView = textureView;
+        }
+
+        DescriptorBindings bindings;
+        bindings
+            .bindBuffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                        uniformBuffers[frame], 0,
+                        sizeof(UniformBufferObject))
+            .bindImage(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                       textureView, textureSampler,
+                       textureStreamer.getLayout())
+            .bindBuffer(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        transformBuffers[frame], 0,
+                        sizeof(glm::mat4) * MAX_OBJECT_TRANSFORMS)
+            .bindBuffer(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        instanceBuffers[frame], 0,
+                        sizeof(InstanceData) * MAX_OBJECT_TRANSFORMS)
+            .bindBuffer(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        gpuCulling.getVisibleBuffer(frame), 0,
+                        gpuCulling.getVisibleBufferSize())
+            .bindBuffer(11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        textureStreamer.getFeedbackBuffer(frame), 0,
+                        textureStreamer.getFeedbackBufferSize());
+        bindLighting(bindings, frame);
+
+        meshDescriptorSets[mesh][frame] =
+            frameDescriptorAllocators[frame].getSet(descriptorSetLayout,
+                                                    bindings);
+    }
+}
+
+// Counters from the allocator of the frame being recorded
+const DescriptorAllocatorStats& VulkanContext::getDescriptorStats() const {
+    return frameDescriptorAllocators[currentFrame].getStats();
 }
 
-void VulkanContext::createDescriptorSets() {
-    debugger.consoleMessage("\nBegin creating descriptor sets...", false);
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
-                                               descriptorSetLayout);
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    allocInfo.pSetLayouts = layouts.data();
+void VulkanContext::createSyncObjects() {
+    debugger.consoleMessage("\nBegin creating sync objects...", false);
 
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-    if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to allocate descriptor sets!", true);
-    } else {
-        debugger.consoleMessage("Successfully allocated descriptor sets",
-                                false);
+    imageAvailableSemaphores.resize(framesInFlight);
+    renderFinishedSemaphores.resize(framesInFlight);
+    inFlightFences.resize(framesInFlight);
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    for (size_t i = 0; i < framesInFlight; i++) {
+        checkVulkanResult(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                                            &imageAvailableSemaphores[i]),
+                          "create image available semaphore");
+        checkVulkanResult(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                                            &renderFinishedSemaphores[i]),
+                          "create render finished semaphore");
+        checkVulkanResult(
+            vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]),
+            "create in flight fence");
+        debugger.consoleMessage(
+            "Successfully created synchronization objects for a frame", false);
     }
+    debugger.consoleMessage("Successfully created all synchronization objects",
+                            false);
+}
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uniformBuffers[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
-
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = textureImageView;
-        imageInfo.sampler = textureSampler;
-
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = descriptorSets[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = descriptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType =
-            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
-
-        vkUpdateDescriptorSets(device,
-                               static_cast<uint32_t>(descriptorWrites.size()),
-                               descriptorWrites.data(), 0, nullptr);
-
-        /*VkWriteDescriptorSet descriptorWrite{};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = descriptorSets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrite.descriptorCount = 1;
-
-        descriptorWrite.pBufferInfo = &bufferInfo;
-        descriptorWrite.pImageInfo = nullptr;
-        descriptorWrite.pTexelBufferView = nullptr;
-
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);*/
-    }
-}
-
-void VulkanContext::createDescriptorSets2() {
-    debugger.consoleMessage("\nBegin creating descriptor sets 2...", false);
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
-                                               descriptorSetLayout);
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    allocInfo.pSetLayouts = layouts.data();
-
-    descriptorSets2.resize(MAX_FRAMES_IN_FLIGHT);
-    if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets2.data()) !=
-        VK_SUCCESS) {
-        debugger.consoleMessage("Failed to allocate descriptor sets!", true);
-    } else {
-        debugger.consoleMessage("Successfully allocated descriptor sets",
+// Render into offscreen images instead of a window. Call before initVulkan,
+// no window or surface is needed
+void VulkanContext::setHeadless(uint32_t width, uint32_t height) {
+    headless = true;
+    headlessExtent = {width, height};
+}
+
+// Copy the next headless frame back to the CPU and save it as a PNG
+void VulkanContext::captureNextFrame(const std::string& path) {
+    if (!headless) {
+        debugger.consoleMessage("Frame capture is only supported headless",
                                 false);
+        return;
     }
+    capturePath = path;
+    captureThisFrame = true;
+}
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uniformBuffers2[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
-
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = textureImageView2;
-        imageInfo.sampler = textureSampler2;
+// Block until the GPU has finished all submitted work
+void VulkanContext::waitIdle() { vkDeviceWaitIdle(device); }
 
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+// Preferred present mode, falls back when unsupported. Rebuilds the swapchain
+// straight away if Vulkan is already running
+void VulkanContext::setPresentMode(VkPresentModeKHR mode) {
+    requestedPresentMode = mode;
+    if (initialized && !headless && mode != activePresentMode) {
+        recreateSwapchain();
+    }
+}
 
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = descriptorSets2[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
+// Frames the CPU may record ahead of the GPU. More frames hide CPU spikes at
+// the cost of input latency. Waits for the GPU and rebuilds every per frame
+// resource if Vulkan is already running
+void VulkanContext::setFramesInFlight(uint32_t count) {
+    count = std::clamp(count, 1u, MAX_FRAMES_IN_FLIGHT);
+    if (count == framesInFlight) return;
+    if (!initialized) {
+        framesInFlight = count;
+        return;
+    }
 
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = descriptorSets2[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType =
-            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
+    debugger.consoleMessage("\nBegin changing frames in flight...", false);
+    vkDeviceWaitIdle(device);
+    cleanupFrameResources();
+    framesInFlight = count;
+    meshCache.setRetireFrames(framesInFlight);
+    currentFrame = 0;
+    createFrameResources();
+    // Headless targets are allocated per frame in flight too
+    if (headless) {
+        recreateSwapchain();
+    }
+    LOG_INFO("Frames in flight set to {}", framesInFlight);
+}
 
-        vkUpdateDescriptorSets(device,
-                               static_cast<uint32_t>(descriptorWrites.size()),
-                               descriptorWrites.data(), 0, nullptr);
+// Create the offscreen images that stand in for the swapchain
+void VulkanContext::createOffscreenTargets() {
+    debugger.consoleMessage("\nBegin creating offscreen targets...", false);
 
-        /*VkWriteDescriptorSet descriptorWrite{};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = descriptorSets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
+    // RGBA so captures can be written out without swizzling
+    swapchainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    swapchainExtent = headlessExtent;
 
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrite.descriptorCount = 1;
+    swapchainImages.resize(framesInFlight);
+    offscreenImageMemory.resize(framesInFlight);
+    for (size_t i = 0; i < framesInFlight; i++) {
+        createImage(swapchainExtent.width, swapchainExtent.height, 1,
+                    VK_SAMPLE_COUNT_1_BIT, swapchainImageFormat,
+                    VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapchainImages[i],
+                    offscreenImageMemory[i]);
+    }
 
-        descriptorWrite.pBufferInfo = &bufferInfo;
-        descriptorWrite.pImageInfo = nullptr;
-        descriptorWrite.pTexelBufferView = nullptr;
+    VkDeviceSize readbackSize =
+        static_cast<VkDeviceSize>(swapchainExtent.width) *
+        swapchainExtent.height * 4;
+    createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 readbackBuffer, readbackBufferMemory);
+    vkMapMemory(device, readbackBufferMemory, 0, readbackSize, 0,
+                &readbackBufferMapped);
 
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);*/
-    }
+    debugger.consoleMessage("Successfully created offscreen targets", false);
 }
 
-void VulkanContext::createSyncObjects() {
-    debugger.consoleMessage("\nBegin creating sync objects...", false);
+// Copy the backbuffer into the readback buffer if a capture is pending
+void VulkanContext::recordReadbackPass(VkCommandBuffer commandBuffer) {
+    if (!captureThisFrame) return;
 
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {swapchainExtent.width, swapchainExtent.height, 1};
 
-    VkSemaphoreCreateInfo semaphoreInfo{};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    vkCmdCopyImageToBuffer(commandBuffer, swapchainImages[currentImageIndex],
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           readbackBuffer, 1, &region);
 
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    // Make the copy visible to the host once the fence signals
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = readbackBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                              &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-            vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                              &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-            vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) !=
-                VK_SUCCESS) {
-            debugger.consoleMessage(
-                "Failed to create synchronization objects for a frame!", true);
-        } else {
-            debugger.consoleMessage(
-                "Successfully created synchronization objects for a frame",
-                false);
-        }
-    }
-    debugger.consoleMessage("Successfully created all synchronization objects",
-                            false);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+}
+
+// Wait for the captured frame and write it to disk
+void VulkanContext::saveCapture() {
+    PROFILE_FUNCTION();
+    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
+                    UINT64_MAX);
+    imageWriter.writePNG(capturePath, swapchainExtent.width,
+                         swapchainExtent.height,
+                         static_cast<const uint8_t*>(readbackBufferMapped));
+    captureThisFrame = false;
 }
 
 // If the window is resized, we need to recreate the swap chain
 void VulkanContext::recreateSwapchain() {
+    PROFILE_FUNCTION();
+    // A minimized window has no drawable area, wait until it comes back
     int width = 0, height = 0;
-    SDL_Vulkan_GetDrawableSize(window, &width, &height);
-
-    while (width == 0 || height == 0) {
+    while (!headless && (width == 0 || height == 0)) {
         SDL_Vulkan_GetDrawableSize(window, &width, &height);
+        if (width != 0 && height != 0) break;
         int wait = SDL_WaitEvent(NULL);
         if (wait == 0) {
             debugger.consoleMessage("Failed to wait for event!", false);
@@ -2089,25 +2394,54 @@ void VulkanContext::recreateSwapchain() {
     createImageViews();
     createColorResources();
     createDepthResources();
+    buildRenderGraph();
     createFramebuffers();
 }
 
 void VulkanContext::recordCommandBuffer(VkCommandBuffer commandBuffer,
                                         uint32_t imageIndex) {
+    PROFILE_FUNCTION();
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to begin recording command buffer!",
-                                true);
+    checkVulkanResult(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+                      "begin recording command buffer");
+
+    gpuProfiler.beginFrame(commandBuffer, currentFrame);
+    frameStats.gpuTimeMs = gpuProfiler.getFrameTime();
+    updateAntiAliasingTiming();
+    frameStats.fragmentInvocations = 0;
+    for (const auto& region : gpuProfiler.getRegions()) {
+        if (region.hasStatistics) {
+            frameStats.fragmentInvocations +=
+                region.statistics.fragmentShaderInvocations;
+        }
     }
 
+    frameStats.drawCount = 0;
+    frameStats.instanceCount = 0;
+
+    currentImageIndex = imageIndex;
+    renderGraph.setImportedImage(backbuffer, swapchainImages[imageIndex],
+                                 swapchainImageViews[imageIndex]);
+    renderGraph.execute(commandBuffer);
+
+    gpuProfiler.endFrame(commandBuffer);
+
+    checkVulkanResult(vkEndCommandBuffer(commandBuffer),
+                      "record command buffer");
+}
+
+// Draw the scene into the main render pass
+void VulkanContext::recordMainPass(VkCommandBuffer commandBuffer) {
+    PROFILE_FUNCTION();
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapchainFramebuffers[imageIndex];
+    renderPassInfo.renderPass =
+        depthPrepassEnabled ? depthTestedRenderPass : renderPass;
+    renderPassInfo.framebuffer = swapchainFramebuffers[currentImageIndex];
     renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = swapchainExtent;
+    renderPassInfo.renderArea.extent = renderExtent;
 
     // VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
     std::array<VkClearValue, 2> clearValues{};
@@ -2120,78 +2454,142 @@ void VulkanContext::recordCommandBuffer(VkCommandBuffer commandBuffer,
                          VK_SUBPASS_CONTENTS_INLINE);
 
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      graphicsPipeline);
+                      depthPrepassEnabled ? depthEqualPipeline
+                                          : graphicsPipeline);
 
     VkViewport viewport{};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
-    viewport.width = (float)swapchainExtent.width;
-    viewport.height = (float)swapchainExtent.height;
+    viewport.width = (float)renderExtent.width;
+    viewport.height = (float)renderExtent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
     VkRect2D scissor{};
     scissor.offset = {0, 0};
-    scissor.extent = swapchainExtent;
+    scissor.extent = renderExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    for (uint32_t i = 0; i < instanceGroups.size(); i++) {
+        drawInstanceGroup(commandBuffer, i);
+        frameStats.instanceCount += instanceGroups[i].instanceCount;
+    }
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            pipelineLayout, 0, 1, &descriptorSets[currentFrame],
-                            0, nullptr);
+    vkCmdEndRenderPass(commandBuffer);
+}
 
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0,
-                     0, 0);
+// Draw the visible instances into depth only, with the same indirect draws
+// the main pass uses
+void VulkanContext::recordDepthPrepass(VkCommandBuffer commandBuffer) {
+    PROFILE_FUNCTION();
+    VkClearValue clearDepth{};
+    clearDepth.depthStencil = {1.0f, 0};
 
-    VkBuffer vertexBuffers2[] = {vertexBuffer2};
-    VkDeviceSize offsets2[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers2, offsets2);
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer2, 0, VK_INDEX_TYPE_UINT32);
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = depthPrepassRenderPass;
+    renderPassInfo.framebuffer = depthPrepassFramebuffer;
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = renderExtent;
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearDepth;
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            pipelineLayout, 0, 1, &descriptorSets2[currentFrame],
-                            0, nullptr);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
 
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices2.size()), 1, 0,
-                     0, 0);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      depthPrepassPipeline);
 
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)renderExtent.width;
+    viewport.height = (float)renderExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-    vkCmdEndRenderPass(commandBuffer);
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = renderExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to record command buffer!", true);
+    for (uint32_t i = 0; i < instanceGroups.size(); i++) {
+        drawInstanceGroup(commandBuffer, i);
     }
+
+    vkCmdEndRenderPass(commandBuffer);
 }
 
-void VulkanContext::drawFrame() {
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
-                    UINT64_MAX);
+// One indirect draw for a group, the cull pass fills in its instances
+void VulkanContext::drawInstanceGroup(VkCommandBuffer commandBuffer,
+                                      uint32_t drawIndex) {
+    const InstanceGroup& group = instanceGroups[drawIndex];
+    const GpuMesh& mesh = getMesh(group.mesh);
+    uint32_t textureSlot = getMeshTexture(group.mesh);
+    VkDescriptorSet descriptorSet =
+        meshDescriptorSets[group.mesh][currentFrame];
 
-    uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(
-        device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
-        VK_NULL_HANDLE, &imageIndex);
+    VkBuffer vertexBuffers[] = {mesh.vertexBuffer};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer, 0,
+                         VK_INDEX_TYPE_UINT32);
 
-    // If our window has been resized, we need to recreate the swap chain
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        recreateSwapchain();
-        return;
-    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-        debugger.consoleMessage("Failed to acquire swap chain image!", true);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, pipelineLayout,
+                       VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t),
+                       &textureSlot);
+
+    // Each mesh has its own buffers and descriptors, so a group is one
+    // indirect draw. gl_InstanceIndex starts at the group's firstInstance and
+    // indexes the visible list
+    vkCmdDrawIndexedIndirect(
+        commandBuffer, gpuCulling.getDrawBuffer(currentFrame),
+        sizeof(VkDrawIndexedIndirectCommand) * drawIndex, 1,
+        sizeof(VkDrawIndexedIndirectCommand));
+    frameStats.drawCount++;
+}
+
+void VulkanContext::drawFrame() {
+    PROFILE_FUNCTION();
+    VkResult result = VK_SUCCESS;
+    {
+        PROFILE_ZONE("vkWaitForFences");
+        result = vkWaitForFences(device, 1, &inFlightFences[currentFrame],
+                                 VK_TRUE, UINT64_MAX);
+    }
+    if (!handleFrameResult(result, "wait for frame fence")) return;
+
+    // Headless frames render straight into the offscreen image for this
+    // frame, there is nothing to acquire
+    uint32_t imageIndex = currentFrame;
+    if (!headless) {
+        PROFILE_ZONE("vkAcquireNextImageKHR");
+        result = vkAcquireNextImageKHR(
+            device, swapchain, UINT64_MAX,
+            imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE,
+            &imageIndex);
     }
 
-    vkResetFences(device, 1, &inFlightFences[currentFrame]);
+    // If our window has been resized, we need to recreate the swap chain
+    if (!handleFrameResult(result, "acquire swap chain image")) return;
+
+    checkVulkanResult(vkResetFences(device, 1, &inFlightFences[currentFrame]),
+                      "reset in flight fence");
 
+    updateDynamicResolution();
+    updateInstances(currentFrame);
+    updateLighting(currentFrame);
+    updateShadows(currentFrame);
+    updateTextures(currentFrame);
     vkResetCommandBuffer(commandBuffers[currentFrame], 0);
     recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
 
     updateUniformBuffer(currentFrame);
-    updateUniformBuffer2(currentFrame);
+    uploadObjectTransforms(currentFrame);
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -2199,7 +2597,7 @@ void VulkanContext::drawFrame() {
     VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
     VkPipelineStageFlags waitStages[] = {
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.waitSemaphoreCount = headless ? 0 : 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
@@ -2207,12 +2605,36 @@ void VulkanContext::drawFrame() {
     submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
     VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = headless ? 0 : 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-                      inFlightFences[currentFrame]) != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to submit draw command buffer!", true);
+    {
+        PROFILE_ZONE("vkQueueSubmit");
+        result = vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+                               inFlightFences[currentFrame]);
+        // Give back cached memory and try once more before rebuilding
+        if (isOutOfMemory(result)) {
+            recovery.evict(0);
+            result = vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+                                   inFlightFences[currentFrame]);
+        }
+    }
+    // A failed submit leaves the fence unsignalled, so there is no way to
+    // carry on with this device
+    if (isOutOfMemory(result)) {
+        recoverDeviceLost();
+        return;
+    }
+    if (!handleFrameResult(result, "submit draw command buffer")) return;
+    PROFILE_COUNTER("drawCount", frameStats.drawCount);
+    PROFILE_COUNTER("gpuFrameMs", frameStats.gpuTimeMs);
+
+    if (headless) {
+        if (captureThisFrame) {
+            saveCapture();
+        }
+        currentFrame = (currentFrame + 1) % framesInFlight;
+        return;
     }
 
     VkPresentInfoKHR presentInfo{};
@@ -2227,164 +2649,511 @@ void VulkanContext::drawFrame() {
 
     presentInfo.pImageIndices = &imageIndex;
 
-    result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    {
+        PROFILE_ZONE("vkQueuePresentKHR");
+        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
         framebufferResized) {
         framebufferResized = false;
         recreateSwapchain();
-    } else if (result != VK_SUCCESS) {
-        debugger.consoleMessage("Failed to present swap chain image!", true);
+    } else if (!handleFrameResult(result, "present swap chain image")) {
+        return;
     }
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    currentFrame = (currentFrame + 1) % framesInFlight;
 }
 
-void VulkanContext::updateUniformBuffer(uint32_t currentImage) {
-    static auto startTime = std::chrono::high_resolution_clock::now();
-
-    auto currentTime = std::chrono::high_resolution_clock::now();
-
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(
-                     currentTime - startTime)
-                     .count();
-
-    UniformBufferObject ubo{};
+// Returns true if the frame can go on. Out of date swapchains are recreated,
+// lost devices rebuilt, anything else is fatal
+bool VulkanContext::handleFrameResult(VkResult result, const char* operation) {
+    switch (result) {
+        case VK_SUCCESS:
+        case VK_SUBOPTIMAL_KHR:
+            return true;
+        case VK_ERROR_OUT_OF_DATE_KHR:
+            recreateSwapchain();
+            return false;
+        case VK_ERROR_DEVICE_LOST:
+        case VK_ERROR_SURFACE_LOST_KHR:
+            LOG_WARNING("Failed to {} ({})", operation, vkResultName(result));
+            recoverDeviceLost();
+            return false;
+        default:
+            checkVulkanResult(result, operation);
+            return true;
+    }
+}
 
-    ubo.model = glm::scale(glm::mat4(0.01f), glm::vec3(0.01f));
+// Tear down every Vulkan object and initialize again on a new device
+void VulkanContext::recoverDeviceLost() {
+    if (!recovery.beginDeviceLostRecovery()) {
+        checkVulkanResult(VK_ERROR_DEVICE_LOST, "recover from device loss");
+    }
 
-    // ubo.model *= glm::rotate(glm::mat4(1.0f), glm::radians(90.0f),
-    //                          glm::vec3(0.0f, 1.0f, 0.0f));
+    // Destroying objects of a lost device is allowed, waiting just returns
+    // VK_ERROR_DEVICE_LOST straight away
+    cleanup();
 
-    ubo.model *= glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f),
-                             glm::vec3(0.0f, 1.0f, 0.0f));
+    currentFrame = 0;
+    framebufferResized = false;
 
-    ubo.model *= glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -90.0f, 0.0f));
+    initVulkan();
+    debugger.consoleMessage("Successfully recovered from device loss", false);
+}
 
-    ubo.view =
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f),
-                    glm::vec3(0.0f, 1.0f, 0.0f));
+// Point the camera. Defaults to looking at the origin from (0, 0, 3)
+void VulkanContext::setCamera(const glm::vec3& eye, const glm::vec3& target) {
+    cameraEye = eye;
+    cameraTarget = target;
+}
 
-    ubo.proj = glm::perspective(
-        glm::radians(45.0f),
-        swapchainExtent.width / (float)swapchainExtent.height, 0.1f, 10.0f);
+// World matrices of the scene objects, only the changed nodes are copied
+void VulkanContext::setObjectTransforms(const TransformHierarchy& hierarchy) {
+    for (uint32_t node : hierarchy.getChangedNodes()) {
+        if (node >= MAX_OBJECT_TRANSFORMS) continue;
+        // A static object that moves anyway redraws the cached shadows it
+        // left and the ones it entered
+        bool invalidateShadows = isObjectStatic(node) &&
+                                 node < objectMeshes.size() &&
+                                 objectMeshes[node] != NO_MESH;
+        if (invalidateShadows) {
+            shadowCascades.invalidateStatic(getObjectBounds(node));
+        }
+        objectTransforms[node] = hierarchy.getWorldMatrix(node);
+        if (invalidateShadows) {
+            shadowCascades.invalidateStatic(getObjectBounds(node));
+        }
+        markTransformStale(node);
+    }
+}
 
-    ubo.proj[1][1] *= -1;
-    memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+// Mesh of every object, objects sharing a mesh are instanced together
+void VulkanContext::setObjectMeshes(const std::vector<uint32_t>& meshes) {
+    if (meshes.size() > MAX_OBJECT_TRANSFORMS) {
+        debugger.consoleMessage("Too many objects for the instance buffer!",
+                                true);
+    }
+    for (uint32_t mesh : meshes) {
+        if (mesh >= LOADED_MESH_COUNT && mesh != NO_MESH) {
+            debugger.consoleMessage("Object uses a mesh that is not loaded!",
+                                    true);
+        }
+    }
+    objectMeshes = meshes;
+    instancesDirty = true;
+    shadowCascades.invalidateCache();
 }
 
-void VulkanContext::updateUniformBuffer2(uint32_t currentImage) {
-    static auto startTime = std::chrono::high_resolution_clock::now();
+// GPU culling against the view frustum and last frame's depth
+void VulkanContext::setGpuCulling(bool frustum, bool occlusion) {
+    gpuCulling.setEnabled(frustum, occlusion);
+}
 
-    auto currentTime = std::chrono::high_resolution_clock::now();
+// Depth only pass before the main pass, which then shades with an EQUAL depth
+// test. The passes and the main pass's depth layout change, so the render
+// graph is rebuilt along with the swapchain
+void VulkanContext::setDepthPrepass(bool enabled) {
+    if (enabled == depthPrepassEnabled) return;
+    depthPrepassEnabled = enabled;
+    if (initialized) {
+        recreateSwapchain();
+    }
+    LOG_INFO("Depth pre-pass {}", enabled ? "on" : "off");
+}
 
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(
-                     currentTime - startTime)
-                     .count();
+// Off, MSAA or FXAA. The sample count is baked into the render passes,
+// pipelines and attachments, so all of them are rebuilt
+void VulkanContext::setAntiAliasing(AntiAliasingMode mode) {
+    if (mode == antiAliasing) return;
+    antiAliasing = mode;
+    if (!initialized) return;
 
-    UniformBufferObject ubo{};
+    debugger.consoleMessage("\nBegin changing anti-aliasing...", false);
+    vkDeviceWaitIdle(device);
+    cleanupGraphicsPipelines();
+    msaaSamples = sampleCountFor(mode);
+    createRenderPass();
+    createGraphicsPipeline();
+    recreateSwapchain();
+    antiAliasingSkipFrames = framesInFlight;
+    LOG_INFO("Anti-aliasing set to {}, {} samples", antiAliasingName(mode),
+             static_cast<uint32_t>(msaaSamples));
+}
+
+// Samples the mode renders with on this device
+VkSampleCountFlagBits VulkanContext::sampleCountFor(
+    AntiAliasingMode mode) const {
+    VkSampleCountFlagBits requested = VK_SAMPLE_COUNT_1_BIT;
+    switch (mode) {
+        case AntiAliasingMode::Msaa2x:
+            requested = VK_SAMPLE_COUNT_2_BIT;
+            break;
+        case AntiAliasingMode::Msaa4x:
+            requested = VK_SAMPLE_COUNT_4_BIT;
+            break;
+        case AntiAliasingMode::Msaa8x:
+            requested = VK_SAMPLE_COUNT_8_BIT;
+            break;
+        default:
+            break;
+    }
+    // Sample count bits are the counts themselves
+    return std::min(requested, maxMsaaSamples);
+}
 
-    ubo.model = glm::scale(glm::mat4(1.0f), glm::vec3(2.0f));
+// Fold the last GPU results into the active mode's timing. Every frame
+// counts the same, so the averages settle the longer a mode runs
+void VulkanContext::updateAntiAliasingTiming() {
+    if (antiAliasingSkipFrames > 0) {
+        antiAliasingSkipFrames--;
+        return;
+    }
+    double frameMs = gpuProfiler.getFrameTime();
+    if (frameMs <= 0.0) return;
 
-    ubo.model *= glm::rotate(glm::mat4(1.0), glm::radians(90.0f),
-                             glm::vec3(-1.0f, 0.0f, 0.0f));
+    double mainPassMs = 0.0;
+    double postPassMs = 0.0;
+    for (const auto& region : gpuProfiler.getRegions()) {
+        if (region.name == "main") {
+            mainPassMs = region.timeMs;
+        } else if (region.name == "fxaa") {
+            postPassMs = region.timeMs;
+        }
+    }
 
-    ubo.model *= glm::rotate(glm::mat4(1.0), glm::radians(220.0f),
-                             glm::vec3(0.0f, 0.0f, 1.0f));
+    AntiAliasingTiming& timing =
+        antiAliasingTimings[static_cast<size_t>(antiAliasing)];
+    timing.samples = msaaSamples;
+    timing.frames++;
+    timing.frameMs += (frameMs - timing.frameMs) / timing.frames;
+    timing.mainPassMs += (mainPassMs - timing.mainPassMs) / timing.frames;
+    timing.postPassMs += (postPassMs - timing.postPassMs) / timing.frames;
+}
 
-    // ubo.model *= glm::rotate(glm::mat4(1.0f), glm::radians(90.0f),
-    //                          glm::vec3(0.0f, 1.0f, 0.0f));
+// The upscale pass and the images around it only exist with dynamic
+// resolution, so the render graph is rebuilt along with the swapchain
+void VulkanContext::setDynamicResolution(bool enabled, double targetMs) {
+    dynamicResolution.setTarget(targetMs);
+    if (enabled == dynamicResolutionEnabled) return;
+    dynamicResolutionEnabled = enabled;
+    dynamicResolution.reset();
+    if (initialized) {
+        recreateSwapchain();
+    }
+    LOG_INFO("Dynamic resolution {}, target {} ms", enabled ? "on" : "off",
+             targetMs);
+}
+
+// Scale renderExtent from the swapchain, never below a pixel
+void VulkanContext::updateRenderExtent() {
+    double scale =
+        dynamicResolutionEnabled ? dynamicResolution.getScale() : 1.0;
+    renderExtent.width = std::max(
+        1u, static_cast<uint32_t>(std::lround(swapchainExtent.width * scale)));
+    renderExtent.height = std::max(
+        1u, static_cast<uint32_t>(std::lround(swapchainExtent.height * scale)));
+    frameStats.renderScale =
+        static_cast<double>(renderExtent.width) / swapchainExtent.width;
+}
+
+// Feed the last GPU frame time to the controller, before recording. The
+// timings show a new scale once the frames in flight have been through the
+// GPU, so the controller waits that long after each change
+void VulkanContext::updateDynamicResolution() {
+    if (!dynamicResolutionEnabled) return;
+    dynamicResolution.setLatency(framesInFlight + 1);
+    if (dynamicResolution.update(gpuProfiler.getFrameTime())) {
+        updateRenderExtent();
+        PROFILE_COUNTER("renderScale", frameStats.renderScale);
+    }
+}
+
+// Replaces every light, the frames in flight pick them up as they come around
+void VulkanContext::setPointLights(const std::vector<PointLight>& lights) {
+    clusteredLighting.setLights(lights);
+    if (lights.size() > MAX_POINT_LIGHTS) {
+        LOG_INFO("Only the first {} of {} point lights are used",
+                 MAX_POINT_LIGHTS, lights.size());
+    }
+}
+
+void VulkanContext::setAmbientLight(const glm::vec3& ambient) {
+    clusteredLighting.setAmbient(ambient);
+}
+
+// A black sun is off. A new direction redraws the cached cascades
+void VulkanContext::setSun(const glm::vec3& direction, const glm::vec3& color) {
+    shadowCascades.setSun(direction, color);
+}
+
+// Static objects go into the cached cascades, so the caches start over
+void VulkanContext::setStaticObjects(const std::vector<uint8_t>& flags) {
+    staticObjects = flags;
+    shadowCascades.invalidateCache();
+}
+
+// Model space sphere of the object's mesh moved into the world. The radius
+// grows with the largest axis scale
+glm::vec4 VulkanContext::getObjectBounds(uint32_t object) const {
+    const glm::mat4& model = objectTransforms[object];
+    glm::vec4 sphere = getMesh(objectMeshes[object]).bounds;
+    glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(sphere), 1.0f));
+    float scale = std::max({glm::length(glm::vec3(model[0])),
+                            glm::length(glm::vec3(model[1])),
+                            glm::length(glm::vec3(model[2]))});
+    return glm::vec4(center, sphere.w * scale);
+}
+
+// Fit the cascades to the camera and cull the casters, before recording
+void VulkanContext::updateShadows(uint32_t frame) {
+    PROFILE_FUNCTION();
+    shadowCasters.clear();
+    for (uint32_t object = 0; object < objectMeshes.size(); object++) {
+        if (objectMeshes[object] == NO_MESH) continue;
+        shadowCasters.push_back({object, objectMeshes[object],
+                                 getObjectBounds(object),
+                                 isObjectStatic(object)});
+    }
+
+    UniformBufferObject camera = buildCameraUniforms();
+    ShadowFrame shadowFrame;
+    shadowFrame.view = camera.view;
+    shadowFrame.proj = camera.proj;
+    shadowFrame.nearPlane = CAMERA_NEAR_PLANE;
+    shadowFrame.farPlane = CAMERA_FAR_PLANE;
+    shadowFrame.transformBuffer = transformBuffers[frame];
+    shadowFrame.transformRange = sizeof(glm::mat4) * MAX_OBJECT_TRANSFORMS;
+    shadowCascades.beginFrame(frame, shadowFrame, shadowCasters);
+
+    const ShadowStats& shadowStats = shadowCascades.getStats();
+    frameStats.shadowCascadesRendered = shadowStats.cascadesRendered;
+    frameStats.shadowCacheRebuilds = shadowStats.cacheRebuilds;
+    frameStats.shadowCasters = shadowStats.casterDraws;
+    PROFILE_COUNTER("shadowCascadesRendered",
+                    frameStats.shadowCascadesRendered);
+}
+
+// Pick the mips to stream from the usage this frame slot saw last time and
+// look up the main pass sets with the views that are now resident
+void VulkanContext::updateTextures(uint32_t frame) {
+    PROFILE_FUNCTION();
+    meshCache.beginFrame();
+    textureCache.beginFrame();
+    textureStreamer.beginFrame(frame);
+    updateDescriptorSets(frame);
+
+    const TextureStreamingStats& textureStats = textureStreamer.getStats();
+    frameStats.textureMemory = textureStats.residentBytes;
+    frameStats.textureBudget = textureStats.budgetBytes;
+    frameStats.textureUploads = textureStats.uploadedBytes;
+    PROFILE_COUNTER("textureMemory", frameStats.textureMemory);
+}
+
+// Camera and viewport for this frame's binning pass, before recording
+void VulkanContext::updateLighting(uint32_t frame) {
+    PROFILE_FUNCTION();
+    UniformBufferObject camera = buildCameraUniforms();
+    ClusteredLightingFrame lightingFrame;
+    lightingFrame.view = camera.view;
+    lightingFrame.proj = camera.proj;
+    lightingFrame.nearPlane = CAMERA_NEAR_PLANE;
+    lightingFrame.farPlane = CAMERA_FAR_PLANE;
+    lightingFrame.viewport = renderExtent;
+    clusteredLighting.beginFrame(frame, lightingFrame);
+    frameStats.lightCount = clusteredLighting.getLightCount();
+    PROFILE_COUNTER("lightCount", frameStats.lightCount);
+}
+
+// Pipeline statistics per pass, on top of the validation layer default
+void VulkanContext::setPipelineStatistics(bool enabled) {
+    pipelineStatisticsRequested = enabled;
+}
+
+// Multiplied with the object's texture, white by default
+void VulkanContext::setObjectTint(uint32_t object, const glm::vec4& tint) {
+    if (object >= MAX_OBJECT_TRANSFORMS) return;
+    objectTints[object] = tint;
+    instancesDirty = true;
+}
+
+// Sort the objects into one group per mesh
+void VulkanContext::buildInstanceGroups() {
+    std::vector<uint32_t> meshCounts(LOADED_MESH_COUNT, 0);
+    uint32_t drawnObjects = 0;
+    for (uint32_t mesh : objectMeshes) {
+        if (mesh == NO_MESH) continue;
+        meshCounts[mesh]++;
+        drawnObjects++;
+    }
+
+    instanceGroups.clear();
+    instanceDraws.clear();
+    std::vector<uint32_t> nextInstance(LOADED_MESH_COUNT, 0);
+    std::vector<uint32_t> meshDraws(LOADED_MESH_COUNT, 0);
+    uint32_t firstInstance = 0;
+    for (uint32_t mesh = 0; mesh < LOADED_MESH_COUNT; mesh++) {
+        nextInstance[mesh] = firstInstance;
+        if (meshCounts[mesh] > 0) {
+            meshDraws[mesh] = static_cast<uint32_t>(instanceGroups.size());
+            instanceGroups.push_back({mesh, firstInstance, meshCounts[mesh]});
+
+            VkDrawIndexedIndirectCommand draw{};
+            draw.indexCount = getMesh(mesh).indexCount;
+            draw.firstInstance = firstInstance;
+            instanceDraws.push_back(draw);
+        }
+        firstInstance += meshCounts[mesh];
+    }
+
+    instances.resize(drawnObjects);
+    for (uint32_t object = 0; object < objectMeshes.size(); object++) {
+        if (objectMeshes[object] == NO_MESH) continue;
+        InstanceData& instance =
+            instances[nextInstance[objectMeshes[object]]++];
+        instance = InstanceData{};
+        instance.objectIndex = object;
+        instance.drawIndex = meshDraws[objectMeshes[object]];
+        instance.tint = objectTints[object];
+        instance.boundingSphere = getMesh(objectMeshes[object]).bounds;
+    }
+    instancesDirty = false;
+}
+
+// Write this frame's instance buffer, before recording
+void VulkanContext::updateInstances(uint32_t frame) {
+    PROFILE_FUNCTION();
+    if (instancesDirty) buildInstanceGroups();
+    memcpy(instanceBuffersMapped[frame], instances.data(),
+           instances.size() * sizeof(InstanceData));
+
+    UniformBufferObject camera = buildCameraUniforms();
+    GpuCullingFrame cullFrame;
+    cullFrame.view = camera.view;
+    cullFrame.proj = camera.proj;
+    cullFrame.nearPlane = CAMERA_NEAR_PLANE;
+    cullFrame.transformBuffer = transformBuffers[frame];
+    cullFrame.transformRange = sizeof(glm::mat4) * MAX_OBJECT_TRANSFORMS;
+    cullFrame.instanceBuffer = instanceBuffers[frame];
+    cullFrame.instanceRange = sizeof(InstanceData) * MAX_OBJECT_TRANSFORMS;
+    cullFrame.instanceCount = static_cast<uint32_t>(instances.size());
+    cullFrame.viewport = renderExtent;
+    gpuCulling.beginFrame(frame, cullFrame, instanceDraws);
+
+    const GpuCullingStats& cullingStats = gpuCulling.getStats();
+    frameStats.visibleInstances = cullingStats.visibleInstances;
+    frameStats.frustumCulled = cullingStats.frustumCulled;
+    frameStats.occlusionCulled = cullingStats.occlusionCulled;
+    frameStats.triangleCount = cullingStats.visibleTriangles;
+    PROFILE_COUNTER("visibleInstances", frameStats.visibleInstances);
+}
+
+void VulkanContext::markTransformStale(uint32_t object) {
+    if (transformStaleFrames[object] == 0) {
+        staleTransforms.push_back(object);
+    }
+    transformStaleFrames[object] =
+        static_cast<uint8_t>((1u << framesInFlight) - 1);
+}
+
+// Copy matrices this frame's buffer has not seen yet. The fence wait in
+// drawFrame means the GPU is done reading it
+void VulkanContext::uploadObjectTransforms(uint32_t frame) {
+    PROFILE_FUNCTION();
+    auto* mapped = static_cast<glm::mat4*>(transformBuffersMapped[frame]);
+    uint8_t frameBit = static_cast<uint8_t>(1u << frame);
+
+    frameStats.transformsUploaded = 0;
+    size_t stillStale = 0;
+    for (uint32_t object : staleTransforms) {
+        if (transformStaleFrames[object] & frameBit) {
+            mapped[object] = objectTransforms[object];
+            transformStaleFrames[object] &= static_cast<uint8_t>(~frameBit);
+            frameStats.transformsUploaded++;
+        }
+        if (transformStaleFrames[object] != 0) {
+            staleTransforms[stillStale++] = object;
+        }
+    }
+    staleTransforms.resize(stillStale);
+    PROFILE_COUNTER("transformsUploaded", frameStats.transformsUploaded);
+}
+
+const FrameStats& VulkanContext::getFrameStats() {
+    frameStats.deviceMemoryUsed = 0;
+    if (memoryBudgetSupported) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+        budget.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties.pNext = &budget;
+        vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+
+        for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount;
+             i++) {
+            if (properties.memoryProperties.memoryHeaps[i].flags &
+                VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                frameStats.deviceMemoryUsed += budget.heapUsage[i];
+            }
+        }
+    }
+    return frameStats;
+}
 
-    //ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f),
-    //                         glm::vec3(0.0f, -1.0f, 0.0f));
+std::string VulkanContext::getDeviceName() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    return properties.deviceName;
+}
 
-    ubo.model *= glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -0.5f));
+// View and projection of the camera for this frame
+UniformBufferObject VulkanContext::buildCameraUniforms() {
+    UniformBufferObject ubo{};
 
-    ubo.view =
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f),
-                    glm::vec3(0.0f, 1.0f, 0.0f));
+    ubo.view = glm::lookAt(cameraEye, cameraTarget, glm::vec3(0.0f, 1.0f, 0.0f));
 
     ubo.proj = glm::perspective(
         glm::radians(45.0f),
-        swapchainExtent.width / (float)swapchainExtent.height, 0.1f, 10.0f);
+        swapchainExtent.width / (float)swapchainExtent.height,
+        CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
 
     ubo.proj[1][1] *= -1;
-    memcpy(uniformBuffersMapped2[currentImage], &ubo, sizeof(ubo));
+    return ubo;
+}
+
+void VulkanContext::updateUniformBuffer(uint32_t currentImage) {
+    PROFILE_FUNCTION();
+    UniformBufferObject ubo = buildCameraUniforms();
+    memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
 }
 
 void VulkanContext::cleanup() {
     debugger.consoleMessage("\nBegin cleaning up Vulkan...", false);
+    initialized = false;
     vkDeviceWaitIdle(device);
     cleanupSwapchain();
 
     vkDestroySampler(device, textureSampler, nullptr);
-    vkDestroySampler(device, textureSampler2, nullptr);
     debugger.consoleMessage("Destroyed Vulkan texture sampler", false);
 
-    vkDestroyImageView(device, textureImageView, nullptr);
-    vkDestroyImageView(device, textureImageView2, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan texture image view", false);
-
-    vkDestroyImage(device, textureImage, nullptr);
-    vkDestroyImage(device, textureImage2, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan texture image", false);
-    vkFreeMemory(device, textureImageMemory, nullptr);
-    vkFreeMemory(device, textureImageMemory2, nullptr);
-    debugger.consoleMessage("Freed Vulkan texture image memory", false);
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-        vkDestroyBuffer(device, uniformBuffers2[i], nullptr);
-        debugger.consoleMessage("Destroyed Vulkan uniform buffer", false);
-        vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-        vkFreeMemory(device, uniformBuffersMemory2[i], nullptr);
-        debugger.consoleMessage("Freed Vulkan uniform buffer memory", false);
-    }
-    debugger.consoleMessage(
-        "Destroyed and freed all Vulkan uniform buffers and memory", false);
-
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan descriptor pool", false);
+    cleanupFrameResources();
+    releaseMeshAssets();
+    meshCache.clear();
+    textureCache.clear();
+    debugger.consoleMessage("Destroyed cached meshes and textures", false);
+    textureStreamer.cleanup();
+    gpuCulling.cleanup();
+    clusteredLighting.cleanup();
+    shadowCascades.cleanup();
 
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
     debugger.consoleMessage("Destroyed Vulkan descriptor set layout", false);
 
-    vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkDestroyBuffer(device, indexBuffer2, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan index buffer", false);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
-    vkFreeMemory(device, indexBufferMemory2, nullptr);
-    debugger.consoleMessage("Freed Vulkan index buffer memory", false);
-
-    vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkDestroyBuffer(device, vertexBuffer2, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan vertex buffer", false);
-
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
-    vkFreeMemory(device, vertexBufferMemory2, nullptr);
-    debugger.consoleMessage("Freed Vulkan vertex buffer memory", false);
-
-    vkDestroyPipeline(device, graphicsPipeline, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan graphics pipeline", false);
-
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan graphics pipeline layout", false);
-
-    vkDestroyRenderPass(device, renderPass, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan render pass\n", false);
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-        debugger.consoleMessage("Destroyed Vulkan render finished semaphore",
-                                false);
-        vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-        debugger.consoleMessage("Destroyed Vulkan image available semaphore",
-                                false);
-        vkDestroyFence(device, inFlightFences[i], nullptr);
-        debugger.consoleMessage("Destroyed Vulkan in flight fence", false);
-    }
-    debugger.consoleMessage("Destroyed all Vulkan semaphores and fences\n",
-                            false);
+    cleanupGraphicsPipelines();
+    fxaaPass.cleanup();
+    upscalePass.cleanup();
 
     vkDestroyCommandPool(device, commandPool, nullptr);
     debugger.consoleMessage("Destroyed Vulkan command pool\n", false);
@@ -2396,8 +3165,10 @@ void VulkanContext::cleanup() {
         debugger.consoleMessage("Destroyed Vulkan debug messenger\n", false);
     }
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
-    debugger.consoleMessage("Destroyed Vulkan surface", false);
+    if (!headless) {
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+        debugger.consoleMessage("Destroyed Vulkan surface", false);
+    }
     vkDestroyInstance(instance, nullptr);
     debugger.consoleMessage("Destroyed Vulkan instance", false);
     debugger.consoleMessage("\nSuccessfully cleaned up Vulkan\n", false);
@@ -7,11 +7,13 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <glm/glm.hpp>
 #include <optional>
 #include <set>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -26,7 +28,25 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/hash.hpp>
 
+#include "core/assets/asset_cache.h"
+#include "core/assets/cooked_format.h"
 #include "core/debugger/debugger.h"
+#include "core/debugger/profiler.h"
+#include "core/image_writer/image_writer.h"
+#include "core/vfs/virtual_file_system.h"
+#include "scene/3d/mesh_3d.h"
+#include "scene/3d/transform_hierarchy.h"
+#include "scene/ecs/components.h"
+#include "clustered_lighting.h"
+#include "descriptor_allocator.h"
+#include "dynamic_resolution.h"
+#include "gpu_culling.h"
+#include "gpu_profiler.h"
+#include "post_process_pass.h"
+#include "render_graph.h"
+#include "shadow_cascades.h"
+#include "texture_streamer.h"
+#include "vulkan_result.h"
 
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -40,14 +60,84 @@ const bool enableValidationLayers = true;
 #define ASSET_PATH ""
 #endif
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// Frames the CPU may record ahead of the GPU, see setFramesInFlight
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+// Model matrices the transform storage buffer holds, also the most
+// instances a frame can draw
+const uint32_t MAX_OBJECT_TRANSFORMS = 1024;
+
+// Point lights the clustered lighting can hold
+const uint32_t MAX_POINT_LIGHTS = 4096;
+
+// Clip planes of the camera projection
+const float CAMERA_NEAR_PLANE = 0.1f;
+const float CAMERA_FAR_PLANE = 10.0f;
+
+// Sun the command line turns on, low enough to cast long shadows
+const glm::vec3 DEFAULT_SUN_DIRECTION = glm::vec3(-0.4f, -1.0f, -0.3f);
+const glm::vec3 DEFAULT_SUN_COLOR = glm::vec3(1.0f, 0.95f, 0.85f);
+
+// Meshes the context loads, dennis then the viking room. Each mesh comes
+// with its own texture, so a mesh is also a material
+const uint32_t LOADED_MESH_COUNT = 2;
+
+// Memory unused meshes and textures may hold in their caches before the
+// least recently released are freed. Textures count their CPU mip chains,
+// the streamer keeps device memory under its own budget
+const uint64_t MESH_CACHE_BUDGET = 256ull * 1024 * 1024;
+const uint64_t TEXTURE_CACHE_BUDGET = 512ull * 1024 * 1024;
+
+// A mesh's geometry in device memory
+struct GpuMesh {
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
+    uint32_t indexCount = 0;
+    // Model space center and radius
+    glm::vec4 bounds = glm::vec4(0.0f);
+};
+
+// A texture registered with the TextureStreamer
+struct GpuTexture {
+    uint32_t slot = 0;
+};
+
+// Name of a present mode for logs and the command line
+const char* presentModeName(VkPresentModeKHR mode);
+
+// Anti-aliasing, see setAntiAliasing
+enum class AntiAliasingMode { Off, Msaa2x, Msaa4x, Msaa8x, Fxaa };
+const uint32_t ANTI_ALIASING_MODE_COUNT = 5;
+
+// off, msaa2, msaa4, msaa8 or fxaa, for logs and the command line
+const char* antiAliasingName(AntiAliasingMode mode);
+bool parseAntiAliasing(const std::string& name, AntiAliasingMode& mode);
+
+// GPU cost measured while an anti-aliasing mode was active, averaged over
+// every frame spent in it. The MSAA resolve happens inside the main render
+// pass, so comparing the main pass across modes gives the cost of the samples
+// and the resolve together
+struct AntiAliasingTiming {
+    // Samples actually used, MSAA falls back to what the device supports
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    uint32_t frames = 0;
+    double frameMs = 0.0;
+    double mainPassMs = 0.0;
+    // The FXAA pass, 0 for the other modes
+    double postPassMs = 0.0;
+};
 
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
 
-    bool isComplete() {
-        return graphicsFamily.has_value() && presentFamily.has_value();
+    // Headless devices never present, so they only need graphics
+    bool isComplete(bool headless) const {
+        return graphicsFamily.has_value() &&
+               (headless || presentFamily.has_value());
     }
 };
 
@@ -57,65 +147,64 @@ struct SwapchainSupportDetails {
     std::vector<VkPresentModeKHR> presentModes;
 };
 
+// Numbers gathered while rendering, used by the benchmark
+struct FrameStats {
+    // GPU time of the last frame whose results are back. Timestamps lag the
+    // CPU by the number of frames in flight
+    double gpuTimeMs = 0.0;
+    uint32_t drawCount = 0;
+    // Triangles in the instances that survived culling, trails like
+    // gpuTimeMs
+    uint64_t triangleCount = 0;
+    // Device local memory in use, 0 if VK_EXT_memory_budget is missing
+    VkDeviceSize deviceMemoryUsed = 0;
+    // Model matrices written to the transform buffer for the last frame
+    uint32_t transformsUploaded = 0;
+    // Objects sent to culling, drawCount is the number of instanced calls
+    // they took
+    uint32_t instanceCount = 0;
+    // What GPU culling made of them, trails like gpuTimeMs
+    uint32_t visibleInstances = 0;
+    uint32_t frustumCulled = 0;
+    uint32_t occlusionCulled = 0;
+    // Fragment shader invocations across all passes, trails like gpuTimeMs.
+    // 0 unless pipeline statistics are on
+    uint64_t fragmentInvocations = 0;
+    // Width of the scene relative to the swapchain, 1 unless dynamic
+    // resolution lowered it
+    double renderScale = 1.0;
+    // Point lights binned into clusters for the last frame
+    uint32_t lightCount = 0;
+    // Shadow cascades drawn for the last frame, cached ones only count when
+    // their cache was redrawn
+    uint32_t shadowCascadesRendered = 0;
+    uint32_t shadowCacheRebuilds = 0;
+    // Casters drawn over every cascade
+    uint32_t shadowCasters = 0;
+    // Device memory held by streamed textures and the budget it is kept
+    // under
+    VkDeviceSize textureMemory = 0;
+    VkDeviceSize textureBudget = 0;
+    // Texture mips copied from staging for the last frame
+    VkDeviceSize textureUploads = 0;
+};
+
 struct UniformBufferObject {
-    glm::mat4 model;
     glm::mat4 view;
     glm::mat4 proj;
 };
 
-struct Vertex {
-    glm::vec3 pos;
-    glm::vec3 color;
-    glm::vec2 texCoord;
-
-    bool operator==(const Vertex& other) const {
-        return pos == other.pos && color == other.color &&
-               texCoord == other.texCoord;
-    }
-
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription bindingDescription{};
-        bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Vertex);
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        return bindingDescription;
-    }
-
-    static std::array<VkVertexInputAttributeDescription, 3>
-    getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3>
-            attributeDescriptions{};
-
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-
-        return attributeDescriptions;
-    }
-};
-
-namespace std {
-template <>
-struct hash<Vertex> {
-    size_t operator()(Vertex const& vertex) const {
-        return ((hash<glm::vec3>()(vertex.pos) ^
-                 (hash<glm::vec3>()(vertex.color) << 1)) >>
-                1) ^
-               (hash<glm::vec2>()(vertex.texCoord) << 1);
-    }
+// One entry per drawn object in the instance buffer, matches InstanceData in
+// shader.vert and cull.comp with std430 layout
+struct InstanceData {
+    uint32_t objectIndex;
+    // Indirect draw the instance is counted into when it survives culling
+    uint32_t drawIndex;
+    uint32_t padding[2];
+    glm::vec4 tint;
+    // Model space center and radius of the mesh
+    glm::vec4 boundingSphere;
 };
-}  // namespace std
 
 /*const std::vector<Vertex> vertices = {
     {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
@@ -144,6 +233,122 @@ class VulkanContext {
     void cleanup();
     void drawFrame();
 
+    // Render into offscreen images instead of a window. Call before
+    // initVulkan, no window or surface is needed
+    void setHeadless(uint32_t width, uint32_t height);
+
+    // Copy the next headless frame back to the CPU and save it as a PNG
+    void captureNextFrame(const std::string& path);
+
+    // Block until the GPU has finished all submitted work
+    void waitIdle();
+
+    // Preferred present mode, falls back to mailbox or FIFO when the surface
+    // does not support it. Rebuilds the swapchain if already running
+    void setPresentMode(VkPresentModeKHR mode);
+    VkPresentModeKHR getPresentMode() const { return activePresentMode; }
+    // What was last asked for, which the surface may not support
+    VkPresentModeKHR getRequestedPresentMode() const {
+        return requestedPresentMode;
+    }
+
+    // Frames the CPU may record ahead of the GPU, 1 to MAX_FRAMES_IN_FLIGHT.
+    // Rebuilds the per frame resources if already running
+    void setFramesInFlight(uint32_t count);
+    uint32_t getFramesInFlight() const { return framesInFlight; }
+
+    // Point the camera. Defaults to looking at the origin from (0, 0, 3)
+    void setCamera(const glm::vec3& eye, const glm::vec3& target);
+    const glm::vec3& getCameraEye() const { return cameraEye; }
+
+    // World matrices of the scene objects, one hierarchy node per object in
+    // draw order. Only the hierarchy's changed nodes are copied, and each
+    // reaches the GPU once per frame in flight. The simulation owns all
+    // motion, the renderer only draws what it is given
+    void setObjectTransforms(const TransformHierarchy& hierarchy);
+
+    // Mesh of every object, indexed like the transforms. Objects sharing a
+    // mesh are drawn with a single instanced call, objects with NO_MESH or
+    // past the end of the list are not drawn. Defaults to dennis then the
+    // viking room
+    void setObjectMeshes(const std::vector<uint32_t>& meshes);
+    // Multiplied with the object's texture, white by default
+    void setObjectTint(uint32_t object, const glm::vec4& tint);
+    // 1 for objects that never move on their own, indexed like the meshes.
+    // Static objects are kept in the cached shadow cascades, dynamic ones
+    // are drawn into them every frame. Every object is dynamic by default
+    void setStaticObjects(const std::vector<uint8_t>& flags);
+
+    // Point lights in world space, at most MAX_POINT_LIGHTS. The ambient
+    // term is white by default, so the scene shows its textures unlit until
+    // it is lowered
+    void setPointLights(const std::vector<PointLight>& lights);
+    void setAmbientLight(const glm::vec3& ambient);
+    // Directional light with cascaded shadows. direction is where the light
+    // travels, a black color turns the sun and its shadow passes off, which
+    // is the default
+    void setSun(const glm::vec3& direction, const glm::vec3& color);
+    bool getSun() const { return shadowCascades.isSunEnabled(); }
+
+    // Device memory the textures may hold, DEFAULT_TEXTURE_BUDGET unless
+    // changed. The heap budget of VK_EXT_memory_budget can lower it further
+    void setTextureBudget(VkDeviceSize bytes) {
+        textureStreamer.setBudget(bytes);
+    }
+    // Every texture is at the level the last frames sampled it at, or as
+    // close as the budget allows
+    bool isTextureStreamingIdle() const { return textureStreamer.isIdle(); }
+    // Between a finished initVulkan and cleanup
+    bool isInitialized() const { return initialized; }
+
+    // GPU culling against the view frustum and last frame's depth. Both are
+    // on by default, turning them off draws every object
+    void setGpuCulling(bool frustum, bool occlusion);
+
+    // Lay down depth in a depth only pass first, then shade with an EQUAL
+    // depth test so every pixel runs the fragment shader once. Pays off when
+    // overdraw is heavy. Off by default, rebuilds the render graph if already
+    // running
+    void setDepthPrepass(bool enabled);
+    bool getDepthPrepass() const { return depthPrepassEnabled; }
+
+    // Off, MSAA or FXAA. MSAA sample counts above the device's limit fall
+    // back to the highest it supports. Defaults to 4x MSAA. Rebuilds the
+    // render passes, pipelines and frame attachments if already running
+    void setAntiAliasing(AntiAliasingMode mode);
+    AntiAliasingMode getAntiAliasing() const { return antiAliasing; }
+    VkSampleCountFlagBits getSampleCount() const { return msaaSamples; }
+    const AntiAliasingTiming& getAntiAliasingTiming(
+        AntiAliasingMode mode) const {
+        return antiAliasingTimings[static_cast<size_t>(mode)];
+    }
+
+    // Render the scene at a lower resolution when the GPU frame time goes
+    // over targetMs, then upscale it to the swapchain. The scale only ever
+    // goes down to half of either axis. Off by default, rebuilds the render
+    // graph if already running
+    void setDynamicResolution(bool enabled, double targetMs);
+    bool getDynamicResolution() const { return dynamicResolutionEnabled; }
+    double getDynamicResolutionTarget() const {
+        return dynamicResolution.getTarget();
+    }
+
+    // Gather pipeline statistics such as fragment shader invocations per
+    // render graph pass, when the device supports them. Always on with
+    // validation layers. Call before initVulkan
+    void setPipelineStatistics(bool enabled);
+
+    const FrameStats& getFrameStats();
+    const GpuProfiler& getGpuProfiler() const { return gpuProfiler; }
+    std::string getDeviceName();
+
+    // Counters from the allocator of the frame being recorded
+    const DescriptorAllocatorStats& getDescriptorStats() const;
+
+    // Out of memory and device lost handling. Subsystems holding GPU caches
+    // register eviction callbacks here
+    VulkanRecovery& getRecovery() { return recovery; }
+
    private:
     // Get the queue families for the physical device
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
@@ -159,7 +364,8 @@ class VulkanContext {
     VkDevice device;
 
     VkQueue graphicsQueue;
-    VkQueue presentQueue;
+    // Left null when headless
+    VkQueue presentQueue = VK_NULL_HANDLE;
 
     VkSwapchainKHR swapchain;
     std::vector<VkImage> swapchainImages;
@@ -172,48 +378,147 @@ class VulkanContext {
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
+    // Pipelines and render passes depend on the sample count, these go when
+    // it changes
+    void cleanupGraphicsPipelines();
+
+    // Depth pre-pass: a depth only render pass and pipeline, and variants of
+    // the main render pass and pipeline that load its depth and only shade
+    // fragments that match it
+    VkRenderPass depthPrepassRenderPass;
+    VkRenderPass depthTestedRenderPass;
+    VkPipeline depthPrepassPipeline;
+    VkPipeline depthEqualPipeline;
+    VkFramebuffer depthPrepassFramebuffer = VK_NULL_HANDLE;
+    bool depthPrepassEnabled = false;
+    // The main render pass, clearing depth or loading it from the pre-pass
+    VkRenderPass createMainRenderPass(bool depthPrepass);
+    void createDepthPrepassRenderPass();
+    // Draw the visible instances into depth only
+    void recordDepthPrepass(VkCommandBuffer commandBuffer);
 
     VkCommandPool commandPool;
     std::vector<VkCommandBuffer> commandBuffers;
 
-    std::vector<Vertex> vertices;
-    std::vector<Vertex> vertices2;
-    std::vector<uint32_t> indices;
-    std::vector<uint32_t> indices2;
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
-    VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
-
-    VkBuffer vertexBuffer2;
-    VkDeviceMemory vertexBufferMemory2;
-    VkBuffer indexBuffer2;
-    VkDeviceMemory indexBufferMemory2;
-
-    void createVertexBuffer2();
-    void createIndexBuffer2();
+    // Meshes and textures by path and load settings, so one loaded twice is
+    // shared. Unused ones stay cached under a memory cap
+    AssetCache<GpuMesh> meshCache;
+    AssetCache<GpuTexture> textureCache;
+    void createAssetCaches();
+    // Load through the caches, throws if the asset is missing or broken
+    AssetHandle<GpuMesh> loadMesh(const std::string& path);
+    AssetHandle<GpuTexture> loadTexture(const std::string& path);
+    // Copy data into a new device local buffer
+    void createDeviceBuffer(const void* data, VkDeviceSize size,
+                            VkBufferUsageFlags usage, VkBuffer& buffer,
+                            VkDeviceMemory& memory);
+
+    // Model and texture of every mesh id, held for as long as Vulkan runs
+    std::array<AssetHandle<GpuMesh>, LOADED_MESH_COUNT> meshAssets{};
+    std::array<AssetHandle<GpuTexture>, LOADED_MESH_COUNT> textureAssets{};
+    void loadMeshAssets();
+    void releaseMeshAssets();
+    const GpuMesh& getMesh(uint32_t mesh) const {
+        return *meshCache.get(meshAssets[mesh]);
+    }
+    // Streamed texture slot of a mesh id
+    uint32_t getMeshTexture(uint32_t mesh) const {
+        return textureCache.get(textureAssets[mesh])->slot;
+    }
 
     std::vector<VkBuffer> uniformBuffers;
     std::vector<VkDeviceMemory> uniformBuffersMemory;
     std::vector<void*> uniformBuffersMapped;
 
-    std::vector<VkBuffer> uniformBuffers2;
-    std::vector<VkDeviceMemory> uniformBuffersMemory2;
-    std::vector<void*> uniformBuffersMapped2;
-
     void createUniformBuffers();
 
-    void updateUniformBuffer2(uint32_t currentImage);
-
-    void loadModel();
-
-    Assimp::Importer importer;
-
-    void createDescriptorSets2();
-    void createUniformBuffers2();
+    // Model matrices for every object, one persistently mapped storage
+    // buffer per frame in flight
+    std::vector<VkBuffer> transformBuffers;
+    std::vector<VkDeviceMemory> transformBuffersMemory;
+    std::vector<void*> transformBuffersMapped;
+    // Bit f is set while frame f's buffer still has an old matrix
+    std::vector<uint8_t> transformStaleFrames =
+        std::vector<uint8_t>(MAX_OBJECT_TRANSFORMS, 0);
+    // Objects with any stale bit set
+    std::vector<uint32_t> staleTransforms;
+
+    void createTransformBuffers();
+    void markTransformStale(uint32_t object);
+    // Copy matrices this frame's buffer has not seen yet
+    void uploadObjectTransforms(uint32_t frame);
+
+    // Objects that share a mesh, a contiguous run of the instance buffer
+    struct InstanceGroup {
+        uint32_t mesh;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    std::vector<uint32_t> objectMeshes = {0, 1};
+    std::vector<glm::vec4> objectTints =
+        std::vector<glm::vec4>(MAX_OBJECT_TRANSFORMS, glm::vec4(1.0f));
+    // Rebuilt from objectMeshes whenever the meshes or tints change
+    std::vector<InstanceData> instances;
+    std::vector<InstanceGroup> instanceGroups;
+    // One per group, the cull pass counts the instances in
+    std::vector<VkDrawIndexedIndirectCommand> instanceDraws;
+    bool instancesDirty = true;
+
+    // Per frame in flight, persistently mapped
+    std::vector<VkBuffer> instanceBuffers;
+    std::vector<VkDeviceMemory> instanceBuffersMemory;
+    std::vector<void*> instanceBuffersMapped;
+
+    void createInstanceBuffers();
+    // Sort the objects into one group per mesh
+    void buildInstanceGroups();
+    // Write this frame's instance buffer, before recording
+    void updateInstances(uint32_t frame);
+    // One indirect draw for a group, the cull pass fills in its instances
+    void drawInstanceGroup(VkCommandBuffer commandBuffer, uint32_t drawIndex);
+
+    // Frustum and occlusion culling before the main pass
+    GpuCulling gpuCulling;
+    void createGpuCulling();
+
+    // Light lists per cluster for the main pass's fragment shader
+    ClusteredLighting clusteredLighting;
+    void createClusteredLighting();
+    void bindLighting(DescriptorBindings& bindings, uint32_t frame) const;
+    // Camera and viewport of the frame for the binning pass, before
+    // recording
+    void updateLighting(uint32_t frame);
+
+    // Sun shadows, the far cascades cache the static objects
+    ShadowCascades shadowCascades;
+    std::vector<uint8_t> staticObjects;
+    std::vector<ShadowCaster> shadowCasters;
+    // Needs the vertex and index buffers
+    void createShadowCascades();
+    // World space bounding sphere of an object's mesh
+    glm::vec4 getObjectBounds(uint32_t object) const;
+    bool isObjectStatic(uint32_t object) const {
+        return object < staticObjects.size() && staticObjects[object];
+    }
+    // Fit the cascades and cull the casters, before recording
+    void updateShadows(uint32_t frame);
+
+    // Texture mips, streamed in from the main pass's usage feedback
+    TextureStreamer textureStreamer;
+    // Stream mips and write the frame's main pass sets, before recording
+    void updateTextures(uint32_t frame);
+    void updateDescriptorSets(uint32_t frame);
+
+    // Textures and models, read in one batch while the device is set up and
+    // dropped once they are loaded
+    std::shared_ptr<FileBatch> assetFiles;
+    // Files loaded after the batch are read into here
+    std::vector<uint8_t> assetFile;
+    // Waits for the batch, or reads the file if the batch does not have it.
+    // Throws if the file could not be read
+    std::vector<uint8_t>& getAssetFile(const std::string& path);
 
-    void createTextureImage();
-    void createTextureImage2();
     void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples,
                      VkFormat format, VkImageTiling tiling,
                      VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
@@ -223,34 +528,97 @@ class VulkanContext {
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
     uint32_t currentFrame = 0;
-
-    VkDescriptorPool descriptorPool;
-    std::vector<VkDescriptorSet> descriptorSets;
-    std::vector<VkDescriptorSet> descriptorSets2;
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    // Set once initVulkan has finished, runtime changes rebuild resources
+    bool initialized = false;
+
+    // Uniform buffers, descriptors, command buffers, sync objects and GPU
+    // queries, one of each per frame in flight
+    void createFrameResources();
+    void cleanupFrameResources();
+
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    VkPresentModeKHR activePresentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+    // One allocator per frame in flight, its sets cached across frames. The
+    // main pass sets are looked up here every frame, and the sets of a view
+    // streaming swapped out are invalidated
+    std::vector<DescriptorAllocator> frameDescriptorAllocators;
+    // Texture view each frame's main pass sets were last written with
+    std::vector<std::array<VkImageView, LOADED_MESH_COUNT>> boundTextureViews;
+    // Main pass set of each loaded mesh, per frame in flight
+    std::vector<std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT>>
+        meshDescriptorSets;
 
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkSampleCountFlagBits maxMsaaSamples = VK_SAMPLE_COUNT_1_BIT;
     VkSampleCountFlagBits getMaxUsableSampleCount();
 
-    VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
-    VkImageView colorImageView;
-
-    uint32_t mipLevels;
-    VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
-
-    uint32_t mipLevels2;
-    VkImage textureImage2;
-    VkDeviceMemory textureImageMemory2;
-
-    VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
-    VkImageView depthImageView;
+    AntiAliasingMode antiAliasing = AntiAliasingMode::Msaa4x;
+    // Samples the mode renders with on this device
+    VkSampleCountFlagBits sampleCountFor(AntiAliasingMode mode) const;
+    // Matches FxaaConstants in fxaa.frag
+    struct FxaaConstants {
+        glm::vec2 inverseSize;
+        glm::vec2 uvScale;
+    };
+    // Post-process alternative to MSAA, samples sceneColorTarget
+    PostProcessPass fxaaPass;
+    // Load the full screen shaders and build the post-process pipelines
+    void createPostProcessPasses();
+    std::array<AntiAliasingTiming, ANTI_ALIASING_MODE_COUNT>
+        antiAliasingTimings{};
+    // Profiler results trail by the frames in flight, so the first ones
+    // after a switch still belong to the old mode
+    uint32_t antiAliasingSkipFrames = 0;
+    // Fold the last GPU results into the active mode's timing
+    void updateAntiAliasingTiming();
+
+    // Matches UpscaleConstants in upscale.frag
+    struct UpscaleConstants {
+        glm::vec2 inverseSize;
+        glm::vec2 uvScale;
+        float sharpness;
+    };
+    // The scene is drawn into the top left renderExtent of full size
+    // attachments, so a new scale never reallocates anything. The upscale
+    // pass then stretches it over the swapchain image
+    bool dynamicResolutionEnabled = false;
+    DynamicResolution dynamicResolution;
+    VkExtent2D renderExtent{};
+    PostProcessPass upscalePass;
+    // Scale renderExtent from the swapchain
+    void updateRenderExtent();
+    // Feed the last GPU frame time to the controller, before recording
+    void updateDynamicResolution();
+
+    // Frame attachments and the passes that use them. Color and depth are
+    // owned by the graph, the swapchain image is imported each frame
+    RenderGraph renderGraph;
+    // Multisampled color, only with MSAA. It resolves into the backbuffer,
+    // or into the scene color when that exists
+    RenderGraphHandle colorTarget = INVALID_RENDER_GRAPH_HANDLE;
+    // Single sampled color the post-processing reads, only with FXAA or
+    // dynamic resolution. Without either the main pass draws straight into
+    // the backbuffer
+    RenderGraphHandle sceneColorTarget = INVALID_RENDER_GRAPH_HANDLE;
+    // FXAA output waiting to be upscaled, only with both of them
+    RenderGraphHandle antiAliasedTarget = INVALID_RENDER_GRAPH_HANDLE;
+    RenderGraphHandle depthTarget = INVALID_RENDER_GRAPH_HANDLE;
+    RenderGraphHandle backbuffer = INVALID_RENDER_GRAPH_HANDLE;
+    // Swapchain image being recorded, read by the pass callbacks
+    uint32_t currentImageIndex = 0;
 
     void createDepthResources();
 
     void createColorResources();
 
+    // Import the swapchain, add the passes and compile the graph
+    void buildRenderGraph();
+
+    // Draw the scene into the main render pass
+    void recordMainPass(VkCommandBuffer commandBuffer);
+
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates,
                                  VkImageTiling tiling,
                                  VkFormatFeatureFlags features);
@@ -259,6 +627,50 @@ class VulkanContext {
 
     bool framebufferResized = false;
 
+    glm::vec3 cameraEye = glm::vec3(0.0f, 0.0f, 3.0f);
+    glm::vec3 cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
+    std::vector<glm::mat4> objectTransforms =
+        std::vector<glm::mat4>(MAX_OBJECT_TRANSFORMS, glm::mat4(1.0f));
+
+    // Times every render graph pass, results trail by a frame in flight
+    GpuProfiler gpuProfiler;
+    bool pipelineStatisticsSupported = false;
+    bool pipelineStatisticsRequested = false;
+    bool memoryBudgetSupported = false;
+    FrameStats frameStats;
+
+    // Memory allocation retries and device loss bookkeeping
+    VulkanRecovery recovery;
+    // Returns true if the frame can go on. Out of date swapchains are
+    // recreated, lost devices rebuilt, anything else is fatal
+    bool handleFrameResult(VkResult result, const char* operation);
+    // Tear down every Vulkan object and initialize again on a new device
+    void recoverDeviceLost();
+
+    // Headless mode: swapchainImages hold offscreen images we own, one per
+    // frame in flight
+    bool headless = false;
+    VkExtent2D headlessExtent{};
+    std::vector<VkDeviceMemory> offscreenImageMemory;
+
+    // Host visible copy of the backbuffer for frame captures
+    VkBuffer readbackBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory readbackBufferMemory = VK_NULL_HANDLE;
+    void* readbackBufferMapped = nullptr;
+    std::string capturePath;
+    bool captureThisFrame = false;
+    ImageWriter imageWriter;
+
+    // Create the offscreen images that stand in for the swapchain
+    void createOffscreenTargets();
+    // Copy the backbuffer into the readback buffer if a capture is pending
+    void recordReadbackPass(VkCommandBuffer commandBuffer);
+    // Wait for the captured frame and write it to disk
+    void saveCapture();
+
+    // Device extensions we need, the swapchain is skipped when headless
+    std::vector<const char*> getDeviceExtensions();
+
     // The steps in order we take to initialize Vulkan
     void createInstance();
     // If debug mode, create the debug messenger
@@ -272,50 +684,29 @@ class VulkanContext {
     void createGraphicsPipeline();
     void createFramebuffers();
     void createCommandPool();
-    void createVertexBuffer();
     void createCommandBuffers();
     void createSyncObjects();
 
     void createTextureImageModel();
 
-    void createTextureImageView2();
-
-    void createTextureSampler2();
-
     void createTextureSampler();
 
-    void loadModel2();
 
-    void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
-
-    VkImageView textureImageView;
+    // Shared by every streamed texture
     VkSampler textureSampler;
 
-    VkImageView textureImageView2;
-    VkSampler textureSampler2;
-
-    void createTextureImageView();
-
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
-    void transitionImageLayout(VkImage image, VkFormat format,
-                               VkImageLayout oldLayout,
-                               VkImageLayout newLayout, uint32_t mipLevels);
-
     void createDescriptorPool();
-    void createDescriptorSets();
 
     void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                       VkMemoryPropertyFlags properties, VkBuffer& buffer,
                       VkDeviceMemory& bufferMemory);
 
-    void createIndexBuffer();
-
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                           uint32_t height);
-
     void updateUniformBuffer(uint32_t currentImage);
+    // View and projection of the camera for this frame
+    UniformBufferObject buildCameraUniforms();
 
     VkImageView createImageView(VkImage image, VkFormat format,
                                 VkImageAspectFlags aspectFlags, uint32_t mipLevels);
@@ -327,9 +718,6 @@ class VulkanContext {
     // Check to make sure we have the required validation layers
     bool checkValidationLayerSupport();
 
-    uint32_t findMemoryType(uint32_t typeFilter,
-                            VkMemoryPropertyFlags properties);
-
     // Get the required extensions for the Vulkan instance
     std::vector<const char*> getRequiredExtensions();
 
@@ -375,7 +763,7 @@ class VulkanContext {
     // Get the desired swap extent
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
 
-    // Read in a file and return the buffer
+    // Read in a file through the virtual file system and return the buffer
     std::vector<char> readFile(const std::string& filename);
 
     // Destroy the swap chain
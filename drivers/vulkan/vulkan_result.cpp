@@ -0,0 +1,188 @@
+#include "vulkan_result.h"
+
+#include <algorithm>
+
+// Name of a VkResult for log messages
+const char* vkResultName(VkResult result) {
+    switch (result) {
+        case VK_SUCCESS:
+            return "VK_SUCCESS";
+        case VK_NOT_READY:
+            return "VK_NOT_READY";
+        case VK_TIMEOUT:
+            return "VK_TIMEOUT";
+        case VK_INCOMPLETE:
+            return "VK_INCOMPLETE";
+        case VK_SUBOPTIMAL_KHR:
+            return "VK_SUBOPTIMAL_KHR";
+        case VK_ERROR_OUT_OF_HOST_MEMORY:
+            return "VK_ERROR_OUT_OF_HOST_MEMORY";
+        case VK_ERROR_OUT_OF_DEVICE_MEMORY:
+            return "VK_ERROR_OUT_OF_DEVICE_MEMORY";
+        case VK_ERROR_INITIALIZATION_FAILED:
+            return "VK_ERROR_INITIALIZATION_FAILED";
+        case VK_ERROR_DEVICE_LOST:
+            return "VK_ERROR_DEVICE_LOST";
+        case VK_ERROR_MEMORY_MAP_FAILED:
+            return "VK_ERROR_MEMORY_MAP_FAILED";
+        case VK_ERROR_LAYER_NOT_PRESENT:
+            return "VK_ERROR_LAYER_NOT_PRESENT";
+        case VK_ERROR_EXTENSION_NOT_PRESENT:
+            return "VK_ERROR_EXTENSION_NOT_PRESENT";
+        case VK_ERROR_FEATURE_NOT_PRESENT:
+            return "VK_ERROR_FEATURE_NOT_PRESENT";
+        case VK_ERROR_TOO_MANY_OBJECTS:
+            return "VK_ERROR_TOO_MANY_OBJECTS";
+        case VK_ERROR_FORMAT_NOT_SUPPORTED:
+            return "VK_ERROR_FORMAT_NOT_SUPPORTED";
+        case VK_ERROR_FRAGMENTED_POOL:
+            return "VK_ERROR_FRAGMENTED_POOL";
+        case VK_ERROR_OUT_OF_POOL_MEMORY:
+            return "VK_ERROR_OUT_OF_POOL_MEMORY";
+        case VK_ERROR_SURFACE_LOST_KHR:
+            return "VK_ERROR_SURFACE_LOST_KHR";
+        case VK_ERROR_OUT_OF_DATE_KHR:
+            return "VK_ERROR_OUT_OF_DATE_KHR";
+        default:
+            return "unknown VkResult";
+    }
+}
+
+// Host or device out of memory
+bool isOutOfMemory(VkResult result) {
+    return result == VK_ERROR_OUT_OF_HOST_MEMORY ||
+           result == VK_ERROR_OUT_OF_DEVICE_MEMORY;
+}
+
+VulkanError::VulkanError(VkResult result, const std::string& operation)
+    : std::runtime_error("Failed to " + operation + " (" +
+                         vkResultName(result) + ")"),
+      result(result) {}
+
+// Throw a VulkanError if result is an error code
+void checkVulkanResult(VkResult result, const char* operation) {
+    if (result < 0) {
+        Logger::get().flush();
+        throw VulkanError(result, operation);
+    }
+}
+
+void VulkanRecovery::init(VkDevice device, VkPhysicalDevice physicalDevice) {
+    this->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+// Callbacks run in the order they were added
+void VulkanRecovery::addEvictionCallback(const std::string& name,
+                                         EvictionCallback callback) {
+    evictors.push_back({name, std::move(callback)});
+}
+
+void VulkanRecovery::removeEvictionCallback(const std::string& name) {
+    evictors.erase(std::remove_if(evictors.begin(), evictors.end(),
+                                  [&](const Evictor& evictor) {
+                                      return evictor.name == name;
+                                  }),
+                   evictors.end());
+}
+
+void VulkanRecovery::clearEvictionCallbacks() { evictors.clear(); }
+
+int32_t VulkanRecovery::findMemoryType(uint32_t memoryTypeBits,
+                                       VkMemoryPropertyFlags properties,
+                                       VkMemoryPropertyFlags excluded) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+        if ((memoryTypeBits & (1 << i)) && (flags & properties) == properties &&
+            (flags & excluded) == 0) {
+            return static_cast<int32_t>(i);
+        }
+    }
+    return -1;
+}
+
+VkResult VulkanRecovery::tryAllocate(VkDeviceSize size, int32_t memoryType,
+                                     VkDeviceMemory& memory) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = static_cast<uint32_t>(memoryType);
+    return vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+}
+
+// Allocate memory, evicting caches and falling back to a host heap on out of
+// memory
+VkResult VulkanRecovery::allocateMemory(VkDeviceSize size,
+                                        uint32_t memoryTypeBits,
+                                        VkMemoryPropertyFlags properties,
+                                        VkDeviceMemory& memory) {
+    int32_t memoryType = findMemoryType(memoryTypeBits, properties, 0);
+    if (memoryType < 0) {
+        debugger.consoleMessage("Failed to find suitable memory type!", false);
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    VkResult result = tryAllocate(size, memoryType, memory);
+    if (!isOutOfMemory(result)) return result;
+    stats.outOfMemoryErrors++;
+    LOG_WARNING("Out of memory allocating {} bytes ({}), evicting caches", size,
+                vkResultName(result));
+
+    // Caches first, they are the cheapest thing to give back
+    if (evict(size) > 0) {
+        result = tryAllocate(size, memoryType, memory);
+        if (!isOutOfMemory(result)) return result;
+    }
+
+    // Memory of finished frames may still be pending release in the driver
+    vkDeviceWaitIdle(device);
+    result = tryAllocate(size, memoryType, memory);
+    if (!isOutOfMemory(result)) return result;
+
+    // Slower, but a frame rendered from host memory beats a crash
+    if (properties & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+        int32_t fallbackType = findMemoryType(
+            memoryTypeBits, properties & ~VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (fallbackType >= 0) {
+            result = tryAllocate(size, fallbackType, memory);
+            if (result == VK_SUCCESS) {
+                stats.fallbackAllocations++;
+                LOG_WARNING("Allocated {} bytes in host memory instead", size);
+                return result;
+            }
+        }
+    }
+
+    LOG_ERROR("Out of memory allocating {} bytes, recovery failed ({})", size,
+              vkResultName(result));
+    return result;
+}
+
+// Run every eviction callback, returns the bytes freed
+VkDeviceSize VulkanRecovery::evict(VkDeviceSize bytesNeeded) {
+    VkDeviceSize freed = 0;
+    for (auto& evictor : evictors) {
+        VkDeviceSize released = evictor.callback(bytesNeeded);
+        if (released > 0) {
+            LOG_INFO("Evicted {} bytes from {}", released, evictor.name);
+        }
+        freed += released;
+    }
+    stats.evictions++;
+    stats.bytesEvicted += freed;
+    return freed;
+}
+
+// Record a lost device, false once the session's budget is spent
+bool VulkanRecovery::beginDeviceLostRecovery() {
+    if (stats.deviceLostRecoveries >= maxDeviceLostRecoveries) {
+        LOG_ERROR("Device lost {} times, giving up",
+                  stats.deviceLostRecoveries + 1);
+        return false;
+    }
+    stats.deviceLostRecoveries++;
+    LOG_WARNING("Device lost, rebuilding the Vulkan context (attempt {} of {})",
+                stats.deviceLostRecoveries, maxDeviceLostRecoveries);
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef VULKAN_RESULT_H
+#define VULKAN_RESULT_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+
+// Name of a VkResult for log messages
+const char* vkResultName(VkResult result);
+
+// Host or device out of memory
+bool isOutOfMemory(VkResult result);
+
+// Thrown when a Vulkan call fails and every recovery policy has been tried.
+// Carries the VkResult so a caller can still tell what went wrong
+class VulkanError : public std::runtime_error {
+   public:
+    VulkanError(VkResult result, const std::string& operation);
+
+    VkResult getResult() const { return result; }
+
+   private:
+    VkResult result;
+};
+
+// Throw a VulkanError if result is an error code. Positive results such as
+// VK_SUBOPTIMAL_KHR are not errors
+void checkVulkanResult(VkResult result, const char* operation);
+
+// Counters so long sessions show how often recovery kicked in
+struct VulkanRecoveryStats {
+    uint64_t outOfMemoryErrors = 0;
+    uint64_t evictions = 0;
+    VkDeviceSize bytesEvicted = 0;
+    // Allocations that ended up outside the memory type asked for
+    uint64_t fallbackAllocations = 0;
+    uint64_t deviceLostRecoveries = 0;
+};
+
+// Recovery policies for failed Vulkan calls. Memory allocations go through
+// here so an out of memory error first evicts caches and falls back to a
+// slower heap before giving up, and device loss is counted so the context
+// can rebuild itself a bounded number of times
+class VulkanRecovery {
+   public:
+    // Frees memory held by a cache and returns how many bytes were released.
+    // bytesNeeded is a hint, freeing more is fine
+    using EvictionCallback = std::function<VkDeviceSize(VkDeviceSize)>;
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice);
+
+    // Callbacks run in the order they were added, cheapest to rebuild first
+    void addEvictionCallback(const std::string& name,
+                             EvictionCallback callback);
+    // Drop every callback added under the name
+    void removeEvictionCallback(const std::string& name);
+    void clearEvictionCallbacks();
+
+    // Allocate memory of a type in memoryTypeBits with the given properties.
+    // On out of memory: evict caches and retry, then wait for the GPU to
+    // retire in flight work and retry, then, if the properties ask for device
+    // local memory, retry in a host heap. Returns the last VkResult
+    VkResult allocateMemory(VkDeviceSize size, uint32_t memoryTypeBits,
+                            VkMemoryPropertyFlags properties,
+                            VkDeviceMemory& memory);
+
+    // Run every eviction callback, returns the bytes freed
+    VkDeviceSize evict(VkDeviceSize bytesNeeded);
+
+    // Record a lost device. Returns false once the recovery budget for the
+    // session is spent and the caller should give up
+    bool beginDeviceLostRecovery();
+
+    const VulkanRecoveryStats& getStats() const { return stats; }
+
+   private:
+    struct Evictor {
+        std::string name;
+        EvictionCallback callback;
+    };
+
+    // Index of a matching memory type, or -1. excluded flags must be absent
+    int32_t findMemoryType(uint32_t memoryTypeBits,
+                           VkMemoryPropertyFlags properties,
+                           VkMemoryPropertyFlags excluded) const;
+    VkResult tryAllocate(VkDeviceSize size, int32_t memoryType,
+                         VkDeviceMemory& memory);
+
+    Debugger debugger;
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    std::vector<Evictor> evictors;
+
+    // Device loss this many times in one session is treated as fatal
+    uint32_t maxDeviceLostRecoveries = 3;
+
+    VulkanRecoveryStats stats;
+};
+
+#endif
@@ -1,4 +1,13 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+
 #include "core/debugger/debugger.h"
+#include "core/debugger/profiler.h"
+#include "core/vfs/io_benchmark.h"
+#include "core/vfs/virtual_file_system.h"
+#include "scene/ecs/ecs_benchmark.h"
+#include "servers/benchmark_runner.h"
 #include "servers/display_server.h"
 
 #ifdef NDEBUG
@@ -7,7 +16,197 @@ const bool DEBUG = false;
 const bool DEBUG = true;
 #endif
 
-int main() {
+// This is defined in the CMakelists.txt file
+// Doing this simply to get rid of the intellisense error
+#ifndef ASSET_PATH
+#define ASSET_PATH ""
+#endif
+#ifndef SHADER_PATH
+#define SHADER_PATH ""
+#endif
+
+// Command line options
+//   --headless          render offscreen with no window
+//   --frames N          number of frames to render when headless
+//   --width W           offscreen width when headless
+//   --height H          offscreen height when headless
+//   --capture PATH      save the last headless frame as a PNG
+//   --benchmark         run the camera path benchmark headless, --frames
+//                       sets the frames per path
+//   --golden-dir DIR    where the benchmark golden images live
+//   --update-golden     overwrite the golden images with this run's frames
+//   --record-missing-golden
+//                       record golden images only for paths without one and
+//                       compare the rest. None are committed, so a fresh
+//                       checkout passes it to its first --benchmark run
+//   --output PATH       where the benchmark JSON results go
+//   --present-mode M    fifo, mailbox (default), immediate or fifo-relaxed
+//   --fps-cap N         cap the frame rate, 0 for uncapped
+//   --frames-in-flight N
+//                       frames the CPU may record ahead of the GPU, 1 to 4
+//   --depth-prepass     lay down depth before shading, F4 toggles it live
+//   --aa M              off, msaa2, msaa4 (default), msaa8 or fxaa, F5
+//                       cycles it live
+//   --dynamic-resolution MS
+//                       lower the render resolution to keep the GPU frame
+//                       under MS milliseconds, F6 toggles it live
+//   --lights N          scatter N point lights around the scene with a dim
+//                       ambient, up to 4096
+//   --sun               light the scene with a sun casting cascaded shadows,
+//                       F7 toggles it live
+//   --texture-budget MB device memory streamed textures may hold, default
+//                       256, the driver's memory budget can lower it
+//   --ecs-benchmark     time the ECS on a synthetic world and exit, --frames
+//                       sets the passes per system
+//   --entities N        entities in the ECS benchmark, default 100000
+//   --io-benchmark      time loading a level's worth of files with each
+//                       reader and exit, --frames sets the passes
+//   --files N           files in the I/O benchmark, default 1000
+//   --trace PATH        write the CPU profiler zones as a Chrome trace on
+//                       shutdown (debug builds, or -DENABLE_PROFILER=ON)
+//   --pack PATH         mount a pack archive over the loose asset files,
+//                       repeat it to mount several, later ones win
+struct LaunchOptions {
+    bool headless = false;
+    bool benchmark = false;
+    bool ecsBenchmark = false;
+    uint32_t entities = 100000;
+    bool ioBenchmark = false;
+    uint32_t files = 1000;
+    BenchmarkOptions benchmarkOptions;
+    uint32_t frames = 300;
+    uint32_t width = 800;
+    uint32_t height = 600;
+    std::string capturePath;
+    std::string tracePath;
+    std::vector<std::string> packs;
+    FramePacingOptions pacing;
+    bool depthPrepass = false;
+    AntiAliasingMode antiAliasing = AntiAliasingMode::Msaa4x;
+    // 0 leaves dynamic resolution off
+    double dynamicResolutionMs = 0.0;
+    // 0 keeps the scene unlit
+    uint32_t lightCount = 0;
+    bool sun = false;
+    VkDeviceSize textureBudget = DEFAULT_TEXTURE_BUDGET;
+};
+
+LaunchOptions parseArguments(int argc, char* argv[], Debugger& debugger) {
+    LaunchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--width" && hasValue) {
+            options.width = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--height" && hasValue) {
+            options.height = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--capture" && hasValue) {
+            options.capturePath = argv[++i];
+        } else if (arg == "--benchmark") {
+            options.benchmark = true;
+        } else if (arg == "--golden-dir" && hasValue) {
+            options.benchmarkOptions.goldenDir = argv[++i];
+        } else if (arg == "--update-golden") {
+            options.benchmarkOptions.updateGolden = true;
+        } else if (arg == "--record-missing-golden") {
+            options.benchmarkOptions.recordMissingGolden = true;
+        } else if (arg == "--output" && hasValue) {
+            options.benchmarkOptions.outputPath = argv[++i];
+        } else if (arg == "--present-mode" && hasValue) {
+            if (!parsePresentMode(argv[++i], options.pacing.presentMode)) {
+                debugger.consoleMessage(
+                    ("Unknown present mode " + std::string(argv[i])).c_str(),
+                    true);
+            }
+        } else if (arg == "--fps-cap" && hasValue) {
+            options.pacing.maxFps = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--frames-in-flight" && hasValue) {
+            options.pacing.framesInFlight =
+                std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--depth-prepass") {
+            options.depthPrepass = true;
+        } else if (arg == "--aa" && hasValue) {
+            if (!parseAntiAliasing(argv[++i], options.antiAliasing)) {
+                debugger.consoleMessage(
+                    ("Unknown anti-aliasing mode " + std::string(argv[i]))
+                        .c_str(),
+                    true);
+            }
+        } else if (arg == "--dynamic-resolution" && hasValue) {
+            options.dynamicResolutionMs = std::strtod(argv[++i], nullptr);
+            if (options.dynamicResolutionMs <= 0.0) {
+                debugger.consoleMessage(
+                    "Dynamic resolution target must be positive!", true);
+            }
+        } else if (arg == "--lights" && hasValue) {
+            options.lightCount = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--sun") {
+            options.sun = true;
+        } else if (arg == "--texture-budget" && hasValue) {
+            options.textureBudget =
+                std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+            if (options.textureBudget == 0) {
+                debugger.consoleMessage("Texture budget must be positive!",
+                                        true);
+            }
+        } else if (arg == "--ecs-benchmark") {
+            options.ecsBenchmark = true;
+        } else if (arg == "--entities" && hasValue) {
+            options.entities = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--io-benchmark") {
+            options.ioBenchmark = true;
+        } else if (arg == "--files" && hasValue) {
+            options.files = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--pack" && hasValue) {
+            options.packs.push_back(argv[++i]);
+        } else {
+            debugger.consoleMessage(("Unknown argument " + arg).c_str(), true);
+        }
+    }
+    options.benchmarkOptions.width = options.width;
+    options.benchmarkOptions.height = options.height;
+    options.benchmarkOptions.framesPerPath = options.frames;
+    options.benchmarkOptions.depthPrepass = options.depthPrepass;
+    options.benchmarkOptions.antiAliasing = options.antiAliasing;
+    options.benchmarkOptions.dynamicResolutionMs = options.dynamicResolutionMs;
+    options.benchmarkOptions.lightCount = options.lightCount;
+    options.benchmarkOptions.sun = options.sun;
+    options.benchmarkOptions.textureBudget = options.textureBudget;
+    return options;
+}
+
+// Loose files from the build tree, with the packs given mounted over them
+void mountAssets(const LaunchOptions& options, Debugger& debugger) {
+    VirtualFileSystem& fileSystem = VirtualFileSystem::get();
+    fileSystem.mountDirectory(ASSET_PATH);
+    fileSystem.mountDirectory(SHADER_PATH, "shaders");
+    for (const std::string& pack : options.packs) {
+        if (!fileSystem.mountPack(pack)) {
+            debugger.consoleMessage(("Failed to mount pack " + pack).c_str(),
+                                    true);
+        }
+    }
+}
+
+// Dump the profiler zones recorded this run, if a trace was asked for
+void writeTrace(const LaunchOptions& options, Debugger& debugger) {
+    if (options.tracePath.empty()) return;
+#if PROFILER_ENABLED
+    Profiler::get().writeChromeTrace(options.tracePath);
+#else
+    debugger.consoleMessage(
+        "--trace ignored, profiler is not compiled into this build", false);
+#endif
+}
+
+int main(int argc, char* argv[]) {
     Debugger debugger;
     DisplayServer displayServer;
 
@@ -17,11 +216,69 @@ int main() {
         debugger.consoleMessage("\n[RELEASE MODE]", false);
     }
 
-    displayServer.init();
-    displayServer.run();
+    LaunchOptions options = parseArguments(argc, argv, debugger);
+    mountAssets(options, debugger);
+
+    // Vulkan errors that survive every recovery policy end up here with
+    // their VkResult, exit code 2 tells them apart from golden failures
+    try {
+        // The benchmark owns its own headless context, exit code 1 means a
+        // golden image did not match
+        if (options.benchmark) {
+            BenchmarkRunner benchmarkRunner;
+            bool passed = benchmarkRunner.run(options.benchmarkOptions);
+            writeTrace(options, debugger);
+            debugger.consoleMessage("\nProgram shutdown successful", false);
+            return passed ? 0 : 1;
+        }
+
+        // Needs no GPU at all
+        if (options.ecsBenchmark) {
+            EcsBenchmark ecsBenchmark;
+            ecsBenchmark.run(options.entities, options.frames);
+            writeTrace(options, debugger);
+            debugger.consoleMessage("\nProgram shutdown successful", false);
+            return 0;
+        }
+
+        if (options.ioBenchmark) {
+            IoBenchmark ioBenchmark;
+            ioBenchmark.run(options.files, options.frames);
+            writeTrace(options, debugger);
+            debugger.consoleMessage("\nProgram shutdown successful", false);
+            return 0;
+        }
+
+        displayServer.setFramePacing(options.pacing);
+        displayServer.setDepthPrepass(options.depthPrepass);
+        displayServer.setAntiAliasing(options.antiAliasing);
+        if (options.dynamicResolutionMs > 0.0) {
+            displayServer.setDynamicResolution(options.dynamicResolutionMs);
+        }
+        if (options.lightCount > 0) {
+            displayServer.setPointLights(options.lightCount);
+        }
+        if (options.sun) {
+            displayServer.setSun();
+        }
+        displayServer.setTextureBudget(options.textureBudget);
+        if (options.headless) {
+            displayServer.initHeadless(options.width, options.height);
+            displayServer.runHeadless(options.frames, options.capturePath);
+        } else {
+            displayServer.init();
+            displayServer.run();
+        }
+    } catch (const VulkanError& error) {
+        Logger::get().flush();
+        std::cerr << error.what() << std::endl;
+        displayServer.cleanup();
+        return 2;
+    }
 
     debugger.consoleMessage("\nShutdown initiated...", false);
     displayServer.cleanup();
+    writeTrace(options, debugger);
     debugger.consoleMessage("\nProgram shutdown successful", false);
     return 0;
-}
\ No newline at end of file
+}
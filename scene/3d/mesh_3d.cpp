@@ -1,22 +1,70 @@
 #include "mesh_3d.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "thirdparty/stb/stb_image.h"
-
-Mesh3D::Mesh3D(const char* meshFile, const char* textureFile) {
-    debugger.consoleMessage("\nBegin loading in Mesh3D...", false);
-    debugger.consoleMessage("Begin loading in texture image...", false);
-    int texWidth, texHeight, texChannels;
-    texturePixels =
-        stbi_load(textureFile, &texWidth,
-                  &texHeight, &texChannels, STBI_rgb_alpha);
-
-    if (!texturePixels) {
-        debugger.consoleMessage("Failed to load texture image!", true);
-    } else {
-        debugger.consoleMessage("Successfully loaded texture image", false);
+
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <algorithm>
+#include <assimp/Importer.hpp>
+#include <unordered_map>
+
+// Center of the bounding box and the farthest vertex from it. Not the
+// tightest sphere, but close enough for culling
+static glm::vec4 computeBoundingSphere(const std::vector<Vertex>& vertices) {
+    if (vertices.empty()) return glm::vec4(0.0f);
+    glm::vec3 minimum = vertices[0].pos;
+    glm::vec3 maximum = vertices[0].pos;
+    for (const Vertex& vertex : vertices) {
+        minimum = glm::min(minimum, vertex.pos);
+        maximum = glm::max(maximum, vertex.pos);
     }
+    glm::vec3 center = (minimum + maximum) * 0.5f;
+    float radius = 0.0f;
+    for (const Vertex& vertex : vertices) {
+        radius = std::max(radius, glm::length(vertex.pos - center));
+    }
+    return glm::vec4(center, radius);
+}
+
+bool Mesh3D::load(const std::vector<uint8_t>& file,
+                  const std::string& format) {
+    vertices.clear();
+    indices.clear();
 
-    mipLevels = static_cast<uint32_t>(
-                    std::floor(std::log2(std::max(texWidth, texHeight)))) +
-                1;
-}
\ No newline at end of file
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFileFromMemory(
+        file.data(), file.size(),
+        aiProcess_Triangulate | aiProcess_FlipUVs |
+            aiProcess_GenSmoothNormals,
+        format.c_str());
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
+        !scene->mRootNode) {
+        debugger.consoleMessage("Failed to load model!", false);
+        return false;
+    }
+
+    std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+        const aiMesh* mesh = scene->mMeshes[i];
+
+        for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
+            Vertex vertex{};
+            vertex.pos = {mesh->mVertices[j].x, mesh->mVertices[j].y,
+                          mesh->mVertices[j].z};
+            vertex.texCoord = {mesh->mTextureCoords[0][j].x,
+                               mesh->mTextureCoords[0][j].y};
+            vertex.color = {1.0f, 1.0f, 1.0f};
+            vertex.normal = {mesh->mNormals[j].x, mesh->mNormals[j].y,
+                             mesh->mNormals[j].z};
+
+            if (uniqueVertices.count(vertex) == 0) {
+                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+                vertices.push_back(vertex);
+            }
+
+            indices.push_back(uniqueVertices[vertex]);
+        }
+    }
+    bounds = computeBoundingSphere(vertices);
+    debugger.consoleMessage("Successfully loaded model", false);
+    return true;
+}
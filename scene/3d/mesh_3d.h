@@ -4,21 +4,28 @@
 #include <vulkan/vulkan.h>
 
 #include <array>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
 
-#include "core/debugger/debugger.h"
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/gtx/hash.hpp>
 
+#include "core/debugger/debugger.h"
 
 struct Vertex {
     glm::vec3 pos;
     glm::vec3 color;
     glm::vec2 texCoord;
+    // Model space, for lighting
+    glm::vec3 normal;
 
     bool operator==(const Vertex& other) const {
         return pos == other.pos && color == other.color &&
-               texCoord == other.texCoord;
+               texCoord == other.texCoord && normal == other.normal;
     }
 
     static VkVertexInputBindingDescription getBindingDescription() {
@@ -29,9 +36,9 @@ struct Vertex {
         return bindingDescription;
     }
 
-    static std::array<VkVertexInputAttributeDescription, 3>
+    static std::array<VkVertexInputAttributeDescription, 4>
     getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3>
+        std::array<VkVertexInputAttributeDescription, 4>
             attributeDescriptions{};
 
         attributeDescriptions[0].binding = 0;
@@ -49,27 +56,45 @@ struct Vertex {
         attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
         attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
 
+        attributeDescriptions[3].binding = 0;
+        attributeDescriptions[3].location = 3;
+        attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[3].offset = offsetof(Vertex, normal);
+
         return attributeDescriptions;
     }
 };
 
+namespace std {
+template <>
+struct hash<Vertex> {
+    size_t operator()(Vertex const& vertex) const {
+        return (((hash<glm::vec3>()(vertex.pos) ^
+                  (hash<glm::vec3>()(vertex.color) << 1)) >>
+                 1) ^
+                (hash<glm::vec2>()(vertex.texCoord) << 1)) ^
+               (hash<glm::vec3>()(vertex.normal) >> 1);
+    }
+};
+}  // namespace std
+
+// A model's geometry on the CPU, parsed from a file already in memory.
+// Vertices are deduplicated, so the index buffer does the sharing. The
+// renderer uploads it once and drops it
 class Mesh3D {
    public:
-    Mesh3D();
-    Mesh3D(const char* meshFile, const char* textureFile);
-    std::vector<Vertex> vertices;
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    // format is the file's extension, like "obj". Materials are not used,
+    // so the .mtl next to an .obj is not needed. Returns false if the file
+    // could not be parsed
+    bool load(const std::vector<uint8_t>& file, const std::string& format);
 
-    void* texturePixels;
-    uint32_t mipLevels;
-    VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
-    VkImageView textureImageView;
-    VkSampler textureSampler;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // Model space center and radius of a sphere around every vertex
+    glm::vec4 bounds = glm::vec4(0.0f);
 
    private:
     Debugger debugger;
 };
 
-#endif
\ No newline at end of file
+#endif
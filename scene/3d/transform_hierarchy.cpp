@@ -0,0 +1,329 @@
+#include "transform_hierarchy.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TRANSFORM_HIERARCHY_SSE 1
+#else
+#define TRANSFORM_HIERARCHY_SSE 0
+#include <glm/gtc/matrix_transform.hpp>
+#endif
+
+namespace {
+
+// Reorder an array so new slot s holds what old slot oldSlots[s] held
+template <typename T>
+void permute(std::vector<T>& values, const std::vector<uint32_t>& oldSlots) {
+    std::vector<T> reordered(values.size());
+    for (size_t slot = 0; slot < oldSlots.size(); slot++) {
+        reordered[slot] = values[oldSlots[slot]];
+    }
+    values.swap(reordered);
+}
+
+}  // namespace
+
+// Returns the new node's id
+uint32_t TransformHierarchy::addNode(uint32_t parent) {
+    uint32_t node = static_cast<uint32_t>(parents.size());
+    parents.push_back(NO_PARENT);
+    slotOfNode.push_back(node);
+
+    // New nodes go on the end until the next update sorts them in
+    nodeOfSlot.push_back(node);
+    parentSlots.push_back(NO_PARENT);
+    positionX.push_back(0.0f);
+    positionY.push_back(0.0f);
+    positionZ.push_back(0.0f);
+    rotationX.push_back(0.0f);
+    rotationY.push_back(0.0f);
+    rotationZ.push_back(0.0f);
+    rotationW.push_back(1.0f);
+    scaleX.push_back(1.0f);
+    scaleY.push_back(1.0f);
+    scaleZ.push_back(1.0f);
+    worldMatrices.push_back(glm::mat4(1.0f));
+    dirty.push_back(1);
+    changed.push_back(0);
+
+    orderDirty = true;
+    if (parent != NO_PARENT) setParent(node, parent);
+    return node;
+}
+
+void TransformHierarchy::setParent(uint32_t node, uint32_t parent) {
+    for (uint32_t ancestor = parent; ancestor != NO_PARENT;
+         ancestor = parents[ancestor]) {
+        if (ancestor == node) {
+            debugger.consoleMessage("Transform parent would form a cycle!",
+                                    true);
+        }
+    }
+    parents[node] = parent;
+    dirty[slotOfNode[node]] = 1;
+    orderDirty = true;
+}
+
+void TransformHierarchy::clear() {
+    parents.clear();
+    slotOfNode.clear();
+    nodeOfSlot.clear();
+    parentSlots.clear();
+    positionX.clear();
+    positionY.clear();
+    positionZ.clear();
+    rotationX.clear();
+    rotationY.clear();
+    rotationZ.clear();
+    rotationW.clear();
+    scaleX.clear();
+    scaleY.clear();
+    scaleZ.clear();
+    worldMatrices.clear();
+    dirty.clear();
+    changed.clear();
+    levelStarts.clear();
+    changedNodes.clear();
+    orderDirty = false;
+}
+
+// Only marks the node dirty if something actually changed
+void TransformHierarchy::setLocal(uint32_t node, const glm::vec3& position,
+                                  const glm::quat& rotation,
+                                  const glm::vec3& scale) {
+    uint32_t slot = slotOfNode[node];
+    if (positionX[slot] == position.x && positionY[slot] == position.y &&
+        positionZ[slot] == position.z && rotationX[slot] == rotation.x &&
+        rotationY[slot] == rotation.y && rotationZ[slot] == rotation.z &&
+        rotationW[slot] == rotation.w && scaleX[slot] == scale.x &&
+        scaleY[slot] == scale.y && scaleZ[slot] == scale.z) {
+        return;
+    }
+
+    positionX[slot] = position.x;
+    positionY[slot] = position.y;
+    positionZ[slot] = position.z;
+    rotationX[slot] = rotation.x;
+    rotationY[slot] = rotation.y;
+    rotationZ[slot] = rotation.z;
+    rotationW[slot] = rotation.w;
+    scaleX[slot] = scale.x;
+    scaleY[slot] = scale.y;
+    scaleZ[slot] = scale.z;
+    dirty[slot] = 1;
+}
+
+// Sort the slots breadth-first after the tree changed shape
+void TransformHierarchy::rebuildOrder() {
+    uint32_t count = getNodeCount();
+    std::vector<std::vector<uint32_t>> children(count);
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    for (uint32_t node = 0; node < count; node++) {
+        if (parents[node] == NO_PARENT) {
+            order.push_back(node);
+        } else {
+            children[parents[node]].push_back(node);
+        }
+    }
+
+    levelStarts.clear();
+    size_t levelBegin = 0;
+    while (levelBegin < order.size()) {
+        levelStarts.push_back(static_cast<uint32_t>(levelBegin));
+        size_t levelEnd = order.size();
+        for (size_t i = levelBegin; i < levelEnd; i++) {
+            for (uint32_t child : children[order[i]]) {
+                order.push_back(child);
+            }
+        }
+        levelBegin = levelEnd;
+    }
+    levelStarts.push_back(count);
+
+    std::vector<uint32_t> oldSlots(count);
+    for (uint32_t slot = 0; slot < count; slot++) {
+        oldSlots[slot] = slotOfNode[order[slot]];
+    }
+    permute(positionX, oldSlots);
+    permute(positionY, oldSlots);
+    permute(positionZ, oldSlots);
+    permute(rotationX, oldSlots);
+    permute(rotationY, oldSlots);
+    permute(rotationZ, oldSlots);
+    permute(rotationW, oldSlots);
+    permute(scaleX, oldSlots);
+    permute(scaleY, oldSlots);
+    permute(scaleZ, oldSlots);
+    permute(worldMatrices, oldSlots);
+    permute(dirty, oldSlots);
+
+    nodeOfSlot = order;
+    for (uint32_t slot = 0; slot < count; slot++) {
+        slotOfNode[order[slot]] = slot;
+    }
+    for (uint32_t slot = 0; slot < count; slot++) {
+        uint32_t parent = parents[order[slot]];
+        parentSlots[slot] = parent == NO_PARENT ? NO_PARENT : slotOfNode[parent];
+    }
+    orderDirty = false;
+}
+
+// Recompute the world matrices of dirty nodes and their descendants
+void TransformHierarchy::update() {
+    if (orderDirty) rebuildOrder();
+    changedNodes.clear();
+
+    uint32_t batch[4];
+    uint32_t batchSize = 0;
+    for (size_t level = 0; level + 1 < levelStarts.size(); level++) {
+        for (uint32_t slot = levelStarts[level]; slot < levelStarts[level + 1];
+             slot++) {
+            uint32_t parentSlot = parentSlots[slot];
+            bool needsUpdate = dirty[slot] || (parentSlot != NO_PARENT &&
+                                               changed[parentSlot]);
+            changed[slot] = needsUpdate;
+            dirty[slot] = 0;
+            if (!needsUpdate) continue;
+
+            changedNodes.push_back(nodeOfSlot[slot]);
+            batch[batchSize++] = slot;
+            if (batchSize == 4) {
+                updateBatch(batch, batchSize);
+                batchSize = 0;
+            }
+        }
+
+        // Children read these next level, so finish the level first
+        if (batchSize > 0) {
+            updateBatch(batch, batchSize);
+            batchSize = 0;
+        }
+    }
+}
+
+#if TRANSFORM_HIERARCHY_SSE
+
+// World matrices for up to four slots of the same depth. Each SSE lane
+// builds one node's local matrix from its translation, rotation and scale,
+// the lanes are then transposed into columns and multiplied by the parent
+void TransformHierarchy::updateBatch(const uint32_t* slots, uint32_t count) {
+    // Short batches repeat the last slot, the extra lanes are never stored
+    uint32_t s0 = slots[0];
+    uint32_t s1 = slots[count > 1 ? 1 : 0];
+    uint32_t s2 = slots[count > 2 ? 2 : count - 1];
+    uint32_t s3 = slots[count - 1];
+    auto gather = [&](const std::vector<float>& values) {
+        return _mm_setr_ps(values[s0], values[s1], values[s2], values[s3]);
+    };
+
+    __m128 qx = gather(rotationX);
+    __m128 qy = gather(rotationY);
+    __m128 qz = gather(rotationZ);
+    __m128 qw = gather(rotationW);
+    __m128 sx = gather(scaleX);
+    __m128 sy = gather(scaleY);
+    __m128 sz = gather(scaleZ);
+
+    // Same terms as glm::mat3_cast
+    __m128 x2 = _mm_add_ps(qx, qx);
+    __m128 y2 = _mm_add_ps(qy, qy);
+    __m128 z2 = _mm_add_ps(qz, qz);
+    __m128 xx = _mm_mul_ps(qx, x2);
+    __m128 yy = _mm_mul_ps(qy, y2);
+    __m128 zz = _mm_mul_ps(qz, z2);
+    __m128 xy = _mm_mul_ps(qx, y2);
+    __m128 xz = _mm_mul_ps(qx, z2);
+    __m128 yz = _mm_mul_ps(qy, z2);
+    __m128 wx = _mm_mul_ps(qw, x2);
+    __m128 wy = _mm_mul_ps(qw, y2);
+    __m128 wz = _mm_mul_ps(qw, z2);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 zero = _mm_setzero_ps();
+
+    // Row r of column c, one node per lane, scale folded into the columns
+    __m128 c0r0 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+    __m128 c0r1 = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+    __m128 c0r2 = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+    __m128 c1r0 = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+    __m128 c1r1 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+    __m128 c1r2 = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+    __m128 c2r0 = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+    __m128 c2r1 = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+    __m128 c2r2 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+    __m128 c3r0 = gather(positionX);
+    __m128 c3r1 = gather(positionY);
+    __m128 c3r2 = gather(positionZ);
+    __m128 c3r3 = one;
+    __m128 c0r3 = zero;
+    __m128 c1r3 = zero;
+    __m128 c2r3 = zero;
+
+    // After transposing, register cNrL is column N of lane L's matrix
+    _MM_TRANSPOSE4_PS(c0r0, c0r1, c0r2, c0r3);
+    _MM_TRANSPOSE4_PS(c1r0, c1r1, c1r2, c1r3);
+    _MM_TRANSPOSE4_PS(c2r0, c2r1, c2r2, c2r3);
+    _MM_TRANSPOSE4_PS(c3r0, c3r1, c3r2, c3r3);
+    __m128 locals[4][4] = {{c0r0, c1r0, c2r0, c3r0},
+                           {c0r1, c1r1, c2r1, c3r1},
+                           {c0r2, c1r2, c2r2, c3r2},
+                           {c0r3, c1r3, c2r3, c3r3}};
+
+    for (uint32_t lane = 0; lane < count; lane++) {
+        uint32_t slot = slots[lane];
+        float* world = glm::value_ptr(worldMatrices[slot]);
+        uint32_t parentSlot = parentSlots[slot];
+        if (parentSlot == NO_PARENT) {
+            for (int column = 0; column < 4; column++) {
+                _mm_storeu_ps(world + column * 4, locals[lane][column]);
+            }
+            continue;
+        }
+
+        const float* parent = glm::value_ptr(worldMatrices[parentSlot]);
+        __m128 p0 = _mm_loadu_ps(parent);
+        __m128 p1 = _mm_loadu_ps(parent + 4);
+        __m128 p2 = _mm_loadu_ps(parent + 8);
+        __m128 p3 = _mm_loadu_ps(parent + 12);
+        for (int column = 0; column < 4; column++) {
+            __m128 local = locals[lane][column];
+            __m128 result = _mm_mul_ps(
+                p0, _mm_shuffle_ps(local, local, _MM_SHUFFLE(0, 0, 0, 0)));
+            result = _mm_add_ps(
+                result, _mm_mul_ps(p1, _mm_shuffle_ps(local, local,
+                                                      _MM_SHUFFLE(1, 1, 1, 1))));
+            result = _mm_add_ps(
+                result, _mm_mul_ps(p2, _mm_shuffle_ps(local, local,
+                                                      _MM_SHUFFLE(2, 2, 2, 2))));
+            result = _mm_add_ps(
+                result, _mm_mul_ps(p3, _mm_shuffle_ps(local, local,
+                                                      _MM_SHUFFLE(3, 3, 3, 3))));
+            _mm_storeu_ps(world + column * 4, result);
+        }
+    }
+}
+
+#else
+
+// World matrices for up to four slots of the same depth
+void TransformHierarchy::updateBatch(const uint32_t* slots, uint32_t count) {
+    for (uint32_t lane = 0; lane < count; lane++) {
+        uint32_t slot = slots[lane];
+        glm::mat4 local = glm::translate(
+            glm::mat4(1.0f),
+            glm::vec3(positionX[slot], positionY[slot], positionZ[slot]));
+        local *= glm::mat4_cast(glm::quat(rotationW[slot], rotationX[slot],
+                                          rotationY[slot], rotationZ[slot]));
+        local = glm::scale(local,
+                           glm::vec3(scaleX[slot], scaleY[slot], scaleZ[slot]));
+
+        uint32_t parentSlot = parentSlots[slot];
+        worldMatrices[slot] = parentSlot == NO_PARENT
+                                  ? local
+                                  : worldMatrices[parentSlot] * local;
+    }
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef TRANSFORM_HIERARCHY_H
+#define TRANSFORM_HIERARCHY_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+
+// Parent and child transforms for the scene. Local position, rotation and
+// scale are kept as structure of arrays in breadth-first order, so every
+// parent is finished before its children and each depth level is one
+// contiguous run. update only recomputes nodes whose local transform changed
+// and everything below them, four matrices at a time
+class TransformHierarchy {
+   public:
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+    // Returns the new node's id. Ids are dense from 0 and never change
+    uint32_t addNode(uint32_t parent = NO_PARENT);
+    void setParent(uint32_t node, uint32_t parent);
+    uint32_t getNodeCount() const {
+        return static_cast<uint32_t>(parents.size());
+    }
+    void clear();
+
+    // Only marks the node dirty if something actually changed
+    void setLocal(uint32_t node, const glm::vec3& position,
+                  const glm::quat& rotation, const glm::vec3& scale);
+
+    // Recompute the world matrices of dirty nodes and their descendants
+    void update();
+
+    const glm::mat4& getWorldMatrix(uint32_t node) const {
+        return worldMatrices[slotOfNode[node]];
+    }
+    // Nodes whose world matrix changed in the last update, so only those
+    // need to reach the GPU
+    const std::vector<uint32_t>& getChangedNodes() const {
+        return changedNodes;
+    }
+
+   private:
+    // Sort the slots breadth-first after the tree changed shape
+    void rebuildOrder();
+    // World matrices for up to four slots of the same depth
+    void updateBatch(const uint32_t* slots, uint32_t count);
+
+    Debugger debugger;
+
+    // Indexed by node id
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> slotOfNode;
+
+    // Indexed by slot, in breadth-first order
+    std::vector<uint32_t> nodeOfSlot;
+    std::vector<uint32_t> parentSlots;
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+    std::vector<float> scaleX, scaleY, scaleZ;
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<uint8_t> dirty;
+    // Recomputed during the current update, children follow their parent
+    std::vector<uint8_t> changed;
+
+    // Slot each depth level starts at, with the slot count at the end
+    std::vector<uint32_t> levelStarts;
+    bool orderDirty = false;
+
+    std::vector<uint32_t> changedNodes;
+};
+
+#endif
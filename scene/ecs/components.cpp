@@ -0,0 +1,19 @@
+#include "components.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+glm::mat4 Transform::toMatrix() const {
+    glm::mat4 matrix = glm::translate(glm::mat4(1.0f), position);
+    matrix *= glm::mat4_cast(rotation);
+    matrix = glm::scale(matrix, scale);
+    return matrix;
+}
+
+// Blend two transforms, alpha 0 gives a and 1 gives b
+Transform interpolate(const Transform& a, const Transform& b, float alpha) {
+    Transform result;
+    result.position = glm::mix(a.position, b.position, alpha);
+    result.rotation = glm::slerp(a.rotation, b.rotation, alpha);
+    result.scale = glm::mix(a.scale, b.scale, alpha);
+    return result;
+}
@@ -0,0 +1,52 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "ecs.h"
+
+// Position, rotation and scale of an entity, relative to its Parent if it
+// has one
+struct Transform {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+    glm::mat4 toMatrix() const;
+};
+
+// Blend two transforms, alpha 0 gives a and 1 gives b
+Transform interpolate(const Transform& a, const Transform& b, float alpha);
+
+// Constant motion in units per second
+struct Velocity {
+    glm::vec3 linear = glm::vec3(0.0f);
+};
+
+// Turns about an axis at a fixed rate, on top of a base orientation
+struct Spin {
+    glm::quat baseRotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f);
+    float radiansPerSecond = 0.0f;
+};
+
+// Attaches an entity to another, its Transform becomes local to the parent.
+// Both must be Renderable, the hierarchy is resolved by draw slot
+struct Parent {
+    Entity entity;
+};
+
+// Mesh of a draw slot no Renderable holds, nothing is drawn there
+const uint32_t NO_MESH = UINT32_MAX;
+
+// Drawn by the renderer. The slot is the entity's index into the model
+// matrices handed to the Vulkan context. Entities sharing a mesh are drawn
+// with one instanced call
+struct Renderable {
+    uint32_t drawSlot = 0;
+    uint32_t mesh = 0;
+};
+
+#endif
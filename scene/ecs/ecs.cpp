@@ -0,0 +1,258 @@
+#include "ecs.h"
+
+#include <atomic>
+
+namespace {
+
+// Filled in once per type and never moved, so lookups need no lock
+ComponentInfo componentInfos[MAX_COMPONENT_TYPES];
+std::atomic<uint32_t> componentCount{0};
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+ComponentId ComponentRegistry::add(const ComponentInfo& info) {
+    // Only ever called from a function local static, which the compiler
+    // already makes thread safe per type
+    ComponentId id = componentCount.fetch_add(1);
+    if (id >= MAX_COMPONENT_TYPES) {
+        Debugger debugger;
+        debugger.consoleMessage("Too many component types!", true);
+    }
+    componentInfos[id] = info;
+    return id;
+}
+
+const ComponentInfo& ComponentRegistry::get(ComponentId id) {
+    return componentInfos[id];
+}
+
+// Lay out the chunk arrays for this set of components
+Archetype::Archetype(const ComponentMask& mask) : mask(mask) {
+    size_t bytesPerEntity = sizeof(Entity);
+    for (ComponentId id = 0; id < MAX_COMPONENT_TYPES; id++) {
+        if (!mask.test(id)) continue;
+        components.push_back(id);
+        infos.push_back(ComponentRegistry::get(id));
+        bytesPerEntity += infos.back().size;
+    }
+
+    // Leave room to pad the start of every array up to its alignment
+    size_t padding = components.size() * alignof(std::max_align_t);
+    chunkCapacity =
+        static_cast<uint32_t>((ECS_CHUNK_SIZE - padding) / bytesPerEntity);
+    if (chunkCapacity == 0) {
+        Debugger debugger;
+        debugger.consoleMessage("Components are too large for a chunk!", true);
+    }
+
+    size_t offset = sizeof(Entity) * chunkCapacity;
+    for (size_t i = 0; i < components.size(); i++) {
+        offset = alignUp(offset, infos[i].alignment);
+        columnOffsets[components[i]] = offset;
+        offset += infos[i].size * chunkCapacity;
+    }
+}
+
+Archetype::~Archetype() {
+    for (uint32_t chunk = 0; chunk < chunks.size(); chunk++) {
+        for (uint32_t row = 0; row < chunks[chunk].count; row++) {
+            destroyRow(chunk, row);
+        }
+    }
+}
+
+// Append an entity with its components left unconstructed
+void Archetype::pushEntity(Entity entity, uint32_t& chunk, uint32_t& row) {
+    if (chunks.empty() || chunks.back().count == chunkCapacity) {
+        Chunk newChunk;
+        if (spareChunk) {
+            newChunk.memory = std::move(spareChunk);
+        } else {
+            newChunk.memory.reset(new uint8_t[ECS_CHUNK_SIZE]);
+        }
+        chunks.push_back(std::move(newChunk));
+    }
+
+    chunk = static_cast<uint32_t>(chunks.size() - 1);
+    row = chunks[chunk].count++;
+    getEntities(chunk)[row] = entity;
+    entityCount++;
+}
+
+// Close the hole at chunk/row by moving the last entity into it
+Entity Archetype::removeRow(uint32_t chunk, uint32_t row) {
+    uint32_t lastChunk = static_cast<uint32_t>(chunks.size() - 1);
+    uint32_t lastRow = chunks[lastChunk].count - 1;
+
+    Entity moved = NULL_ENTITY;
+    if (chunk != lastChunk || row != lastRow) {
+        for (size_t i = 0; i < components.size(); i++) {
+            void* last = getComponent(lastChunk, lastRow, components[i]);
+            infos[i].moveConstruct(getComponent(chunk, row, components[i]),
+                                   last);
+            infos[i].destroy(last);
+        }
+        moved = getEntities(lastChunk)[lastRow];
+        getEntities(chunk)[row] = moved;
+    }
+
+    entityCount--;
+    if (--chunks[lastChunk].count == 0) {
+        spareChunk = std::move(chunks[lastChunk].memory);
+        chunks.pop_back();
+    }
+    return moved;
+}
+
+// Destroy every component of the entity at chunk/row
+void Archetype::destroyRow(uint32_t chunk, uint32_t row) {
+    for (size_t i = 0; i < components.size(); i++) {
+        infos[i].destroy(getComponent(chunk, row, components[i]));
+    }
+}
+
+World::World() { emptyArchetype = getArchetype(ComponentMask()); }
+
+// Archetypes destroy their own components
+World::~World() {}
+
+Entity World::create() {
+    Entity entity;
+    if (!freeIndices.empty()) {
+        entity.index = freeIndices.back();
+        freeIndices.pop_back();
+    } else {
+        entity.index = static_cast<uint32_t>(records.size());
+        records.emplace_back();
+    }
+
+    EntityRecord& record = records[entity.index];
+    entity.generation = record.generation;
+    record.archetype = emptyArchetype;
+    emptyArchetype->pushEntity(entity, record.chunk, record.row);
+    aliveCount++;
+    return entity;
+}
+
+void World::destroy(Entity entity) {
+    getRecord(entity);
+    EntityRecord& record = records[entity.index];
+    Archetype* archetype = record.archetype;
+    archetype->destroyRow(record.chunk, record.row);
+    Entity moved = archetype->removeRow(record.chunk, record.row);
+    if (moved != NULL_ENTITY) {
+        records[moved.index].chunk = record.chunk;
+        records[moved.index].row = record.row;
+    }
+
+    // Bumping the generation invalidates every handle to this entity
+    record.archetype = nullptr;
+    record.generation++;
+    freeIndices.push_back(entity.index);
+    aliveCount--;
+}
+
+bool World::isAlive(Entity entity) const {
+    return entity.index < records.size() &&
+           records[entity.index].archetype != nullptr &&
+           records[entity.index].generation == entity.generation;
+}
+
+// Destroy every entity
+void World::clear() {
+    archetypes.clear();
+    archetypesByMask.clear();
+    emptyArchetype = getArchetype(ComponentMask());
+
+    // Records stay so old handles keep failing isAlive
+    freeIndices.clear();
+    for (uint32_t index = 0; index < records.size(); index++) {
+        if (records[index].archetype) records[index].generation++;
+        records[index].archetype = nullptr;
+        freeIndices.push_back(index);
+    }
+    aliveCount = 0;
+}
+
+const World::EntityRecord& World::getRecord(Entity entity) {
+    if (!isAlive(entity)) {
+        debugger.consoleMessage("Entity is not alive!", true);
+    }
+    return records[entity.index];
+}
+
+Archetype* World::getArchetype(const ComponentMask& mask) {
+    auto found = archetypesByMask.find(mask);
+    if (found != archetypesByMask.end()) return found->second;
+
+    archetypes.push_back(std::make_unique<Archetype>(mask));
+    Archetype* archetype = archetypes.back().get();
+    archetypesByMask[mask] = archetype;
+    return archetype;
+}
+
+Archetype* World::getAddTarget(Archetype* archetype, ComponentId id) {
+    auto edge = archetype->addEdges.find(id);
+    if (edge != archetype->addEdges.end()) return edge->second;
+
+    Archetype* target = getArchetype(ComponentMask(archetype->getMask()).set(id));
+    archetype->addEdges[id] = target;
+    target->removeEdges[id] = archetype;
+    return target;
+}
+
+Archetype* World::getRemoveTarget(Archetype* archetype, ComponentId id) {
+    auto edge = archetype->removeEdges.find(id);
+    if (edge != archetype->removeEdges.end()) return edge->second;
+
+    Archetype* target =
+        getArchetype(ComponentMask(archetype->getMask()).reset(id));
+    archetype->removeEdges[id] = target;
+    target->addEdges[id] = archetype;
+    return target;
+}
+
+// Move an entity's components over to another archetype
+void World::moveEntity(Entity entity, Archetype* target) {
+    EntityRecord& record = records[entity.index];
+    Archetype* source = record.archetype;
+
+    uint32_t chunk;
+    uint32_t row;
+    target->pushEntity(entity, chunk, row);
+
+    for (size_t i = 0; i < source->components.size(); i++) {
+        ComponentId id = source->components[i];
+        void* component = source->getComponent(record.chunk, record.row, id);
+        if (target->getMask().test(id)) {
+            source->infos[i].moveConstruct(
+                target->getComponent(chunk, row, id), component);
+        }
+        source->infos[i].destroy(component);
+    }
+
+    Entity moved = source->removeRow(record.chunk, record.row);
+    if (moved != NULL_ENTITY) {
+        records[moved.index].chunk = record.chunk;
+        records[moved.index].row = record.row;
+    }
+
+    record.archetype = target;
+    record.chunk = chunk;
+    record.row = row;
+}
+
+std::vector<World::ChunkReference> World::findChunks(const ComponentMask& mask) {
+    std::vector<ChunkReference> found;
+    for (auto& archetype : archetypes) {
+        if ((archetype->getMask() & mask) != mask) continue;
+        for (uint32_t chunk = 0; chunk < archetype->getChunkCount(); chunk++) {
+            found.push_back({archetype.get(), chunk});
+        }
+    }
+    return found;
+}
@@ -0,0 +1,328 @@
+#ifndef ECS_H
+#define ECS_H
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "core/jobs/job_system.h"
+
+// Handle to an entity. The generation changes every time the index is
+// reused, so a handle to a destroyed entity never aliases a new one
+struct Entity {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const Entity& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+const Entity NULL_ENTITY = Entity();
+
+const uint32_t MAX_COMPONENT_TYPES = 64;
+using ComponentId = uint32_t;
+using ComponentMask = std::bitset<MAX_COMPONENT_TYPES>;
+
+// Bytes per chunk. Small enough that the arrays a system touches stay in
+// cache, large enough that a loop rarely has to hop to the next chunk
+const size_t ECS_CHUNK_SIZE = 16 * 1024;
+
+// How to handle one component type inside untyped chunk memory
+struct ComponentInfo {
+    size_t size = 0;
+    size_t alignment = 0;
+    void (*moveConstruct)(void* destination, void* source) = nullptr;
+    void (*destroy)(void* component) = nullptr;
+};
+
+// Hands out a small id to every component type the first time it is used
+class ComponentRegistry {
+   public:
+    static ComponentId add(const ComponentInfo& info);
+    static const ComponentInfo& get(ComponentId id);
+};
+
+// Id of component type T, the same for every World
+template <typename T>
+ComponentId componentId() {
+    // const T shares the id of T
+    if constexpr (!std::is_same_v<T, std::remove_cv_t<T>>) {
+        return componentId<std::remove_cv_t<T>>();
+    } else {
+        static_assert(std::is_nothrow_move_constructible_v<T>,
+                      "Components are moved between chunks and must not throw");
+        static_assert(alignof(T) <= alignof(std::max_align_t),
+                      "Component alignment is larger than chunks provide");
+
+        static const ComponentId id = ComponentRegistry::add(ComponentInfo{
+            sizeof(T), alignof(T),
+            [](void* destination, void* source) {
+                new (destination) T(std::move(*static_cast<T*>(source)));
+            },
+            [](void* component) { static_cast<T*>(component)->~T(); }});
+        return id;
+    }
+}
+
+// Fixed block of memory holding entities of one archetype. It starts with
+// the entity handles, followed by one tightly packed array per component
+struct Chunk {
+    std::unique_ptr<uint8_t[]> memory;
+    uint32_t count = 0;
+};
+
+// Every entity with exactly the same set of components lives in the same
+// archetype. Entities are packed densely, every chunk but the last is full
+class Archetype {
+   public:
+    explicit Archetype(const ComponentMask& mask);
+    ~Archetype();
+    Archetype(const Archetype&) = delete;
+    Archetype& operator=(const Archetype&) = delete;
+
+    const ComponentMask& getMask() const { return mask; }
+    uint32_t getChunkCapacity() const { return chunkCapacity; }
+    uint32_t getEntityCount() const { return entityCount; }
+    uint32_t getChunkCount() const {
+        return static_cast<uint32_t>(chunks.size());
+    }
+    uint32_t getChunkSize(uint32_t chunk) const { return chunks[chunk].count; }
+
+    Entity* getEntities(uint32_t chunk) {
+        return reinterpret_cast<Entity*>(chunks[chunk].memory.get());
+    }
+    // Start of a component's array inside a chunk. The archetype must have
+    // the component
+    void* getColumn(uint32_t chunk, ComponentId id) {
+        return chunks[chunk].memory.get() + columnOffsets[id];
+    }
+    template <typename T>
+    T* getColumn(uint32_t chunk) {
+        return static_cast<T*>(getColumn(chunk, componentId<T>()));
+    }
+    void* getComponent(uint32_t chunk, uint32_t row, ComponentId id) {
+        return static_cast<uint8_t*>(getColumn(chunk, id)) +
+               row * ComponentRegistry::get(id).size;
+    }
+
+   private:
+    friend class World;
+
+    // Append an entity with its components left unconstructed
+    void pushEntity(Entity entity, uint32_t& chunk, uint32_t& row);
+    // Close the hole at chunk/row by moving the last entity into it. The
+    // components at chunk/row must already be destroyed or moved out.
+    // Returns the entity that moved, or NULL_ENTITY if none did
+    Entity removeRow(uint32_t chunk, uint32_t row);
+    // Destroy every component of the entity at chunk/row
+    void destroyRow(uint32_t chunk, uint32_t row);
+
+    ComponentMask mask;
+    // Sorted, with the matching type info alongside
+    std::vector<ComponentId> components;
+    std::vector<ComponentInfo> infos;
+    size_t columnOffsets[MAX_COMPONENT_TYPES] = {};
+    uint32_t chunkCapacity = 0;
+    uint32_t entityCount = 0;
+
+    std::vector<Chunk> chunks;
+    // The last emptied chunk is kept so an entity bouncing across a chunk
+    // boundary does not allocate every time
+    std::unique_ptr<uint8_t[]> spareChunk;
+
+    // Archetypes one component away, filled in as entities move
+    std::unordered_map<ComponentId, Archetype*> addEdges;
+    std::unordered_map<ComponentId, Archetype*> removeEdges;
+};
+
+// Owns entities and their components, stored by archetype in structure of
+// arrays chunks. Systems are plain loops over the matching chunks.
+// Adding or removing entities and components while iterating is not allowed
+class World {
+   public:
+    World();
+    ~World();
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    Entity create();
+    void destroy(Entity entity);
+    bool isAlive(Entity entity) const;
+    uint32_t getEntityCount() const { return aliveCount; }
+    // Destroy every entity
+    void clear();
+
+    // Add a component, or overwrite it if the entity already has one
+    template <typename T>
+    T& add(Entity entity, T component = T());
+    template <typename T>
+    void remove(Entity entity);
+    template <typename T>
+    bool has(Entity entity);
+    template <typename T>
+    T& get(Entity entity);
+
+    // Call function(Cs&...) for every entity with all of Cs. Mark a
+    // component const to only read it
+    template <typename... Cs, typename Function>
+    void each(Function&& function);
+
+    // Call function(count, entities, Cs*...) once per matching chunk, for
+    // loops that want the raw arrays
+    template <typename... Cs, typename Function>
+    void eachChunk(Function&& function);
+
+    // Like each, with the matching chunks spread across the job system.
+    // The function runs on several threads at once
+    template <typename... Cs, typename Function>
+    void parallelEach(JobSystem& jobs, Function&& function);
+
+    uint32_t getArchetypeCount() const {
+        return static_cast<uint32_t>(archetypes.size());
+    }
+
+   private:
+    // Where an entity's components live
+    struct EntityRecord {
+        Archetype* archetype = nullptr;
+        uint32_t chunk = 0;
+        uint32_t row = 0;
+        uint32_t generation = 0;
+    };
+
+    // A chunk matched by a query
+    struct ChunkReference {
+        Archetype* archetype;
+        uint32_t chunk;
+    };
+
+    template <typename... Cs>
+    static ComponentMask maskOf() {
+        ComponentMask mask;
+        (mask.set(componentId<Cs>()), ...);
+        return mask;
+    }
+
+    template <typename... Cs, typename Function>
+    static void eachInChunk(Archetype& archetype, uint32_t chunk,
+                            Function& function) {
+        auto columns = std::make_tuple(archetype.getColumn<Cs>(chunk)...);
+        uint32_t count = archetype.getChunkSize(chunk);
+        for (uint32_t i = 0; i < count; i++) {
+            function(std::get<Cs*>(columns)[i]...);
+        }
+    }
+
+    Archetype* getArchetype(const ComponentMask& mask);
+    Archetype* getAddTarget(Archetype* archetype, ComponentId id);
+    Archetype* getRemoveTarget(Archetype* archetype, ComponentId id);
+    // Move an entity's components over to another archetype. Components the
+    // target does not have are destroyed, ones only the target has are left
+    // unconstructed for the caller
+    void moveEntity(Entity entity, Archetype* target);
+    // Throws if the entity is not alive
+    const EntityRecord& getRecord(Entity entity);
+    std::vector<ChunkReference> findChunks(const ComponentMask& mask);
+
+    Debugger debugger;
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<ComponentMask, Archetype*> archetypesByMask;
+    Archetype* emptyArchetype = nullptr;
+
+    std::vector<EntityRecord> records;
+    std::vector<uint32_t> freeIndices;
+    uint32_t aliveCount = 0;
+};
+
+// Add a component, or overwrite it if the entity already has one
+template <typename T>
+T& World::add(Entity entity, T component) {
+    ComponentId id = componentId<T>();
+    const EntityRecord& record = getRecord(entity);
+    if (record.archetype->getMask().test(id)) {
+        T& existing = *static_cast<T*>(
+            record.archetype->getComponent(record.chunk, record.row, id));
+        existing = std::move(component);
+        return existing;
+    }
+
+    moveEntity(entity, getAddTarget(record.archetype, id));
+    const EntityRecord& moved = records[entity.index];
+    void* slot = moved.archetype->getComponent(moved.chunk, moved.row, id);
+    return *new (slot) T(std::move(component));
+}
+
+template <typename T>
+void World::remove(Entity entity) {
+    ComponentId id = componentId<T>();
+    const EntityRecord& record = getRecord(entity);
+    if (!record.archetype->getMask().test(id)) return;
+    moveEntity(entity, getRemoveTarget(record.archetype, id));
+}
+
+template <typename T>
+bool World::has(Entity entity) {
+    return getRecord(entity).archetype->getMask().test(componentId<T>());
+}
+
+template <typename T>
+T& World::get(Entity entity) {
+    ComponentId id = componentId<T>();
+    const EntityRecord& record = getRecord(entity);
+    if (!record.archetype->getMask().test(id)) {
+        debugger.consoleMessage("Entity does not have the component!", true);
+    }
+    return *static_cast<T*>(
+        record.archetype->getComponent(record.chunk, record.row, id));
+}
+
+// Call function(Cs&...) for every entity with all of Cs
+template <typename... Cs, typename Function>
+void World::each(Function&& function) {
+    ComponentMask mask = maskOf<Cs...>();
+    for (auto& archetype : archetypes) {
+        if ((archetype->getMask() & mask) != mask) continue;
+        for (uint32_t chunk = 0; chunk < archetype->getChunkCount(); chunk++) {
+            eachInChunk<Cs...>(*archetype, chunk, function);
+        }
+    }
+}
+
+// Call function(count, entities, Cs*...) once per matching chunk
+template <typename... Cs, typename Function>
+void World::eachChunk(Function&& function) {
+    ComponentMask mask = maskOf<Cs...>();
+    for (auto& archetype : archetypes) {
+        if ((archetype->getMask() & mask) != mask) continue;
+        for (uint32_t chunk = 0; chunk < archetype->getChunkCount(); chunk++) {
+            function(archetype->getChunkSize(chunk),
+                     const_cast<const Entity*>(archetype->getEntities(chunk)),
+                     archetype->template getColumn<Cs>(chunk)...);
+        }
+    }
+}
+
+// Like each, with the matching chunks spread across the job system
+template <typename... Cs, typename Function>
+void World::parallelEach(JobSystem& jobs, Function&& function) {
+    std::vector<ChunkReference> work = findChunks(maskOf<Cs...>());
+    jobs.parallelFor(static_cast<uint32_t>(work.size()), 1,
+                     [&](uint32_t begin, uint32_t end) {
+                         for (uint32_t i = begin; i < end; i++) {
+                             eachInChunk<Cs...>(*work[i].archetype,
+                                                work[i].chunk, function);
+                         }
+                     });
+}
+
+#endif
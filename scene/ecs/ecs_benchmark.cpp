@@ -0,0 +1,112 @@
+#include "ecs_benchmark.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "components.h"
+#include "core/jobs/job_system.h"
+#include "ecs.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+}  // namespace
+
+void EcsBenchmark::run(uint32_t entityCount, uint32_t iterations) {
+    debugger.consoleMessage("\nBegin ECS benchmark...", false);
+    const float deltaTime = 1.0f / 60.0f;
+
+    World world;
+    JobSystem jobs;
+    jobs.init();
+
+    // Every fourth entity also spins, so queries span two archetypes
+    std::vector<Entity> entities(entityCount);
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < entityCount; i++) {
+        entities[i] = world.create();
+        Transform transform;
+        transform.position = glm::vec3(static_cast<float>(i), 0.0f, 0.0f);
+        world.add<Transform>(entities[i], transform);
+        Velocity velocity;
+        velocity.linear = glm::vec3(0.0f, 1.0f, 0.0f);
+        world.add<Velocity>(entities[i], velocity);
+        if (i % 4 == 0) world.add<Spin>(entities[i]);
+    }
+    LOG_INFO("Created {} entities in {} ms, {} archetypes", entityCount,
+             millisecondsSince(start), world.getArchetypeCount());
+
+    auto report = [&](const char* name, double milliseconds) {
+        double perEntity =
+            milliseconds * 1.0e6 / (double(entityCount) * iterations);
+        LOG_INFO("{}: {} ms per pass, {} ns per entity", name,
+                 milliseconds / iterations, perEntity);
+    };
+
+    start = Clock::now();
+    for (uint32_t pass = 0; pass < iterations; pass++) {
+        world.each<Transform, const Velocity>(
+            [&](Transform& transform, const Velocity& velocity) {
+                transform.position += velocity.linear * deltaTime;
+            });
+    }
+    report("Serial each", millisecondsSince(start));
+
+    start = Clock::now();
+    for (uint32_t pass = 0; pass < iterations; pass++) {
+        world.eachChunk<Transform, const Velocity>(
+            [&](uint32_t count, const Entity*, Transform* transforms,
+                const Velocity* velocities) {
+                for (uint32_t i = 0; i < count; i++) {
+                    transforms[i].position += velocities[i].linear * deltaTime;
+                }
+            });
+    }
+    report("Serial chunks", millisecondsSince(start));
+
+    start = Clock::now();
+    for (uint32_t pass = 0; pass < iterations; pass++) {
+        world.parallelEach<Transform, const Velocity>(
+            jobs, [&](Transform& transform, const Velocity& velocity) {
+                transform.position += velocity.linear * deltaTime;
+            });
+    }
+    report(("Parallel each, " + std::to_string(jobs.getWorkerCount() + 1) +
+            " threads")
+               .c_str(),
+           millisecondsSince(start));
+
+    // Every add and remove moves the entity to another archetype's chunk
+    start = Clock::now();
+    for (Entity entity : entities) {
+        world.add<Renderable>(entity);
+    }
+    for (Entity entity : entities) {
+        world.remove<Renderable>(entity);
+    }
+    double structural = millisecondsSince(start);
+    LOG_INFO("Add and remove a component: {} ns per change",
+             structural * 1.0e6 / (2.0 * entityCount));
+
+    // Keeps the passes above from being optimised away, every entity moved
+    // the same distance so this should equal the pass count
+    float moved = world.get<Transform>(entities[0]).position.y / deltaTime;
+    LOG_INFO("Checksum {} of {} passes", moved, iterations * 3);
+
+    start = Clock::now();
+    for (Entity entity : entities) {
+        world.destroy(entity);
+    }
+    LOG_INFO("Destroyed {} entities in {} ms", entityCount,
+             millisecondsSince(start));
+
+    jobs.shutdown();
+    debugger.consoleMessage("Successfully ran ECS benchmark", false);
+}
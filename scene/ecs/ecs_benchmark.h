@@ -0,0 +1,19 @@
+#ifndef ECS_BENCHMARK_H
+#define ECS_BENCHMARK_H
+
+#include <cstdint>
+
+#include "core/debugger/debugger.h"
+
+// Times the ECS on a synthetic world: creating entities, a movement system
+// run serially, per chunk and across the job system, and moving every
+// entity between archetypes by adding and removing a component
+class EcsBenchmark {
+   public:
+    void run(uint32_t entityCount = 100000, uint32_t iterations = 100);
+
+   private:
+    Debugger debugger;
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include "level_streamer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+#include "core/debugger/logger.h"
+#include "core/debugger/profiler.h"
+
+// Chunks closer than this to the viewer load
+const float LOAD_DISTANCE = 8.0f;
+// Loaded chunks stay until the viewer is this far away, so walking along a
+// border does not load and unload the same chunk over and over
+const float UNLOAD_DISTANCE = 16.0f;
+// Chunks read, parsed or waiting to spawn at once, nearest first
+const uint32_t MAX_LOADS_IN_FLIGHT = 2;
+// Entities spawned per update, a chunk bigger than this still spawns whole
+const uint32_t SPAWNS_PER_UPDATE = 64;
+
+// Parse a chunk file into the entities it places
+bool parseChunk(const std::string& text, std::vector<ChunkSpawn>& spawns) {
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string keyword;
+        if (!(words >> keyword)) continue;
+        if (keyword != "entity") return false;
+
+        ChunkSpawn spawn;
+        float scale = 1.0f;
+        if (!(words >> spawn.mesh >> spawn.transform.position.x >>
+              spawn.transform.position.y >> spawn.transform.position.z >>
+              scale)) {
+            return false;
+        }
+        spawn.transform.scale = glm::vec3(scale);
+
+        std::string option;
+        while (words >> option) {
+            if (option == "rotate") {
+                glm::vec3 axis;
+                float degrees = 0.0f;
+                if (!(words >> axis.x >> axis.y >> axis.z >> degrees)) {
+                    return false;
+                }
+                spawn.transform.rotation =
+                    spawn.transform.rotation *
+                    glm::angleAxis(glm::radians(degrees), glm::normalize(axis));
+            } else if (option == "spin") {
+                float degrees = 0.0f;
+                if (!(words >> degrees)) return false;
+                spawn.spinRadiansPerSecond = glm::radians(degrees);
+            } else {
+                return false;
+            }
+        }
+        spawns.push_back(std::move(spawn));
+    }
+    return true;
+}
+
+// Chunks are parsed on jobs, spawning and despawning happen in update
+void LevelStreamer::init(JobSystem& jobs, SpawnFunction spawn,
+                         DespawnFunction despawn) {
+    this->jobs = &jobs;
+    this->spawn = std::move(spawn);
+    this->despawn = std::move(despawn);
+}
+
+// Read the stage's chunk layout, a line per chunk and per door
+//   chunk NAME PATH MINX MINY MINZ MAXX MAXY MAXZ
+//   door NAME NAME
+bool LevelStreamer::loadStage(const std::string& path) {
+    unloadStage();
+    chunks.clear();
+
+    std::vector<uint8_t> data;
+    if (!VirtualFileSystem::get().readFile(path, data)) {
+        LOG_WARNING("Failed to read stage {}", path);
+        return false;
+    }
+
+    std::istringstream lines(std::string(data.begin(), data.end()));
+    std::string line;
+    std::vector<LevelChunk> stage;
+    auto findChunk = [&](const std::string& name) {
+        for (uint32_t i = 0; i < stage.size(); i++) {
+            if (stage[i].name == name) return i;
+        }
+        return UINT32_MAX;
+    };
+    while (std::getline(lines, line)) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string keyword;
+        if (!(words >> keyword)) continue;
+
+        if (keyword == "chunk") {
+            LevelChunk chunk;
+            if (words >> chunk.name >> chunk.path >> chunk.boundsMin.x >>
+                chunk.boundsMin.y >> chunk.boundsMin.z >> chunk.boundsMax.x >>
+                chunk.boundsMax.y >> chunk.boundsMax.z) {
+                stage.push_back(std::move(chunk));
+                continue;
+            }
+        } else if (keyword == "door") {
+            std::string from;
+            std::string to;
+            words >> from >> to;
+            uint32_t a = findChunk(from);
+            uint32_t b = findChunk(to);
+            if (a != UINT32_MAX && b != UINT32_MAX) {
+                stage[a].neighbours.push_back(b);
+                stage[b].neighbours.push_back(a);
+                continue;
+            }
+        }
+        LOG_WARNING("Malformed line in stage {}: {}", path, line);
+        return false;
+    }
+
+    chunks = std::move(stage);
+    slots.assign(chunks.size(), Slot());
+    loads = 0;
+    unloads = 0;
+    budgetWarned = false;
+    LOG_INFO("Loaded stage {} with {} chunks", path, chunks.size());
+    return true;
+}
+
+// Despawn every chunk. Reads and parses in flight finish on their own, the
+// results are simply dropped
+void LevelStreamer::unloadStage() {
+    for (uint32_t chunk = 0; chunk < slots.size(); chunk++) {
+        if (slots[chunk].state == ChunkState::Loaded) unload(chunk);
+    }
+    slots.assign(chunks.size(), Slot());
+    residentBytes = 0;
+}
+
+// Distance from viewer to the chunk's bounds, 0 inside them
+float LevelStreamer::distanceTo(uint32_t chunk, const glm::vec3& viewer) const {
+    glm::vec3 closest =
+        glm::clamp(viewer, chunks[chunk].boundsMin, chunks[chunk].boundsMax);
+    return glm::length(viewer - closest);
+}
+
+// Chunk the viewer is in or nearest to
+uint32_t LevelStreamer::findCurrent(const glm::vec3& viewer) const {
+    uint32_t current = 0;
+    for (uint32_t chunk = 1; chunk < chunks.size(); chunk++) {
+        if (distanceTo(chunk, viewer) < distanceTo(current, viewer)) {
+            current = chunk;
+        }
+    }
+    return current;
+}
+
+// Near the viewer, or behind a door of the chunk the viewer is in
+bool LevelStreamer::isWanted(uint32_t chunk, uint32_t current,
+                             const glm::vec3& viewer) const {
+    const std::vector<uint32_t>& doors = chunks[current].neighbours;
+    return chunk == current || distanceTo(chunk, viewer) <= LOAD_DISTANCE ||
+           std::find(doors.begin(), doors.end(), chunk) != doors.end();
+}
+
+// Move reads and parses that finished along
+void LevelStreamer::poll() {
+    for (uint32_t chunk = 0; chunk < slots.size(); chunk++) {
+        Slot& slot = slots[chunk];
+        if (slot.state == ChunkState::Reading && slot.file->isDone()) {
+            if (slot.file->succeeded(0)) {
+                startDecode(chunk);
+            } else {
+                LOG_WARNING("Failed to read chunk {}", chunks[chunk].name);
+                slot = Slot();
+                slot.failed = true;
+            }
+        } else if (slot.state == ChunkState::Decoding &&
+                   slot.decoded->done.load(std::memory_order_acquire)) {
+            if (slot.decoded->succeeded) {
+                slot.state = ChunkState::Ready;
+                slot.bytes = slot.decoded->bytes;
+            } else {
+                LOG_WARNING("Malformed chunk {}", chunks[chunk].path);
+                slot = Slot();
+                slot.failed = true;
+            }
+        }
+    }
+}
+
+// Parse on a job, which only holds the file and its result so the stage
+// can unload under it
+void LevelStreamer::startDecode(uint32_t chunk) {
+    Slot& slot = slots[chunk];
+    std::shared_ptr<FileBatch> file = std::move(slot.file);
+    auto decoded = std::make_shared<Decoded>();
+    slot.decoded = decoded;
+    slot.state = ChunkState::Decoding;
+    jobs->post([file, decoded]() {
+        PROFILE_ZONE("Parse level chunk");
+        const std::vector<uint8_t>& data = file->getData(0);
+        decoded->succeeded =
+            parseChunk(std::string(data.begin(), data.end()), decoded->spawns);
+        decoded->bytes =
+            data.size() + decoded->spawns.capacity() * sizeof(ChunkSpawn);
+        decoded->done.store(true, std::memory_order_release);
+    });
+}
+
+void LevelStreamer::unload(uint32_t chunk) {
+    despawn(chunk);
+    residentBytes -= slots[chunk].bytes;
+    slots[chunk] = Slot();
+    unloads++;
+}
+
+// Unload kept chunks nobody wants, farthest first, until bytes fit
+bool LevelStreamer::makeRoom(uint64_t bytes, const glm::vec3& viewer,
+                             uint32_t current) {
+    std::vector<uint32_t> spare;
+    for (uint32_t chunk = 0; chunk < slots.size(); chunk++) {
+        if (slots[chunk].state == ChunkState::Loaded &&
+            !isWanted(chunk, current, viewer)) {
+            spare.push_back(chunk);
+        }
+    }
+    std::sort(spare.begin(), spare.end(), [&](uint32_t a, uint32_t b) {
+        return distanceTo(a, viewer) > distanceTo(b, viewer);
+    });
+    for (uint32_t chunk : spare) {
+        if (residentBytes + bytes <= budgetBytes) break;
+        unload(chunk);
+    }
+    return residentBytes + bytes <= budgetBytes;
+}
+
+// Start loads around viewer, spawn what finished and unload what is far
+void LevelStreamer::update(const glm::vec3& viewer) {
+    step(viewer, SPAWNS_PER_UPDATE);
+}
+
+void LevelStreamer::step(const glm::vec3& viewer, uint32_t spawnLimit) {
+    PROFILE_FUNCTION();
+    if (chunks.empty()) return;
+    poll();
+
+    uint32_t current = findCurrent(viewer);
+    std::vector<float> distances(chunks.size());
+    for (uint32_t chunk = 0; chunk < chunks.size(); chunk++) {
+        distances[chunk] =
+            chunk == current ? -1.0f : distanceTo(chunk, viewer);
+    }
+    std::vector<uint32_t> order(chunks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return distances[a] < distances[b];
+    });
+    auto isKept = [&](uint32_t chunk) {
+        return isWanted(chunk, current, viewer) ||
+               distances[chunk] <= UNLOAD_DISTANCE;
+    };
+
+    for (uint32_t chunk = 0; chunk < slots.size(); chunk++) {
+        if (slots[chunk].state == ChunkState::Loaded && !isKept(chunk)) {
+            unload(chunk);
+        }
+    }
+
+    // Nearest first, a chunk that no longer fits the budget waits and holds
+    // its load slot, so nothing further away is read meanwhile
+    uint32_t spawned = 0;
+    for (uint32_t chunk : order) {
+        Slot& slot = slots[chunk];
+        if (slot.state != ChunkState::Ready) continue;
+        if (!isKept(chunk)) {
+            slot = Slot();
+            continue;
+        }
+        if (spawned > 0 && spawned >= spawnLimit) continue;
+
+        slot.overBudget = residentBytes + slot.bytes > budgetBytes &&
+                          !makeRoom(slot.bytes, viewer, current);
+        if (slot.overBudget) {
+            if (!budgetWarned) {
+                LOG_WARNING("Chunk {} does not fit the {} MB level budget",
+                            chunks[chunk].name, budgetBytes / (1024 * 1024));
+                budgetWarned = true;
+            }
+            continue;
+        }
+
+        PROFILE_ZONE("Spawn level chunk");
+        spawn(chunk, slot.decoded->spawns);
+        spawned += static_cast<uint32_t>(slot.decoded->spawns.size());
+        slot.decoded.reset();
+        slot.state = ChunkState::Loaded;
+        residentBytes += slot.bytes;
+        loads++;
+    }
+
+    uint32_t inFlight = 0;
+    for (const Slot& slot : slots) {
+        if (slot.state != ChunkState::Unloaded &&
+            slot.state != ChunkState::Loaded) {
+            inFlight++;
+        }
+    }
+    for (uint32_t chunk : order) {
+        if (inFlight >= MAX_LOADS_IN_FLIGHT) break;
+        Slot& slot = slots[chunk];
+        if (slot.state != ChunkState::Unloaded || slot.failed ||
+            !isWanted(chunk, current, viewer)) {
+            continue;
+        }
+        slot.file = VirtualFileSystem::get().readAsync({chunks[chunk].path});
+        slot.state = ChunkState::Reading;
+        inFlight++;
+    }
+}
+
+// Every wanted chunk is spawned, failed or stuck over the budget
+bool LevelStreamer::isSettled(const glm::vec3& viewer) const {
+    uint32_t current = findCurrent(viewer);
+    for (uint32_t chunk = 0; chunk < slots.size(); chunk++) {
+        const Slot& slot = slots[chunk];
+        if (!isWanted(chunk, current, viewer) || slot.failed ||
+            slot.state == ChunkState::Loaded ||
+            (slot.state == ChunkState::Ready && slot.overBudget)) {
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Update until every chunk wanted at viewer is spawned
+void LevelStreamer::loadAround(const glm::vec3& viewer) {
+    PROFILE_FUNCTION();
+    if (chunks.empty()) return;
+    step(viewer, UINT32_MAX);
+    while (!isSettled(viewer)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        step(viewer, UINT32_MAX);
+    }
+}
+
+LevelStreamerStats LevelStreamer::getStats() const {
+    LevelStreamerStats stats;
+    for (const Slot& slot : slots) {
+        if (slot.state == ChunkState::Loaded) {
+            stats.chunksLoaded++;
+        } else if (slot.state != ChunkState::Unloaded) {
+            stats.chunksInFlight++;
+        }
+    }
+    stats.residentBytes = residentBytes;
+    stats.budgetBytes = budgetBytes;
+    stats.loads = loads;
+    stats.unloads = unloads;
+    return stats;
+}
@@ -0,0 +1,143 @@
+#ifndef LEVEL_STREAMER_H
+#define LEVEL_STREAMER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "core/jobs/job_system.h"
+#include "core/vfs/virtual_file_system.h"
+#include "ecs/components.h"
+
+// Resident chunks may hold this much by default
+const uint64_t DEFAULT_LEVEL_BUDGET = 16ull * 1024 * 1024;
+
+// An entity a chunk places when it streams in
+struct ChunkSpawn {
+    std::string mesh;
+    Transform transform;
+    // Turns about Y on top of the transform's rotation, 0 for none
+    float spinRadiansPerSecond = 0.0f;
+};
+
+// One area of a stage, loaded and unloaded as a whole
+struct LevelChunk {
+    std::string name;
+    // Virtual path of the file listing its entities
+    std::string path;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    // Chunks on the other side of this one's doors
+    std::vector<uint32_t> neighbours;
+};
+
+enum class ChunkState { Unloaded, Reading, Decoding, Ready, Loaded };
+
+struct LevelStreamerStats {
+    uint32_t chunksLoaded = 0;
+    // Reading, decoding or waiting to spawn
+    uint32_t chunksInFlight = 0;
+    uint64_t residentBytes = 0;
+    uint64_t budgetBytes = 0;
+    // Totals since the stage was loaded
+    uint32_t loads = 0;
+    uint32_t unloads = 0;
+};
+
+// Streams the chunks of a stage in and out around a viewer, so a stage
+// needs no loading screen past its first area. A chunk is read through the
+// virtual file system, parsed on the job system and handed to the spawn
+// callback on the thread calling update, a few entities per update so no
+// tick hitches. Chunks near the viewer load nearest first, along with the
+// chunks behind the doors of the one the viewer is in. Chunks unload once
+// the viewer is well past them, and the farthest go early when the memory
+// budget runs out
+class LevelStreamer {
+   public:
+    using SpawnFunction = std::function<void(
+        uint32_t chunk, const std::vector<ChunkSpawn>& spawns)>;
+    using DespawnFunction = std::function<void(uint32_t chunk)>;
+
+    // Chunks are parsed on jobs, spawning and despawning happen in update
+    void init(JobSystem& jobs, SpawnFunction spawn, DespawnFunction despawn);
+
+    // Read the stage's chunk layout, unloading the stage before it. Returns
+    // false if the file is missing or malformed
+    bool loadStage(const std::string& path);
+    // Despawn every chunk, loads in flight finish and are dropped
+    void unloadStage();
+
+    // Start loads around viewer, spawn what finished and unload what is far
+    void update(const glm::vec3& viewer);
+    // Update until every chunk wanted at viewer is spawned, for the start of
+    // a stage where a loading screen is fine
+    void loadAround(const glm::vec3& viewer);
+
+    // Resident chunks may hold this much, DEFAULT_LEVEL_BUDGET by default
+    void setBudget(uint64_t bytes) { budgetBytes = bytes; }
+
+    const std::vector<LevelChunk>& getChunks() const { return chunks; }
+    ChunkState getState(uint32_t chunk) const { return slots[chunk].state; }
+    LevelStreamerStats getStats() const;
+
+   private:
+    // Filled in on a job, handed over once done is set
+    struct Decoded {
+        std::atomic<bool> done{false};
+        bool succeeded = false;
+        std::vector<ChunkSpawn> spawns;
+        uint64_t bytes = 0;
+    };
+
+    struct Slot {
+        ChunkState state = ChunkState::Unloaded;
+        std::shared_ptr<FileBatch> file;
+        std::shared_ptr<Decoded> decoded;
+        uint64_t bytes = 0;
+        // Failed to read or parse, not tried again until the stage reloads
+        bool failed = false;
+        // Parsed but did not fit the budget on the last update
+        bool overBudget = false;
+    };
+
+    float distanceTo(uint32_t chunk, const glm::vec3& viewer) const;
+    // Chunk the viewer is in or nearest to
+    uint32_t findCurrent(const glm::vec3& viewer) const;
+    bool isWanted(uint32_t chunk, uint32_t current,
+                  const glm::vec3& viewer) const;
+    // update, spawning at most spawnLimit entities
+    void step(const glm::vec3& viewer, uint32_t spawnLimit);
+    // Move reads and parses that finished along
+    void poll();
+    void startDecode(uint32_t chunk);
+    void unload(uint32_t chunk);
+    // Unload kept chunks nobody wants, farthest first, until bytes fit
+    bool makeRoom(uint64_t bytes, const glm::vec3& viewer, uint32_t current);
+    bool isSettled(const glm::vec3& viewer) const;
+
+    Debugger debugger;
+    JobSystem* jobs = nullptr;
+    SpawnFunction spawn;
+    DespawnFunction despawn;
+
+    std::vector<LevelChunk> chunks;
+    std::vector<Slot> slots;
+    uint64_t budgetBytes = DEFAULT_LEVEL_BUDGET;
+    uint64_t residentBytes = 0;
+    uint32_t loads = 0;
+    uint32_t unloads = 0;
+    // Warned once per stage rather than every update
+    bool budgetWarned = false;
+};
+
+// Parse a chunk file into the entities it places. Each line is
+//   entity MESH X Y Z SCALE [rotate AX AY AZ DEGREES]... [spin DEGREES]
+// with rotations applied in the order given. # starts a comment
+bool parseChunk(const std::string& text, std::vector<ChunkSpawn>& spawns);
+
+#endif
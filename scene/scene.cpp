@@ -1,7 +1,88 @@
 #include "scene.h"
 
-Scene::Scene() {
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include "core/debugger/logger.h"
+
+// Layout of the stage's chunks and the doors between them
+const char* STAGE_PATH = "levels/stage1.level";
+
+// Read the stage's layout and spawn the chunks around viewer
+void Scene::load(JobSystem& jobs, const glm::vec3& viewer) {
     debugger.consoleMessage("\nBegin loading in Scene...", false);
-    dennis = Mesh3D((std::string(ASSET_PATH) + "/models/dennis.obj").c_str(),
-                    (std::string(ASSET_PATH) + "/textures/dennis.png").c_str());
-}
\ No newline at end of file
+    streamer.init(
+        jobs,
+        [this](uint32_t chunk, const std::vector<ChunkSpawn>& spawns) {
+            spawnChunk(chunk, spawns);
+        },
+        [this](uint32_t chunk) { despawnChunk(chunk); });
+    if (!streamer.loadStage(STAGE_PATH)) {
+        debugger.consoleMessage("Failed to load the stage!", true);
+    }
+
+    world.clear();
+    chunkEntities.assign(streamer.getChunks().size(), {});
+    freeDrawSlots.clear();
+    drawSlotCount = 0;
+    streamer.loadAround(viewer);
+    layoutChanged = false;
+
+    LevelStreamerStats stats = streamer.getStats();
+    LOG_INFO("Spawned {} entities from {} chunks", world.getEntityCount(),
+             stats.chunksLoaded);
+    debugger.consoleMessage("Successfully loaded in Scene", false);
+}
+
+// Stream chunks in and out around viewer
+bool Scene::stream(const glm::vec3& viewer) {
+    layoutChanged = false;
+    streamer.update(viewer);
+    return layoutChanged;
+}
+
+uint32_t Scene::allocateDrawSlot() {
+    if (freeDrawSlots.empty()) return drawSlotCount++;
+    uint32_t slot = freeDrawSlots.back();
+    freeDrawSlots.pop_back();
+    return slot;
+}
+
+void Scene::spawnChunk(uint32_t chunk, const std::vector<ChunkSpawn>& spawns) {
+    for (const ChunkSpawn& spawn : spawns) {
+        uint32_t mesh;
+        if (spawn.mesh == "dennis") {
+            mesh = MESH_DENNIS;
+        } else if (spawn.mesh == "viking_room") {
+            mesh = MESH_VIKING_ROOM;
+        } else {
+            LOG_WARNING("Chunk {} places unknown mesh {}",
+                        streamer.getChunks()[chunk].name, spawn.mesh);
+            continue;
+        }
+
+        Entity entity = world.create();
+        world.add<Transform>(entity, spawn.transform);
+        if (spawn.spinRadiansPerSecond != 0.0f) {
+            Spin spin;
+            spin.baseRotation = spawn.transform.rotation;
+            spin.radiansPerSecond = spawn.spinRadiansPerSecond;
+            world.add<Spin>(entity, spin);
+        }
+        world.add<Renderable>(entity, Renderable{allocateDrawSlot(), mesh});
+        chunkEntities[chunk].push_back(entity);
+    }
+    layoutChanged = true;
+}
+
+void Scene::despawnChunk(uint32_t chunk) {
+    for (Entity entity : chunkEntities[chunk]) {
+        freeDrawSlots.push_back(world.get<Renderable>(entity).drawSlot);
+        world.destroy(entity);
+    }
+    chunkEntities[chunk].clear();
+    std::sort(freeDrawSlots.begin(), freeDrawSlots.end(),
+              std::greater<uint32_t>());
+    layoutChanged = true;
+}
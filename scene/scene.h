@@ -1,7 +1,14 @@
 #ifndef SCENE_H
 #define SCENE_H
 
-#include "3d/mesh_3d.h"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "core/jobs/job_system.h"
+#include "ecs/ecs.h"
+#include "level_streamer.h"
 
 // This is defined in the CMakelists.txt file
 // Doing this simply to get rid of the intellisense error
@@ -9,14 +16,44 @@
 #define ASSET_PATH "${CMAKE_BINARY_DIR}/assets}"
 #endif
 
+// The stage's entities, streamed in chunk by chunk around a viewer. Meshes
+// are still loaded by the Vulkan context, an entity's Renderable slot says
+// which of them it moves. Draw slots of despawned entities are handed out
+// again, lowest first
 class Scene {
    public:
-    Scene();
+    // Meshes, in the order the Vulkan context loads them
+    static const uint32_t MESH_DENNIS = 0;
+    static const uint32_t MESH_VIKING_ROOM = 1;
+
+    // Read the stage's layout and spawn the chunks around viewer, replacing
+    // anything already loaded. Blocks until they are in
+    void load(JobSystem& jobs, const glm::vec3& viewer);
+
+    // Stream chunks in and out around viewer. Returns true if entities were
+    // spawned or despawned, which changes what the draw slots hold
+    bool stream(const glm::vec3& viewer);
 
-    Mesh3D dennis;
+    World& getWorld() { return world; }
+    // Draw slots handed out so far, free ones included
+    uint32_t getDrawSlotCount() const { return drawSlotCount; }
+    LevelStreamer& getStreamer() { return streamer; }
 
    private:
+    void spawnChunk(uint32_t chunk, const std::vector<ChunkSpawn>& spawns);
+    void despawnChunk(uint32_t chunk);
+    uint32_t allocateDrawSlot();
+
     Debugger debugger;
+    World world;
+    LevelStreamer streamer;
+
+    // Entities of every chunk, empty while it is not loaded
+    std::vector<std::vector<Entity>> chunkEntities;
+    // Sorted highest first, so the back is the lowest
+    std::vector<uint32_t> freeDrawSlots;
+    uint32_t drawSlotCount = 0;
+    bool layoutChanged = false;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,362 @@
+#include "benchmark_runner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <glm/gtc/constants.hpp>
+
+#include "thirdparty/stb/stb_image.h"
+
+// Frames rendered before timing starts, so pipeline creation and first use
+// costs stay out of the numbers
+const uint32_t WARMUP_FRAMES = 10;
+// Most frames drawn waiting for texture streaming before a golden capture
+const uint32_t MAX_SETTLE_FRAMES = 600;
+
+const std::vector<CameraPath> cameraPaths = {
+    // Stand still at the default camera
+    {"static", [](float) { return glm::vec3(0.0f, 0.0f, 3.0f); },
+     [](float) { return glm::vec3(0.0f); }},
+    // Circle the scene at eye height
+    {"orbit",
+     [](float t) {
+         float angle = t * 2.0f * glm::pi<float>();
+         return glm::vec3(3.0f * std::sin(angle), 0.5f, 3.0f * std::cos(angle));
+     },
+     [](float) { return glm::vec3(0.0f); }},
+    // Move in from far away until the models fill the screen
+    {"dolly", [](float t) { return glm::vec3(0.0f, 0.2f, 6.0f - 4.5f * t); },
+     [](float) { return glm::vec3(0.0f); }},
+};
+
+// Returns false if any golden image comparison failed
+bool BenchmarkRunner::run(const BenchmarkOptions& options) {
+    this->options = options;
+    debugger.consoleMessage("\nBegin running benchmark...", false);
+
+    vulkanContext.setHeadless(options.width, options.height);
+    // Fragment shader invocations show what overdraw and the depth pre-pass
+    // cost, release builds included
+    vulkanContext.setPipelineStatistics(true);
+    vulkanContext.setDepthPrepass(options.depthPrepass);
+    vulkanContext.setAntiAliasing(options.antiAliasing);
+    if (options.dynamicResolutionMs > 0.0) {
+        vulkanContext.setDynamicResolution(true, options.dynamicResolutionMs);
+    }
+    if (options.lightCount > 0) {
+        vulkanContext.setPointLights(scatterPointLights(options.lightCount));
+        vulkanContext.setAmbientLight(glm::vec3(0.15f));
+    }
+    if (options.sun) {
+        vulkanContext.setSun(DEFAULT_SUN_DIRECTION, DEFAULT_SUN_COLOR);
+        vulkanContext.setAmbientLight(glm::vec3(0.3f));
+    }
+    vulkanContext.setTextureBudget(options.textureBudget);
+    vulkanContext.initVulkan();
+
+    std::vector<PathResult> results;
+    bool passed = true;
+    for (const auto& path : cameraPaths) {
+        results.push_back(runPath(path));
+        if (results.back().golden == "failed") {
+            passed = false;
+        }
+    }
+
+    writeJson(results);
+    vulkanContext.cleanup();
+
+    debugger.consoleMessage(passed ? "Benchmark golden images passed"
+                                   : "Benchmark golden images FAILED",
+                            false);
+    return passed;
+}
+
+BenchmarkRunner::PathResult BenchmarkRunner::runPath(const CameraPath& path) {
+    debugger.consoleMessage(("\nBenchmark path " + path.name).c_str(), false);
+    using Clock = std::chrono::steady_clock;
+
+    PathResult result;
+    result.name = path.name;
+
+    std::string capturePath =
+        (std::filesystem::path(options.outputPath).parent_path() /
+         ("benchmark_" + path.name + ".png"))
+            .string();
+
+    // Every path starts from the same simulation state, with the chunks
+    // around its first camera position loaded
+    simulationServer.setViewer(path.position(0.0f));
+    simulationServer.init();
+    vulkanContext.setObjectMeshes(simulationServer.getObjectMeshes());
+    vulkanContext.setStaticObjects(simulationServer.getStaticObjects());
+
+    std::vector<double> cpuTimes;
+    std::vector<double> gpuTimes;
+    double renderScaleSum = 0.0;
+    uint32_t shadowCascadeSum = 0;
+    uint32_t totalFrames = WARMUP_FRAMES + options.framesPerPath;
+    for (uint32_t i = 0; i < totalFrames; i++) {
+        uint32_t frame = i < WARMUP_FRAMES ? 0 : i - WARMUP_FRAMES;
+        float t = options.framesPerPath > 1
+                      ? frame / float(options.framesPerPath - 1)
+                      : 0.0f;
+        vulkanContext.setCamera(path.position(t), path.target(t));
+        simulationServer.setViewer(path.position(t));
+        // One 60 Hz simulation tick per frame, warmup frames all show tick 0
+        while (simulationServer.getTick() < frame) {
+            simulationServer.step();
+        }
+        const TransformHierarchy& objects = simulationServer.sample();
+        if (simulationServer.takeLayoutChange()) {
+            vulkanContext.setObjectMeshes(simulationServer.getObjectMeshes());
+            vulkanContext.setStaticObjects(
+                simulationServer.getStaticObjects());
+        }
+        vulkanContext.setObjectTransforms(objects);
+
+        if (i == totalFrames - 1) {
+            settleTextureStreaming();
+            vulkanContext.captureNextFrame(capturePath);
+        }
+
+        auto frameStart = Clock::now();
+        vulkanContext.drawFrame();
+        double cpuTime =
+            std::chrono::duration<double, std::milli>(Clock::now() - frameStart)
+                .count();
+
+        if (i < WARMUP_FRAMES) continue;
+
+        const FrameStats& stats = vulkanContext.getFrameStats();
+        cpuTimes.push_back(cpuTime);
+        // GPU results trail the CPU, skip frames that have none yet
+        if (stats.gpuTimeMs > 0.0) {
+            gpuTimes.push_back(stats.gpuTimeMs);
+        }
+        result.drawCount = stats.drawCount;
+        result.instanceCount = stats.instanceCount;
+        result.visibleInstances = stats.visibleInstances;
+        result.triangleCount = stats.triangleCount;
+        result.fragmentInvocations = stats.fragmentInvocations;
+        renderScaleSum += stats.renderScale;
+        shadowCascadeSum += stats.shadowCascadesRendered;
+        result.shadowCacheRebuilds += stats.shadowCacheRebuilds;
+        result.minRenderScale =
+            std::min(result.minRenderScale, stats.renderScale);
+        result.deviceMemoryUsed =
+            std::max(result.deviceMemoryUsed, stats.deviceMemoryUsed);
+        result.textureMemory =
+            std::max(result.textureMemory, stats.textureMemory);
+        result.textureUploads += stats.textureUploads;
+    }
+    vulkanContext.waitIdle();
+
+    result.gpuPasses = vulkanContext.getGpuProfiler().getRegions();
+    result.cpuFrameMs = summarize(cpuTimes);
+    result.gpuFrameMs = summarize(gpuTimes);
+    if (!cpuTimes.empty()) {
+        result.renderScale = renderScaleSum / cpuTimes.size();
+        result.shadowCascadesRendered =
+            static_cast<double>(shadowCascadeSum) / cpuTimes.size();
+    }
+
+    std::string goldenPath = options.goldenDir + "/" + path.name + ".png";
+    bool hasGolden = std::filesystem::exists(goldenPath);
+    if (options.updateGolden || (!hasGolden && options.recordMissingGolden)) {
+        std::error_code error;
+        std::filesystem::create_directories(options.goldenDir, error);
+        std::filesystem::copy_file(
+            capturePath, goldenPath,
+            std::filesystem::copy_options::overwrite_existing, error);
+        if (error) {
+            debugger.consoleMessage(("Failed to update golden image " +
+                                     goldenPath + ": " + error.message())
+                                        .c_str(),
+                                    false);
+            result.golden = "failed";
+        } else {
+            result.golden = hasGolden ? "updated" : "recorded";
+        }
+    } else if (!hasGolden) {
+        // A path without a golden image checks nothing, so it fails until
+        // one is recorded
+        debugger.consoleMessage(
+            ("Golden image " + goldenPath +
+             " is missing, record it with --record-missing-golden")
+                .c_str(),
+            false);
+        result.golden = "failed";
+    } else {
+        compareGolden(capturePath, goldenPath, result);
+    }
+
+    std::string summary =
+        "cpu " + std::to_string(result.cpuFrameMs.avg) + " ms, gpu " +
+        std::to_string(result.gpuFrameMs.avg) + " ms, golden " + result.golden;
+    debugger.consoleMessage(summary.c_str(), false);
+    return result;
+}
+
+// Untimed frames at the last camera position. Streaming is settled once it
+// stays idle long enough for every frame in flight to have reported usage
+void BenchmarkRunner::settleTextureStreaming() {
+    uint32_t idleFrames = 0;
+    for (uint32_t i = 0; i < MAX_SETTLE_FRAMES; i++) {
+        if (vulkanContext.isTextureStreamingIdle()) {
+            if (++idleFrames > vulkanContext.getFramesInFlight()) return;
+        } else {
+            idleFrames = 0;
+        }
+        vulkanContext.drawFrame();
+    }
+    debugger.consoleMessage(
+        "Texture streaming did not settle before the golden capture", false);
+}
+
+// Compare the captured frame with the golden image of the same name
+void BenchmarkRunner::compareGolden(const std::string& capturePath,
+                                    const std::string& goldenPath,
+                                    PathResult& result) {
+    int captureWidth, captureHeight, captureChannels;
+    int goldenWidth, goldenHeight, goldenChannels;
+    stbi_uc* capture = stbi_load(capturePath.c_str(), &captureWidth,
+                                 &captureHeight, &captureChannels, 4);
+    stbi_uc* golden = stbi_load(goldenPath.c_str(), &goldenWidth,
+                                &goldenHeight, &goldenChannels, 4);
+
+    if (!capture || !golden || captureWidth != goldenWidth ||
+        captureHeight != goldenHeight) {
+        debugger.consoleMessage(
+            ("Golden image " + goldenPath + " is missing or a different size")
+                .c_str(),
+            false);
+        result.golden = "failed";
+        stbi_image_free(capture);
+        stbi_image_free(golden);
+        return;
+    }
+
+    size_t pixelCount = static_cast<size_t>(captureWidth) * captureHeight;
+    size_t diffPixels = 0;
+    for (size_t i = 0; i < pixelCount; i++) {
+        int pixelDiff = 0;
+        for (size_t c = 0; c < 4; c++) {
+            pixelDiff = std::max(
+                pixelDiff, std::abs(int(capture[i * 4 + c]) -
+                                    int(golden[i * 4 + c])));
+        }
+        result.maxPixelDiff = std::max(result.maxPixelDiff, pixelDiff);
+        if (pixelDiff > options.pixelTolerance) {
+            diffPixels++;
+        }
+    }
+    stbi_image_free(capture);
+    stbi_image_free(golden);
+
+    result.diffPixelRatio = double(diffPixels) / pixelCount;
+    result.golden =
+        result.diffPixelRatio <= options.maxDiffPixelRatio ? "passed" : "failed";
+}
+
+BenchmarkRunner::TimingSummary BenchmarkRunner::summarize(
+    std::vector<double> samples) {
+    TimingSummary summary;
+    if (samples.empty()) return summary;
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    summary.avg = sum / samples.size();
+    summary.min = samples.front();
+    summary.median = samples[samples.size() / 2];
+    summary.p99 = samples[samples.size() * 99 / 100];
+    summary.max = samples.back();
+    return summary;
+}
+
+void BenchmarkRunner::writeJson(const std::vector<PathResult>& results) {
+    std::ofstream file(options.outputPath);
+    if (!file.is_open()) {
+        debugger.consoleMessage(
+            ("Failed to open " + options.outputPath).c_str(), true);
+    }
+
+    auto writeTiming = [&](const char* name, const TimingSummary& timing) {
+        file << "      \"" << name << "\": {\"avg\": " << timing.avg
+             << ", \"min\": " << timing.min << ", \"median\": " << timing.median
+             << ", \"p99\": " << timing.p99 << ", \"max\": " << timing.max
+             << "},\n";
+    };
+
+    file << "{\n";
+    file << "  \"device\": \"" << vulkanContext.getDeviceName() << "\",\n";
+    file << "  \"width\": " << options.width << ",\n";
+    file << "  \"height\": " << options.height << ",\n";
+    file << "  \"framesPerPath\": " << options.framesPerPath << ",\n";
+    file << "  \"depthPrepass\": "
+         << (options.depthPrepass ? "true" : "false") << ",\n";
+    // The resolve or FXAA cost shows up in the main and fxaa passes below
+    file << "  \"antiAliasing\": \""
+         << antiAliasingName(options.antiAliasing) << "\",\n";
+    file << "  \"samples\": "
+         << static_cast<uint32_t>(vulkanContext.getSampleCount()) << ",\n";
+    file << "  \"dynamicResolutionMs\": " << options.dynamicResolutionMs
+         << ",\n";
+    // The binning cost shows up in the light binning pass below
+    file << "  \"lightCount\": " << options.lightCount << ",\n";
+    file << "  \"sun\": " << (options.sun ? "true" : "false") << ",\n";
+    file << "  \"textureBudgetBytes\": " << options.textureBudget << ",\n";
+    file << "  \"paths\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const PathResult& result = results[i];
+        file << "    {\n";
+        file << "      \"name\": \"" << result.name << "\",\n";
+        writeTiming("cpuFrameMs", result.cpuFrameMs);
+        writeTiming("gpuFrameMs", result.gpuFrameMs);
+        file << "      \"drawCount\": " << result.drawCount << ",\n";
+        file << "      \"instanceCount\": " << result.instanceCount << ",\n";
+        file << "      \"visibleInstances\": " << result.visibleInstances
+             << ",\n";
+        file << "      \"triangleCount\": " << result.triangleCount << ",\n";
+        file << "      \"fragmentInvocations\": " << result.fragmentInvocations
+             << ",\n";
+        file << "      \"renderScale\": " << result.renderScale << ",\n";
+        file << "      \"minRenderScale\": " << result.minRenderScale
+             << ",\n";
+        file << "      \"shadowCascadesRendered\": "
+             << result.shadowCascadesRendered << ",\n";
+        file << "      \"shadowCacheRebuilds\": "
+             << result.shadowCacheRebuilds << ",\n";
+        file << "      \"deviceMemoryBytes\": " << result.deviceMemoryUsed
+             << ",\n";
+        file << "      \"textureMemoryBytes\": " << result.textureMemory
+             << ",\n";
+        file << "      \"textureUploadBytes\": " << result.textureUploads
+             << ",\n";
+        file << "      \"golden\": \"" << result.golden << "\",\n";
+        file << "      \"maxPixelDiff\": " << result.maxPixelDiff << ",\n";
+        file << "      \"diffPixelRatio\": " << result.diffPixelRatio << ",\n";
+        file << "      \"gpuPasses\": [";
+        for (size_t p = 0; p < result.gpuPasses.size(); p++) {
+            const GpuRegionTiming& pass = result.gpuPasses[p];
+            file << (p ? ", " : "") << "{\"name\": \"" << pass.name
+                 << "\", \"avgMs\": " << pass.averageMs;
+            if (pass.hasStatistics) {
+                file << ", \"fragmentInvocations\": "
+                     << pass.statistics.fragmentShaderInvocations;
+            }
+            file << "}";
+        }
+        file << "]\n";
+        file << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+
+    debugger.consoleMessage(("Wrote " + options.outputPath).c_str(), false);
+}
@@ -0,0 +1,120 @@
+#ifndef BENCHMARK_RUNNER_H
+#define BENCHMARK_RUNNER_H
+
+#include <string>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "drivers/vulkan/vulkan_context.h"
+#include "simulation_server.h"
+
+struct BenchmarkOptions {
+    uint32_t width = 800;
+    uint32_t height = 600;
+    // Frames rendered along each camera path
+    uint32_t framesPerPath = 300;
+    std::string goldenDir = "benchmark/golden";
+    std::string outputPath = "benchmark_results.json";
+    // Overwrite the golden images with this run's frames
+    bool updateGolden = false;
+    // Record golden images only for paths that have none and compare the
+    // rest. The repo ships no golden images, so a fresh checkout needs this
+    // once
+    bool recordMissingGolden = false;
+    // Largest per channel difference still counted as a match
+    int pixelTolerance = 8;
+    // Fraction of pixels allowed to exceed the tolerance
+    double maxDiffPixelRatio = 0.001;
+    // Render with the depth pre-pass, to compare fragment shading cost
+    bool depthPrepass = false;
+    AntiAliasingMode antiAliasing = AntiAliasingMode::Msaa4x;
+    // GPU frame budget for dynamic resolution, 0 for off. Golden images
+    // only match when the scale stays at 1
+    double dynamicResolutionMs = 0.0;
+    // Point lights scattered around the scene, 0 renders it unlit like the
+    // golden images
+    uint32_t lightCount = 0;
+    // Light the scene with the default sun and its cascaded shadows
+    bool sun = false;
+    // Device memory streamed textures may hold
+    VkDeviceSize textureBudget = DEFAULT_TEXTURE_BUDGET;
+};
+
+// A camera moving through the scene. position(t) and target(t) are sampled
+// with t going from 0 to 1 over the path
+struct CameraPath {
+    std::string name;
+    glm::vec3 (*position)(float t);
+    glm::vec3 (*target)(float t);
+};
+
+// Renders scripted camera paths headless, checks the last frame of each path
+// against a golden image and writes timings to JSON
+class BenchmarkRunner {
+   public:
+    // Returns false if any golden image comparison failed
+    bool run(const BenchmarkOptions& options);
+
+   private:
+    struct TimingSummary {
+        double avg = 0.0;
+        double min = 0.0;
+        double median = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    struct PathResult {
+        std::string name;
+        TimingSummary cpuFrameMs;
+        TimingSummary gpuFrameMs;
+        uint32_t drawCount = 0;
+        uint32_t instanceCount = 0;
+        // Left after GPU frustum and occlusion culling
+        uint32_t visibleInstances = 0;
+        uint64_t triangleCount = 0;
+        // Summed over every pass of the last frame with statistics
+        uint64_t fragmentInvocations = 0;
+        // Average and lowest render scale over the measured frames
+        double renderScale = 1.0;
+        double minRenderScale = 1.0;
+        // Shadow cascades drawn per frame on average, and how often the
+        // cached ones had to be redrawn over the whole path
+        double shadowCascadesRendered = 0.0;
+        uint32_t shadowCacheRebuilds = 0;
+        VkDeviceSize deviceMemoryUsed = 0;
+        // Most device memory streamed textures held, and what was uploaded
+        // to them over the measured frames
+        VkDeviceSize textureMemory = 0;
+        VkDeviceSize textureUploads = 0;
+        // passed, failed (also with no golden image), updated or recorded
+        std::string golden;
+        int maxPixelDiff = 0;
+        double diffPixelRatio = 0.0;
+        // Rolling average GPU time of every render graph pass, with its
+        // pipeline statistics
+        std::vector<GpuRegionTiming> gpuPasses;
+    };
+
+    Debugger debugger;
+    VulkanContext vulkanContext;
+    // Stepped by hand, one tick per frame, so every run is identical
+    SimulationServer simulationServer;
+    BenchmarkOptions options;
+
+    PathResult runPath(const CameraPath& path);
+
+    // Draw the current frame again until texture streaming has caught up
+    // with it, so golden frames do not depend on upload timing
+    void settleTextureStreaming();
+
+    // Compare the captured frame with the golden image of the same name
+    void compareGolden(const std::string& capturePath,
+                       const std::string& goldenPath, PathResult& result);
+
+    TimingSummary summarize(std::vector<double> samples);
+
+    void writeJson(const std::vector<PathResult>& results);
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "display_server.h"
 
+#include <algorithm>
+#include <chrono>
+
 // Initialize SDL2 and create a window
 void DisplayServer::initSDL2() {
     debugger.consoleMessage("\nBegin initializing SDL2...", false);
@@ -8,6 +11,7 @@ void DisplayServer::initSDL2() {
         debugger.consoleMessage("Failed to initialize SDL2 video!", false);
         debugger.consoleMessage(SDL_GetError(), true);
     } else {
+        sdlInitialized = true;
         debugger.consoleMessage("Successfully initialized SDL2 video", false);
     }
 
@@ -31,35 +35,303 @@ void DisplayServer::initSDL2() {
 // Destroy all SDL2 and Vulkan objects and quit SDL2
 void DisplayServer::cleanup() {
     debugger.consoleMessage("\nBegin cleaning up display server...", false);
-    vulkanContext.cleanup();
-    SDL_DestroyWindowSurface(window);
-    debugger.consoleMessage("Destroyed SDL2 window surface", false);
-    SDL_DestroyWindow(window);
-    debugger.consoleMessage("Destroyed SDL2 window", false);
-    SDL_Quit();
-    debugger.consoleMessage("Quit SDL2", false);
+    simulationServer.stop();
+    // A Vulkan error during initVulkan leaves nothing cleanup can rely on,
+    // the process is exiting anyway
+    if (vulkanContext.isInitialized()) {
+        vulkanContext.cleanup();
+    }
+    if (window) {
+        SDL_DestroyWindowSurface(window);
+        debugger.consoleMessage("Destroyed SDL2 window surface", false);
+        SDL_DestroyWindow(window);
+        debugger.consoleMessage("Destroyed SDL2 window", false);
+    }
+    // Headless runs never initialize SDL2
+    if (sdlInitialized) {
+        SDL_Quit();
+        sdlInitialized = false;
+        debugger.consoleMessage("Quit SDL2", false);
+    }
     debugger.consoleMessage("\nSuccessfully cleaned up display server", false);
 }
 
+// Present mode, frame rate cap and frames in flight. Call before init
+void DisplayServer::setFramePacing(const FramePacingOptions& options) {
+    vulkanContext.setPresentMode(options.presentMode);
+    vulkanContext.setFramesInFlight(options.framesInFlight);
+    framePacer.setMaxFps(options.maxFps);
+}
+
+// Depth only pass before shading. Call before init, F4 toggles it
+void DisplayServer::setDepthPrepass(bool enabled) {
+    vulkanContext.setDepthPrepass(enabled);
+}
+
+// Off, MSAA or FXAA. Call before init, F5 cycles it
+void DisplayServer::setAntiAliasing(AntiAliasingMode mode) {
+    vulkanContext.setAntiAliasing(mode);
+}
+
+// Keep the GPU frame under targetMs. Call before init, F6 toggles it
+void DisplayServer::setDynamicResolution(double targetMs) {
+    vulkanContext.setDynamicResolution(true, targetMs);
+}
+
+// The default sun with a dim ambient, so its shadows show. Call before init
+void DisplayServer::setSun() {
+    vulkanContext.setSun(DEFAULT_SUN_DIRECTION, DEFAULT_SUN_COLOR);
+    vulkanContext.setAmbientLight(glm::vec3(0.3f));
+}
+
+// Device memory streamed textures may hold
+void DisplayServer::setTextureBudget(VkDeviceSize bytes) {
+    vulkanContext.setTextureBudget(bytes);
+}
+
+// Scatter count point lights with a dim ambient. Call before init
+void DisplayServer::setPointLights(uint32_t count) {
+    vulkanContext.setPointLights(scatterPointLights(count));
+    vulkanContext.setAmbientLight(glm::vec3(0.15f));
+}
+
 // Initialize SDL2 and Vulkan
 void DisplayServer::init() {
     initSDL2();
     vulkanContext.initVulkan();
+    simulationServer.setViewer(vulkanContext.getCameraEye());
+    simulationServer.init();
+    vulkanContext.setObjectMeshes(simulationServer.getObjectMeshes());
+    vulkanContext.setStaticObjects(simulationServer.getStaticObjects());
+}
+
+// Initialize Vulkan without a window, rendering into offscreen images
+void DisplayServer::initHeadless(uint32_t width, uint32_t height) {
+    debugger.consoleMessage("\nBegin initializing headless display server...",
+                            false);
+    vulkanContext.setHeadless(width, height);
+    vulkanContext.initVulkan();
+    simulationServer.setViewer(vulkanContext.getCameraEye());
+    simulationServer.init();
+    vulkanContext.setObjectMeshes(simulationServer.getObjectMeshes());
+    vulkanContext.setStaticObjects(simulationServer.getStaticObjects());
 }
 
 // Display server loop
 void DisplayServer::run() {
     debugger.consoleMessage("\nBegin running display server...", false);
+    PROFILE_THREAD("main");
     SDL_Event e;
     bool bQuit = false;
+    Uint32 lastTitleUpdate = SDL_GetTicks();
+    // Game logic ticks on its own thread from here on
+    simulationServer.start();
     while (!bQuit) {
-        while (SDL_PollEvent(&e)) {
-            if (e.type == SDL_QUIT ||
-                e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) {
-                bQuit = true;
+        PROFILE_ZONE("Frame");
+        {
+            PROFILE_ZONE("FramePacer wait");
+            framePacer.waitForNextFrame();
+        }
+        framePacer.beginFrame();
+        {
+            PROFILE_ZONE("SDL_PollEvent");
+            while (SDL_PollEvent(&e)) {
+                if (e.type == SDL_QUIT ||
+                    e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) {
+                    bQuit = true;
+                }
+                // F1 dumps the per pass GPU timings
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F1) {
+                    debugger.consoleMessage(
+                        vulkanContext.getGpuProfiler().getReport().c_str(),
+                        false);
+                    debugger.consoleMessage(framePacer.getReport().c_str(),
+                                            false);
+                    debugger.consoleMessage(getAntiAliasingReport().c_str(),
+                                            false);
+                }
+                // F2 cycles the present mode, F3 the frames in flight, so
+                // latency and throughput can be compared on the spot
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F2) {
+                    cyclePresentMode();
+                }
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F3) {
+                    vulkanContext.setFramesInFlight(
+                        vulkanContext.getFramesInFlight() %
+                            MAX_FRAMES_IN_FLIGHT +
+                        1);
+                }
+                // F4 toggles the depth pre-pass, F1 then shows the fragment
+                // invocations it saves in debug builds
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F4) {
+                    vulkanContext.setDepthPrepass(
+                        !vulkanContext.getDepthPrepass());
+                }
+                // F5 cycles the anti-aliasing mode, F1 then compares what
+                // each one cost
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F5) {
+                    uint32_t mode =
+                        static_cast<uint32_t>(vulkanContext.getAntiAliasing());
+                    vulkanContext.setAntiAliasing(static_cast<AntiAliasingMode>(
+                        (mode + 1) % ANTI_ALIASING_MODE_COUNT));
+                }
+                // F6 toggles dynamic resolution, keeping its budget
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F6) {
+                    vulkanContext.setDynamicResolution(
+                        !vulkanContext.getDynamicResolution(),
+                        vulkanContext.getDynamicResolutionTarget());
+                }
+                // F7 toggles the sun and its shadow passes
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F7) {
+                    vulkanContext.setSun(DEFAULT_SUN_DIRECTION,
+                                         vulkanContext.getSun()
+                                             ? glm::vec3(0.0f)
+                                             : DEFAULT_SUN_COLOR);
+                }
             }
         }
+        // Draw the simulation as of now, between its last two ticks
+        simulationServer.setViewer(vulkanContext.getCameraEye());
+        syncSimulation();
         // Vulkan context handles drawing to the surface
         vulkanContext.drawFrame();
+        framePacer.endFrame();
+
+        // Show the rolling GPU frame time in the title once a second
+        if (SDL_GetTicks() - lastTitleUpdate >= 1000) {
+            lastTitleUpdate = SDL_GetTicks();
+            std::string title =
+                "Ape Escape Remake - GPU " +
+                std::to_string(
+                    vulkanContext.getGpuProfiler().getAverageFrameTime()) +
+                " ms, latency " +
+                std::to_string(framePacer.getStats().latencyMs) + " ms, " +
+                presentModeName(vulkanContext.getPresentMode()) + ", " +
+                std::to_string(vulkanContext.getFramesInFlight()) +
+                " in flight, aa " +
+                antiAliasingName(vulkanContext.getAntiAliasing()) +
+                (vulkanContext.getDepthPrepass() ? ", depth pre-pass" : "");
+            if (vulkanContext.getDynamicResolution()) {
+                title += ", scale " +
+                         std::to_string(
+                             vulkanContext.getFrameStats().renderScale);
+            }
+            if (vulkanContext.getSun()) {
+                title += ", sun";
+            }
+            if (vulkanContext.getFrameStats().lightCount > 0) {
+                title += ", " +
+                         std::to_string(
+                             vulkanContext.getFrameStats().lightCount) +
+                         " lights";
+            }
+            title += ", textures " +
+                     std::to_string(
+                         vulkanContext.getFrameStats().textureMemory >> 20) +
+                     " MB";
+            SDL_SetWindowTitle(window, title.c_str());
+        }
+    }
+    simulationServer.stop();
+}
+
+// Switch to the next present mode, the context falls back if unsupported.
+// Steps from the requested mode, as an unsupported request falls back to a
+// mode earlier in the cycle and would ask for the same mode again
+void DisplayServer::cyclePresentMode() {
+    const VkPresentModeKHR modes[] = {
+        VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+        VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+    const size_t modeCount = sizeof(modes) / sizeof(modes[0]);
+
+    VkPresentModeKHR current = vulkanContext.getRequestedPresentMode();
+    size_t next = 0;
+    for (size_t i = 0; i < modeCount; i++) {
+        if (modes[i] == current) next = (i + 1) % modeCount;
+    }
+    vulkanContext.setPresentMode(modes[next]);
+}
+
+// GPU cost of every anti-aliasing mode used so far
+std::string DisplayServer::getAntiAliasingReport() {
+    std::string report = "Anti-aliasing GPU cost (frame / main / post ms):";
+    for (uint32_t i = 0; i < ANTI_ALIASING_MODE_COUNT; i++) {
+        AntiAliasingMode mode = static_cast<AntiAliasingMode>(i);
+        const AntiAliasingTiming& timing =
+            vulkanContext.getAntiAliasingTiming(mode);
+        if (timing.frames == 0) continue;
+        report += "\n  " + std::string(antiAliasingName(mode)) + " (" +
+                  std::to_string(static_cast<uint32_t>(timing.samples)) +
+                  " samples, " + std::to_string(timing.frames) +
+                  " frames): " + std::to_string(timing.frameMs) + " / " +
+                  std::to_string(timing.mainPassMs) + " / " +
+                  std::to_string(timing.postPassMs);
+    }
+    return report;
+}
+
+// Hand the renderer the simulation's transforms, and what the draw slots
+// hold whenever the stage streamed entities in or out
+void DisplayServer::syncSimulation() {
+    const TransformHierarchy& objects = simulationServer.sample();
+    if (simulationServer.takeLayoutChange()) {
+        vulkanContext.setObjectMeshes(simulationServer.getObjectMeshes());
+        vulkanContext.setStaticObjects(simulationServer.getStaticObjects());
     }
+    vulkanContext.setObjectTransforms(objects);
+}
+
+// Render a fixed number of frames and print timings. If capturePath is set
+// the last frame is saved to it as a PNG
+void DisplayServer::runHeadless(uint32_t frameCount,
+                                const std::string& capturePath) {
+    debugger.consoleMessage("\nBegin running headless display server...",
+                            false);
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<double> frameTimes;
+    frameTimes.reserve(frameCount);
+
+    auto start = Clock::now();
+    for (uint32_t i = 0; i < frameCount; i++) {
+        if (!capturePath.empty() && i == frameCount - 1) {
+            vulkanContext.captureNextFrame(capturePath);
+        }
+
+        // One tick per frame keeps headless output reproducible
+        auto frameStart = Clock::now();
+        simulationServer.step();
+        syncSimulation();
+        vulkanContext.drawFrame();
+        frameTimes.push_back(
+            std::chrono::duration<double, std::milli>(Clock::now() - frameStart)
+                .count());
+    }
+    // Frames are pipelined, so the GPU may still be working on the last ones
+    vulkanContext.waitIdle();
+    double totalMs =
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+
+    if (frameTimes.empty()) return;
+
+    std::vector<double> sorted = frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double time : frameTimes) {
+        sum += time;
+    }
+
+    std::string report =
+        "\nHeadless run: " + std::to_string(frameCount) + " frames in " +
+        std::to_string(totalMs) + " ms (" +
+        std::to_string(frameCount * 1000.0 / totalMs) + " fps)" +
+        "\nCPU frame time avg " + std::to_string(sum / frameTimes.size()) +
+        " ms, min " + std::to_string(sorted.front()) + " ms, median " +
+        std::to_string(sorted[sorted.size() / 2]) + " ms, p99 " +
+        std::to_string(sorted[sorted.size() * 99 / 100]) + " ms, max " +
+        std::to_string(sorted.back()) + " ms";
+    debugger.consoleMessage(report.c_str(), false);
+    debugger.consoleMessage(
+        vulkanContext.getGpuProfiler().getReport().c_str(), false);
 }
\ No newline at end of file
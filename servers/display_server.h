@@ -3,27 +3,75 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_vulkan.h>
 
+#include <string>
+
 #include "core/debugger/debugger.h"
 #include "drivers/vulkan/vulkan_context.h"
+#include "frame_pacer.h"
+#include "simulation_server.h"
 
 class DisplayServer {
    public:
+    // Present mode, frame rate cap and frames in flight. Call before init
+    void setFramePacing(const FramePacingOptions& options);
+
+    // Depth only pass before shading. Call before init, F4 toggles it
+    void setDepthPrepass(bool enabled);
+
+    // Off, MSAA or FXAA. Call before init, F5 cycles it
+    void setAntiAliasing(AntiAliasingMode mode);
+
+    // Keep the GPU frame under targetMs by lowering the render resolution.
+    // Call before init, F6 toggles it
+    void setDynamicResolution(double targetMs);
+
+    // Scatter count point lights around the scene and dim the ambient light.
+    // Call before init
+    void setPointLights(uint32_t count);
+
+    // Turn on the default sun with cascaded shadows and dim the ambient
+    // light. Call before init, F7 toggles the sun
+    void setSun();
+
+    // Device memory streamed textures may hold, the driver's memory budget
+    // can lower it further
+    void setTextureBudget(VkDeviceSize bytes);
+
     // Initialize SDL2 and Vulkan
     void init();
 
+    // Initialize Vulkan without a window, rendering into offscreen images
+    void initHeadless(uint32_t width, uint32_t height);
+
     // Destroy all SDL2 and Vulkan objects and quit SDL2
     void cleanup();
 
     // Display server loop
     void run();
 
+    // Render a fixed number of frames and print timings. If capturePath is
+    // set the last frame is saved to it as a PNG
+    void runHeadless(uint32_t frameCount, const std::string& capturePath);
+
    private:
+    // Sample the simulation into the renderer, before drawing
+    void syncSimulation();
+
     Debugger debugger;
     VulkanContext vulkanContext;
+    FramePacer framePacer;
+    SimulationServer simulationServer;
 
-    SDL_Window *window;
+    SDL_Window *window = NULL;
+    bool sdlInitialized = false;
 
     // Initialize SDL2 and create a window
     void initSDL2();
+
+    // Switch to the next present mode, the context falls back if unsupported
+    void cyclePresentMode();
+
+    // GPU cost of every anti-aliasing mode used so far
+    std::string getAntiAliasingReport();
 };
 #endif
\ No newline at end of file
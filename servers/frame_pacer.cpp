@@ -0,0 +1,115 @@
+#include "frame_pacer.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Parse fifo, mailbox, immediate or fifo-relaxed
+bool parsePresentMode(const std::string& name, VkPresentModeKHR& mode) {
+    if (name == "fifo") {
+        mode = VK_PRESENT_MODE_FIFO_KHR;
+    } else if (name == "mailbox") {
+        mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    } else if (name == "immediate") {
+        mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    } else if (name == "fifo-relaxed") {
+        mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 0 removes the cap
+void FramePacer::setMaxFps(double fps) {
+    maxFps = std::max(fps, 0.0);
+    hasDeadline = false;
+}
+
+// Wait until the next frame is due
+void FramePacer::waitForNextFrame() {
+    lastCapWaitMs = 0.0;
+    if (maxFps <= 0.0) return;
+
+    auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / maxFps));
+    Clock::time_point now = Clock::now();
+    if (!hasDeadline) {
+        nextDeadline = now;
+        hasDeadline = true;
+    }
+
+    if (nextDeadline > now) {
+        waitUntil(nextDeadline);
+        lastCapWaitMs = std::chrono::duration<double, std::milli>(
+                            Clock::now() - now)
+                            .count();
+        nextDeadline += period;
+    } else if (now - nextDeadline > period) {
+        // More than a frame behind, start over instead of rushing to catch up
+        nextDeadline = now + period;
+    } else {
+        nextDeadline += period;
+    }
+}
+
+void FramePacer::waitUntil(Clock::time_point deadline) {
+    Clock::time_point now = Clock::now();
+    if (deadline - now > spinThreshold) {
+        std::this_thread::sleep_for(deadline - now - spinThreshold);
+    }
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+// Call right before polling input
+void FramePacer::beginFrame() { frameStart = Clock::now(); }
+
+// Call once the frame has been presented
+void FramePacer::endFrame() {
+    Clock::time_point now = Clock::now();
+    latencies.push_back(
+        std::chrono::duration<double, std::milli>(now - frameStart).count());
+    capWaits.push_back(lastCapWaitMs);
+    if (lastFrameEnd != Clock::time_point()) {
+        frameTimes.push_back(
+            std::chrono::duration<double, std::milli>(now - lastFrameEnd)
+                .count());
+    }
+    lastFrameEnd = now;
+
+    while (latencies.size() > historySize) latencies.pop_front();
+    while (capWaits.size() > historySize) capWaits.pop_front();
+    while (frameTimes.size() > historySize) frameTimes.pop_front();
+    updateStats();
+}
+
+void FramePacer::updateStats() {
+    auto average = [](const std::deque<double>& samples) {
+        if (samples.empty()) return 0.0;
+        double sum = 0.0;
+        for (double sample : samples) sum += sample;
+        return sum / samples.size();
+    };
+
+    stats.frameTimeMs = average(frameTimes);
+    stats.latencyMs = average(latencies);
+    stats.capWaitMs = average(capWaits);
+
+    std::vector<double> sorted(latencies.begin(), latencies.end());
+    std::sort(sorted.begin(), sorted.end());
+    stats.p99LatencyMs = sorted.empty() ? 0.0 : sorted[sorted.size() * 99 / 100];
+}
+
+std::string FramePacer::getReport() const {
+    std::string report =
+        "\nFrame pacing: frame " + std::to_string(stats.frameTimeMs) +
+        " ms, input to present " + std::to_string(stats.latencyMs) +
+        " ms (p99 " + std::to_string(stats.p99LatencyMs) + " ms)";
+    if (maxFps > 0.0) {
+        report += ", capped at " + std::to_string(maxFps) + " fps, waiting " +
+                  std::to_string(stats.capWaitMs) + " ms";
+    }
+    return report;
+}
@@ -0,0 +1,81 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+#include "core/debugger/debugger.h"
+#include "drivers/vulkan/vulkan_context.h"
+
+// How the display server paces frames, set from the command line
+struct FramePacingOptions {
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    // 0 leaves the frame rate uncapped
+    double maxFps = 0.0;
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+};
+
+// Rolling averages over the last few seconds of frames
+struct FramePacingStats {
+    double frameTimeMs = 0.0;
+    // Input sampled to vkQueuePresentKHR returning. Includes every wait in
+    // between, so it grows with frames in flight and FIFO queueing
+    double latencyMs = 0.0;
+    double p99LatencyMs = 0.0;
+    // Time spent holding back to the frame rate cap
+    double capWaitMs = 0.0;
+};
+
+// Parse fifo, mailbox, immediate or fifo-relaxed
+bool parsePresentMode(const std::string& name, VkPresentModeKHR& mode);
+
+// Caps the frame rate and measures input to present latency. The cap wait
+// happens before input is sampled, so capping never adds stale input
+class FramePacer {
+   public:
+    // 0 removes the cap
+    void setMaxFps(double fps);
+    double getMaxFps() const { return maxFps; }
+
+    // Wait until the next frame is due
+    void waitForNextFrame();
+    // Call right before polling input
+    void beginFrame();
+    // Call once the frame has been presented
+    void endFrame();
+
+    const FramePacingStats& getStats() const { return stats; }
+    std::string getReport() const;
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    // Sleep most of the way, then spin the rest, since sleeping overshoots
+    // by up to a scheduler tick
+    void waitUntil(Clock::time_point deadline);
+    void updateStats();
+
+    Debugger debugger;
+    double maxFps = 0.0;
+    // Remaining waits shorter than this are spun instead of slept
+    std::chrono::microseconds spinThreshold{2000};
+
+    Clock::time_point nextDeadline;
+    bool hasDeadline = false;
+    Clock::time_point frameStart;
+    Clock::time_point lastFrameEnd;
+    double lastCapWaitMs = 0.0;
+
+    std::deque<double> frameTimes;
+    std::deque<double> latencies;
+    std::deque<double> capWaits;
+    size_t historySize = 240;
+
+    FramePacingStats stats;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "simulation_server.h"
+
+#include <algorithm>
+#include <string>
+
+#include "core/debugger/profiler.h"
+
+// A tick running this far behind schedule is dropped instead of caught up
+const uint32_t MAX_CATCH_UP_TICKS = 5;
+
+// Load the scene around the viewer and set up the first state
+void SimulationServer::init(double tickRate) {
+    debugger.consoleMessage("\nBegin initializing simulation server...", false);
+    tickSeconds = 1.0 / tickRate;
+
+    if (jobs.getWorkerCount() == 0) jobs.init();
+    scene.load(jobs, getViewer());
+
+    current = SimulationState();
+    current.layout = buildLayout();
+    update(current);
+    previous = current;
+
+    // The render thread rebuilds its hierarchy from this on the first sample
+    renderLayout = current.layout;
+    layoutChanged = false;
+    hierarchy.clear();
+
+    Snapshot& snapshot = snapshots.getWriteBuffer();
+    snapshot.previous = previous;
+    snapshot.current = current;
+    snapshot.currentTime = Clock::now();
+    snapshots.publish();
+    debugger.consoleMessage("Successfully initialized simulation server",
+                            false);
+}
+
+// Where the player is, the stage streams in and out around it
+void SimulationServer::setViewer(const glm::vec3& position) {
+    std::lock_guard<std::mutex> lock(viewerMutex);
+    viewer = position;
+}
+
+glm::vec3 SimulationServer::getViewer() {
+    std::lock_guard<std::mutex> lock(viewerMutex);
+    return viewer;
+}
+
+// What the scene's draw slots hold right now
+std::shared_ptr<const SceneLayout> SimulationServer::buildLayout() {
+    auto layout = std::make_shared<SceneLayout>();
+    uint32_t slotCount = scene.getDrawSlotCount();
+    layout->parentSlots.assign(slotCount, TransformHierarchy::NO_PARENT);
+    layout->objectMeshes.assign(slotCount, NO_MESH);
+    World& world = scene.getWorld();
+    world.each<const Renderable>([&](const Renderable& renderable) {
+        layout->objectMeshes[renderable.drawSlot] = renderable.mesh;
+    });
+    world.each<const Renderable, const Parent>(
+        [&](const Renderable& renderable, const Parent& parent) {
+            layout->parentSlots[renderable.drawSlot] =
+                world.get<Renderable>(parent.entity).drawSlot;
+        });
+
+    // Anything that moves makes everything below it move too
+    std::vector<uint8_t> moves(slotCount, 0);
+    world.each<const Renderable, const Spin>(
+        [&](const Renderable& renderable, const Spin&) {
+            moves[renderable.drawSlot] = 1;
+        });
+    world.each<const Renderable, const Velocity>(
+        [&](const Renderable& renderable, const Velocity&) {
+            moves[renderable.drawSlot] = 1;
+        });
+    layout->staticObjects.assign(slotCount, 1);
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        for (uint32_t node = slot; node != TransformHierarchy::NO_PARENT;
+             node = layout->parentSlots[node]) {
+            if (moves[node]) {
+                layout->staticObjects[slot] = 0;
+                break;
+            }
+        }
+    }
+    return layout;
+}
+
+// Game logic, streams the stage and runs the systems up to state.time
+void SimulationServer::update(SimulationState& state) {
+    if (scene.stream(getViewer())) {
+        state.layout = buildLayout();
+    }
+
+    World& world = scene.getWorld();
+    float time = static_cast<float>(state.time);
+
+    // Derived from the simulated time rather than accumulated, so a given
+    // tick always lands on the same angle
+    world.parallelEach<Transform, const Spin>(
+        jobs, [&](Transform& transform, const Spin& spin) {
+            transform.rotation =
+                glm::angleAxis(time * spin.radiansPerSecond, spin.axis) *
+                spin.baseRotation;
+        });
+
+    state.objects.resize(scene.getDrawSlotCount());
+    world.each<const Renderable, const Transform>(
+        [&](const Renderable& renderable, const Transform& transform) {
+            state.objects[renderable.drawSlot] = transform;
+        });
+}
+
+// Tick once and publish the result
+void SimulationServer::advance(Clock::time_point tickTime) {
+    previous = current;
+    current.tick++;
+    current.time = current.tick * tickSeconds;
+    update(current);
+
+    Snapshot& snapshot = snapshots.getWriteBuffer();
+    snapshot.previous = previous;
+    snapshot.current = current;
+    snapshot.currentTime = tickTime;
+    snapshots.publish();
+}
+
+// Advance one tick on the calling thread
+void SimulationServer::step() {
+    if (isRunning()) {
+        debugger.consoleMessage("Cannot step a running simulation!", true);
+    }
+    advance(Clock::now());
+}
+
+// Tick on a background thread until stop
+void SimulationServer::start() {
+    if (isRunning()) return;
+    running.store(true, std::memory_order_release);
+    thread = std::thread(&SimulationServer::run, this);
+    debugger.consoleMessage("Started simulation thread", false);
+}
+
+SimulationServer::~SimulationServer() { stop(); }
+
+void SimulationServer::stop() {
+    if (!running.exchange(false, std::memory_order_acq_rel)) return;
+    thread.join();
+    LOG_INFO("Stopped simulation thread after {} ticks, {} dropped",
+             current.tick, droppedTicks);
+}
+
+void SimulationServer::run() {
+    PROFILE_THREAD("simulation");
+    auto tickDuration = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(tickSeconds));
+    Clock::time_point nextTick = Clock::now() + tickDuration;
+
+    while (running.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_until(nextTick);
+
+        // After a long stall (debugger, window drag) skip ahead rather than
+        // running a burst of ticks the renderer will never see
+        Clock::time_point now = Clock::now();
+        if (now - nextTick > tickDuration * MAX_CATCH_UP_TICKS) {
+            uint64_t behind = (now - nextTick) / tickDuration;
+            droppedTicks += behind;
+            nextTick += tickDuration * behind;
+        }
+
+        while (nextTick <= now && running.load(std::memory_order_relaxed)) {
+            PROFILE_ZONE("Simulation tick");
+            advance(nextTick);
+            nextTick += tickDuration;
+        }
+    }
+}
+
+// Transforms to render now
+const TransformHierarchy& SimulationServer::sample() {
+    PROFILE_FUNCTION();
+    const Snapshot& snapshot = snapshots.read();
+
+    // Draw one tick behind the newest state, so there is always a pair of
+    // states either side of the render time
+    float alpha = 1.0f;
+    if (isRunning()) {
+        double sinceTick =
+            std::chrono::duration<double>(Clock::now() - snapshot.currentTime)
+                .count();
+        alpha = static_cast<float>(
+            std::clamp(sinceTick / tickSeconds, 0.0, 1.0));
+    }
+
+    if (snapshot.current.layout != renderLayout) {
+        renderLayout = snapshot.current.layout;
+        layoutChanged = true;
+        hierarchy.clear();
+    }
+    if (hierarchy.getNodeCount() == 0) {
+        const std::vector<uint32_t>& parentSlots = renderLayout->parentSlots;
+        for (size_t slot = 0; slot < parentSlots.size(); slot++) {
+            hierarchy.addNode();
+        }
+        for (uint32_t slot = 0; slot < parentSlots.size(); slot++) {
+            if (parentSlots[slot] != TransformHierarchy::NO_PARENT) {
+                hierarchy.setParent(slot, parentSlots[slot]);
+            }
+        }
+    }
+
+    // A slot may hold another entity than it did a tick ago, so across a
+    // layout change there is nothing to blend from
+    const auto& to = snapshot.current.objects;
+    const auto& from = snapshot.previous.layout == snapshot.current.layout
+                           ? snapshot.previous.objects
+                           : to;
+    for (uint32_t slot = 0; slot < hierarchy.getNodeCount(); slot++) {
+        Transform local = interpolate(from[slot], to[slot], alpha);
+        hierarchy.setLocal(slot, local.position, local.rotation, local.scale);
+    }
+    hierarchy.update();
+    return hierarchy;
+}
+
+// True once after sample picked up a new layout
+bool SimulationServer::takeLayoutChange() {
+    bool changed = layoutChanged;
+    layoutChanged = false;
+    return changed;
+}
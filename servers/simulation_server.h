@@ -0,0 +1,138 @@
+#ifndef SIMULATION_SERVER_H
+#define SIMULATION_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/debugger/debugger.h"
+#include "core/jobs/job_system.h"
+#include "core/templates/triple_buffer.h"
+#include "scene/3d/transform_hierarchy.h"
+#include "scene/ecs/components.h"
+#include "scene/scene.h"
+
+// What the draw slots hold, rebuilt whenever the scene streams entities in
+// or out
+struct SceneLayout {
+    // Mesh of every draw slot, NO_MESH for the empty ones
+    std::vector<uint32_t> objectMeshes;
+    // Parent draw slot of every draw slot
+    std::vector<uint32_t> parentSlots;
+    // 1 for draw slots that never move, nothing in them or above them spins
+    // or has a velocity
+    std::vector<uint8_t> staticObjects;
+};
+
+// Everything the game logic owns for one tick
+struct SimulationState {
+    uint64_t tick = 0;
+    // Simulated seconds, tick times the tick length
+    double time = 0.0;
+    // Transforms of the renderable entities, indexed by draw slot
+    std::vector<Transform> objects;
+    // Shared by every tick until the scene's entities change
+    std::shared_ptr<const SceneLayout> layout;
+};
+
+// Runs game logic at a fixed rate on its own thread. The game logic is the
+// scene's ECS systems, spread over a job system, and streaming the stage's
+// chunks in and out around the viewer. Every tick the last two
+// states are handed to the render thread through a triple buffer, and the
+// renderer interpolates between them, drawing one tick behind so motion stays
+// smooth at any frame rate
+class SimulationServer {
+   public:
+    // Load the scene around the viewer and set up the first state. Ticks per
+    // second defaults to 60
+    void init(double tickRate = 60.0);
+    // Stops the thread, a render loop that threw never got to
+    ~SimulationServer();
+
+    // Where the player is, the stage streams in and out around it. Safe to
+    // call from any thread
+    void setViewer(const glm::vec3& position);
+
+    // Tick on a background thread until stop
+    void start();
+    void stop();
+    bool isRunning() const { return running.load(std::memory_order_acquire); }
+
+    // Advance one tick on the calling thread, for deterministic runs such as
+    // the benchmark. Only valid while the thread is stopped
+    void step();
+    uint64_t getTick() const { return current.tick; }
+
+    // Transforms to render now, one hierarchy node per draw slot. While
+    // running the local transforms are interpolated between the last two
+    // ticks, when stepping by hand they are the latest tick. Only nodes that
+    // moved since the last sample are reported as changed. Call from the
+    // render thread only
+    const TransformHierarchy& sample();
+
+    // True once after sample picked up a new layout, the meshes and static
+    // flags below need handing to the renderer again. Render thread only
+    bool takeLayoutChange();
+    // Mesh of every draw slot as of the last sample, NO_MESH for empty ones
+    const std::vector<uint32_t>& getObjectMeshes() const {
+        return renderLayout->objectMeshes;
+    }
+    // 1 for draw slots that never move, as of the last sample
+    const std::vector<uint8_t>& getStaticObjects() const {
+        return renderLayout->staticObjects;
+    }
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    // What the render thread receives each tick
+    struct Snapshot {
+        SimulationState previous;
+        SimulationState current;
+        // Wall clock time the current tick was due
+        Clock::time_point currentTime;
+    };
+
+    // Game logic, streams the stage, runs the systems up to state.time and
+    // copies the renderable transforms out
+    void update(SimulationState& state);
+    // What the scene's draw slots hold right now
+    std::shared_ptr<const SceneLayout> buildLayout();
+    glm::vec3 getViewer();
+    // Tick once and publish the result
+    void advance(Clock::time_point tickTime);
+    void run();
+
+    Debugger debugger;
+    double tickSeconds = 1.0 / 60.0;
+
+    // Only touched by whichever thread is ticking
+    Scene scene;
+    JobSystem jobs;
+
+    // Owned by whichever thread is ticking
+    SimulationState previous;
+    SimulationState current;
+
+    TripleBuffer<Snapshot> snapshots;
+
+    std::mutex viewerMutex;
+    glm::vec3 viewer = glm::vec3(0.0f);
+
+    // Render thread only, the layout the hierarchy was built from
+    std::shared_ptr<const SceneLayout> renderLayout;
+    bool layoutChanged = false;
+    TransformHierarchy hierarchy;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    // Ticks that fell more than a tick behind and were skipped
+    uint64_t droppedTicks = 0;
+};
+
+#endif
@@ -0,0 +1,3 @@
+// stb_image's implementation, compiled once for every target linking it
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
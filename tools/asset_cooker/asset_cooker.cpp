@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "asset_database.h"
+#include "asset_importers.h"
+#include "core/debugger/logger.h"
+#include "core/jobs/job_system.h"
+
+namespace fs = std::filesystem;
+
+// Lists every artifact, written into the output directory
+const char* MANIFEST_NAME = "manifest.txt";
+
+// A source that may need cooking, filled in across the job system
+struct CookTask {
+    std::string source;
+    const AssetImporter* importer = nullptr;
+    ImportSettings settings;
+    uint64_t settingsHash = 0;
+    uint64_t size = 0;
+    int64_t modified = 0;
+    // From the last run, null for a new source
+    const AssetRecord* previous = nullptr;
+
+    enum class Outcome { Cooked, Refreshed, Failed };
+    Outcome outcome = Outcome::Failed;
+    AssetRecord record;
+    std::string error;
+};
+
+static int64_t modifiedTime(const fs::path& path) {
+    std::error_code error;
+    auto time = fs::last_write_time(path, error);
+    if (error) return 0;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               time.time_since_epoch())
+        .count();
+}
+
+// The artifact is still there as it was written
+static bool artifactIntact(const fs::path& outputRoot,
+                           const AssetRecord& record) {
+    std::error_code error;
+    uint64_t size = fs::file_size(outputRoot / record.artifact, error);
+    return !error && size == record.artifactSize;
+}
+
+static bool sameInputs(const AssetRecord& record, const CookTask& task) {
+    return record.settingsHash == task.settingsHash &&
+           record.artifact == task.importer->artifactPath(task.source);
+}
+
+static bool writeArtifact(const fs::path& path,
+                          const std::vector<uint8_t>& data) {
+    fs::path temporary = path.string() + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!out) return false;
+    }
+    std::error_code error;
+    fs::rename(temporary, path, error);
+    return !error;
+}
+
+// Hash the source, then cook it unless only its timestamp changed
+static void runTask(CookTask& task, const fs::path& sourceRoot,
+                    const fs::path& outputRoot) {
+    std::ifstream in(sourceRoot / task.source, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    if (!in.eof() && !in) {
+        task.error = "failed to read";
+        return;
+    }
+
+    task.record.source = task.source;
+    task.record.size = task.size;
+    task.record.modified = task.modified;
+    task.record.contentHash = hashBytes(data.data(), data.size());
+    task.record.settingsHash = task.settingsHash;
+    task.record.artifact = task.importer->artifactPath(task.source);
+    if (task.previous && sameInputs(*task.previous, task) &&
+        task.previous->contentHash == task.record.contentHash &&
+        artifactIntact(outputRoot, *task.previous)) {
+        task.record.artifactHash = task.previous->artifactHash;
+        task.record.artifactSize = task.previous->artifactSize;
+        task.outcome = CookTask::Outcome::Refreshed;
+        return;
+    }
+
+    std::vector<uint8_t> artifact;
+    if (!task.importer->cook(data, task.settings, artifact, task.error)) {
+        return;
+    }
+    if (!writeArtifact(outputRoot / task.record.artifact, artifact)) {
+        task.error = "failed to write " + task.record.artifact;
+        return;
+    }
+    task.record.artifactHash = hashBytes(artifact.data(), artifact.size());
+    task.record.artifactSize = artifact.size();
+    task.outcome = CookTask::Outcome::Cooked;
+}
+
+// Cooks a directory of source assets into what the game loads at runtime
+//   asset_cooker SOURCE OUTPUT DATABASE [--jobs N] [--force]
+// DATABASE remembers every source's content hash and import settings, so
+// a run only cooks what changed since the last one, across N threads. A
+// source whose size and modification time match the database is not even
+// read, so a build with nothing to do takes milliseconds. Artifacts of
+// deleted sources are removed, and OUTPUT/manifest.txt lists the rest.
+// --force cooks everything
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: asset_cooker SOURCE OUTPUT DATABASE "
+                     "[--jobs N] [--force]"
+                  << std::endl;
+        return 1;
+    }
+    fs::path sourceRoot = argv[1];
+    fs::path outputRoot = argv[2];
+    std::string databasePath = argv[3];
+    uint32_t jobCount = 0;
+    bool force = false;
+    for (int i = 4; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) {
+            jobCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--force") {
+            force = true;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (!fs::is_directory(sourceRoot)) {
+        std::cerr << sourceRoot.string() << " is not a directory"
+                  << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    AssetDatabase database;
+    if (!force) database.load(databasePath);
+
+    // Sorted, so the same sources always make the same database
+    std::vector<std::string> sources;
+    for (const auto& file : fs::recursive_directory_iterator(sourceRoot)) {
+        std::string path =
+            fs::relative(file.path(), sourceRoot).generic_string();
+        if (file.is_regular_file() &&
+            fs::path(path).extension() != IMPORT_SETTINGS_EXTENSION) {
+            sources.push_back(path);
+        }
+    }
+    std::sort(sources.begin(), sources.end());
+
+    std::vector<CookTask> tasks;
+    std::set<std::string> seen(sources.begin(), sources.end());
+    std::map<std::string, std::string> artifactSources;
+    uint32_t upToDate = 0;
+    uint32_t failed = 0;
+    for (const std::string& source : sources) {
+        CookTask task;
+        task.source = source;
+        fs::path sourcePath = sourceRoot / source;
+        std::string settingsPath =
+            sourcePath.string() + IMPORT_SETTINGS_EXTENSION;
+        if (!readImportSettings(settingsPath, task.settings)) {
+            LOG_ERROR("Malformed import settings for {}", source);
+            failed++;
+            continue;
+        }
+        task.importer = findImporter(source, task.settings);
+        if (!task.importer) {
+            LOG_ERROR("Unknown importer for {}", source);
+            failed++;
+            continue;
+        }
+
+        std::string artifact = task.importer->artifactPath(source);
+        auto [claimed, inserted] = artifactSources.emplace(artifact, source);
+        if (!inserted) {
+            LOG_ERROR("{} and {} both cook to {}", claimed->second, source,
+                      artifact);
+            failed++;
+            continue;
+        }
+
+        task.settingsHash = hashImportSettings(*task.importer, task.settings);
+        std::error_code error;
+        task.size = fs::file_size(sourcePath, error);
+        task.modified = modifiedTime(sourcePath);
+        task.previous = database.find(source);
+        if (task.previous && task.previous->size == task.size &&
+            task.previous->modified == task.modified &&
+            sameInputs(*task.previous, task) &&
+            artifactIntact(outputRoot, *task.previous)) {
+            upToDate++;
+            continue;
+        }
+        tasks.push_back(std::move(task));
+    }
+
+    // Made up front, creating the same directory from two jobs can race
+    for (const CookTask& task : tasks) {
+        std::error_code error;
+        fs::create_directories(
+            (outputRoot / task.importer->artifactPath(task.source))
+                .parent_path(),
+            error);
+    }
+
+    JobSystem jobs;
+    jobs.init(jobCount);
+    jobs.parallelFor(static_cast<uint32_t>(tasks.size()), 1,
+                     [&](uint32_t begin, uint32_t end) {
+                         for (uint32_t i = begin; i < end; i++) {
+                             runTask(tasks[i], sourceRoot, outputRoot);
+                         }
+                     });
+    jobs.shutdown();
+
+    uint32_t cooked = 0;
+    uint32_t refreshed = 0;
+    for (const CookTask& task : tasks) {
+        if (task.outcome == CookTask::Outcome::Failed) {
+            // The last good artifact stays until the source cooks again
+            LOG_ERROR("Failed to cook {}: {}", task.source, task.error);
+            failed++;
+            continue;
+        }
+        if (task.outcome == CookTask::Outcome::Cooked) {
+            LOG_DEBUG("Cooked {}", task.source);
+            cooked++;
+        } else {
+            refreshed++;
+        }
+        database.set(task.record);
+    }
+
+    // Sources deleted since the last run take their artifacts with them,
+    // unless another source cooks to the same path now
+    std::vector<std::string> removed;
+    for (const auto& [source, record] : database.getRecords()) {
+        if (seen.count(source)) continue;
+        if (!artifactSources.count(record.artifact)) {
+            std::error_code error;
+            fs::remove(outputRoot / record.artifact, error);
+        }
+        removed.push_back(source);
+    }
+    for (const std::string& source : removed) {
+        database.remove(source);
+    }
+
+    fs::path manifestPath = outputRoot / MANIFEST_NAME;
+    bool changed = cooked + refreshed + removed.size() > 0;
+    if (changed || force || !fs::exists(manifestPath)) {
+        std::error_code error;
+        fs::create_directories(outputRoot, error);
+        if (!database.save(databasePath) ||
+            !database.writeManifest(manifestPath.string())) {
+            failed++;
+        }
+    }
+
+    double milliseconds = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    LOG_INFO("Cooked {}, refreshed {}, removed {}, {} up to date in {} ms",
+             cooked, refreshed, removed.size(), upToDate, milliseconds);
+    if (failed > 0) LOG_ERROR("{} assets failed to cook", failed);
+    Logger::get().flush();
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+#include "asset_database.h"
+
+#include <xxhash.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "core/debugger/logger.h"
+
+// Bumped when the columns change, older databases are dropped
+const char* DATABASE_HEADER = "# asset database 1";
+
+static std::string toHex(uint64_t value) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx",
+             static_cast<unsigned long long>(value));
+    return text;
+}
+
+uint64_t hashBytes(const void* data, size_t size) {
+    return XXH3_64bits(data, size);
+}
+
+void AssetDatabase::load(const std::string& path) {
+    records.clear();
+    std::ifstream in(path);
+    std::string line;
+    if (!in || !std::getline(in, line)) return;
+    if (line != DATABASE_HEADER) {
+        LOG_WARNING("{} is from another cooker version, cooking everything",
+                    path);
+        return;
+    }
+
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t')) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 8) {
+            LOG_WARNING("Malformed asset database {}, cooking everything",
+                        path);
+            records.clear();
+            return;
+        }
+        try {
+            AssetRecord record;
+            record.source = fields[0];
+            record.size = std::stoull(fields[1]);
+            record.modified = std::stoll(fields[2]);
+            record.contentHash = std::stoull(fields[3], nullptr, 16);
+            record.settingsHash = std::stoull(fields[4], nullptr, 16);
+            record.artifact = fields[5];
+            record.artifactHash = std::stoull(fields[6], nullptr, 16);
+            record.artifactSize = std::stoull(fields[7]);
+            records[record.source] = record;
+        } catch (const std::exception&) {
+            LOG_WARNING("Malformed asset database {}, cooking everything",
+                        path);
+            records.clear();
+            return;
+        }
+    }
+}
+
+bool AssetDatabase::save(const std::string& path) const {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        out << DATABASE_HEADER << '\n';
+        for (const auto& [source, record] : records) {
+            out << record.source << '\t' << record.size << '\t'
+                << record.modified << '\t' << toHex(record.contentHash)
+                << '\t' << toHex(record.settingsHash) << '\t'
+                << record.artifact << '\t' << toHex(record.artifactHash)
+                << '\t' << record.artifactSize << '\n';
+        }
+        if (!out) {
+            LOG_ERROR("Failed to write asset database {}", temporary);
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        LOG_ERROR("Failed to replace asset database {} ({})", path,
+                  error.message());
+        return false;
+    }
+    return true;
+}
+
+bool AssetDatabase::writeManifest(const std::string& path) const {
+    std::map<std::string, const AssetRecord*> byArtifact;
+    for (const auto& [source, record] : records) {
+        byArtifact[record.artifact] = &record;
+    }
+
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        for (const auto& [artifact, record] : byArtifact) {
+            out << artifact << '\t' << record->source << '\t'
+                << toHex(record->artifactHash) << '\t'
+                << record->artifactSize << '\n';
+        }
+        if (!out) {
+            LOG_ERROR("Failed to write asset manifest {}", temporary);
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        LOG_ERROR("Failed to replace asset manifest {} ({})", path,
+                  error.message());
+        return false;
+    }
+    return true;
+}
+
+const AssetRecord* AssetDatabase::find(const std::string& source) const {
+    auto found = records.find(source);
+    return found != records.end() ? &found->second : nullptr;
+}
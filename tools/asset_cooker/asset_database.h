@@ -0,0 +1,57 @@
+#ifndef ASSET_DATABASE_H
+#define ASSET_DATABASE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "core/debugger/debugger.h"
+
+// What the cooker knew about a source file the last time it cooked it
+struct AssetRecord {
+    // Relative to the source directory, with forward slashes
+    std::string source;
+    // Cheap to check, the content is only hashed again when these change
+    uint64_t size = 0;
+    int64_t modified = 0;
+    uint64_t contentHash = 0;
+    // Importer, its version and the asset's import settings
+    uint64_t settingsHash = 0;
+    // Relative to the output directory
+    std::string artifact;
+    uint64_t artifactHash = 0;
+    uint64_t artifactSize = 0;
+};
+
+// Source files by path, kept between runs so only changed assets cook.
+// Stored as tab separated text, one record per line
+class AssetDatabase {
+   public:
+    // A missing or unreadable database loads empty, so everything cooks
+    void load(const std::string& path);
+    // Written beside path and renamed over it, so a killed run never leaves
+    // half a database behind
+    bool save(const std::string& path) const;
+
+    // The artifacts the game reads, for packs and tools. Each line is
+    //   ARTIFACT SOURCE ARTIFACT_HASH BYTES
+    // separated by tabs, sorted by artifact
+    bool writeManifest(const std::string& path) const;
+
+    const AssetRecord* find(const std::string& source) const;
+    void set(const AssetRecord& record) { records[record.source] = record; }
+    void remove(const std::string& source) { records.erase(source); }
+    const std::map<std::string, AssetRecord>& getRecords() const {
+        return records;
+    }
+
+   private:
+    Debugger debugger;
+    std::map<std::string, AssetRecord> records;
+};
+
+// XXH3, for file contents and import settings
+uint64_t hashBytes(const void* data, size_t size);
+
+#endif
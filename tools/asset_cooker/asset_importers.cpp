@@ -0,0 +1,176 @@
+#include "asset_importers.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "asset_database.h"
+#include "core/assets/cooked_format.h"
+#include "core/vfs/pack_writer.h"
+#include "thirdparty/stb/stb_image.h"
+
+static std::string lowercaseExtension(const std::string& source) {
+    std::string extension =
+        std::filesystem::path(source).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return extension;
+}
+
+static std::string getSetting(const ImportSettings& settings,
+                              const std::string& key,
+                              const std::string& fallback) {
+    auto found = settings.find(key);
+    return found != settings.end() ? found->second : fallback;
+}
+
+// Files the game reads as they are, like models and stage layouts
+static std::string copyArtifactPath(const std::string& source) {
+    return source;
+}
+
+static bool cookCopy(const std::vector<uint8_t>& source,
+                     const ImportSettings& settings,
+                     std::vector<uint8_t>& artifact, std::string& error) {
+    (void)settings;
+    (void)error;
+    artifact = source;
+    return true;
+}
+
+// Cooking is incremental, but a large texture should still cook in seconds.
+// Higher levels shrink the pixels little more for many times the time
+const int TEXTURE_ZSTD_LEVEL = 6;
+
+static std::string textureArtifactPath(const std::string& source) {
+    return std::filesystem::path(source)
+        .replace_extension(COOKED_TEXTURE_EXTENSION)
+        .generic_string();
+}
+
+// Decoded to RGBA once here rather than on every launch. Raw pixels are
+// many times the size of the source image, so they are compressed, zstd
+// reads back fastest for its size. Settings:
+//   last_level half|full|N  coarsest mip level the game builds, half by
+//                           default as the coarser levels are never sampled
+//   compression zstd|lz4|none  how the pixels are stored, zstd by default
+static bool cookTexture(const std::vector<uint8_t>& source,
+                        const ImportSettings& settings,
+                        std::vector<uint8_t>& artifact, std::string& error) {
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load_from_memory(
+        source.data(), static_cast<int>(source.size()), &width, &height,
+        &channels, STBI_rgb_alpha);
+    if (!pixels) {
+        error = stbi_failure_reason();
+        return false;
+    }
+
+    uint32_t chain = static_cast<uint32_t>(
+                         std::floor(std::log2(std::max(width, height)))) +
+                     1;
+    std::string lastLevel = getSetting(settings, "last_level", "half");
+    std::string compression = getSetting(settings, "compression", "zstd");
+    CookedTextureHeader header;
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    if (lastLevel == "half") {
+        header.lastLevel = chain / 2;
+    } else if (lastLevel == "full") {
+        header.lastLevel = chain - 1;
+    } else {
+        char* end = nullptr;
+        unsigned long level = std::strtoul(lastLevel.c_str(), &end, 10);
+        if (lastLevel.empty() || *end != '\0') {
+            error = "last_level must be half, full or a level";
+            stbi_image_free(pixels);
+            return false;
+        }
+        header.lastLevel = static_cast<uint32_t>(
+            std::min<unsigned long>(level, chain - 1));
+    }
+
+    if (compression == "zstd") {
+        header.compression = PackCompression::Zstd;
+    } else if (compression == "lz4") {
+        header.compression = PackCompression::Lz4;
+    } else if (compression != "none") {
+        error = "compression must be zstd, lz4 or none";
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    std::vector<uint8_t> stored(
+        pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+    if (header.compression != PackCompression::None) {
+        int level = header.compression == PackCompression::Zstd
+                        ? TEXTURE_ZSTD_LEVEL
+                        : 0;
+        stored = PackWriter::compress(stored, header.compression, level);
+        if (stored.empty()) {
+            error = "failed to compress the pixels";
+            return false;
+        }
+    }
+
+    artifact.resize(sizeof(header) + stored.size());
+    std::memcpy(artifact.data(), &header, sizeof(header));
+    std::memcpy(artifact.data() + sizeof(header), stored.data(),
+                stored.size());
+    return true;
+}
+
+const AssetImporter COPY_IMPORTER = {"copy", 1, copyArtifactPath, cookCopy};
+const AssetImporter TEXTURE_IMPORTER = {"texture", 2, textureArtifactPath,
+                                        cookTexture};
+
+const AssetImporter* findImporter(const std::string& source,
+                                  const ImportSettings& settings) {
+    auto named = settings.find("importer");
+    if (named != settings.end()) {
+        for (const AssetImporter* importer :
+             {&COPY_IMPORTER, &TEXTURE_IMPORTER}) {
+            if (named->second == importer->name) return importer;
+        }
+        return nullptr;
+    }
+
+    std::string extension = lowercaseExtension(source);
+    if (extension == ".png" || extension == ".jpg" || extension == ".jpeg" ||
+        extension == ".tga" || extension == ".bmp") {
+        return &TEXTURE_IMPORTER;
+    }
+    return &COPY_IMPORTER;
+}
+
+bool readImportSettings(const std::string& path, ImportSettings& settings) {
+    settings.clear();
+    std::ifstream in(path);
+    if (!in) return true;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::stringstream stream(line);
+        std::string key, value, extra;
+        if (!(stream >> key) || key[0] == '#') continue;
+        if (!(stream >> value) || (stream >> extra)) return false;
+        settings[key] = value;
+    }
+    return true;
+}
+
+uint64_t hashImportSettings(const AssetImporter& importer,
+                            const ImportSettings& settings) {
+    // The map is sorted, so the same settings in any order hash the same
+    std::string text = std::string(importer.name) + '\n' +
+                       std::to_string(importer.version) + '\n';
+    for (const auto& [key, value] : settings) {
+        text += key + '=' + value + '\n';
+    }
+    return hashBytes(text.data(), text.size());
+}
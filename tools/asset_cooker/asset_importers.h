@@ -0,0 +1,42 @@
+#ifndef ASSET_IMPORTERS_H
+#define ASSET_IMPORTERS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// An asset's import settings, from the KEY VALUE lines of the file next to
+// it named SOURCE.import. Settings it leaves out take the importer's default
+using ImportSettings = std::map<std::string, std::string>;
+
+// Extension of the settings files, they are read with their asset and
+// never cooked themselves
+const char* const IMPORT_SETTINGS_EXTENSION = ".import";
+
+// Turns a source file into what the game loads at runtime. Setting
+// "importer" to an importer's name overrides the pick by extension
+struct AssetImporter {
+    const char* name;
+    // Bumped whenever its output changes, so every asset it made cooks again
+    uint32_t version;
+    // Where the artifact goes, relative to the output directory
+    std::string (*artifactPath)(const std::string& source);
+    // Returns false with error set if the source cannot be cooked
+    bool (*cook)(const std::vector<uint8_t>& source,
+                 const ImportSettings& settings,
+                 std::vector<uint8_t>& artifact, std::string& error);
+};
+
+// Returns nullptr if settings name an importer that does not exist
+const AssetImporter* findImporter(const std::string& source,
+                                  const ImportSettings& settings);
+
+// A missing file is no settings, returns false if it is malformed
+bool readImportSettings(const std::string& path, ImportSettings& settings);
+
+// Changes with the importer, its version or any setting
+uint64_t hashImportSettings(const AssetImporter& importer,
+                            const ImportSettings& settings);
+
+#endif
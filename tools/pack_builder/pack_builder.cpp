@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "core/debugger/logger.h"
+#include "core/vfs/pack_writer.h"
+
+// Packs directories into one archive the virtual file system can mount
+//   pack_builder OUTPUT [--store | --lz4 | --zstd] DIRECTORY[=PREFIX]...
+// Files are stored under PREFIX/their path inside DIRECTORY, or just their
+// path without a prefix. A compression flag applies to the directories
+// after it, the default is --lz4
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: pack_builder OUTPUT [--store | --lz4 | --zstd] "
+                     "DIRECTORY[=PREFIX]..."
+                  << std::endl;
+        return 1;
+    }
+
+    PackWriter writer;
+    PackCompression compression = PackCompression::Lz4;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--store") {
+            compression = PackCompression::None;
+            continue;
+        } else if (arg == "--lz4") {
+            compression = PackCompression::Lz4;
+            continue;
+        } else if (arg == "--zstd") {
+            compression = PackCompression::Zstd;
+            continue;
+        }
+
+        std::string directory = arg;
+        std::string prefix;
+        size_t separator = arg.find('=');
+        if (separator != std::string::npos) {
+            directory = arg.substr(0, separator);
+            prefix = arg.substr(separator + 1) + "/";
+        }
+        if (!std::filesystem::is_directory(directory)) {
+            std::cerr << directory << " is not a directory" << std::endl;
+            return 1;
+        }
+
+        // Sorted, so the same input always makes the same pack and files
+        // in one directory sit next to each other
+        std::vector<std::filesystem::path> files;
+        for (const auto& file :
+             std::filesystem::recursive_directory_iterator(directory)) {
+            if (file.is_regular_file()) files.push_back(file.path());
+        }
+        std::sort(files.begin(), files.end());
+
+        for (const auto& file : files) {
+            std::ifstream in(file, std::ios::binary);
+            std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                                      std::istreambuf_iterator<char>());
+            std::string path =
+                prefix +
+                std::filesystem::relative(file, directory).generic_string();
+            writer.addFile(path, std::move(data), compression);
+        }
+    }
+
+    bool written = writer.write(argv[1]);
+    Logger::get().flush();
+    return written ? 0 : 1;
+}